@@ -22,6 +22,11 @@
 --   Model                 Engine model
 -- }
 --
+-- Engines without a custom Simulator are simulated natively by X-Space using
+-- the same model as EngineSimulator. Their parameters are read once when the
+-- aircraft is loaded. Command, ActualForce and Intensity are written back to
+-- the engine table every frame.
+--
 -- Possible engine types:
 --  "LO2-LH2" (default)
 --  "RCS"
@@ -226,5 +226,8 @@ end
 -- Initialize engines simulation
 Include(PluginsFolder.."lua/engines.lua")
 
+-- Direct access to vessel state
+Include(PluginsFolder.."lua/vessel_view.lua")
+
 -- VSFL related includes
 if DEDICATED_SERVER then Include(PluginsFolder.."lua/vsfl.lua") end
@@ -8,7 +8,7 @@
 Net = {}
 
 -- Protocol version
-Net.ProtocolVersion = 4
+Net.ProtocolVersion = 6
 
 -- Event types
 Net.EventType = {
@@ -29,6 +29,9 @@ Net.Message = {
 -- Invalid data cycle
 Net.InvalidCycle = 0
 
+-- Service network hosts in a separate thread (packets are sent out on NetAPI.Flush)
+Net.UseNetworkThread = true
+
 -- Functions for working with messages
 function Net.Write8(msg,value)       NetAPI.MessageWrite(msg,0,value) end
 function Net.Write16(msg,value)      NetAPI.MessageWrite(msg,1,value) end
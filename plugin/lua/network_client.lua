@@ -15,13 +15,13 @@ function Net.Client.Connect(host,port)
 
   -- Create host and connect to client
   print("X-Space: Connecting to "..tostring(host)..":"..tostring(port))
-  Net.Client.Host = NetAPI.Host(nil,0,1)
+  Net.Client.Host = NetAPI.Host(nil,0,1,Net.UseNetworkThread)
   Net.Client.Peer = NetAPI.Connect(Net.Client.Host,host,port,0,0)
   
   -- Set NetID counter for new vessels (wraps from 1023 to 1)
   Net.Client.NetID = 1
   -- Last acknowledged frames list
-  Net.Client.LastFrames = {}
+  Net.Client.Frames = NetAPI.NewFrameHistory()
   Net.Client.LastFrameID = Net.InvalidCycle
   -- Last time when world was sent to server
   Net.Client.LastUpdateTime = curtime()
@@ -49,6 +49,7 @@ function Net.Client.Disconnect()
     print("X-Space: Disconnecting from server")
     NetAPI.ResetPeer(Net.Client.Peer)
     NetAPI.DestroyHost(Net.Client.Host)
+    NetAPI.DestroyFrameHistory(Net.Client.Frames)
   
     Net.Client.Peer = nil
     Net.Client.Host = nil
@@ -85,33 +86,19 @@ function Net.Client.OnEvent(peer,type,data,message)
       -- Read base frame cycle
       local baseFrameCycle = Net.Read32(message)
 
-      -- Fetch base frame
-      local base_frame
-      if baseFrameCycle ~= Net.InvalidCycle then
-        if Net.Client.LastFrames[baseFrameCycle] then
-          -- Read prior state
-          base_frame = Net.Client.LastFrames[baseFrameCycle]
-        else
-          -- Cannot read prior state, must resync
-          Net.Client.LastFrameID = Net.InvalidCycle
---          Console.WriteDebug("Sync error! No frame %d!",baseFrameCycle)
-          return
-        end
-      else
-        -- No prior frames: read full state
-        base_frame = { Vessels = {} }
-        base_frame.Cycle = Net.InvalidCycle
+      -- Cannot read prior state, must resync
+      if (baseFrameCycle ~= Net.InvalidCycle) and
+         (not NetAPI.HasFrame(Net.Client.Frames,baseFrameCycle)) then
+        Net.Client.LastFrameID = Net.InvalidCycle
+--        Console.WriteDebug("Sync error! No frame %d!",baseFrameCycle)
+        return
       end
       
       -- Read message from server
-      local frame = Net.Frame.Read(base_frame,message)
-      frame.Time = frameTime
-      frame.Cycle = frameCycle
-      frame.ReceiveTime = curtime()
+      NetAPI.ReadFrame(Net.Client.Frames,baseFrameCycle,frameCycle,frameTime,message)
 
       -- Remember frame
-      Net.Client.LastFrameID = frame.Cycle
-      Net.Client.LastFrames[frame.Cycle] = frame
+      Net.Client.LastFrameID = frameCycle
    elseif messageID == Net.Message.Transmission then
       -- Read channel
       local channel = Net.Read8(message)
@@ -144,40 +131,16 @@ AddCallback("frame","NetworkClient",function(dT)
       Net.Client.LastUpdateTime = curtime()
 
       -- Get current base frame (last frame received from server)
-      local base_frame
-      if Net.Client.LastFrames[Net.Client.LastFrameID] then
-        base_frame = Net.Client.LastFrames[Net.Client.LastFrameID]
-      else
-        base_frame = { Vessels = { } }
-        base_frame.Cycle = Net.InvalidCycle
+      local baseCycle = Net.Client.LastFrameID
+      if not NetAPI.HasFrame(Net.Client.Frames,baseCycle) then
+        baseCycle = Net.InvalidCycle
       end
    
-      -- Get new frame (client world state)
-      local frame = Net.Frame.Get(true)
-      -- At what time this frame can be considered valid
-      frame.Time = curtime()
-   
-      -- Create message for the server (send world)
-      local message = NetAPI.NewMessage()
-      Net.Write8(message,Net.Message.World)
-      -- Send time at which this frame could be considered valid
-      Net.WriteSingle(message,frame.Time)
-      -- Send new data cycle (not used in clients)
-      Net.Write32(message,0)
-      -- Send last acknowledged cycle
-      Net.Write32(message,base_frame.Cycle)
-      -- Send clients frame ID
---      Net.Write32(message,Net.Client.ClientFrameID)
-      -- Compress frame based on last server frame
-      Net.Frame.Write(base_frame,frame,message)
-      NetAPI.SendMessage(Net.Client.Host,Net.Client.Peer,message)
-      
-      -- Purge old frames from the list (older than 5 seconds)
-      for frameIndex,frame in pairs(Net.Client.LastFrames) do
-        if (frame.ReceiveTime or 0) < (curtime()-5.0) then
-          Net.Client.LastFrames[frameIndex] = nil
-        end
-      end
+      -- Get new frame (client world state) and compress it based on last server frame
+      NetAPI.CaptureFrame(Net.Client.Frames,Net.InvalidCycle,curtime(),true)
+      Net.Frame.Send(Net.Client.Host,Net.Client.Peer,Net.Client.Frames,
+        curtime(),Net.InvalidCycle,baseCycle)
+      NetAPI.Flush(Net.Client.Host)
     end
 
     -- Update networking
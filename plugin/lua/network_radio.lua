@@ -37,6 +37,7 @@ function Net.RadioTransmissions.SendClient()
     -- Nullify the buffer
     Net.RadioTransmissions.SendBuffer[vesselIdx] = {}
   end
+  NetAPI.Flush(Net.Client.Host)
 end
 
 
@@ -67,6 +68,7 @@ function Net.RadioTransmissions.SendServer()
     -- Nullify the buffer
     Net.RadioTransmissions.SendBuffer[vesselIdx] = {}
   end
+  NetAPI.Flush(Net.Server.Host)
 end
 
 
@@ -14,7 +14,7 @@ function Net.Server.Start(port,maxClients)
   -- Start server
   print("X-Space: Starting up server on port "..tostring(port))
   print("X-Space: Setting maximum number of clients to "..tostring(maxClients))
-  Net.Server.Host = NetAPI.Host("127.0.0.1",port,maxClients)
+  Net.Server.Host = NetAPI.Host("127.0.0.1",port,maxClients,Net.UseNetworkThread)
   Net.Server.MaxClients = maxClients
   
   -- Client ID counter
@@ -25,10 +25,10 @@ function Net.Server.Start(port,maxClients)
   Net.Server.NetID = 1024
   -- Client data
   Net.Server.Clients = {}
-  -- Frame history (only stores last frame, frames which were acknowledged by users)
-  Net.Server.Frames = {}
-  -- Current server frame
-  Net.Server.CurrentFrame = nil
+  -- Frame history (last frames sent to clients)
+  Net.Server.Frames = NetAPI.NewFrameHistory()
+  -- Current server frame cycle
+  Net.Server.CurrentCycle = Net.InvalidCycle
   
   -- Last time when frame updates were sent to clients
   Net.Server.LastUpdateTime = curtime()
@@ -47,6 +47,12 @@ function Net.Server.Stop()
   if Net.Server.Host then
     print("X-Space: Stopping server")
     NetAPI.DestroyHost(Net.Server.Host)
+    for clientID,client in pairs(Net.Server.Clients) do
+      NetAPI.DestroyFrameClient(client.FrameClient)
+    end
+    Net.Server.Clients = {}
+    NetAPI.DestroyFrameHistory(Net.Server.Frames)
+    Net.Server.Host = nil
   end
 end
 
@@ -74,7 +80,9 @@ function Net.Server.OnEvent(peer,type,data,message)
       ReadRadio = false,    -- Radio transmissions are sent to this client
       
       -- Last acknowledged frame index
-      LastAcknowledgedFrame = nil,
+      LastAcknowledgedFrame = Net.InvalidCycle,
+      -- Frame encoder state (interest management)
+      FrameClient = NetAPI.NewFrameClient(Net.Server.ClientID),
       -- Networking peer
       Peer = peer,
       
@@ -95,6 +103,9 @@ function Net.Server.OnEvent(peer,type,data,message)
       clientID))
       
     -- Clear up data
+    if Net.Server.Clients[clientID] then
+      NetAPI.DestroyFrameClient(Net.Server.Clients[clientID].FrameClient)
+    end
     Net.Server.Clients[clientID] = nil
   ------------------------------------------------------------------------------
   elseif type == Net.EventType.Message then
@@ -113,30 +124,20 @@ function Net.Server.OnEvent(peer,type,data,message)
       -- Read base frame cycle
       local baseFrameCycle = Net.Read32(message)
       
-      -- Fetch base frame
-      local base_frame
-      if (baseFrameCycle ~= Net.InvalidCycle) and Net.Server.Frames[baseFrameCycle] then
-        -- Read prior state
-        base_frame = Net.Server.Frames[baseFrameCycle]
-      else
-        -- No prior frames: read full state
-        base_frame = { Vessels = {} }
-        base_frame.Cycle = baseFrameCycle
+      -- Read message from client into local frame (no prior frames: read full state)
+      if not Net.Frame.IsValid(Net.Server.Frames,baseFrameCycle) then
+        baseFrameCycle = Net.InvalidCycle
       end
-  
-      -- Read message from clients
-      local frame = Net.Frame.Read(base_frame,message)
-      frame.Time = frameTime
-      frame.Cycle = frameCycle
+      NetAPI.ReadFrame(Net.Server.Frames,baseFrameCycle,Net.InvalidCycle,frameTime,message)
       
       -- Merge received vessels with current frame
-      Net.Frame.Merge(Net.Server.CurrentFrame,frame)
+      NetAPI.MergeFrame(Net.Server.Frames,Net.Server.CurrentCycle,Net.InvalidCycle)
       
-      -- Update server state
-      Net.Frame.Update(frame)
+      -- Update server state (vessels are marked as owned by client)
+      NetAPI.ApplyFrame(Net.Server.Frames,Net.InvalidCycle,clientID)
 
       -- Update last acknowledged frame
-      client.LastAcknowledgedFrame = base_frame.Cycle
+      client.LastAcknowledgedFrame = baseFrameCycle
       
       -- Remap vessel indexes to correct ones
 --[[      for k,v in pairs(frame.Vessels) do
@@ -196,28 +197,9 @@ AddCallback("frame","NetworkServer",function(dT)
     if curtime() - Net.Server.LastUpdateTime > 0.1 then
       Net.Server.LastUpdateTime = curtime()
       
-      -- Purge old frames from the list (older than 5 seconds)
-      local t = 0
-      for frameIndex,frame in pairs(Net.Server.Frames) do
-        t = t + 1
-        if (frame.Time or 0) < (curtime()-5.0) then
-          Net.Server.Frames[frameIndex] = nil
-        end
-      end
---      print("FRAMES",t,curtime(),collectgarbage("count"))
-  
       -- Generate new frame
---      Net.Server.Frames[Net.Server.FrameID] = Net.Frame.Get()
---      Net.Server.Frames[Net.Server.FrameID-1] = nil -- FIXME: no delta support yet
-      if Net.Server.Frames[Net.Server.FrameID-1] then
-        Net.Server.Frames[Net.Server.FrameID] = Net.Frame.Get()
---          Net.Frame.GetCopy(Net.Server.Frames[Net.Server.FrameID-1])
-      else
-        Net.Server.Frames[Net.Server.FrameID] = { Vessels = {} }
-      end
-      Net.Server.CurrentFrame = Net.Server.Frames[Net.Server.FrameID]
-      Net.Server.CurrentFrame.Time = curtime()
-      Net.Server.CurrentFrame.Cycle = Net.Server.FrameID
+      Net.Server.CurrentCycle = Net.Server.FrameID
+      NetAPI.CaptureFrame(Net.Server.Frames,Net.Server.CurrentCycle,curtime())
       
       -- Update networking
       NetAPI.Update(Net.Server.Host,Net.Server.OnEvent)
@@ -228,37 +210,26 @@ AddCallback("frame","NetworkServer",function(dT)
       -- Send data for all clients
       for clientID,client in pairs(Net.Server.Clients) do
         -- Get base frame for client
-        local base_frame
-        if client.LastAcknowledgedFrame ~= Net.InvalidCycle then
-          if Net.Server.Frames[client.LastAcknowledgedFrame] then
-            base_frame = Net.Server.Frames[client.LastAcknowledgedFrame]
-          else
-            -- Sychronization error
-            print("X-Space: Sync error in client "..tostring(clientID)..
-                  ". Frame "..tostring(client.LastAcknowledgedFrame).." invalid")
-            client.LastAcknowledgedFrame = Net.InvalidCycle
-            
-            -- Send full state
-            base_frame = { Vessels = { } }
-            base_frame.Cycle = Net.InvalidCycle
-          end
-        else
-          base_frame = { Vessels = { } }
-          base_frame.Cycle = Net.InvalidCycle
+        local baseCycle = client.LastAcknowledgedFrame
+        if (baseCycle ~= Net.InvalidCycle) and
+           (not Net.Frame.IsValid(Net.Server.Frames,baseCycle)) then
+          -- Sychronization error
+          print("X-Space: Sync error in client "..tostring(clientID)..
+                ". Frame "..tostring(baseCycle).." invalid")
+          client.LastAcknowledgedFrame = Net.InvalidCycle
+          
+          -- Send full state
+          baseCycle = Net.InvalidCycle
         end
         
-        -- Get new frame
-        local frame = Net.Server.CurrentFrame
-        
-        -- Create message for the client (send world)
-        local message = NetAPI.NewMessage()
-        Net.Write8(message,Net.Message.World)
-        Net.WriteSingle(message,frame.Time)
-        Net.Write32(message,frame.Cycle)
-        Net.Write32(message,base_frame.Cycle)
-        Net.Frame.Write(base_frame,frame,message)
-        NetAPI.SendMessage(Net.Server.Host,client.Peer,message)
+        -- Send world to the client
+        Net.Frame.Send(Net.Server.Host,client.Peer,Net.Server.Frames,
+          NetAPI.GetFrameTime(Net.Server.Frames,Net.Server.CurrentCycle),
+          Net.Server.CurrentCycle,baseCycle,client.FrameClient)
       end
+
+      -- Send out all frames at once
+      NetAPI.Flush(Net.Server.Host)
     end
   end
 end)
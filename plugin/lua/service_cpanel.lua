@@ -40,12 +40,32 @@ Net.HTTPServer.Handlers["/"] = function(request)
         (delta / (60)) % 60,
         (delta) % 60,
         (delta * 1000) % 1000)
+
+    local messageStats = NetAPI.GetMessageStats()
+    server_info = server_info..
+      string.format("<strong>Message buffers:</strong> %.0f allocs/s, %.0f requests/s, %.1f KB allocated (%.1f KB pooled)<br />",
+        messageStats.AllocationsPerSecond,
+        messageStats.RequestsPerSecond,
+        messageStats.BytesAllocated/1024,
+        messageStats.BytesPooled/1024)
         
+    local perfStats = ProfilerAPI.GetStats()
+    server_info = server_info..
+      string.format("<strong>Tick time:</strong> %.2f ms mean, %.2f ms p99, %.2f ms max (<a href=\"/perf\">details</a>)<br />",
+        perfStats.tick.Mean,
+        perfStats.tick.P99,
+        perfStats.tick.Max)
+
     server_info = server_info.."<strong>Clients:</strong>"
 --    if #Net.Server.Clients > 0 then
       server_info = server_info.."<ul>"
       for k,v in pairs(Net.Server.Clients) do
-        server_info = server_info.."<li>"..k.." "..tostring(v).."</li>"
+        local stats = NetAPI.GetFrameClientStats(v.FrameClient)
+        server_info = server_info..string.format(
+          "<li>%08X: %.1f bytes/frame, %.3f ms/frame, %d vessels sent, %d skipped</li>",
+          k,stats.BytesWritten/math.max(1,stats.Encodes),
+          1000*stats.EncodeTime/math.max(1,stats.Encodes),
+          stats.VesselsWritten,stats.VesselsSkipped)
       end
       server_info = server_info.."</ul>"
 --    else
@@ -77,18 +97,20 @@ Net.HTTPServer.Handlers["/"] = function(request)
 </thead>
 <tbody>]]
   
+    local state = {}
     for idx=0,VesselAPI.GetCount()-1 do
-      local exists = VesselAPI.GetParameter(idx,0)
+      VesselAPI.GetState(idx,state)
+      local exists = state.exists
       local status = ""
       if exists == 0 then status = " class=\"decayed\"" end
       
       local mass_sym = "%.0f"
-      if VesselAPI.GetParameter(idx,13) > 1000e3 then mass_sym = "%.3E" end
+      if state.mass > 1000e3 then mass_sym = "%.3E" end
       local alt_sym = "%.0f"
-      if VesselAPI.GetParameter(idx,16) > 120000e3 then alt_sym = "%.3E" end
+      if state.elevation > 120000e3 then alt_sym = "%.3E" end
       
       
-      if VesselAPI.GetParameter(idx,2) > 1000000 then
+      if state.net_id > 1000000 then
         server_info = server_info..string.format(
           "<tr"..status..">"..
           "<td>%05d</td>"..
@@ -110,12 +132,12 @@ Net.HTTPServer.Handlers["/"] = function(request)
           "<td>"..mass_sym.."</td>"..
           "<td>%s</td>"..
           "</tr>",
-          VesselAPI.GetParameter(idx,2),
-          VesselAPI.GetParameter(idx,14),
-          VesselAPI.GetParameter(idx,15),
-          VesselAPI.GetParameter(idx,16),
-          VesselAPI.GetParameter(idx,13),
-          physicsMode[VesselAPI.GetParameter(idx,4)] or "Unknown")
+          state.net_id,
+          state.latitude,
+          state.longitude,
+          state.elevation,
+          state.mass,
+          physicsMode[state.physics_type] or "Unknown")
       else
         server_info = server_info..string.format(
           "<tr"..status..">"..
@@ -138,27 +160,27 @@ Net.HTTPServer.Handlers["/"] = function(request)
           "<td>"..mass_sym.."</td>"..
           "<td>%s</td>"..
           "</tr>",
-          VesselAPI.GetParameter(idx,2),
-  --        VesselAPI.GetParameter(idx,50)*1e-3,
-  --        VesselAPI.GetParameter(idx,51)*1e-3,
-  --        VesselAPI.GetParameter(idx,52)*1e-3,
+          state.net_id,
+  --        state.noninertial_x*1e-3,
+  --        state.noninertial_y*1e-3,
+  --        state.noninertial_z*1e-3,
   
-          VesselAPI.GetParameter(idx,120)*1e-3,
-          VesselAPI.GetParameter(idx,121),
-          math.deg(VesselAPI.GetParameter(idx,122)),
-          math.deg(VesselAPI.GetParameter(idx,123)),
-          math.deg(VesselAPI.GetParameter(idx,124)),
-          math.deg(VesselAPI.GetParameter(idx,125)),
-          VesselAPI.GetParameter(idx,127)/60,
+          state.orbit_smA*1e-3,
+          state.orbit_e,
+          math.deg(state.orbit_i),
+          math.deg(state.orbit_MnA),
+          math.deg(state.orbit_AgP),
+          math.deg(state.orbit_AsN),
+          state.orbit_period/60,
           
-          VesselAPI.GetParameter(idx,132),
+          state.statistics_total_true_orbits,
           
-          VesselAPI.GetParameter(idx,14),
-          VesselAPI.GetParameter(idx,15),
-          VesselAPI.GetParameter(idx,16),
+          state.latitude,
+          state.longitude,
+          state.elevation,
           
-          VesselAPI.GetParameter(idx,13),
-          physicsMode[VesselAPI.GetParameter(idx,4)] or "Unknown")
+          state.mass,
+          physicsMode[state.physics_type] or "Unknown")
       end
     end
     server_info = server_info.."</tbody></table>"
@@ -203,6 +225,25 @@ Net.HTTPServer.Handlers["/"] = function(request)
 end
 
 
+--------------------------------------------------------------------------------
+-- Simulation profiler statistics (milliseconds per tick, JSON)
+--------------------------------------------------------------------------------
+Net.HTTPServer.Handlers["/perf"] = function(parameters)
+  local response = "{"
+  for name,stats in pairs(ProfilerAPI.GetStats()) do
+    response = response..string.format(
+      "\"%s\":{\"min\":%.4f,\"mean\":%.4f,\"p99\":%.4f,\"max\":%.4f,\"calls\":%d},",
+      name,stats.Min,stats.Mean,stats.P99,stats.Max,stats.Calls)
+  end
+  local memory = ProfilerAPI.GetMemory()
+  response = response..string.format(
+    "\"memory\":{\"used\":%.1f,\"peak\":%.1f,\"pooled\":%.1f,\"allocations\":%.0f,\"pool_allocations\":%.0f,\"gc_cycles\":%.0f}",
+    memory.Used,memory.Peak,memory.Pooled,memory.Allocations,memory.PoolAllocations,memory.GCCycles)
+
+  return response.."}"
+end
+
+
 --------------------------------------------------------------------------------
 -- Reloads handlers
 --------------------------------------------------------------------------------
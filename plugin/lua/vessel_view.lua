@@ -0,0 +1,76 @@
+--=============================================================================-
+-- Direct read access to vessel state
+--=============================================================================-
+
+-- VesselView.Field(name[,element])  Returns reader function(idx) for parameter
+-- VesselView.Get(idx,name[,element]) Reads a single parameter by name
+--
+-- With LuaJIT the readers access the native vessel array through FFI pointers,
+-- without going through the C API. With plain Lua they fall back to
+-- VesselAPI.GetParameter. Views are read-only: writes must use VesselAPI so
+-- that dependent state is updated. Layout fields marked ReadOnly (weights,
+-- moments of inertia, mounts) must never be written through raw pointers,
+-- because mass properties are only recomputed for vessels changed through
+-- VesselAPI.SetParameter. The exists and net_id fields are not in the layout
+-- (slot lists and network ID index must be updated with them), use
+-- VesselAPI.GetParameter and SetParameter for them. Readers return nil for
+-- indexes that are not valid vessels, like VesselAPI.GetParameter does.
+--
+-- VesselView.Layout is fetched on first use, because this file is loaded
+-- before VesselAPI is registered.
+VesselView = {}
+setmetatable(VesselView,{ __index = function(t,key)
+  if key == "Layout" then
+    rawset(t,"Layout",VesselAPI.GetLayout())
+    return rawget(t,"Layout")
+  end
+end })
+
+local ffi = jit and require("ffi")
+local readers = {}
+
+if ffi then
+  VesselView.Backend = jit.version
+  function VesselView.Field(name,element)
+    local layout = VesselView.Layout
+    local field = layout.Fields[name]
+    if not field then return nil end
+
+    -- Vessel count changes as vessels are added, so base address and vessel
+    -- count are read from the native variables on every access
+    local base = ffi.cast("char**",layout.BaseAddress)
+    local count = ffi.cast("int*",layout.CountAddress)
+    local stride = layout.Stride
+    local offset = field.Offset + (element or 0)*field.Stride
+    local ctype = ffi.typeof((field.Type == "int") and "int*" or "double*")
+    return function(idx)
+      if (idx < 0) or (idx >= count[0]) then return nil end
+      return ffi.cast(ctype,base[0] + idx*stride + offset)[0]
+    end
+  end
+else
+  VesselView.Backend = _VERSION
+  function VesselView.Field(name,element)
+    local field = VesselView.Layout.Fields[name]
+    if not field then return nil end
+
+    local GetParameter = VesselAPI.GetParameter
+    local index = field.Index
+    if element then
+      return function(idx) return GetParameter(idx,index,element) end
+    else
+      return function(idx) return GetParameter(idx,index) end
+    end
+  end
+end
+
+function VesselView.Get(idx,name,element)
+  local key = element and (name.."["..element.."]") or name
+  local reader = readers[key]
+  if not reader then
+    reader = VesselView.Field(name,element)
+    if not reader then return nil end
+    readers[key] = reader
+  end
+  return reader(idx)
+end
@@ -14,68 +14,8 @@ Include(PluginsFolder.."lua/vsfl_xsag_groundstations.lua")
 -- Persisting features
 --------------------------------------------------------------------------------
 function VSFL.SaveState()
-  -- Copy state
-  local f_old = io.open(PluginsFolder.."vsfl/state/full.dat","r")
-  local f_bak = io.open(PluginsFolder.."vsfl/state/full_backup.dat","w+")
-  if f_old and f_bak then
-    local data = f_old:read("*all")
-    f_bak:write(data)
-    f_old:close()
-    f_bak:close()
-  end
-  
-  -- Create new state
-  local f = io.open(PluginsFolder.."vsfl/state/full.dat","w+")
-  if not f then return end
-  
-  -- Write MJD date
-  f:write("MJD  ",DedicatedServerAPI.GetMJD(),"\n")
-  
-  -- Save existing vessels
-  for idx=0,VesselAPI.GetCount()-1 do
-    local exists = VesselAPI.GetParameter(idx,0)
-    local physics_type = VesselAPI.GetParameter(idx,4)
-    local net_id = VesselAPI.GetParameter(idx,2)
-    if (exists == 1) and (physics_type == 1) and (net_id < 100000) then
-      -- Network ID
-      f:write("VESS ",net_id,"\n")
-      
-      -- Write state vector, attitude
-      f:write("X    ",VesselAPI.GetParameter(idx,50),"\n")
-      f:write("Y    ",VesselAPI.GetParameter(idx,51),"\n")
-      f:write("Z    ",VesselAPI.GetParameter(idx,52),"\n")
-      f:write("VX   ",VesselAPI.GetParameter(idx,53),"\n")
-      f:write("VY   ",VesselAPI.GetParameter(idx,54),"\n")
-      f:write("VZ   ",VesselAPI.GetParameter(idx,55),"\n")
-
-      f:write("Q0   ",VesselAPI.GetParameter(idx,59),"\n")
-      f:write("Q1   ",VesselAPI.GetParameter(idx,60),"\n")
-      f:write("Q2   ",VesselAPI.GetParameter(idx,61),"\n")
-      f:write("Q3   ",VesselAPI.GetParameter(idx,62),"\n")
-      f:write("P    ",VesselAPI.GetParameter(idx,63),"\n")
-      f:write("Q    ",VesselAPI.GetParameter(idx,64),"\n")
-      f:write("R    ",VesselAPI.GetParameter(idx,65),"\n")
-
-      f:write("Jxx  ",VesselAPI.GetParameter(idx,10),"\n")
-      f:write("Jyy  ",VesselAPI.GetParameter(idx,11),"\n")
-      f:write("Jzz  ",VesselAPI.GetParameter(idx,12),"\n")
-      f:write("Mc   ",VesselAPI.GetParameter(idx,17),"\n")
-      f:write("Mh   ",VesselAPI.GetParameter(idx,18),"\n")
-      f:write("Mf0  ",VesselAPI.GetParameter(idx,19),"\n")
-      f:write("Mf1  ",VesselAPI.GetParameter(idx,20),"\n")
-      f:write("Mf2  ",VesselAPI.GetParameter(idx,21),"\n")
-      f:write("Mf3  ",VesselAPI.GetParameter(idx,22),"\n")
-      
-      f:write("Stis ",VesselAPI.GetParameter(idx,130),"\n")
-      f:write("Sorb ",VesselAPI.GetParameter(idx,131),"\n")
-      f:write("Stor ",VesselAPI.GetParameter(idx,132),"\n")
-      f:write("Sdis ",VesselAPI.GetParameter(idx,133),"\n")
-      
-      -- End structure
-      f:write("VEND ","\n")
-    end
-  end
-  f:close()
+  -- Binary snapshot of all inertial vessels (written in background, crash-safe)
+  SnapshotAPI.Save(PluginsFolder.."vsfl/state/full.bin",DedicatedServerAPI.GetMJD(),100000)
 end
 
 
@@ -131,6 +71,16 @@ end
 
 -- Load state
 function VSFL.LoadState()
+  local mjd = SnapshotAPI.Load(PluginsFolder.."vsfl/state/full.bin")
+  if mjd then
+    DedicatedServerAPI.SetMJD(mjd)
+    return
+  end
+  VSFL.LoadState_Text()
+end
+
+-- Text state written by previous versions of VSFL
+function VSFL.LoadState_Text()
   local f = io.open(PluginsFolder.."vsfl/state/full.dat","r")
   if not f then
     if VSFL.LoadState_Compat1() then return end
@@ -54,6 +54,14 @@
 	config_macro(nonspherical_gravity,	"NonsphericalGravity",		boolean,1) \
 	config_macro(planet_rotation,		"PlanetRotates",			boolean,1) \
 	config_macro(staging_wait_time,		"StagingWaitTime",			number, 60.0) \
+	\
+	config_macro(server_cpu,			"ServerCPU",				integer,-1) \
+	config_macro(server_stats_interval,	"ServerStatsInterval",		number, 60.0) \
+	\
+	config_macro(lua_gc_pause,			"LuaGCPause",				integer,200) \
+	config_macro(lua_gc_stepmul,		"LuaGCStepMultiplier",		integer,200) \
+	config_macro(lua_gc_budget,			"LuaGCBudget",				number, 1.0) \
+	config_macro(lua_gc_step_size,		"LuaGCStepSize",			integer,8) \
 
 //Global configuration
 global_config config;
@@ -168,6 +176,9 @@ void config_load()
 
 	//Restore correct globals table
 	lua_replace(L,LUA_GLOBALSINDEX);
+
+	//Apply garbage collector settings
+	highlevel_configure_gc();
 }
 
 void config_save()
@@ -3,7 +3,7 @@
 
 typedef struct global_config {
 	//Resource settings
-	int max_vessels;
+	int max_vessels;			//Number of vessels to allocate memory for on startup (at least 1024)
 
 	//Debug settings
 	int write_atmosphere;
@@ -26,6 +26,16 @@ typedef struct global_config {
 	int nonspherical_gravity;	//Use non-spherical gravity
 	int planet_rotation;		//Simulate planet rotation
 	double staging_wait_time;	//Time during which inertial physics must be enabled after staging
+
+	//Dedicated server settings
+	int server_cpu;				//CPU to which server main thread is bound (-1: any)
+	double server_stats_interval; //Interval between tick statistics log messages (0: disabled)
+
+	//Lua settings
+	int lua_gc_pause;			//Collector pause (percent, see collectgarbage("setpause"))
+	int lua_gc_stepmul;			//Collector step multiplier (percent)
+	double lua_gc_budget;		//Time per frame for incremental collection (ms, 0: automatic collection only)
+	int lua_gc_step_size;		//Size of a single collection step (KB)
 } global_config;
 
 extern global_config config;
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 #include "x-space.h"
 #include "dataref.h"
 #include "vessel.h"
@@ -26,6 +27,17 @@ quaternion sim2ni_rotation;		//Quaternion defining rotation X-Plane coordinate s
 quaternion i2ni_rotation;		//Quaternion defining rotation from inertial to non-inertial
 quaternion ni2i_rotation;		//Quaternion defining rotation from non-inertial to inertial
 
+//Same rotations as matrices (including axis swaps between coordinate systems)
+double i2sim_matrix[3][3];
+double sim2i_matrix[3][3];
+double i2rel_matrix[3][3];
+double ni2sim_matrix[3][3];
+double sim2ni_matrix[3][3];
+double i2ni_matrix[3][3];
+double ni2i_matrix[3][3];
+//Incremented when matrices are recomputed (invalidates cached vessel transforms)
+int coordsys_epoch = 1;
+
 //#define HISTORY_POINTS 60*60*4
 //double coord_history_timeout;
 //double coord_history_xyz[(MAX_BODIES-1)*HISTORY_POINTS*3];
@@ -67,11 +79,8 @@ void coordsys_update_datarefs(vessel* base, vessel* v)
 	double nx,ny,nz;
 	coordsys_retvel(v,&nx,&ny,&nz);
 
-	//Non-inertial
-	coord_i2ni(v->inertial.x,v->inertial.y,v->inertial.z,
-	           &v->noninertial.x,&v->noninertial.y,&v->noninertial.z);
-	vec_i2ni(v->inertial.vx,v->inertial.vy,v->inertial.vz,
-	         &v->noninertial.vx,&v->noninertial.vy,&v->noninertial.vz);
+	//Non-inertial (position and velocity follow each other in both structures)
+	vec_i2ni_array(&v->inertial.x,&v->noninertial.x,2);
 	vec_i2ni(v->inertial.ax,v->inertial.ay,v->inertial.az,
 		&v->noninertial.ax,&v->noninertial.ay,&v->noninertial.az);
 	quat_i2ni(v->inertial.q,v->noninertial.q);
@@ -85,8 +94,7 @@ void coordsys_update_datarefs(vessel* base, vessel* v)
 	/*vec_sim2l(base,v->sim.vx+nx,v->sim.vy+ny,v->sim.vz+nz,&v->local.vx,&v->local.vy,&v->local.vz);
 	vec_sim2l(base,v->sim.ax,v->sim.ay,v->sim.az,         &v->local.ax,&v->local.ay,&v->local.az);*/
 	//coord_i2l(base,v->inertial.x,v->inertial.y,v->inertial.z,&v->local.x,&v->local.y,&v->local.z);
-	vec_ni2l(v,v->noninertial.vx,v->noninertial.vy,v->noninertial.vz,&v->local.vx,&v->local.vy,&v->local.vz);
-	vec_ni2l(v,v->noninertial.ax,v->noninertial.ay,v->noninertial.az,&v->local.ax,&v->local.ay,&v->local.az);
+	vec_ni2l_array(v,&v->noninertial.vx,&v->local.vx,2); //Velocity and acceleration
 
 	if (v->physics_type == VESSEL_PHYSICS_INERTIAL) {
 		double gx,gy,gz;
@@ -167,6 +175,7 @@ void coordsys_update(float dt)
 	qconj(sim2ni_rotation,ni2sim_rotation);
 	qeuler_from(i2ni_rotation,0,0,-current_planet.a);
 	qconj(ni2i_rotation,i2ni_rotation);
+	coordsys_update_matrices();
 
 	//Update coordinate history
 	/*coord_history_timeout += dt;
@@ -387,44 +396,125 @@ void vel_ni2i_vessel(vessel* v)
 }
 
 
+//==============================================================================
+// Rotation matrices
+//------------------------------------------------------------------------------
+// Every transformation rotates a vector by quaternion (q*v*q^-1) after
+// shuffling axes of the source frame into quaternion components, and shuffles
+// the result into axes of the destination frame. Both the rotation and the
+// shuffles are folded into a single 3x3 matrix.
+//==============================================================================
+static const int axes_xyz[3] = { 0, 1, 2 };	//x->x, y->y, z->z
+static const int axes_xzy[3] = { 0, 2, 1 };	//Inertial, non-inertial frames
+static const int axes_zyx[3] = { 2, 1, 0 };	//Simulator frame
+static const int axes_local[3] = { 1, 2, 0 }; //Local frame (as seen from simulator frame)
+static const double signs_none[3] = { 1.0, 1.0, 1.0 };
+static const double signs_local[3] = { -1.0, 1.0, 1.0 };
+
+void coordsys_matrix(double m[3][3], quaternion q,
+					 const int* in_axes, const double* in_signs, const int* out_axes, const double* out_signs)
+{
+	double r[3][3];
+	int i,j;
+
+	qmatrix(r,q);
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			m[i][j] = out_signs[i]*in_signs[j]*r[out_axes[i]][in_axes[j]];
+		}
+	}
+}
+
+void coordsys_matrix_mul(double m[3][3], double a[3][3], double b[3][3])
+{
+	int i,j;
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++) {
+			m[i][j] = a[i][0]*b[0][j] + a[i][1]*b[1][j] + a[i][2]*b[2][j];
+		}
+	}
+}
+
+//Rotate vector by matrix (or by its transpose)
+#define coordsys_rotate(m,x,y,z,ox,oy,oz) { double _x = (x), _y = (y), _z = (z); \
+	*(ox) = (m)[0][0]*_x + (m)[0][1]*_y + (m)[0][2]*_z; \
+	*(oy) = (m)[1][0]*_x + (m)[1][1]*_y + (m)[1][2]*_z; \
+	*(oz) = (m)[2][0]*_x + (m)[2][1]*_y + (m)[2][2]*_z; }
+#define coordsys_rotate_t(m,x,y,z,ox,oy,oz) { double _x = (x), _y = (y), _z = (z); \
+	*(ox) = (m)[0][0]*_x + (m)[1][0]*_y + (m)[2][0]*_z; \
+	*(oy) = (m)[0][1]*_x + (m)[1][1]*_y + (m)[2][1]*_z; \
+	*(oz) = (m)[0][2]*_x + (m)[1][2]*_y + (m)[2][2]*_z; }
+
+
+//==============================================================================
+// Recompute global rotation matrices (after rotation quaternions changed)
+//==============================================================================
+void coordsys_update_matrices()
+{
+	coordsys_matrix(i2sim_matrix,i2sim_rotation,axes_xzy,signs_none,axes_zyx,signs_none);
+	coordsys_matrix(sim2i_matrix,sim2i_rotation,axes_zyx,signs_none,axes_xzy,signs_none);
+	coordsys_matrix(i2rel_matrix,i2rel_rotation,axes_xzy,signs_none,axes_zyx,signs_none);
+	coordsys_matrix(ni2sim_matrix,ni2sim_rotation,axes_xzy,signs_none,axes_zyx,signs_none);
+	coordsys_matrix(sim2ni_matrix,sim2ni_rotation,axes_zyx,signs_none,axes_xzy,signs_none);
+	coordsys_matrix(i2ni_matrix,i2ni_rotation,axes_xyz,signs_none,axes_xyz,signs_none);
+	coordsys_matrix(ni2i_matrix,ni2i_rotation,axes_xyz,signs_none,axes_xyz,signs_none);
+
+	//Invalidates attitude transforms of all vessels
+	coordsys_epoch++;
+}
+
+
+//==============================================================================
+// Attitude transforms of the vessel. Local frame is defined by simulator
+// attitude, which is derived from inertial attitude
+//==============================================================================
+void coordsys_update_vessel_transform(vessel* v)
+{
+	double l2sim[3][3];
+
+	if ((v->transform.epoch == coordsys_epoch) &&
+		(v->transform.q[0] == v->inertial.q[0]) && (v->transform.q[1] == v->inertial.q[1]) &&
+		(v->transform.q[2] == v->inertial.q[2]) && (v->transform.q[3] == v->inertial.q[3])) {
+		v->sim.q[0] = v->transform.sim_q[0];
+		v->sim.q[1] = v->transform.sim_q[1];
+		v->sim.q[2] = v->transform.sim_q[2];
+		v->sim.q[3] = v->transform.sim_q[3];
+		return;
+	}
+
+	quat_i2sim(v->inertial.q,v->sim.q);
+	coordsys_matrix(l2sim,v->sim.q,axes_xyz,signs_none,axes_local,signs_local);
+	coordsys_matrix_mul(v->transform.l2i,sim2i_matrix,l2sim);
+	coordsys_matrix_mul(v->transform.l2ni,sim2ni_matrix,l2sim);
+
+	v->transform.epoch = coordsys_epoch;
+	memcpy(v->transform.q,v->inertial.q,sizeof(quaternion));
+	memcpy(v->transform.sim_q,v->sim.q,sizeof(quaternion));
+}
+
+
 //==============================================================================
 // Coordinate transformations
 //==============================================================================
 void coord_sim2i(double sx, double sy, double sz, double* ix, double* iy, double* iz)
 {
-	quaternion q;
-	qset_vec(q,sz,sy+current_planet.radius,sx);
-	qdiv(q,q,sim2i_rotation); //transform by Q^-1
-	qmul(q,sim2i_rotation,q);
-	qget_vec(q,ix,iz,iy);
+	coordsys_rotate(sim2i_matrix,sx,sy+current_planet.radius,sz,ix,iy,iz);
 }
 
 void coord_i2sim(double ix, double iy, double iz, double* sx, double* sy, double* sz)
 {
-	quaternion q;
-	qset_vec(q,ix,iz,iy);
-	qdiv(q,q,i2sim_rotation); //transform by Q
-	qmul(q,i2sim_rotation,q);
-	qget_vec(q,sz,sy,sx);
+	coordsys_rotate(i2sim_matrix,ix,iy,iz,sx,sy,sz);
 	*sy -= current_planet.radius;
 }
 
 void coord_sim2ni(double sx, double sy, double sz, double* x, double* y, double* z)
 {
-	quaternion q;
-	qset_vec(q,sz,sy+current_planet.radius,sx);
-	qdiv(q,q,sim2ni_rotation); //transform by Q^-1
-	qmul(q,sim2ni_rotation,q);
-	qget_vec(q,x,z,y);
+	coordsys_rotate(sim2ni_matrix,sx,sy+current_planet.radius,sz,x,y,z);
 }
 
 void coord_ni2sim(double x, double y, double z, double* sx, double* sy, double* sz)
 {
-	quaternion q;
-	qset_vec(q,x,z,y);
-	qdiv(q,q,ni2sim_rotation); //transform by Q
-	qmul(q,ni2sim_rotation,q);
-	qget_vec(q,sz,sy,sx);
+	coordsys_rotate(ni2sim_matrix,x,y,z,sx,sy,sz);
 	*sy -= current_planet.radius;
 }
 
@@ -443,11 +533,6 @@ void coord_l2sim(vessel* v, double lx, double ly, double lz, double* sx, double*
 
 void coord_l2i(vessel* v, double lx, double ly, double lz, double* ix, double* iy, double* iz)
 {
-	//double sx,sy,sz;
-	//quat_i2sim(v->inertial.q,v->sim.q); //FIXME: resets sim Q
-	//coord_l2sim(v,lx,ly,lz,&sx,&sy,&sz);
-	//coord_sim2i(sx,sy,sz,ix,iy,iz);
-
 	vec_l2i(v,lx,ly,lz,ix,iy,iz);
 	*ix += v->inertial.x;
 	*iy += v->inertial.y;
@@ -460,119 +545,135 @@ void coord_l2i(vessel* v, double lx, double ly, double lz, double* ix, double* i
 //==============================================================================
 void vec_sim2i(double sx, double sy, double sz, double* ix, double* iy, double* iz)
 {
-	quaternion q;
-	qset_vec(q,sz,sy,sx);
-	qdiv(q,q,sim2i_rotation);
-	qmul(q,sim2i_rotation,q);
-	qget_vec(q,ix,iz,iy);
+	coordsys_rotate(sim2i_matrix,sx,sy,sz,ix,iy,iz);
 }
 
 void vec_i2sim(double ix, double iy, double iz, double* sx, double* sy, double* sz)
 {
-	quaternion q;
-	qset_vec(q,ix,iz,iy);
-	qdiv(q,q,i2sim_rotation);
-	qmul(q,i2sim_rotation,q);
-	qget_vec(q,sz,sy,sx);
+	coordsys_rotate(i2sim_matrix,ix,iy,iz,sx,sy,sz);
 }
 
 void vec_i2rel(double ix, double iy, double iz, double* rx, double* ry, double* rz)
 {
-	quaternion q;
-	qset_vec(q,ix,iz,iy);
-	qdiv(q,q,i2rel_rotation);
-	qmul(q,i2rel_rotation,q);
-	qget_vec(q,rz,ry,rx);
+	coordsys_rotate(i2rel_matrix,ix,iy,iz,rx,ry,rz);
 }
 
 void vec_sim2ni(double sx, double sy, double sz, double* x, double* y, double* z)
 {
-	quaternion q;
-	qset_vec(q,sz,sy,sx);
-	qdiv(q,q,sim2ni_rotation);
-	qmul(q,sim2ni_rotation,q);
-	qget_vec(q,x,z,y);
+	coordsys_rotate(sim2ni_matrix,sx,sy,sz,x,y,z);
 }
 
 void vec_ni2sim(double x, double y, double z, double* sx, double* sy, double* sz)
 {
-	quaternion q;
-	qset_vec(q,x,z,y);
-	qdiv(q,q,ni2sim_rotation);
-	qmul(q,ni2sim_rotation,q);
-	qget_vec(q,sz,sy,sx);
+	coordsys_rotate(ni2sim_matrix,x,y,z,sx,sy,sz);
 }
 
 void vec_sim2l(vessel* v, double sx, double sy, double sz, double* lx, double* ly, double* lz)
 {
-	quaternion q,qv;
-	qconj(qv,v->sim.q);
-
-	qset_vec(q,sz,-sx,sy);
-	qdiv(q,q,qv);
-	qmul(q,qv,q);
-	qget_vec(q,lx,ly,lz);
+	double l2sim[3][3];
+	coordsys_matrix(l2sim,v->sim.q,axes_xyz,signs_none,axes_local,signs_local);
+	coordsys_rotate_t(l2sim,sx,sy,sz,lx,ly,lz);
 }
 
 void vec_l2sim(vessel* v, double lx, double ly, double lz, double* sx, double* sy, double* sz)
 {
-	quaternion q;
-
-	qset_vec(q,lx,ly,lz);
-	qdiv(q,q,v->sim.q);
-	qmul(q,v->sim.q,q);
-	qget_vec(q,sz,sx,sy);
-	*sx *= -1;
+	double l2sim[3][3];
+	coordsys_matrix(l2sim,v->sim.q,axes_xyz,signs_none,axes_local,signs_local);
+	coordsys_rotate(l2sim,lx,ly,lz,sx,sy,sz);
 }
 
 void vec_i2l(vessel* v, double ix, double iy, double iz, double* lx, double* ly, double* lz)
 {
-	double sx,sy,sz;
-	quat_i2sim(v->inertial.q,v->sim.q); //FIXME: resets sim Q
-	vec_i2sim(ix,iy,iz,&sx,&sy,&sz);
-	vec_sim2l(v,sx,sy,sz,lx,ly,lz);
+	coordsys_update_vessel_transform(v);
+	coordsys_rotate_t(v->transform.l2i,ix,iy,iz,lx,ly,lz);
 }
 
 void vec_l2i(vessel* v, double lx, double ly, double lz, double* ix, double* iy, double* iz)
 {
-	double sx,sy,sz;
-	quat_i2sim(v->inertial.q,v->sim.q);
-	vec_l2sim(v,lx,ly,lz,&sx,&sy,&sz);
-	vec_sim2i(sx,sy,sz,ix,iy,iz);
+	coordsys_update_vessel_transform(v);
+	coordsys_rotate(v->transform.l2i,lx,ly,lz,ix,iy,iz);
 }
 
 void vec_i2ni(double ix, double iy, double iz, double* x, double* y, double* z)
 {
-	quaternion q;
-	qset_vec(q,ix,iy,iz);
-	qdiv(q,q,i2ni_rotation);
-	qmul(q,i2ni_rotation,q);
-	qget_vec(q,x,y,z);
+	coordsys_rotate(i2ni_matrix,ix,iy,iz,x,y,z);
 }
 
 void vec_ni2i(double x, double y, double z, double* ix, double* iy, double* iz)
 {
-	quaternion q;
-	qset_vec(q,x,y,z);
-	qdiv(q,q,ni2i_rotation);
-	qmul(q,ni2i_rotation,q);
-	qget_vec(q,ix,iy,iz);
+	coordsys_rotate(ni2i_matrix,x,y,z,ix,iy,iz);
 }
 
 void vec_ni2l(vessel* v, double ix, double iy, double iz, double* lx, double* ly, double* lz)
 {
-	double sx,sy,sz;
-	quat_i2sim(v->inertial.q,v->sim.q); //FIXME: resets sim Q
-	vec_ni2sim(ix,iy,iz,&sx,&sy,&sz);
-	vec_sim2l(v,sx,sy,sz,lx,ly,lz);
+	coordsys_update_vessel_transform(v);
+	coordsys_rotate_t(v->transform.l2ni,ix,iy,iz,lx,ly,lz);
 }
 
 void vec_l2ni(vessel* v, double lx, double ly, double lz, double* ix, double* iy, double* iz)
 {
-	double sx,sy,sz;
-	quat_i2sim(v->inertial.q,v->sim.q); //FIXME: reset sim Q
-	vec_l2sim(v,lx,ly,lz,&sx,&sy,&sz);
-	vec_sim2ni(sx,sy,sz,ix,iy,iz);
+	coordsys_update_vessel_transform(v);
+	coordsys_rotate(v->transform.l2ni,lx,ly,lz,ix,iy,iz);
+}
+
+
+//==============================================================================
+// Batch vector transformations (count vectors stored as x,y,z triples,
+// source and destination may be the same array)
+//==============================================================================
+void vec_array(double m[3][3], int transpose, double* src, double* dst, int count)
+{
+	int i;
+	if (transpose) {
+		for (i = 0; i < count*3; i += 3) coordsys_rotate_t(m,src[i],src[i+1],src[i+2],&dst[i],&dst[i+1],&dst[i+2]);
+	} else {
+		for (i = 0; i < count*3; i += 3) coordsys_rotate(m,src[i],src[i+1],src[i+2],&dst[i],&dst[i+1],&dst[i+2]);
+	}
+}
+
+void vec_sim2i_array(double* src, double* dst, int count)	{ vec_array(sim2i_matrix,0,src,dst,count); }
+void vec_i2sim_array(double* src, double* dst, int count)	{ vec_array(i2sim_matrix,0,src,dst,count); }
+void vec_sim2ni_array(double* src, double* dst, int count)	{ vec_array(sim2ni_matrix,0,src,dst,count); }
+void vec_ni2sim_array(double* src, double* dst, int count)	{ vec_array(ni2sim_matrix,0,src,dst,count); }
+void vec_i2ni_array(double* src, double* dst, int count)	{ vec_array(i2ni_matrix,0,src,dst,count); }
+void vec_ni2i_array(double* src, double* dst, int count)	{ vec_array(ni2i_matrix,0,src,dst,count); }
+
+void vec_l2i_array(vessel* v, double* src, double* dst, int count)
+{
+	coordsys_update_vessel_transform(v);
+	vec_array(v->transform.l2i,0,src,dst,count);
+}
+
+void vec_i2l_array(vessel* v, double* src, double* dst, int count)
+{
+	coordsys_update_vessel_transform(v);
+	vec_array(v->transform.l2i,1,src,dst,count);
+}
+
+void vec_l2ni_array(vessel* v, double* src, double* dst, int count)
+{
+	coordsys_update_vessel_transform(v);
+	vec_array(v->transform.l2ni,0,src,dst,count);
+}
+
+void vec_ni2l_array(vessel* v, double* src, double* dst, int count)
+{
+	coordsys_update_vessel_transform(v);
+	vec_array(v->transform.l2ni,1,src,dst,count);
+}
+
+void vec_sim2l_array(vessel* v, double* src, double* dst, int count)
+{
+	double l2sim[3][3];
+	coordsys_matrix(l2sim,v->sim.q,axes_xyz,signs_none,axes_local,signs_local);
+	vec_array(l2sim,1,src,dst,count);
+}
+
+void vec_l2sim_array(vessel* v, double* src, double* dst, int count)
+{
+	double l2sim[3][3];
+	coordsys_matrix(l2sim,v->sim.q,axes_xyz,signs_none,axes_local,signs_local);
+	vec_array(l2sim,0,src,dst,count);
 }
 
 
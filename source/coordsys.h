@@ -46,11 +46,22 @@ quaternion sim2ni_rotation;
 quaternion i2ni_rotation;
 quaternion ni2i_rotation;
 
+extern double i2sim_matrix[3][3];
+extern double sim2i_matrix[3][3];
+extern double i2rel_matrix[3][3];
+extern double ni2sim_matrix[3][3];
+extern double sim2ni_matrix[3][3];
+extern double i2ni_matrix[3][3];
+extern double ni2i_matrix[3][3];
+extern int coordsys_epoch;
+
 void coordsys_update(float dt);
 void coordsys_initialize();
 void coordsys_reinitialize();
 void coordsys_draw();
 void coordsys_update_datarefs(vessel* base, vessel* v);
+void coordsys_update_matrices();
+void coordsys_update_vessel_transform(vessel* v);
 
 //Convert velocity in simulator coordinate between inertial and non-inertial
 void vel_i2ni_vessel(vessel* v);
@@ -86,6 +97,21 @@ void vec_ni2i(double x, double y, double z, double* ix, double* iy, double* iz);
 void vec_ni2l(vessel* v, double ix, double iy, double iz, double* lx, double* ly, double* lz);
 void vec_l2ni(vessel* v, double lx, double ly, double lz, double* ix, double* iy, double* iz);
 
+//Batch vector transform (count vectors stored as x,y,z triples)
+void vec_array(double m[3][3], int transpose, double* src, double* dst, int count);
+void vec_sim2i_array(double* src, double* dst, int count);
+void vec_i2sim_array(double* src, double* dst, int count);
+void vec_sim2ni_array(double* src, double* dst, int count);
+void vec_ni2sim_array(double* src, double* dst, int count);
+void vec_i2ni_array(double* src, double* dst, int count);
+void vec_ni2i_array(double* src, double* dst, int count);
+void vec_l2i_array(vessel* v, double* src, double* dst, int count);
+void vec_i2l_array(vessel* v, double* src, double* dst, int count);
+void vec_l2ni_array(vessel* v, double* src, double* dst, int count);
+void vec_ni2l_array(vessel* v, double* src, double* dst, int count);
+void vec_sim2l_array(vessel* v, double* src, double* dst, int count);
+void vec_l2sim_array(vessel* v, double* src, double* dst, int count);
+
 //Quaternion transformation
 void quat_sim2i(quaternion sq, quaternion iq);
 void quat_i2sim(quaternion iq, quaternion sq);
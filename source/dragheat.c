@@ -19,6 +19,8 @@
 
 #include "threading.h"
 #include "curtime.h"
+#include "profiler.h"
+#include "snapshot.h"
 
 
 //==============================================================================
@@ -387,12 +389,18 @@ void dragheat_initialize(vessel* v, char* acfpath, char* acfname)
 	v->geometry.my = my / (1.0*num_tris);
 	v->geometry.mz = mz / (1.0*num_tris);
 
+	//Thermal state restored from snapshot
+	snapshot_restore_thermal(v);
+
 	//Not invalid
 	v->geometry.invalid = 0;
 	fclose(f);
 
 	//Create heat simulation thread
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
+	dragheat_airflow_allocate(&v->geometry.airflow,v->geometry.num_faces);
+	dragheat_airflow_allocate(&v->geometry.heat_airflow,v->geometry.num_faces);
+	dragheat_airflow_allocate(&v->geometry.shockwave_airflow,v->geometry.num_faces);
 	v->geometry.heat_data_lock = lock_create();
 	v->geometry.heat_thread = thread_create(dragheat_simulate_vessel_heat,v);
 	v->geometry.shockwave_thread = thread_create(dragheat_simulate_vessel_shockwaves,v);
@@ -480,6 +488,12 @@ void dragheat_initialize_highlevel(vessel* v)
 			lua_setfield(L,-2,"_sensor_idx");
 			num_sensors++;
 
+#if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
+			//Resolve output datarefs
+			highlevel_bindfield(L,-1,"Temperature");
+			highlevel_bindfield(L,-1,"HeatFlux");
+#endif
+
 			lua_pop(L,1); //Remove value, only leave key
 		}
 	}
@@ -498,6 +512,9 @@ void dragheat_deinitialize(vessel* v)
 		thread_kill(v->geometry.shockwave_thread);
 		lock_destroy(v->geometry.heat_data_lock);
 	}
+	dragheat_airflow_free(&v->geometry.airflow);
+	dragheat_airflow_free(&v->geometry.heat_airflow);
+	dragheat_airflow_free(&v->geometry.shockwave_airflow);
 	if (v->geometry.faces) {
 		free(v->geometry.faces);
 		v->geometry.faces = 0;
@@ -538,7 +555,8 @@ void dragheat_reset() {
 //==============================================================================
 void dragheat_simulate(float dt)
 {
-	int i;
+	double heat_time = 0.0,shockwave_time = 0.0;
+	int i,k;
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
 	if (dragheat_simulation.enabled) {
 		quaternion q;
@@ -572,9 +590,12 @@ void dragheat_simulate(float dt)
 	dragheat_max_temperature = 0.0;
 	dragheat_max_heatflux = 0.0;
 	dragheat_max_Q = 0.0;
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists && vessels[i].geometry.faces) {
 			dragheat_simulate_vessel(&vessels[i],dt);
+			heat_time += vessels[i].geometry.heat_time;
+			shockwave_time += vessels[i].geometry.shockwave_time;
 		}
 	}
 
@@ -586,12 +607,104 @@ void dragheat_simulate(float dt)
 	//Update heating simulation state
 	dragheat_heating_simulate = (dt > 0.0);
 #else
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists && (vessels[i].physics_type == VESSEL_PHYSICS_INERTIAL) && vessels[i].geometry.faces) {
 			dragheat_simulate_vessel(&vessels[i],dt);
+			heat_time += vessels[i].geometry.heat_time;
+			shockwave_time += vessels[i].geometry.shockwave_time;
 		}
 	}
 #endif
+
+	//Report time taken by heating threads
+	profiler_add(PROFILER_HEAT,heat_time);
+	profiler_add(PROFILER_SHOCKWAVES,shockwave_time);
+}
+
+
+//==============================================================================
+// Airflow shared with heating and shockwave threads. Main thread publishes it
+// once per tick, threads take their own consistent copy without locking:
+// sequence is odd while the state is written, and the copy is retried if the
+// sequence changed while copying
+//==============================================================================
+void dragheat_airflow_allocate(airflow_state* state, int num_faces)
+{
+	memset(state,0,sizeof(airflow_state));
+	state->num_faces = num_faces;
+	state->faces = (double*)calloc(num_faces*AIRFLOW_FACE_VALUES,sizeof(double));
+}
+
+void dragheat_airflow_free(airflow_state* state)
+{
+	if (state->faces) free(state->faces);
+	state->faces = 0;
+	state->num_faces = 0;
+}
+
+//Publish airflow computed by dragheat_simulate_vessel (main thread)
+void dragheat_airflow_publish(vessel* v)
+{
+	airflow_state* state = &v->geometry.airflow;
+	face* faces = v->geometry.faces;
+	double* values = state->faces;
+	int i;
+	if (!values) return;
+
+	state->sequence++;
+	thread_memory_barrier();
+
+	state->M = v->geometry.effective_M;
+	state->vx = v->geometry.vx;
+	state->vy = v->geometry.vy;
+	state->vz = v->geometry.vz;
+	state->temperature = v->air.temperature;
+	state->concentration = v->air.concentration;
+	state->hull_weight = v->weight.hull;
+	state->shockwave_heating = v->geometry.shockwave_heating;
+	for (i = 0; i < state->num_faces; i++, values += AIRFLOW_FACE_VALUES) {
+		values[AIRFLOW_HEAT_FLUX] = faces[i].heat_flux;
+		values[AIRFLOW_DOT] = faces[i]._dot;
+		values[AIRFLOW_DOT0] = faces[i]._dot0;
+		values[AIRFLOW_DOT1] = faces[i]._dot1;
+		values[AIRFLOW_DOT2] = faces[i]._dot2;
+	}
+
+	thread_memory_barrier();
+	state->sequence++;
+}
+
+//Copy last published airflow (simulation threads). Returns sequence of the
+//copy, or 0 if airflow was never published
+unsigned int dragheat_airflow_read(vessel* v, airflow_state* copy)
+{
+	airflow_state* state = &v->geometry.airflow;
+	unsigned int sequence;
+
+	do {
+		sequence = state->sequence;
+		if (sequence & 1) {
+			thread_sleep(0.0); //Writer is busy
+			continue;
+		}
+		thread_memory_barrier();
+
+		copy->M = state->M;
+		copy->vx = state->vx;
+		copy->vy = state->vy;
+		copy->vz = state->vz;
+		copy->temperature = state->temperature;
+		copy->concentration = state->concentration;
+		copy->hull_weight = state->hull_weight;
+		copy->shockwave_heating = state->shockwave_heating;
+		memcpy(copy->faces,state->faces,state->num_faces*AIRFLOW_FACE_VALUES*sizeof(double));
+
+		thread_memory_barrier();
+	} while ((sequence & 1) || (state->sequence != sequence));
+
+	copy->sequence = sequence;
+	return sequence;
 }
 
 
@@ -622,13 +735,14 @@ void dragheat_simulate_vessel_shockwaves(vessel* v)
 {
 	face* faces = v->geometry.faces;	//Lookup for faces
 	int num_faces = v->geometry.num_faces;
+	airflow_state* airflow = &v->geometry.shockwave_airflow;
+	double* values = airflow->faces;
+	unsigned int sequence = 0;
 	int i;
 	
 	while (1) {
-		double M = v->geometry.effective_M;
-		double dx = v->geometry.vx;
-		double dy = v->geometry.vy;
-		double dz = v->geometry.vz;
+		double M,dx,dy,dz;
+		double start_time;
 
 		//Skip cycle if paused
 		if (!dragheat_heating_simulate) {
@@ -636,21 +750,34 @@ void dragheat_simulate_vessel_shockwaves(vessel* v)
 			continue;
 		}
 
+		//Recompute only when new airflow was published
+		if (v->geometry.airflow.sequence == sequence) {
+			thread_sleep(1.0/100.0);
+			continue;
+		}
+		sequence = dragheat_airflow_read(v,airflow);
+		start_time = profiler_time();
+		M = airflow->M;
+		dx = airflow->vx;
+		dy = airflow->vy;
+		dz = airflow->vz;
+
 		//Reset
 		for (i = 0; i < num_faces; i++) {
 			faces[i]._shockwaves = 0;
 		}
 
 		//Compute faces which can generate shockwaves, shockwave induced heating coefficients
-		if (v->geometry.shockwave_heating && (M > 1.0)) {
+		if (airflow->shockwave_heating && (M > 1.0)) {
 			double mach_sin = 0.2;//1/M;
 
 			for (i = 0; i < num_faces; i++) {
+				double* value = &values[i*AIRFLOW_FACE_VALUES];
 				faces[i].creates_shockwave = 0;
-				if (faces[i]._dot < 0.0) { //Out of airflow
-					if ((faces[i]._dot0 > 0.0) ||
-						(faces[i]._dot1 > 0.0) ||
-						(faces[i]._dot2 > 0.0)) {
+				if (value[AIRFLOW_DOT] < 0.0) { //Out of airflow
+					if ((value[AIRFLOW_DOT0] > 0.0) ||
+						(value[AIRFLOW_DOT1] > 0.0) ||
+						(value[AIRFLOW_DOT2] > 0.0)) {
 						faces[i].creates_shockwave = 1;
 					}
 				}
@@ -699,9 +826,7 @@ void dragheat_simulate_vessel_shockwaves(vessel* v)
 			if (w > 1.0) w = 1.0;
 			faces[i].shockwaves = w;
 		}
-
-		//10 FPS
-		thread_sleep(1.0/10.0);
+		v->geometry.shockwave_time = profiler_time() - start_time;
 	}
 }
 
@@ -762,9 +887,6 @@ void dragheat_simulate_vessel(vessel* v, float dt)
 	M = vmag / a;
 	v->geometry.effective_M = M;
 
-	//Lock data update
-	//lock_enter(v->geometry.heat_data_lock);
-
 	//Compute dot products of the faces
 	for (i = 0; i < v->geometry.num_faces; i++) {
 		faces[i]._dot = faces[i].nx * dx + faces[i].ny * dy + faces[i].nz * dz; //direction . normal
@@ -857,8 +979,10 @@ void dragheat_simulate_vessel(vessel* v, float dt)
 #endif
 	}
 
-	//Lock data end
-	//lock_leave(v->geometry.heat_data_lock);
+	//Publish airflow for heating and shockwave threads
+#if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
+	dragheat_airflow_publish(v);
+#endif
 
 	//Apply forces acting on the vessel
 	if (v->physics_type == VESSEL_PHYSICS_INERTIAL) {
@@ -935,10 +1059,7 @@ void dragheat_simulate_vessel(vessel* v, float dt)
 									  (   v->sensors.surface[sensor].d0+   v->sensors.surface[sensor].d1+   v->sensors.surface[sensor].d2);
 						v->sensors.surface[sensor].temperature = temperature;
 
-						lua_pushcfunction(L,highlevel_dataref);
-						lua_pushvalue(L,-2); //Push dataref
-						lua_pushnumber(L,temperature); //Push value
-						highlevel_call(2,0); //Write dataref
+						highlevel_writevalue(L,-1,temperature); //Write dataref
 					}
 					lua_pop(L,1);
 
@@ -957,10 +1078,7 @@ void dragheat_simulate_vessel(vessel* v, float dt)
 									(   v->sensors.surface[sensor].d0+   v->sensors.surface[sensor].d1+   v->sensors.surface[sensor].d2);
 						v->sensors.surface[sensor].heat_flux = heat_flux;
 
-						lua_pushcfunction(L,highlevel_dataref);
-						lua_pushvalue(L,-2); //Push dataref
-						lua_pushnumber(L,heat_flux); //Push value
-						highlevel_call(2,0); //Write dataref
+						highlevel_writevalue(L,-1,heat_flux); //Write dataref
 					}
 					lua_pop(L,1);
 				}
@@ -1119,18 +1237,21 @@ void dragheat_simulate_vessel_heat(vessel* v)
 {
 	face* faces = v->geometry.faces;	//Lookup for faces
 	int num_faces = v->geometry.num_faces;
-	double prev_time = curtime();
+	airflow_state* airflow = &v->geometry.heat_airflow;
+	double* values = airflow->faces;
+	double prev_time;
 	int i,j;
 
-	thread_sleep(1.0);
+	//Wait until airflow is computed for the first time
+	while (!v->geometry.airflow.sequence) thread_sleep(1.0/30.0);
+	prev_time = curtime();
 	
 	while (1) {
-		//Fetch some variables
-		double natm = v->air.concentration;
-		double Tatm = v->air.temperature;
+		double natm,Tatm;
 		//Compute delta time
 		double new_time = curtime();
 		double dt = new_time - prev_time;
+		double start_time;
 		prev_time = new_time;
 		//Limit FPS to at least 10 (for stability)
 		if (dt > 0.1) dt = 0.1;
@@ -1141,8 +1262,12 @@ void dragheat_simulate_vessel_heat(vessel* v)
 			continue;
 		}
 
-		//Enter data lock
+		//Fetch airflow, enter data lock (temperatures may be reset by main thread)
+		dragheat_airflow_read(v,airflow);
+		natm = airflow->concentration;
+		Tatm = airflow->temperature;
 		lock_enter(v->geometry.heat_data_lock);
+		start_time = profiler_time();
 
 		//Compute new temperatures due to heat flux
 		for (i = 0; i < num_faces; i++) {
@@ -1156,7 +1281,7 @@ void dragheat_simulate_vessel_heat(vessel* v)
 			//Triangle parameters
 			area = faces[i].area;
 			thickness = faces[i].thickness;
-			heat_flux = faces[i].heat_flux;
+			heat_flux = values[i*AIRFLOW_FACE_VALUES+AIRFLOW_HEAT_FLUX];
 
 			//Get correct parameters
 			if (faces[i].m > 0) { //Thermal Protection
@@ -1176,7 +1301,7 @@ void dragheat_simulate_vessel_heat(vessel* v)
 			}
 
 			//Compute hull mass (FIXME)
-			faces[i].hull_mass = (faces[i].area / v->geometry.total_area)*v->weight.hull;
+			faces[i].hull_mass = (faces[i].area / v->geometry.total_area)*airflow->hull_weight;
 
 			//Calculate total change in thermal energy due to external factors
 			dQ = 
@@ -1219,6 +1344,7 @@ void dragheat_simulate_vessel_heat(vessel* v)
 		}
 
 		//Leave data lock
+		v->geometry.heat_time = profiler_time() - start_time;
 		lock_leave(v->geometry.heat_data_lock);
 
 		//30 FPS
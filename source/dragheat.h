@@ -19,6 +19,11 @@ void dragheat_simulate_vessel_heat(vessel* v);
 void dragheat_simulate_vessel_shockwaves(vessel* v);
 void dragheat_reset();
 
+void dragheat_airflow_allocate(airflow_state* state, int num_faces);
+void dragheat_airflow_free(airflow_state* state);
+void dragheat_airflow_publish(vessel* v);
+unsigned int dragheat_airflow_read(vessel* v, airflow_state* copy);
+
 void dragheat_draw_initialize();
 void dragheat_draw_deinitialize();
 void dragheat_draw();
@@ -3,6 +3,7 @@
 //==============================================================================
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "x-space.h"
 #include "vessel.h"
@@ -119,19 +120,322 @@ void engines_highlevel_read(double* x, double* y, double* z, double* vert, doubl
 	lua_pop(L,1);
 
 	//Read thruster angles
-	lua_pushcfunction(L,highlevel_dataref);
-	lua_getfield(L,-2,"VerticalAngle");
-	highlevel_call(1,1);
+	lua_getfield(L,-1,"VerticalAngle");
+	lua_getfield(L,-2,"HorizontalAngle");
+	*vert = highlevel_readvalue(L,-2);
+	*horiz = highlevel_readvalue(L,-1);
+	lua_pop(L,2);
+}
+
+
+//==============================================================================
+// Read engine parameter (number, or dataref if allowed). Returns 0 if parameter
+// cannot be cached (must be evaluated by Lua every frame)
+//==============================================================================
+int engines_read_value(engine_value* value, char* field, int allow_dataref)
+{
+	int result = 1;
+
+	value->defined = 0;
+	value->value = 0.0;
+	value->dataref = 0;
+
+	lua_getfield(L,-1,field);
+	switch (lua_type(L,-1)) {
+		case LUA_TNIL:
+			break;
+		case LUA_TBOOLEAN:
+			if (lua_toboolean(L,-1)) result = 0;
+			break;
+		case LUA_TNUMBER:
+			value->defined = 1;
+			value->value = lua_tonumber(L,-1);
+			break;
+		case LUA_TSTRING:
+			if (allow_dataref) {
+				value->defined = 1;
+				value->dataref = highlevel_binddataref(L,-1);
+			} else result = 0;
+			break;
+		case LUA_TUSERDATA:
+			value->dataref = highlevel_testdataref(L,-1);
+			value->defined = value->dataref != 0;
+			result = allow_dataref && value->defined;
+			break;
+		default:
+			result = 0;
+			break;
+	}
+	lua_pop(L,1);
+	return result;
+}
+
+double engines_get_value(engine_value* value)
+{
+	if (value->dataref) return highlevel_getdataref(value->dataref);
+	return value->value;
+}
+
+void engines_set_value(engine_value* value, double x)
+{
+	if (value->dataref) highlevel_setdataref(value->dataref,x);
+}
+
+
+//==============================================================================
+// Cache engine parameters from engine table on top of the stack
+//==============================================================================
+void engines_read_parameters(engine* e)
+{
+	int native = 1;
+
+	//Custom simulators are always run in Lua
+	lua_getfield(L,-1,"Simulator");
+	if (!lua_isnil(L,-1)) native = 0;
+	lua_pop(L,1);
+
+	//Read thruster position
+	lua_getfield(L,-1,"Position");
+	if (lua_istable(L,-1)) {
+		lua_rawgeti(L,-1,1);
+		lua_rawgeti(L,-2,2);
+		lua_rawgeti(L,-3,3);
+		e->x = lua_tonumber(L,-3);
+		e->y = lua_tonumber(L,-2);
+		e->z = lua_tonumber(L,-1);
+		lua_pop(L,3);
+	} else if (!lua_isnil(L,-1)) {
+		native = 0;
+	}
+	lua_pop(L,1);
+
+	//Read type
+	lua_getfield(L,-1,"Type");
+	e->rcs = lua_isstring(L,-1) && (strcmp(lua_tostring(L,-1),"RCS") == 0);
+	lua_pop(L,1);
+
+	//Read parameters
+	native &= engines_read_value(&e->vertical_angle,"VerticalAngle",1);
+	native &= engines_read_value(&e->horizontal_angle,"HorizontalAngle",1);
+	native &= engines_read_value(&e->command,"Dataref",1);
+	native &= engines_read_value(&e->max_throttle,"MaxThrottle",0);
+	native &= engines_read_value(&e->min_throttle,"MinThrottle",0);
+	native &= engines_read_value(&e->throttle_speed,"ThrottleSpeed",0);
+	native &= engines_read_value(&e->startup_time,"StartupTime",0);
+	native &= engines_read_value(&e->shutdown_time,"ShutdownTime",0);
+	native &= engines_read_value(&e->force,"Force",0);
+	native &= engines_read_value(&e->force_vac,"Force_vac",0);
+	native &= engines_read_value(&e->force_sl,"Force_sl",0);
+	native &= engines_read_value(&e->isp,"ISP",1);
+	native &= engines_read_value(&e->isp_vac,"ISP_vac",0);
+	native &= engines_read_value(&e->isp_sl,"ISP_sl",0);
+	native &= engines_read_value(&e->sfc,"SFC",1);
+	native &= engines_read_value(&e->ff,"FF",1);
+	native &= engines_read_value(&e->fuel_tank,"FuelTank",0);
+	native &= engines_read_value(&e->fuel_tank_dataref,"FuelTankDataref",1);
+	native &= engines_read_value(&e->fuel_flow_dataref,"FuelFlowDataref",1);
+	e->native = native;
+
+	//Reset simulation state
+	e->real_throttle_set = 0;
+	e->real_throttle = 0.0;
+	e->operation_timing = 0.0;
+	e->visual_timing = 0.0;
+}
+
 
-	lua_pushcfunction(L,highlevel_dataref);
-	lua_getfield(L,-3,"HorizontalAngle");
-	highlevel_call(1,1);
+//==============================================================================
+// Cache engines of the vessel (done once when aircraft is loaded)
+//==============================================================================
+void engines_initialize_highlevel(vessel* v)
+{
+	engines_deinitialize_highlevel(v);
+
+	lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_vessels);
+	lua_rawgeti(L,-1,v->index);
+	if (lua_istable(L,-1)) {
+		lua_getfield(L,-1,"Engine");
+		if (lua_istable(L,-1)) {
+			int count = 0;
+
+			//Count number of engines
+			lua_pushnil(L);
+			while (lua_next(L,-2)) {
+				if (lua_istable(L,-1)) count++;
+				lua_pop(L,1); //Remove value, only leave key
+			}
+			v->engines.list = (engine*)malloc(sizeof(engine)*max(1,count));
 
-	*vert = lua_tonumber(L,-2);
-	*horiz = lua_tonumber(L,-1);
+			//Read engines
+			lua_pushnil(L);
+			while (lua_next(L,-2)) {
+				if (lua_istable(L,-1)) {
+					engine* e = &v->engines.list[v->engines.count++];
+
+					//Resolve datarefs also for engines simulated in Lua
+					highlevel_bindfield(L,-1,"VerticalAngle");
+					highlevel_bindfield(L,-1,"HorizontalAngle");
+					engines_read_parameters(e);
+
+					lua_pushvalue(L,-1);
+					e->table = luaL_ref(L,LUA_REGISTRYINDEX);
+				}
+				lua_pop(L,1); //Remove value, only leave key
+			}
+		}
+		lua_pop(L,1);
+	}
 	lua_pop(L,2);
 }
 
+void engines_deinitialize_highlevel(vessel* v)
+{
+	int i;
+	if (v->engines.list) {
+		for (i = 0; i < v->engines.count; i++) {
+			luaL_unref(L,LUA_REGISTRYINDEX,v->engines.list[i].table);
+		}
+		free(v->engines.list);
+		v->engines.list = 0;
+	}
+	v->engines.count = 0;
+}
+
+
+//==============================================================================
+// Simulate engine with the built-in model (same as EngineSimulator in Lua)
+//==============================================================================
+void engines_simulate_native(vessel* v, engine* e, float dt)
+{
+	double pressure = max(0.0,min(1.0,v->air.pressure/101325.0));
+	double command,thruster_command,force = 0.0,intensity;
+	double fuel_left = 0.0;
+	int fuel_defined = 0;
+
+	//Read command
+	command = e->command.defined ? engines_get_value(&e->command) : 0.0;
+	thruster_command = command;
+
+	//Process throttle limit
+	if (e->max_throttle.defined) thruster_command = min(thruster_command,e->max_throttle.value);
+
+	//Process finite throttle speed
+	if (e->throttle_speed.defined) {
+		double max_delta = e->throttle_speed.value*dt;
+		if (!e->real_throttle_set) {
+			e->real_throttle = command;
+			e->real_throttle_set = 1;
+		}
+		e->real_throttle += max(-max_delta,min(max_delta,command - e->real_throttle));
+		thruster_command = e->real_throttle;
+	}
+
+	//Process engine startup and shutdown
+	if (e->startup_time.defined) {
+		double startup_throttle = (e->min_throttle.defined ? e->min_throttle.value : 0.10)*0.90;
+		if (command > startup_throttle) {
+			if (e->operation_timing < 1.0) {
+				e->operation_timing += dt/e->startup_time.value;
+				if (e->throttle_speed.defined) e->real_throttle = thruster_command;
+			}
+		} else {
+			if (e->shutdown_time.defined && (e->operation_timing > 0.0)) {
+				e->operation_timing -= dt/e->shutdown_time.value;
+			} else {
+				e->operation_timing = 0.0;
+			}
+		}
+		e->operation_timing = max(0.0,min(1.0,e->operation_timing));
+
+		if (e->operation_timing < 1.0) {
+			thruster_command = startup_throttle*(1.0-exp(-0.2*e->operation_timing));
+			if (e->throttle_speed.defined) e->real_throttle = thruster_command;
+		}
+	}
+
+	//Fetch force
+	if (e->force.defined) {
+		force = e->force.value;
+	} else if (e->force_vac.defined) {
+		double force_sl = e->force_sl.defined ? e->force_sl.value : e->force_vac.value*0.75;
+		force = force_sl*pressure + e->force_vac.value*(1-pressure);
+	}
+
+	//Get amount of fuel left
+	if (e->fuel_tank_dataref.defined) {
+		fuel_left = engines_get_value(&e->fuel_tank_dataref);
+		fuel_defined = 1;
+	} else if (e->fuel_tank.defined) {
+		int tank = (int)e->fuel_tank.value;
+		if ((tank >= 0) && (tank < VESSEL_MAX_FUELTANKS)) {
+			fuel_left = v->weight.fuel[tank];
+			fuel_defined = 1;
+		}
+	}
+
+	//Calculate fuel consumption
+	if (fuel_defined) {
+		double fuel_delta;
+		if (e->ff.defined) { //Exact fuel flow (for solid engines)
+			double ff = engines_get_value(&e->ff);
+			fuel_delta = min(ff*thruster_command*dt,fuel_left);
+			engines_set_value(&e->fuel_flow_dataref,ff*thruster_command);
+		} else {
+			double sfc = 0.000600; //kg/(N*s)
+			if (e->isp.defined) {
+				sfc = 0.101972/engines_get_value(&e->isp);
+			} else if (e->isp_vac.defined) {
+				double isp_sl = e->isp_sl.defined ? e->isp_sl.value : e->isp_vac.value*0.75;
+				sfc = 0.101972/(isp_sl*pressure + e->isp_vac.value*(1-pressure));
+			} else if (e->sfc.defined) {
+				sfc = engines_get_value(&e->sfc);
+			}
+
+			fuel_delta = min(sfc*thruster_command*force*dt,fuel_left);
+			engines_set_value(&e->fuel_flow_dataref,sfc*thruster_command*force);
+		}
+
+		//Subtract fuel, shut down engine if no fuel left
+		fuel_left = fuel_left - fuel_delta;
+		if (fuel_left == 0.0) thruster_command = 0.0;
+
+		//Write data back
+		if (e->fuel_tank_dataref.defined) {
+			engines_set_value(&e->fuel_tank_dataref,fuel_left);
+		} else {
+			v->weight.fuel[(int)e->fuel_tank.value] = fuel_left;
+			v->mass_dirty = 1;
+		}
+	}
+
+	//Calculate intensity
+	if (e->rcs) {
+		intensity = 0.0;
+		if (thruster_command == 0.0) {
+			e->visual_timing = 0.0;
+		} else {
+			e->visual_timing += dt;
+			intensity = max(0.5,min(1.0,1.0-pow(2.71,-64.0*e->visual_timing)));
+		}
+		intensity = intensity*(1.0+0.04*rand()/(double)RAND_MAX);
+	} else {
+		intensity = thruster_command*(0.90+0.20*rand()/(double)RAND_MAX);
+	}
+
+	//Output command, force and intensity for rendering and scripts
+	lua_rawgeti(L,LUA_REGISTRYINDEX,e->table);
+	lua_pushnumber(L,thruster_command);	lua_setfield(L,-2,"Command");
+	lua_pushnumber(L,force);			lua_setfield(L,-2,"ActualForce");
+	lua_pushnumber(L,intensity);		lua_setfield(L,-2,"Intensity");
+	lua_pop(L,1);
+
+	//Apply force
+	force = thruster_command*force;
+	if (!(force <= 0) && (!(force >= 0))) force = 0;
+	if (force > 0) engines_addforce(v,dt,e->x,e->y,e->z,
+		engines_get_value(&e->vertical_angle),engines_get_value(&e->horizontal_angle),force);
+}
+
 
 //==============================================================================
 // Simulate a single engine
@@ -177,35 +481,23 @@ void engines_simulate_single(vessel* v, float dt)
 //==============================================================================
 void engines_simulate(float dt)
 {
-	int i;
-
-	lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_vessels);
-	for (i = 0; i < vessel_count; i++) {
-		if (vessels[i].exists) {
-			lua_rawgeti(L,-1,i);
-			if (lua_istable(L,-1)) {
-				lua_getfield(L,-1,"Engine");
-				if (lua_istable(L,-1)) {
-					//First element must be nil for "next" to work
-					lua_pushnil(L);
-
-					//Loop through all engines
-					while (lua_next(L,-2)) {
-						//Simulate a single thruster
-						if (lua_istable(L,-1)) {
-							engines_simulate_single(&vessels[i],dt);
-						}
-
-						//Remove value, only leave key
-						lua_pop(L,1);
-					}
-				}
+	int j,k;
+
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		vessel* v = &vessels[vessels_slots.active[k]];
+		if (!v->exists) continue;
+
+		for (j = 0; j < v->engines.count; j++) {
+			engine* e = &v->engines.list[j];
+			if (e->native) {
+				engines_simulate_native(v,e,dt);
+			} else {
+				lua_rawgeti(L,LUA_REGISTRYINDEX,e->table);
+				engines_simulate_single(v,dt);
 				lua_pop(L,1);
 			}
-			lua_pop(L,1);
 		}
 	}
-	lua_pop(L,1); //Pop vessels table
 }
 
 
@@ -754,6 +1046,7 @@ void engines_update_weights(vessel* v)
 
 			v->weight.fuel[9] = sfc*2.83254504e-5*thrust*left;
 		}
+		v->mass_dirty = 1;
 	}
 }
 
@@ -2,11 +2,50 @@
 #define ENGINE_H
 
 struct vessel_tag;
+struct highlevel_dataref_handle_tag;
+
+//Engine parameter which is either a constant or a dataref
+typedef struct engine_value_tag {
+	int defined;			//Parameter was set in engine table
+	double value;			//Constant value
+	struct highlevel_dataref_handle_tag* dataref; //Dataref (if not constant)
+} engine_value;
+
+//Engine parameters cached from Lua engine table when aircraft is loaded
+typedef struct engine_tag {
+	int table;				//Reference to engine table in Lua registry
+	int native;				//Simulated by built-in model (no custom simulator)
+	int rcs;				//Uses RCS firing model
+
+	//Thruster position and deflection
+	double x,y,z;
+	engine_value vertical_angle,horizontal_angle;
+
+	//Throttle model
+	engine_value command;
+	engine_value max_throttle,min_throttle,throttle_speed;
+	engine_value startup_time,shutdown_time;
+
+	//Performance
+	engine_value force,force_vac,force_sl;
+	engine_value isp,isp_vac,isp_sl,sfc,ff;
+
+	//Fuel
+	engine_value fuel_tank,fuel_tank_dataref,fuel_flow_dataref;
+
+	//Simulation state
+	int real_throttle_set;
+	double real_throttle;
+	double operation_timing;
+	double visual_timing;
+} engine;
 
 void engines_initialize();
 void engines_draw_initialize();
 void engines_draw_deinitialize();
 void engines_draw();
+void engines_initialize_highlevel(struct vessel_tag* v);
+void engines_deinitialize_highlevel(struct vessel_tag* v);
 void engines_simulate(float dt);
 void engines_simulate_xplane(float dt);
 void engines_addforce(struct vessel_tag* v, double dt, double x, double y, double z, double vert, double horiz, double force);
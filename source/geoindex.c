@@ -0,0 +1,462 @@
+//==============================================================================
+// Spatial index for proximity queries (vessels, launch pads)
+//------------------------------------------------------------------------------
+// Objects are kept in a uniform grid over planet-fixed cartesian coordinates,
+// cells of the grid are stored in a hash table. Distances are straight-line
+// distances in 3D, so there are no problems with longitude wrap or poles, and
+// for points on the surface nearest by distance is also nearest along the
+// surface. Nearest object is searched in rings of cells around the query
+// point; once a ring would contain more cells than the index has, all cells
+// are scanned instead.
+//==============================================================================
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "x-space.h"
+#include "vessel.h"
+#include "highlevel.h"
+#include "geoindex.h"
+
+//Index of all existing vessels
+geoindex* geoindex_vessels = 0;
+
+//Limit for cell coordinates (keeps far away objects from overflowing)
+#define GEOINDEX_MAX_CELL 1000000000.0
+//Maximum number of vessels returned to Lua by a single query
+#define GEOINDEX_MAX_RESULTS 1024
+
+
+//==============================================================================
+// Create/destroy index
+//==============================================================================
+geoindex* geoindex_create(double cell_size)
+{
+	geoindex* index = (geoindex*)malloc(sizeof(geoindex));
+	memset(index,0,sizeof(geoindex));
+	index->cell_size = cell_size;
+	return index;
+}
+
+void geoindex_destroy(geoindex* index)
+{
+	if (!index) return;
+	free(index->entries);
+	free(index->cells);
+	free(index);
+}
+
+
+//==============================================================================
+// Cell hash table
+//==============================================================================
+static int geoindex_cell_coordinate(geoindex* index, double x)
+{
+	double c = floor(x/index->cell_size);
+	if (c > GEOINDEX_MAX_CELL) c = GEOINDEX_MAX_CELL;
+	if (c < -GEOINDEX_MAX_CELL) c = -GEOINDEX_MAX_CELL;
+	return (int)c;
+}
+
+static unsigned int geoindex_hash(int ix, int iy, int iz)
+{
+	return ((unsigned int)ix*73856093u) ^ ((unsigned int)iy*19349663u) ^ ((unsigned int)iz*83492791u);
+}
+
+//Find cell slot, or -1 if there is no such cell
+static int geoindex_find_cell(geoindex* index, int ix, int iy, int iz)
+{
+	unsigned int mask = index->cell_alloc-1;
+	unsigned int slot;
+
+	if (!index->cell_alloc) return -1;
+	slot = geoindex_hash(ix,iy,iz) & mask;
+	while (index->cells[slot].used) {
+		geoindex_cell* cell = &index->cells[slot];
+		if ((cell->ix == ix) && (cell->iy == iy) && (cell->iz == iz)) return slot;
+		slot = (slot+1) & mask;
+	}
+	return -1;
+}
+
+//Rebuild hash table, dropping empty cells
+static void geoindex_rehash(geoindex* index, int min_cells)
+{
+	geoindex_cell* old_cells = index->cells;
+	int old_alloc = index->cell_alloc;
+	int i,size = 64;
+
+	while (size < 4*min_cells) size *= 2;
+	index->cells = (geoindex_cell*)malloc(sizeof(geoindex_cell)*size);
+	memset(index->cells,0,sizeof(geoindex_cell)*size);
+	index->cell_alloc = size;
+	index->cell_used = 0;
+
+	for (i = 0; i < old_alloc; i++) {
+		geoindex_cell* cell = &old_cells[i];
+		unsigned int slot;
+		int id;
+
+		if ((!cell->used) || (cell->head < 0)) continue;
+		slot = geoindex_hash(cell->ix,cell->iy,cell->iz) & (size-1);
+		while (index->cells[slot].used) slot = (slot+1) & (size-1);
+		index->cells[slot] = *cell;
+		index->cell_used++;
+		for (id = cell->head; id >= 0; id = index->entries[id].next) index->entries[id].cell = slot;
+	}
+	free(old_cells);
+}
+
+//Find cell slot, adding new cell if required
+static int geoindex_add_cell(geoindex* index, int ix, int iy, int iz)
+{
+	int slot = geoindex_find_cell(index,ix,iy,iz);
+	if (slot >= 0) return slot;
+
+	//Keep table at most half full
+	if (2*(index->cell_used+1) > index->cell_alloc) {
+		int i,nonempty = 0;
+		for (i = 0; i < index->cell_alloc; i++) {
+			if (index->cells[i].used && (index->cells[i].head >= 0)) nonempty++;
+		}
+		geoindex_rehash(index,nonempty+1);
+	}
+
+	slot = geoindex_hash(ix,iy,iz) & (index->cell_alloc-1);
+	while (index->cells[slot].used) slot = (slot+1) & (index->cell_alloc-1);
+	index->cells[slot].ix = ix;
+	index->cells[slot].iy = iy;
+	index->cells[slot].iz = iz;
+	index->cells[slot].head = -1;
+	index->cells[slot].used = 1;
+	index->cell_used++;
+	return slot;
+}
+
+
+//==============================================================================
+// Add object to the index or move it
+//==============================================================================
+static void geoindex_unlink(geoindex* index, int id)
+{
+	geoindex_entry* entry = &index->entries[id];
+	if (entry->prev >= 0) {
+		index->entries[entry->prev].next = entry->next;
+	} else {
+		index->cells[entry->cell].head = entry->next;
+	}
+	if (entry->next >= 0) index->entries[entry->next].prev = entry->prev;
+	entry->cell = -1;
+}
+
+void geoindex_update(geoindex* index, int id, double x, double y, double z)
+{
+	geoindex_entry* entry;
+	int ix,iy,iz,slot;
+
+	if (id < 0) return;
+	if (id >= index->entry_alloc) {
+		int i,size = index->entry_alloc ? index->entry_alloc : 64;
+		while (size <= id) size *= 2;
+		index->entries = (geoindex_entry*)realloc(index->entries,sizeof(geoindex_entry)*size);
+		for (i = index->entry_alloc; i < size; i++) index->entries[i].cell = -1;
+		index->entry_alloc = size;
+	}
+
+	entry = &index->entries[id];
+	entry->x = x;
+	entry->y = y;
+	entry->z = z;
+	ix = geoindex_cell_coordinate(index,x);
+	iy = geoindex_cell_coordinate(index,y);
+	iz = geoindex_cell_coordinate(index,z);
+
+	//Still in the same cell
+	if (entry->cell >= 0) {
+		geoindex_cell* cell = &index->cells[entry->cell];
+		if ((cell->ix == ix) && (cell->iy == iy) && (cell->iz == iz)) return;
+		geoindex_unlink(index,id);
+		index->moves++;
+	} else {
+		index->count++;
+	}
+
+	//Insert into new cell (slot is looked up after possible rehash)
+	slot = geoindex_add_cell(index,ix,iy,iz);
+	entry = &index->entries[id];
+	entry->cell = slot;
+	entry->prev = -1;
+	entry->next = index->cells[slot].head;
+	if (entry->next >= 0) index->entries[entry->next].prev = id;
+	index->cells[slot].head = id;
+}
+
+void geoindex_remove(geoindex* index, int id)
+{
+	if ((id < 0) || (id >= index->entry_alloc) || (index->entries[id].cell < 0)) return;
+	geoindex_unlink(index,id);
+	index->count--;
+}
+
+
+//==============================================================================
+// Queries
+//==============================================================================
+typedef struct geoindex_query_tag {
+	double x,y,z;
+	geoindex_filter filter;
+	void* data;
+
+	//Nearest object
+	int nearest;
+	double nearest_d2;
+
+	//Objects within radius
+	double radius2;
+	int* ids;
+	int max_ids;
+	int found;
+} geoindex_query;
+
+static void geoindex_query_nearest(geoindex* index, geoindex_query* query, int id)
+{
+	geoindex_entry* entry = &index->entries[id];
+	double dx = entry->x - query->x;
+	double dy = entry->y - query->y;
+	double dz = entry->z - query->z;
+	double d2 = dx*dx+dy*dy+dz*dz;
+	if ((d2 < query->nearest_d2) && ((!query->filter) || query->filter(id,query->data))) {
+		query->nearest = id;
+		query->nearest_d2 = d2;
+	}
+}
+
+static void geoindex_query_within(geoindex* index, geoindex_query* query, int id)
+{
+	geoindex_entry* entry = &index->entries[id];
+	double dx = entry->x - query->x;
+	double dy = entry->y - query->y;
+	double dz = entry->z - query->z;
+	if ((dx*dx+dy*dy+dz*dz <= query->radius2) && (query->found < query->max_ids) &&
+		((!query->filter) || query->filter(id,query->data))) {
+		query->ids[query->found++] = id;
+	}
+}
+
+//Visit all objects in the cell
+static void geoindex_query_cell(geoindex* index, geoindex_query* query, int slot,
+								void (*visit)(geoindex*,geoindex_query*,int))
+{
+	int id;
+	for (id = index->cells[slot].head; id >= 0; id = index->entries[id].next) visit(index,query,id);
+}
+
+//Visit all objects in the index
+static void geoindex_query_all(geoindex* index, geoindex_query* query,
+							   void (*visit)(geoindex*,geoindex_query*,int))
+{
+	int id;
+	for (id = 0; id < index->entry_alloc; id++) {
+		if (index->entries[id].cell >= 0) visit(index,query,id);
+	}
+}
+
+
+//==============================================================================
+// Find nearest object (max_distance <= 0 means no limit). Returns object id or
+// -1, distance to the object is written into distance (if not null)
+//==============================================================================
+int geoindex_nearest(geoindex* index, double x, double y, double z, double max_distance,
+					 geoindex_filter filter, void* data, double* distance)
+{
+	geoindex_query query;
+	int cx,cy,cz,r;
+
+	query.x = x;
+	query.y = y;
+	query.z = z;
+	query.filter = filter;
+	query.data = data;
+	query.nearest = -1;
+	query.nearest_d2 = (max_distance > 0.0) ? max_distance*max_distance : 1e300;
+	if (!index->count) return -1;
+
+	cx = geoindex_cell_coordinate(index,x);
+	cy = geoindex_cell_coordinate(index,y);
+	cz = geoindex_cell_coordinate(index,z);
+	for (r = 0; ; r++) {
+		int dx,dy,dz;
+
+		//Searched cube is too large compared to the whole index (cell lookup
+		//is several times slower than checking an object)
+		if (pow(2*r+1,3) > index->count/4) {
+			geoindex_query_all(index,&query,geoindex_query_nearest);
+			break;
+		}
+
+		//Cells at Chebyshev distance r from the query cell
+		for (dx = -r; dx <= r; dx++) {
+			for (dy = -r; dy <= r; dy++) {
+				int step = ((dx == -r) || (dx == r) || (dy == -r) || (dy == r)) ? 1 : 2*r;
+				for (dz = -r; dz <= r; dz += step) {
+					int slot = geoindex_find_cell(index,cx+dx,cy+dy,cz+dz);
+					if (slot >= 0) geoindex_query_cell(index,&query,slot,geoindex_query_nearest);
+				}
+			}
+		}
+
+		//All objects outside of visited cells are farther than r cells
+		if (query.nearest_d2 <= pow(r*index->cell_size,2)) break;
+		if ((max_distance > 0.0) && (r*index->cell_size > max_distance)) break;
+	}
+
+	if (distance) *distance = (query.nearest >= 0) ? sqrt(query.nearest_d2) : 0.0;
+	return query.nearest;
+}
+
+
+//==============================================================================
+// Find objects within radius, returns number of objects written into ids
+//==============================================================================
+int geoindex_within(geoindex* index, double x, double y, double z, double radius,
+					geoindex_filter filter, void* data, int* ids, int max_ids)
+{
+	geoindex_query query;
+	double cube_cells;
+	int cx,cy,cz,r;
+
+	query.x = x;
+	query.y = y;
+	query.z = z;
+	query.filter = filter;
+	query.data = data;
+	query.radius2 = radius*radius;
+	query.ids = ids;
+	query.max_ids = max_ids;
+	query.found = 0;
+	if ((!index->count) || (radius < 0.0)) return 0;
+
+	r = (int)ceil(radius/index->cell_size);
+	cube_cells = pow(2*r+1,3);
+	if (cube_cells > index->count/4) {
+		geoindex_query_all(index,&query,geoindex_query_within);
+	} else {
+		int dx,dy,dz;
+		cx = geoindex_cell_coordinate(index,x);
+		cy = geoindex_cell_coordinate(index,y);
+		cz = geoindex_cell_coordinate(index,z);
+		for (dx = -r; dx <= r; dx++) {
+			for (dy = -r; dy <= r; dy++) {
+				for (dz = -r; dz <= r; dz++) {
+					int slot = geoindex_find_cell(index,cx+dx,cy+dy,cz+dz);
+					if (slot >= 0) geoindex_query_cell(index,&query,slot,geoindex_query_within);
+				}
+			}
+		}
+	}
+	return query.found;
+}
+
+
+//==============================================================================
+// Planet-fixed position by latitude and longitude (same convention as
+// non-inertial coordinates of vessels)
+//==============================================================================
+void geoindex_latlon(double radius, double latitude, double longitude, double* x, double* y, double* z)
+{
+	*x = radius*cos(RAD(latitude))*cos(RAD(longitude));
+	*y = radius*cos(RAD(latitude))*sin(RAD(longitude));
+	*z = radius*sin(RAD(latitude));
+}
+
+
+//==============================================================================
+// Update positions of all vessels (called once per tick after coordinates are
+// synchronized)
+//==============================================================================
+void geoindex_update_vessels()
+{
+	int i;
+
+	for (i = 0; i < vessels_slots.active_count; i++) {
+		vessel* v = &vessels[vessels_slots.active[i]];
+		if (v->exists) geoindex_update(geoindex_vessels,v->index,v->noninertial.x,v->noninertial.y,v->noninertial.z);
+	}
+
+	//Remove vessels which no longer exist
+	for (i = 0; i < geoindex_vessels->entry_alloc; i++) {
+		if ((geoindex_vessels->entries[i].cell >= 0) && ((i >= vessel_count) || (!vessels[i].exists))) {
+			geoindex_remove(geoindex_vessels,i);
+		}
+	}
+}
+
+
+//==============================================================================
+// High-level interface
+//==============================================================================
+static int geoindex_other_vessel(int id, void* data)
+{
+	return (id != *((int*)data)) && vessels[id].exists;
+}
+
+int geoindex_highlevel_getnearest(lua_State* L)
+{
+	int idx = luaL_checkint(L,1);
+	double max_distance = luaL_optnumber(L,2,0.0);
+	double distance;
+	int nearest = -1;
+
+	if ((idx >= 0) && (idx < vessel_count)) {
+		vessel* v = &vessels[idx];
+		nearest = geoindex_nearest(geoindex_vessels,v->noninertial.x,v->noninertial.y,v->noninertial.z,
+			max_distance,geoindex_other_vessel,&idx,&distance);
+	}
+
+	if (nearest >= 0) {
+		lua_pushnumber(L,nearest);
+		lua_pushnumber(L,distance);
+		return 2;
+	}
+	lua_pushnil(L);
+	return 1;
+}
+
+int geoindex_highlevel_getwithinradius(lua_State* L)
+{
+	int idx = luaL_checkint(L,1);
+	double radius = luaL_checknumber(L,2);
+	int ids[GEOINDEX_MAX_RESULTS];
+	int i,count = 0;
+
+	if ((idx >= 0) && (idx < vessel_count)) {
+		vessel* v = &vessels[idx];
+		count = geoindex_within(geoindex_vessels,v->noninertial.x,v->noninertial.y,v->noninertial.z,
+			radius,geoindex_other_vessel,&idx,ids,GEOINDEX_MAX_RESULTS);
+	}
+
+	lua_createtable(L,count,0);
+	for (i = 0; i < count; i++) {
+		lua_pushnumber(L,ids[i]);
+		lua_rawseti(L,-2,i+1);
+	}
+	return 1;
+}
+
+
+//==============================================================================
+// Initialize vessel index and register highlevel interface
+//==============================================================================
+void geoindex_initialize()
+{
+	geoindex_vessels = geoindex_create(GEOINDEX_VESSEL_CELL_SIZE);
+
+	highlevel_addfunction("VesselAPI","GetNearest",geoindex_highlevel_getnearest);
+	highlevel_addfunction("VesselAPI","GetWithinRadius",geoindex_highlevel_getwithinradius);
+}
+
+void geoindex_deinitialize()
+{
+	geoindex_destroy(geoindex_vessels);
+	geoindex_vessels = 0;
+}
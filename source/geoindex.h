@@ -0,0 +1,57 @@
+#ifndef GEOINDEX_H
+#define GEOINDEX_H
+
+//Cell size of the vessel index (m)
+#define GEOINDEX_VESSEL_CELL_SIZE	25000.0
+
+//Object in the index
+typedef struct geoindex_entry_tag {
+	double x,y,z;			//Position (planet-fixed coordinates)
+	int cell;				//Cell the object is in (-1 if object is not in the index)
+	int next,prev;			//Other objects in the same cell
+} geoindex_entry;
+
+//Cell of the grid
+typedef struct geoindex_cell_tag {
+	int ix,iy,iz;			//Cell coordinates
+	int head;				//First object in the cell (-1 if cell is empty)
+	int used;				//Cell slot is taken (cells are never removed until rehash)
+} geoindex_cell;
+
+//Uniform grid over 3D positions with hashed cells. Objects are identified by
+//their index (vessel index, launch pad index) and moved between cells only
+//when they cross cell boundary
+typedef struct geoindex_tag {
+	double cell_size;		//Size of a cell (m)
+	geoindex_entry* entries;
+	int entry_alloc;		//Number of allocated entries
+	int count;				//Number of objects in the index
+	geoindex_cell* cells;
+	int cell_alloc;			//Number of hash slots (power of two)
+	int cell_used;			//Number of used hash slots
+	int moves;				//Number of times objects changed cells
+} geoindex;
+
+//Query filter, returns 0 to skip the object
+typedef int (*geoindex_filter)(int id, void* data);
+
+geoindex* geoindex_create(double cell_size);
+void geoindex_destroy(geoindex* index);
+void geoindex_update(geoindex* index, int id, double x, double y, double z);
+void geoindex_remove(geoindex* index, int id);
+int geoindex_nearest(geoindex* index, double x, double y, double z, double max_distance,
+					 geoindex_filter filter, void* data, double* distance);
+int geoindex_within(geoindex* index, double x, double y, double z, double radius,
+					geoindex_filter filter, void* data, int* ids, int max_ids);
+
+//Position on the planet surface by latitude and longitude (degrees)
+void geoindex_latlon(double radius, double latitude, double longitude, double* x, double* y, double* z);
+
+//Index of all existing vessels (by non-inertial coordinates)
+extern geoindex* geoindex_vessels;
+
+void geoindex_initialize();
+void geoindex_deinitialize();
+void geoindex_update_vessels();
+
+#endif
@@ -160,11 +160,12 @@ void geomagnetic_deinitialize()
 //==============================================================================
 void geomagnetic_update()
 {
-	int i;
-	for (i = 0; i < vessel_count; i++) { //FIXME: can optimize out vessels which don't need magnetic data
+	int i,k;
+	for (k = 0; k < vessels_slots.active_count; k++) { //FIXME: can optimize out vessels which don't need magnetic data
 		WMMtype_CoordSpherical CoordSpherical;
 		WMMtype_CoordGeodetic CoordGeodetic;
 		WMMtype_Date UserDate;
+		i = vessels_slots.active[k];
 	
 		//Set coordinates and time
 		CoordGeodetic.phi = vessels[i].latitude;
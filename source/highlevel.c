@@ -6,6 +6,9 @@
 #include "highlevel.h"
 #include "curtime.h"
 #include "vessel.h"
+#include "profiler.h"
+#include "config.h"
+#include "highlevel_alloc.h"
 
 //X-Plane SDK
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
@@ -38,6 +41,9 @@ void highlevel_bind_functions()
 	highlevel_addfunction(0,"curtime",highlevel_curtime);
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
 	highlevel_addfunction(0,"Dataref",highlevel_dataref);
+	lua_createtable(L,0,1);
+	lua_setglobal(L,"DatarefAPI");
+	highlevel_addfunction("DatarefAPI","Bind",highlevel_dataref_bind);
 #endif
 
 	//lua_pushcfunction(L, highlevel_addbody);
@@ -63,8 +69,12 @@ void highlevel_bind_functions()
 
 void highlevel_initialize()
 {
-	//Create new lua state
+	//Create new lua state (with pooled allocator, LuaJIT uses its own allocator)
+#ifdef USE_LUAJIT
 	L = luaL_newstate();
+#else
+	L = lua_newstate(highlevel_alloc,0);
+#endif
 	lua_atpanic(L,&highlevel_panic);
 
 	//Create table for storing datarefs
@@ -90,6 +100,60 @@ void highlevel_deinitialize()
 {
 	if (L) lua_close(L);
 	L = 0;
+	highlevel_alloc_deinitialize();
+}
+
+
+//==============================================================================
+// Garbage collection (incremental steps from the frame loop)
+//==============================================================================
+static int highlevel_gc_running = 0;	//Cycle was started by frame steps
+static int highlevel_gc_estimate = 0;	//Memory in use after last cycle (KB)
+
+void highlevel_configure_gc()
+{
+	lua_gc(L,LUA_GCSETPAUSE,config.lua_gc_pause);
+	lua_gc(L,LUA_GCSETSTEPMUL,config.lua_gc_stepmul);
+
+	//Frame steps are the only driver of the collector while they have a budget,
+	//so all collection time shows up in the profiler
+	if (config.lua_gc_budget > 0.0) lua_gc(L,LUA_GCSTOP,0);
+	else lua_gc(L,LUA_GCRESTART,0);
+	highlevel_gc_running = 0;
+	highlevel_gc_estimate = lua_gc(L,LUA_GCCOUNT,0);
+}
+
+void highlevel_collect_garbage()
+{
+	double start_time;
+
+	//Only start a new cycle when memory grew past the pause since last cycle
+	//(a step in the paused state starts a cycle, which would run back-to-back)
+	if (!highlevel_gc_running) {
+		int count = lua_gc(L,LUA_GCCOUNT,0);
+		highlevel_gc_running = (config.lua_gc_budget > 0.0) &&
+			((double)count*100.0 >= (double)highlevel_gc_estimate*config.lua_gc_pause);
+	}
+
+	//Run collection steps until cycle is finished or time budget is used up
+	profiler_begin(PROFILER_GC);
+	start_time = profiler_time();
+	if (highlevel_gc_running) do {
+		if (lua_gc(L,LUA_GCSTEP,config.lua_gc_step_size)) {
+			highlevel_memory.gc_cycles++;
+			highlevel_gc_running = 0;
+			highlevel_gc_estimate = lua_gc(L,LUA_GCCOUNT,0);
+			break;
+		}
+	} while (profiler_time() - start_time < config.lua_gc_budget*1e-3);
+	if (config.lua_gc_budget > 0.0) lua_gc(L,LUA_GCSTOP,0); //Steps restart automatic collection
+	profiler_end(PROFILER_GC);
+
+#ifdef USE_LUAJIT
+	//Memory statistics are only available from the collector
+	highlevel_memory.used = 1024*(size_t)lua_gc(L,LUA_GCCOUNT,0) + lua_gc(L,LUA_GCCOUNTB,0);
+	if (highlevel_memory.used > highlevel_memory.peak) highlevel_memory.peak = highlevel_memory.used;
+#endif
 }
 
 
@@ -312,100 +376,192 @@ int highlevel_curtime(lua_State* L)
 
 
 //==============================================================================
-// Read/write dataref from Lua
+// Dataref handles (dataref resolved once, with array index parsed out)
 //==============================================================================
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
-int highlevel_dataref(lua_State* L)
+//Returns handle if value at index is a dataref handle, 0 otherwise
+highlevel_dataref_handle* highlevel_testdataref(lua_State* L, int idx)
 {
-	//Check if need to write
-	int writeDataref = 0;
-	if (lua_isnumber(L,2)) writeDataref = 1;
-
-	//Check if parameter is a function
-	if (lua_isfunction(L,1)) {
-		lua_pushvalue(L,1); //function
-		if (writeDataref) {
-			lua_pushvalue(L,2); //parameter
-			highlevel_call(1,0);
-		} else {
-			highlevel_call(0,1);
-		}
-	} else if (lua_isnumber(L,1)) { //Or just a number
-		if (!writeDataref) {
-			lua_pushvalue(L,1); //Return the number
-		}
-	} else if (lua_isstring(L,1)) { //String (actual dataref to read/write)
-		XPLMDataRef dataref = 0;
-		char datarefName[ARBITRARY_MAX] = { 0 };
-		char fullName[ARBITRARY_MAX] = { 0 };
-		int arrayIndex = -1;
-		char* arrayIndexStart;
-
-		//Fetch full dataref name
-		strncpy(fullName,lua_tostring(L,1),ARBITRARY_MAX-1);
-
-		//Parse out array index
-		arrayIndexStart = strrchr(fullName,'[');
-		if (arrayIndexStart) {
-			strncpy(datarefName,fullName,arrayIndexStart-fullName);
-	//		snscanf(arrayIndexStart+1,ARBITRARY_MAX-1,"%d",&arrayIndex);
-			sscanf(arrayIndexStart+1,"%d",&arrayIndex); //FIXME: KNOWN POSSIBLE SCANNING PROBLEM
-		} else {
-			strncpy(datarefName,fullName,ARBITRARY_MAX-1);
+	void* handle = lua_touserdata(L,idx);
+	if (handle && lua_getmetatable(L,idx)) {
+		luaL_getmetatable(L,"Dataref");
+		if (!lua_rawequal(L,-1,-2)) handle = 0;
+		lua_pop(L,2);
+		return (highlevel_dataref_handle*)handle;
+	}
+	return 0;
+}
+
+//Returns handle for dataref name at index. Handles are cached by name, so
+//every name is parsed and looked up only once
+highlevel_dataref_handle* highlevel_binddataref(lua_State* L, int idx)
+{
+	highlevel_dataref_handle* handle;
+	const char* fullName;
+	const char* arrayIndexStart;
+	size_t length;
+
+	//Check the cache (Lua strings are interned, so this does not copy the name)
+	if (idx < 0) idx = lua_gettop(L)+idx+1;
+	lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_datarefs);
+	lua_pushvalue(L,idx);
+	lua_rawget(L,-2);
+	if (lua_isuserdata(L,-1)) {
+		handle = (highlevel_dataref_handle*)lua_touserdata(L,-1);
+		lua_pop(L,2);
+		return handle;
+	}
+	lua_pop(L,1);
+
+	//Parse out array index
+	fullName = lua_tolstring(L,idx,&length);
+	arrayIndexStart = strrchr(fullName,'[');
+	if (arrayIndexStart) length = arrayIndexStart-fullName;
+
+	//Create new handle
+	handle = (highlevel_dataref_handle*)lua_newuserdata(L,sizeof(highlevel_dataref_handle)+length);
+	luaL_newmetatable(L,"Dataref");
+	lua_setmetatable(L,-2);
+	memcpy(handle->name,fullName,length);
+	handle->name[length] = 0;
+	handle->index = -1;
+	if (arrayIndexStart) sscanf(arrayIndexStart+1,"%d",&handle->index);
+	handle->dataref = XPLMFindDataRef(handle->name);
+
+	//Remember handle
+	lua_pushvalue(L,idx);
+	lua_pushvalue(L,-2);
+	lua_rawset(L,-4);
+	lua_pop(L,2);
+	return handle;
+}
+
+//Read value from dataref handle
+double highlevel_getdataref(highlevel_dataref_handle* handle)
+{
+	if (!handle->dataref) { //Dataref may be registered later by another plugin
+		handle->dataref = XPLMFindDataRef(handle->name);
+		if (!handle->dataref) return 0.0;
+	}
+	if (handle->index >= 0) {
+		float f = 0.0f;
+		XPLMGetDatavf(handle->dataref,&f,handle->index,1);
+		return f;
+	} else {
+		return XPLMGetDataf(handle->dataref);
+	}
+}
+
+//Write value to dataref handle (dataref is created if it does not exist)
+void highlevel_setdataref(highlevel_dataref_handle* handle, double value)
+{
+	if (!handle->dataref) {
+		handle->dataref = XPLMFindDataRef(handle->name);
+		if (!handle->dataref) {
+			double* v = (double*)malloc(sizeof(double));
+			*v = 0.0;
+			handle->dataref = dataref_d(handle->name,v);
 		}
+	}
+	if (handle->index >= 0) {
+		float f = (float)value;
+		XPLMSetDatavf(handle->dataref,&f,handle->index,1);
+	} else {
+		XPLMSetDataf(handle->dataref,(float)value);
+	}
+}
 
-		//Read datarefs global table
-		lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_datarefs);
 
-		//Check if the dataref exists
-		lua_getfield(L,-1,datarefName);
-		if (lua_islightuserdata(L,-1)) {
-			dataref = (XPLMDataRef)lua_touserdata(L,-1);
-			lua_pop(L,1); //Pop userdata field
-		} else {
-			dataref = XPLMFindDataRef(datarefName);
-			lua_pop(L,1); //Pop nil userdata
-
-			//Check if dataref must be created
-			if ((!dataref) && (writeDataref)) {
-				double* v = (double*)malloc(sizeof(double));
-				*v = 0.0;
-				dataref = dataref_d(datarefName,v);
+//==============================================================================
+// Read/write value which may be a number, function, dataref name or handle
+//==============================================================================
+double highlevel_readvalue(lua_State* L, int idx)
+{
+	highlevel_dataref_handle* handle;
+	double value = 0.0;
+
+	switch (lua_type(L,idx)) {
+		case LUA_TNUMBER:
+			return lua_tonumber(L,idx);
+		case LUA_TFUNCTION:
+			lua_pushvalue(L,idx);
+			if (!highlevel_call(0,1)) {
+				value = lua_tonumber(L,-1);
+				lua_pop(L,1);
 			}
+			return value;
+		case LUA_TSTRING:
+			return highlevel_getdataref(highlevel_binddataref(L,idx));
+		case LUA_TUSERDATA:
+			handle = highlevel_testdataref(L,idx);
+			if (handle) return highlevel_getdataref(handle);
+		default:
+			return 0.0;
+	}
+}
 
-			//Remember pointer to dataref
-			lua_pushlightuserdata(L,(void*)dataref);
-			lua_setfield(L,-2,fullName);
-		}
+void highlevel_writevalue(lua_State* L, int idx, double value)
+{
+	highlevel_dataref_handle* handle;
 
-		//Pop datarefs table
+	switch (lua_type(L,idx)) {
+		case LUA_TFUNCTION:
+			lua_pushvalue(L,idx);
+			lua_pushnumber(L,value);
+			highlevel_call(1,0);
+			break;
+		case LUA_TSTRING:
+			highlevel_setdataref(highlevel_binddataref(L,idx),value);
+			break;
+		case LUA_TUSERDATA:
+			handle = highlevel_testdataref(L,idx);
+			if (handle) highlevel_setdataref(handle,value);
+			break;
+		default:
+			break;
+	}
+}
+
+//Replace dataref name in table field with a handle
+void highlevel_bindfield(lua_State* L, int idx, char* field)
+{
+	if (idx < 0) idx = lua_gettop(L)+idx+1;
+	lua_getfield(L,idx,field);
+	if (lua_type(L,-1) == LUA_TSTRING) {
+		highlevel_binddataref(L,-1);
+		lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_datarefs);
+		lua_pushvalue(L,-2);
+		lua_rawget(L,-2);
+		lua_setfield(L,idx,field);
 		lua_pop(L,1);
+	}
+	lua_pop(L,1);
+}
 
-		//Write or read from dataref
-		if (dataref) {
-			if (writeDataref) {
-				if (arrayIndex >= 0) {
-					float f = (float)lua_tonumber(L,2);
-					XPLMSetDatavf(dataref,&f,arrayIndex,1);
-				} else {
-					XPLMSetDataf(dataref,(float)lua_tonumber(L,2));
-				}
-			} else {
-				if (arrayIndex >= 0) {
-					float f;
-					XPLMGetDatavf(dataref,&f,arrayIndex,1);
-					lua_pushnumber(L,f);
-				} else {
-					lua_pushnumber(L,XPLMGetDataf(dataref));
-				}
-			}
-		} else {
-			if (!writeDataref) lua_pushnumber(L,0);
-		}
+
+//==============================================================================
+// Read/write dataref from Lua
+//==============================================================================
+int highlevel_dataref(lua_State* L)
+{
+	if (lua_isnumber(L,2)) {
+		highlevel_writevalue(L,1,lua_tonumber(L,2));
+		return 0;
+	} else {
+		lua_pushnumber(L,highlevel_readvalue(L,1));
+		return 1;
 	}
+}
 
-	//Return if there's any result on stack
-	return !writeDataref;
+//Returns handle to a dataref: DatarefAPI.Bind(name)
+int highlevel_dataref_bind(lua_State* L)
+{
+	luaL_checkstring(L,1);
+	highlevel_binddataref(L,1);
+	lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_datarefs);
+	lua_pushvalue(L,1);
+	lua_rawget(L,-2);
+	return 1;
 }
 #endif
 
@@ -415,7 +571,11 @@ int highlevel_dataref(lua_State* L)
 //==============================================================================
 int highlevel_call(int nargs, int nresults)
 {
-	if (lua_pcall(L,nargs,nresults,0)) {
+	int error;
+	profiler_begin(PROFILER_CALLBACKS);
+	error = lua_pcall(L,nargs,nresults,0);
+	profiler_end(PROFILER_CALLBACKS);
+	if (error) {
 		const char* error_message = lua_tostring(L,-1);
 		log_write("X-Space: Error in lua script: %s\n",lua_tostring(L,-1));
 		lua_pop(L,1);
@@ -15,6 +15,8 @@ extern int highlevel_table_vessels_data;
 void highlevel_initialize();
 void highlevel_deinitialize();
 void highlevel_load_aircraft(struct vessel_tag* v, char* acfpath, char* acfname);
+void highlevel_configure_gc();
+void highlevel_collect_garbage();
 
 int highlevel_panic(lua_State* L);
 int highlevel_print(lua_State* L);
@@ -22,6 +24,25 @@ int highlevel_curtime(lua_State* L);
 int highlevel_dataref(lua_State* L);
 int highlevel_lua_load(lua_State* L);
 
+#if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
+//Resolved dataref (Lua userdata, cached in highlevel_table_datarefs by full name)
+typedef struct highlevel_dataref_handle_tag {
+	void* dataref;			//XPLMDataRef, must be first (see highlevel_getptr)
+	int index;				//Array index, or -1 for scalar dataref
+	char name[1];			//Dataref name without array index
+} highlevel_dataref_handle;
+
+highlevel_dataref_handle* highlevel_testdataref(lua_State* L, int idx);
+highlevel_dataref_handle* highlevel_binddataref(lua_State* L, int idx);
+double highlevel_getdataref(highlevel_dataref_handle* handle);
+void highlevel_setdataref(highlevel_dataref_handle* handle, double value);
+
+int highlevel_dataref_bind(lua_State* L);
+double highlevel_readvalue(lua_State* L, int idx);
+void highlevel_writevalue(lua_State* L, int idx, double value);
+void highlevel_bindfield(lua_State* L, int idx, char* field);
+#endif
+
 void highlevel_addfunction(char* lib, char* name, void* ptr);
 int highlevel_call(int nargs, int nresults);
 int highlevel_load(char* filename);
@@ -0,0 +1,143 @@
+//==============================================================================
+// Lua memory allocator (size-class pools for small blocks)
+//==============================================================================
+#include <stdlib.h>
+#include <string.h>
+#include "highlevel_alloc.h"
+
+//Free block in a pool
+typedef struct highlevel_alloc_block {
+	struct highlevel_alloc_block* next;
+} highlevel_alloc_block;
+
+//Chunk of memory from which pooled blocks are cut (header takes up one
+//granule, so blocks stay aligned for any Lua value)
+typedef struct highlevel_alloc_chunk {
+	struct highlevel_alloc_chunk* next;
+} highlevel_alloc_chunk;
+
+//Free lists for every size class
+highlevel_alloc_block* highlevel_alloc_free[HIGHLEVEL_ALLOC_CLASSES];
+//All chunks (released when Lua state is closed)
+highlevel_alloc_chunk* highlevel_alloc_chunks = 0;
+
+//Memory statistics
+highlevel_alloc_stats highlevel_memory = { 0 };
+
+
+//==============================================================================
+// Size class of the block (-1 if block is not pooled)
+//==============================================================================
+int highlevel_alloc_class(size_t size)
+{
+	if ((size == 0) || (size > HIGHLEVEL_ALLOC_GRANULARITY*HIGHLEVEL_ALLOC_CLASSES)) return -1;
+	return (int)((size-1)/HIGHLEVEL_ALLOC_GRANULARITY);
+}
+
+
+//==============================================================================
+// Get block from pool (cuts a new chunk into blocks when pool is empty)
+//==============================================================================
+void* highlevel_alloc_get(int size_class)
+{
+	highlevel_alloc_block* block = highlevel_alloc_free[size_class];
+	if (!block) {
+		size_t block_size = (size_class+1)*HIGHLEVEL_ALLOC_GRANULARITY;
+		size_t count = (HIGHLEVEL_ALLOC_CHUNK_SIZE - HIGHLEVEL_ALLOC_GRANULARITY)/block_size;
+		char* data;
+		size_t i;
+
+		highlevel_alloc_chunk* chunk = (highlevel_alloc_chunk*)malloc(HIGHLEVEL_ALLOC_CHUNK_SIZE);
+		if (!chunk) return 0;
+		chunk->next = highlevel_alloc_chunks;
+		highlevel_alloc_chunks = chunk;
+		highlevel_memory.pooled += HIGHLEVEL_ALLOC_CHUNK_SIZE;
+
+		//Link all blocks into free list
+		data = (char*)chunk + HIGHLEVEL_ALLOC_GRANULARITY;
+		for (i = 0; i < count; i++) {
+			highlevel_alloc_block* b = (highlevel_alloc_block*)(data + i*block_size);
+			b->next = (i+1 < count) ? (highlevel_alloc_block*)(data + (i+1)*block_size) : 0;
+		}
+		block = (highlevel_alloc_block*)data;
+	}
+	highlevel_alloc_free[size_class] = block->next;
+	return block;
+}
+
+void highlevel_alloc_put(int size_class, void* ptr)
+{
+	highlevel_alloc_block* block = (highlevel_alloc_block*)ptr;
+	block->next = highlevel_alloc_free[size_class];
+	highlevel_alloc_free[size_class] = block;
+}
+
+
+//==============================================================================
+// Lua allocation function (see lua_Alloc)
+//==============================================================================
+void* highlevel_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	int old_class = ptr ? highlevel_alloc_class(osize) : -1;
+	int new_class = highlevel_alloc_class(nsize);
+	void* new_ptr;
+
+	//Free block
+	if (nsize == 0) {
+		if (ptr) {
+			if (old_class >= 0) highlevel_alloc_put(old_class,ptr);
+			else free(ptr);
+			highlevel_memory.used -= osize;
+		}
+		return 0;
+	}
+
+	//Block stays in the same place
+	if (ptr && (old_class == new_class)) {
+		if (old_class < 0) {
+			new_ptr = realloc(ptr,nsize);
+			if (!new_ptr) return 0;
+		} else {
+			new_ptr = ptr;
+		}
+		highlevel_memory.used += nsize - osize;
+		if (highlevel_memory.used > highlevel_memory.peak) highlevel_memory.peak = highlevel_memory.used;
+		return new_ptr;
+	}
+
+	//Allocate new block
+	highlevel_memory.allocations++;
+	if (new_class >= 0) {
+		new_ptr = highlevel_alloc_get(new_class);
+		highlevel_memory.pool_allocations++;
+	} else {
+		new_ptr = malloc(nsize);
+	}
+	if (!new_ptr) return 0;
+
+	//Move data from old block
+	if (ptr) {
+		memcpy(new_ptr,ptr,(osize < nsize) ? osize : nsize);
+		if (old_class >= 0) highlevel_alloc_put(old_class,ptr);
+		else free(ptr);
+		highlevel_memory.used -= osize;
+	}
+	highlevel_memory.used += nsize;
+	if (highlevel_memory.used > highlevel_memory.peak) highlevel_memory.peak = highlevel_memory.used;
+	return new_ptr;
+}
+
+
+//==============================================================================
+// Release all pools (must be called after Lua state is closed)
+//==============================================================================
+void highlevel_alloc_deinitialize()
+{
+	while (highlevel_alloc_chunks) {
+		highlevel_alloc_chunk* next = highlevel_alloc_chunks->next;
+		free(highlevel_alloc_chunks);
+		highlevel_alloc_chunks = next;
+	}
+	memset(highlevel_alloc_free,0,sizeof(highlevel_alloc_free));
+	memset(&highlevel_memory,0,sizeof(highlevel_memory));
+}
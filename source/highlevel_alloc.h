@@ -0,0 +1,28 @@
+#ifndef HIGHLEVEL_ALLOC_H
+#define HIGHLEVEL_ALLOC_H
+
+#include <stddef.h>
+
+//Small blocks are allocated from pools in size classes of this granularity
+#define HIGHLEVEL_ALLOC_GRANULARITY		16
+//Number of size classes (blocks up to 256 bytes are pooled)
+#define HIGHLEVEL_ALLOC_CLASSES			16
+//Size of memory chunk from which pooled blocks are cut
+#define HIGHLEVEL_ALLOC_CHUNK_SIZE		65536
+
+//Lua memory statistics
+typedef struct highlevel_alloc_stats {
+	size_t used;				//Bytes currently allocated by Lua
+	size_t peak;				//Peak number of allocated bytes
+	size_t pooled;				//Bytes reserved for pools (in chunks)
+	double allocations;			//Total number of allocations
+	double pool_allocations;	//Allocations served from pools
+	double gc_cycles;			//Completed garbage collection cycles (by frame steps)
+} highlevel_alloc_stats;
+
+extern highlevel_alloc_stats highlevel_memory;
+
+void* highlevel_alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+void highlevel_alloc_deinitialize();
+
+#endif
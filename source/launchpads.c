@@ -13,6 +13,7 @@
 #include "dataref.h"
 #include "vessel.h"
 #include "highlevel.h"
+#include "geoindex.h"
 
 //X-Plane SDK
 #include <XPLMDisplay.h>
@@ -38,6 +39,11 @@ int* launchpads_drawinfo_count;
 int launchpads_count;
 int launchpads_model_count;
 
+//Spatial index of pads (positions on a sphere of fixed radius, only direction matters)
+#define LAUNCHPADS_INDEX_RADIUS		6378145.0
+#define LAUNCHPADS_INDEX_CELL_SIZE	50000.0
+geoindex* launchpads_index = 0;
+
 //Variables for datarefs
 double launchpads_release;	//Should pad be released
 double launchpads_locked;	//Dataref indicating whether pad is locked
@@ -65,11 +71,21 @@ double launchpads_read_param_d(int idx, int paramidx)
 	}
 }
 
+//==============================================================================
+// Update position of the pad in the spatial index
+//==============================================================================
+void launchpads_update_index(launch_pad* pad)
+{
+	double x,y,z;
+	geoindex_latlon(LAUNCHPADS_INDEX_RADIUS,pad->latitude,pad->longitude,&x,&y,&z);
+	geoindex_update(launchpads_index,pad->index,x,y,z);
+}
+
 void launchpads_write_param_d(int idx, int paramidx, double val)
 {
 	switch (paramidx) {
-		case  0: launchpads[idx].latitude = (float)val; break;
-		case  1: launchpads[idx].longitude = (float)val; break;
+		case  0: launchpads[idx].latitude = (float)val; launchpads_update_index(&launchpads[idx]); break;
+		case  1: launchpads[idx].longitude = (float)val; launchpads_update_index(&launchpads[idx]); break;
 		case  2: launchpads[idx].elevation = (float)val; break;
 		case  3: launchpads[idx].heading = (float)val; break;
 		case  4: launchpads[idx].planet = (int)val; break;
@@ -263,6 +279,12 @@ void launchpads_initialize()
 	}
 	if (f) fclose(f);
 
+	//Build spatial index
+	launchpads_index = geoindex_create(LAUNCHPADS_INDEX_CELL_SIZE);
+	for (pad_index = 0; pad_index < launchpads_count; pad_index++) {
+		launchpads_update_index(&launchpads[pad_index]);
+	}
+
 	//Create terrain probe
 	launchpads_probe = XPLMCreateProbe(xplm_ProbeY);
 
@@ -341,7 +363,7 @@ void launchpads_draw()
 
 void launchpads_simulate(float dt)
 {
-	int i;
+	int i,k;
 
 	//Release launch pad for local vessel if commanded
 	if (launchpads_release >= 1.0) {
@@ -349,7 +371,8 @@ void launchpads_simulate(float dt)
 	}
 
 	//Apply launch pad physics to all vessels which need it
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].attached == VESSEL_MOUNT_LAUNCHPAD) {
 			launch_pad* pad;
 			quaternion q,p;
@@ -419,19 +442,23 @@ void launchpads_set(struct vessel_tag* v, launch_pad* pad)
 	}
 }
 
+//==============================================================================
+// Find nearest pad on current planet (by distance along the surface)
+//==============================================================================
+static int launchpads_on_current_planet(int id, void* data)
+{
+	return launchpads[id].planet == current_planet.index;
+}
+
 launch_pad* launchpads_get_nearest(struct vessel_tag* v) 
 {
-	int i;
-	launch_pad* pad = 0;
-	double distance = 1e99;
-	for (i = 0; i < launchpads_count; i++) {
-		double d = pow(launchpads[i].latitude-v->latitude,2)+pow(launchpads[i].longitude-v->longitude,2);
-		if ((d < distance) && (launchpads[i].planet == current_planet.index)) {
-			distance = d;
-			pad = &launchpads[i];
-		}
-	}
-	return pad;
+	double x,y,z;
+	int nearest;
+
+	if (!launchpads_index) return 0;
+	geoindex_latlon(LAUNCHPADS_INDEX_RADIUS,v->latitude,v->longitude,&x,&y,&z);
+	nearest = geoindex_nearest(launchpads_index,x,y,z,0.0,launchpads_on_current_planet,0,0);
+	return (nearest >= 0) ? &launchpads[nearest] : 0;
 }
 
 
@@ -3,27 +3,322 @@
 #include "x-space.h"
 #include "network.h"
 #include "highlevel.h"
+#include "curtime.h"
+
+//Pool of message buffers
+network_pool network_message_pool = { 0 };
+//Lock for ENet calls (hosts serviced by network thread)
+lockID network_lock = BAD_ID;
+//Clock for networking timeouts (benchmark replaces it with simulated time)
+double (*network_time)() = curtime;
+
 
 //==============================================================================
-// API for working with ENet
+// Message buffer pool
 //==============================================================================
-int network_highlevel_newmessage(lua_State* L)
+static void network_pool_count_request(int allocated)
+{
+	double time = curtime();
+	if (time - network_message_pool.stats.window_start >= 1.0) {
+		double dt = time - network_message_pool.stats.window_start;
+		if (dt < 2.0) {
+			network_message_pool.stats.allocations_per_second = network_message_pool.stats.window_allocations/dt;
+			network_message_pool.stats.requests_per_second = network_message_pool.stats.window_requests/dt;
+		} else {
+			network_message_pool.stats.allocations_per_second = 0.0;
+			network_message_pool.stats.requests_per_second = 0.0;
+		}
+		network_message_pool.stats.window_start = time;
+		network_message_pool.stats.window_allocations = 0;
+		network_message_pool.stats.window_requests = 0;
+	}
+	network_message_pool.stats.window_requests++;
+	if (allocated) network_message_pool.stats.window_allocations++;
+}
+
+//Get buffer with at least given size
+static network_buffer* network_pool_get(int size)
+{
+	network_buffer* buffer;
+	int size_class = 0;
+	int class_size = NETWORK_POOL_MIN_SIZE;
+	while ((class_size < size) && (size_class < NETWORK_POOL_CLASSES)) {
+		class_size *= 4;
+		size_class++;
+	}
+
+	//Too large for pool
+	if (size_class == NETWORK_POOL_CLASSES) {
+		size_class = -1;
+		class_size = size;
+	}
+
+	//Reuse free buffer
+	lock_enter(network_message_pool.lock);
+	if ((size_class >= 0) && (network_message_pool.buffers[size_class])) {
+		buffer = network_message_pool.buffers[size_class];
+		network_message_pool.buffers[size_class] = buffer->next;
+		network_message_pool.buffer_count[size_class]--;
+		network_message_pool.stats.reuses++;
+		network_message_pool.stats.bytes_pooled -= buffer->size;
+		network_pool_count_request(0);
+		lock_leave(network_message_pool.lock);
+		return buffer;
+	}
+
+	//Allocate new buffer
+	buffer = (network_buffer*)malloc(sizeof(network_buffer)+class_size);
+	if (buffer) {
+		buffer->next = 0;
+		buffer->size_class = size_class;
+		buffer->size = class_size;
+		network_message_pool.stats.allocations++;
+		network_message_pool.stats.bytes_allocated += class_size;
+		network_pool_count_request(1);
+	}
+	lock_leave(network_message_pool.lock);
+	return buffer;
+}
+
+//Return buffer to the pool
+static void network_pool_release(network_buffer* buffer)
+{
+	lock_enter(network_message_pool.lock);
+	network_message_pool.stats.releases++;
+	if ((buffer->size_class < 0) ||
+		(network_message_pool.buffer_count[buffer->size_class] >= NETWORK_POOL_MAX_FREE)) {
+		network_message_pool.stats.bytes_allocated -= buffer->size;
+		lock_leave(network_message_pool.lock);
+		free(buffer);
+		return;
+	}
+
+	buffer->next = network_message_pool.buffers[buffer->size_class];
+	network_message_pool.buffers[buffer->size_class] = buffer;
+	network_message_pool.buffer_count[buffer->size_class]++;
+	network_message_pool.stats.bytes_pooled += buffer->size;
+	lock_leave(network_message_pool.lock);
+}
+
+//Called by ENet when packet is no longer used
+static void network_pool_free_packet(ENetPacket* packet)
+{
+	if (packet->data) network_pool_release((network_buffer*)packet->data - 1);
+	packet->data = 0;
+}
+
+//Free all pooled buffers
+static void network_pool_clear()
+{
+	int i;
+	for (i = 0; i < NETWORK_POOL_CLASSES; i++) {
+		while (network_message_pool.buffers[i]) {
+			network_buffer* buffer = network_message_pool.buffers[i];
+			network_message_pool.buffers[i] = buffer->next;
+			network_message_pool.stats.bytes_allocated -= buffer->size;
+			free(buffer);
+		}
+		network_message_pool.buffer_count[i] = 0;
+	}
+	for (i = 0; i < network_message_pool.message_count; i++) {
+		free(network_message_pool.messages[i]);
+	}
+	network_message_pool.message_count = 0;
+	network_message_pool.stats.bytes_pooled = 0;
+}
+
+
+//==============================================================================
+// Queues between simulation and network thread
+//==============================================================================
+static void network_queue_push(network_queue* queue, network_queue_item* item)
 {
-	network_message* msg = (network_message*)malloc(sizeof(network_message));
-	if (lua_toboolean(L,1)) {
-		msg->packet = enet_packet_create(0,NETWORK_MAX_PACKET_SIZE,ENET_PACKET_FLAG_RELIABLE);
+	item->next = 0;
+	lock_enter(queue->lock);
+	if (queue->tail) {
+		queue->tail->next = item;
 	} else {
-		msg->packet = enet_packet_create(0,NETWORK_MAX_PACKET_SIZE,0);
+		queue->head = item;
 	}
+	queue->tail = item;
+	lock_leave(queue->lock);
+}
+
+//Take all items from the queue
+static network_queue_item* network_queue_take(network_queue* queue)
+{
+	network_queue_item* items;
+	lock_enter(queue->lock);
+	items = queue->head;
+	queue->head = 0;
+	queue->tail = 0;
+	lock_leave(queue->lock);
+	return items;
+}
+
+
+//==============================================================================
+// Networking host
+//==============================================================================
+//Send queued packets (must be called with network lock held)
+static void network_host_send(network_host* host)
+{
+	network_queue_item* item = network_queue_take(&host->outgoing);
+	while (item) {
+		network_outgoing* outgoing = (network_outgoing*)item;
+		item = item->next;
+		if (enet_peer_send(outgoing->peer,0,outgoing->packet)) {
+			enet_packet_destroy(outgoing->packet);
+		} else {
+			host->stats.packets_sent++;
+		}
+		free(outgoing);
+	}
+	enet_host_flush(host->host);
+	host->stats.flushes++;
+}
+
+//Service host and queue all events (must be called with network lock held)
+static int network_host_service(network_host* host)
+{
+	ENetEvent enet_event;
+	int count = 0;
+	while (enet_host_service(host->host,&enet_event,0) > 0) {
+		network_event* event = (network_event*)malloc(sizeof(network_event));
+		event->event = enet_event;
+		network_queue_push(&host->incoming,&event->item);
+		count++;
+	}
+	return count;
+}
+
+//Network thread: sends packets when flush is requested, receives events
+void network_host_thread(network_host* host)
+{
+	while (host->running) {
+		enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+		int active = 0;
+
+		lock_enter(network_lock);
+		if (host->flush) {
+			host->flush = 0;
+			network_host_send(host);
+			active = 1;
+		}
+		if (network_host_service(host) > 0) active = 1;
+		lock_leave(network_lock);
+
+		//Wait for incoming data
+		if (!active) enet_socket_wait(host->host->socket,&condition,NETWORK_THREAD_WAIT);
+	}
+}
+
+network_host* network_host_create(ENetHost* enet_host, int threaded)
+{
+	network_host* host = (network_host*)malloc(sizeof(network_host));
+	memset(host,0,sizeof(network_host));
+	host->host = enet_host;
+	host->incoming.lock = lock_create();
+	host->outgoing.lock = lock_create();
+
+	if (threaded) {
+		host->running = 1;
+		host->thread = thread_create(network_host_thread,host);
+		host->threaded = (host->thread != BAD_ID);
+	}
+	return host;
+}
+
+void network_host_destroy(network_host* host)
+{
+	network_queue_item* item;
+
+	//Stop network thread
+	if (host->threaded) {
+		host->running = 0;
+		thread_waitfor(host->thread);
+	}
+
+	//Drop undelivered events and unsent packets
+	item = network_queue_take(&host->incoming);
+	while (item) {
+		network_event* event = (network_event*)item;
+		item = item->next;
+		if (event->event.packet) enet_packet_destroy(event->event.packet);
+		free(event);
+	}
+	item = network_queue_take(&host->outgoing);
+	while (item) {
+		network_outgoing* outgoing = (network_outgoing*)item;
+		item = item->next;
+		enet_packet_destroy(outgoing->packet);
+		free(outgoing);
+	}
+
+	enet_host_destroy(host->host);
+	lock_destroy(host->incoming.lock);
+	lock_destroy(host->outgoing.lock);
+	free(host);
+}
+
+
+//==============================================================================
+// Create new message (packet data comes from the pool, and is handed to ENet
+// without copying)
+//==============================================================================
+network_message* network_message_create(int reliable)
+{
+	network_message* msg;
+	network_buffer* buffer = network_pool_get(NETWORK_MESSAGE_INITIAL_SIZE);
+	if (!buffer) return 0;
+
+	if (network_message_pool.message_count > 0) {
+		msg = network_message_pool.messages[--network_message_pool.message_count];
+	} else {
+		msg = (network_message*)malloc(sizeof(network_message));
+	}
+
+	msg->packet = enet_packet_create(buffer+1,buffer->size,
+		ENET_PACKET_FLAG_NO_ALLOCATE | (reliable ? ENET_PACKET_FLAG_RELIABLE : 0));
+	msg->packet->freeCallback = network_pool_free_packet;
 	msg->offset = 0;
-	msg->size = NETWORK_MAX_PACKET_SIZE;
+	msg->size = buffer->size;
+	msg->bit_buffer = 0;
+	msg->bit_count = 0;
+	return msg;
+}
 
+//==============================================================================
+// Destroy message (packet is destroyed too, unless it was already sent)
+//==============================================================================
+void network_message_destroy(network_message* msg)
+{
+	if (msg->packet) enet_packet_destroy(msg->packet);
+	if (network_message_pool.message_count < NETWORK_POOL_MAX_FREE) {
+		network_message_pool.messages[network_message_pool.message_count++] = msg;
+	} else {
+		free(msg);
+	}
+}
+
+
+//==============================================================================
+// API for working with ENet
+//==============================================================================
+int network_highlevel_newmessage(lua_State* L)
+{
+	network_message* msg = network_message_create(lua_toboolean(L,1));
+	if (!msg) {
+		lua_pushnil(L);
+		return 1;
+	}
 	highlevel_newptr("NetworkMessage",msg);
 	return 1;
 }
 
 int network_highlevel_sendmessage(lua_State* L)
 {
+	network_host* host;
 	network_message* msg;
 
 	luaL_checkudata(L,1,"Host");
@@ -34,23 +329,50 @@ int network_highlevel_sendmessage(lua_State* L)
 	highlevel_checkzero(L,3);
 
 	//Get message and shrink the packet to correct size
+	host = highlevel_getptr(L,1);
 	msg = highlevel_getptr(L,3);
 	enet_packet_resize(msg->packet,msg->offset);
 
-	//Send packet
-	if (enet_peer_send(highlevel_getptr(L,2),0,msg->packet)) {
+	//Send packet (ENet owns the packet if it was sent). Packets are sent
+	//out when host is flushed
+	if (host->threaded) {
+		network_outgoing* outgoing = (network_outgoing*)malloc(sizeof(network_outgoing));
+		outgoing->peer = highlevel_getptr(L,2);
+		outgoing->packet = msg->packet;
+		network_queue_push(&host->outgoing,&outgoing->item);
+		msg->packet = 0;
+		lua_pushboolean(L,1);
+	} else if (enet_peer_send(highlevel_getptr(L,2),0,msg->packet)) {
 		lua_pushboolean(L,0);
 	} else {
+		msg->packet = 0;
+		host->stats.packets_sent++;
 		lua_pushboolean(L,1);
 	}
 
 	//Message no longer needed, free it up and reset pointer
-	free(msg);
+	network_message_destroy(msg);
 	highlevel_setptr(L,3,0);
-	enet_host_flush(highlevel_getptr(L,1));
 	return 1;
 }
 
+int network_highlevel_flush(lua_State* L)
+{
+	network_host* host;
+	luaL_checkudata(L,1,"Host");
+	highlevel_checkzero(L,1);
+
+	//Send all packets queued during this frame at once
+	host = highlevel_getptr(L,1);
+	if (host->threaded) {
+		host->flush = 1;
+	} else {
+		enet_host_flush(host->host);
+		host->stats.flushes++;
+	}
+	return 0;
+}
+
 int network_highlevel_messagewrite(lua_State* L)
 {
 	network_message* msg;
@@ -156,6 +478,7 @@ int network_highlevel_host(lua_State* L)
 	//luaL_checktype(L,1,LUA_TSTRING); //IP
 	luaL_checktype(L,2,LUA_TNUMBER); //Port
 	luaL_checktype(L,3,LUA_TNUMBER); //Max channels
+	//Argument 4: service host in network thread
 
 	//Set address and create host
 	if (lua_isstring(L,1)) {
@@ -172,7 +495,7 @@ int network_highlevel_host(lua_State* L)
 
 	//Return host
 	if (host) {
-		highlevel_newptr("Host",host);
+		highlevel_newptr("Host",network_host_create(host,lua_toboolean(L,4)));
 	} else {
 		lua_pushnil(L);
 	}
@@ -195,7 +518,10 @@ int network_highlevel_connect(lua_State* L)
 	address.port = lua_tointeger(L,3);
 
 	//Create peer
-	peer = enet_host_connect(highlevel_getptr(L,1),&address,lua_tointeger(L,4),lua_tointeger(L,5));
+	lock_enter(network_lock);
+	peer = enet_host_connect(((network_host*)highlevel_getptr(L,1))->host,&address,
+		lua_tointeger(L,4),lua_tointeger(L,5));
+	lock_leave(network_lock);
 	if (peer) {
 		highlevel_newptr("Peer",peer);
 	} else {
@@ -210,7 +536,7 @@ int network_highlevel_destroyhost(lua_State* L)
 	highlevel_checkzero(L,1);
 
 	//Destroy host
-	enet_host_destroy(highlevel_getptr(L,1));
+	network_host_destroy(highlevel_getptr(L,1));
 	highlevel_setptr(L,1,0);
 	return 1;
 }
@@ -221,51 +547,92 @@ int network_highlevel_resetpeer(lua_State* L)
 	highlevel_checkzero(L,1);
 
 	//Reset peer
+	lock_enter(network_lock);
 	enet_peer_reset(highlevel_getptr(L,1));
+	lock_leave(network_lock);
 	return 1;
 }
 
 int network_highlevel_update(lua_State* L)
 {
-	ENetHost* host;
-	ENetEvent enet_event;
+	network_host* host;
+	network_queue_item* item;
+	int count = 0;
 	luaL_checkudata(L,1,"Host"); //host
 	luaL_checktype(L,2,LUA_TFUNCTION); //callback
 	highlevel_checkzero(L,1);
 
-	//Service all messages
+	//Fetch all events received since last update
 	host = highlevel_getptr(L,1);
-	while (host && (enet_host_service(host, &enet_event, 0) > 0)) {
-		//Temporary object
-		network_message msg;
-
-		//Store the packet
-		if (enet_event.packet) {
-			highlevel_newptr("NetworkMessage",&msg);
-			msg.offset = 0;
-			msg.size = enet_event.packet->dataLength;
-			msg.packet = enet_event.packet;
-		} else {
-			lua_pushnil(L);
-		}
+	if (!host->threaded) network_host_service(host);
+	item = network_queue_take(&host->incoming);
+
+	for (; item; count++) {
+		network_event* event = (network_event*)item;
+		ENetEvent* enet_event = &event->event;
+		item = item->next;
+
+		//Deliver events while host exists (callback may destroy the host)
+		if (highlevel_getptr(L,1)) {
+			//Temporary object
+			network_message msg;
+
+			//Store the packet
+			if (enet_event->packet) {
+				highlevel_newptr("NetworkMessage",&msg);
+				msg.offset = 0;
+				msg.size = enet_event->packet->dataLength;
+				msg.packet = enet_event->packet;
+				msg.bit_buffer = 0;
+				msg.bit_count = 0;
+			} else {
+				lua_pushnil(L);
+			}
 
-		//Call the callback
-		lua_pushvalue(L,2); //function
-		highlevel_newptr("Peer",enet_event.peer);
-		lua_pushnumber(L,enet_event.type);
-		lua_pushnumber(L,enet_event.data);
-		lua_pushvalue(L,-5);
-		highlevel_call(4,0);
-
-		//Reset the packet and remove it
-		if (enet_event.packet) {
-			highlevel_setptr(L,-1,0);
+			//Call the callback
+			lua_pushvalue(L,2); //function
+			highlevel_newptr("Peer",enet_event->peer);
+			lua_pushnumber(L,enet_event->type);
+			lua_pushnumber(L,enet_event->data);
+			lua_pushvalue(L,-5);
+			highlevel_call(4,0);
+
+			//Reset the packet and remove it
+			if (enet_event->packet) {
+				highlevel_setptr(L,-1,0);
+			}
+			lua_pop(L,1);
 		}
-		lua_pop(L,1);
+
+		//Received packet is no longer used
+		if (enet_event->packet) enet_packet_destroy(enet_event->packet);
+		free(event);
+	}
+
+	//Update statistics
+	if (highlevel_getptr(L,1)) {
+		host->stats.events += count;
+		host->stats.max_batch = max(host->stats.max_batch,count);
 	}
 	return 0;
 }
 
+int network_highlevel_gethoststats(lua_State* L)
+{
+	network_host* host;
+	luaL_checkudata(L,1,"Host");
+	highlevel_checkzero(L,1);
+
+	host = highlevel_getptr(L,1);
+	lua_createtable(L,0,5);
+	lua_pushboolean(L,host->threaded);					lua_setfield(L,-2,"Threaded");
+	lua_pushnumber(L,host->stats.events);				lua_setfield(L,-2,"Events");
+	lua_pushnumber(L,host->stats.packets_sent);			lua_setfield(L,-2,"PacketsSent");
+	lua_pushnumber(L,host->stats.flushes);				lua_setfield(L,-2,"Flushes");
+	lua_pushnumber(L,host->stats.max_batch);			lua_setfield(L,-2,"MaxBatch");
+	return 1;
+}
+
 int network_highlevel_getpeerhostport(lua_State* L)
 {
 	char buf[ARBITRARY_MAX] = { 0 };
@@ -310,6 +677,20 @@ int network_highlevel_getpeerid(lua_State* L)
 	return 1;
 }
 
+int network_highlevel_getmessagestats(lua_State* L)
+{
+	lua_createtable(L,0,8);
+	lua_pushnumber(L,network_message_pool.stats.allocations);		lua_setfield(L,-2,"Allocations");
+	lua_pushnumber(L,network_message_pool.stats.reuses);			lua_setfield(L,-2,"Reuses");
+	lua_pushnumber(L,network_message_pool.stats.releases);			lua_setfield(L,-2,"Releases");
+	lua_pushnumber(L,network_message_pool.stats.grows);				lua_setfield(L,-2,"Grows");
+	lua_pushnumber(L,network_message_pool.stats.bytes_allocated);	lua_setfield(L,-2,"BytesAllocated");
+	lua_pushnumber(L,network_message_pool.stats.bytes_pooled);		lua_setfield(L,-2,"BytesPooled");
+	lua_pushnumber(L,network_message_pool.stats.allocations_per_second);	lua_setfield(L,-2,"AllocationsPerSecond");
+	lua_pushnumber(L,network_message_pool.stats.requests_per_second);		lua_setfield(L,-2,"RequestsPerSecond");
+	return 1;
+}
+
 
 //==============================================================================
 // Initialize networking
@@ -326,6 +707,7 @@ void network_initialize()
 
 	highlevel_addfunction("NetAPI","NewMessage",network_highlevel_newmessage);
 	highlevel_addfunction("NetAPI","SendMessage",network_highlevel_sendmessage);
+	highlevel_addfunction("NetAPI","Flush",network_highlevel_flush);
 	highlevel_addfunction("NetAPI","MessageWrite",network_highlevel_messagewrite);
 	highlevel_addfunction("NetAPI","MessageRead",network_highlevel_messageread);
 	highlevel_addfunction("NetAPI","Host",network_highlevel_host);
@@ -336,9 +718,14 @@ void network_initialize()
 	highlevel_addfunction("NetAPI","GetPeerHostPort",network_highlevel_getpeerhostport);
 	highlevel_addfunction("NetAPI","SetPeerID",network_highlevel_setpeerid);
 	highlevel_addfunction("NetAPI","GetPeerID",network_highlevel_getpeerid);
+	highlevel_addfunction("NetAPI","GetMessageStats",network_highlevel_getmessagestats);
+	highlevel_addfunction("NetAPI","GetHostStats",network_highlevel_gethoststats);
+	network_frame_initialize();
 
 	//Initialize ENet
 	enet_initialize();
+	network_lock = lock_create();
+	network_message_pool.lock = lock_create();
 
 	//Initialize X-Net
 	highlevel_load(FROM_PLUGINS("lua/network.lua"));
@@ -350,6 +737,9 @@ void network_initialize()
 void network_deinitialize()
 {
 	enet_deinitialize();
+	network_pool_clear();
+	lock_destroy(network_message_pool.lock);
+	lock_destroy(network_lock);
 }
 
 
@@ -374,12 +764,107 @@ int network_message_read(network_message* msg, void* ptr, int size)
 //==============================================================================
 int network_message_write(network_message* msg, void* ptr, int size)
 {
-	char* new_ptr = msg->packet->data + msg->offset;
-	if (msg->offset + size <= msg->size) {
-		memcpy(new_ptr,ptr,size);
+	if (network_message_reserve(msg,size)) {
+		memcpy(msg->packet->data + msg->offset,ptr,size);
 		msg->offset += size;
 		return 1;
 	} else {
 		return 0;
 	}
+}
+
+
+//==============================================================================
+// Makes sure message has space for given number of bytes (grows the packet)
+//==============================================================================
+int network_message_reserve(network_message* msg, int size)
+{
+	int new_size = msg->size;
+	if (msg->offset + size <= msg->size) return 1;
+
+	while (msg->offset + size > new_size) new_size *= 2;
+
+	//Move pooled packet into a larger buffer
+	if (msg->packet->freeCallback == network_pool_free_packet) {
+		network_buffer* buffer = network_pool_get(new_size);
+		if (!buffer) return 0;
+		memcpy(buffer+1,msg->packet->data,msg->offset);
+		network_pool_release((network_buffer*)msg->packet->data - 1);
+		msg->packet->data = (enet_uint8*)(buffer+1);
+		msg->packet->dataLength = buffer->size;
+		msg->size = buffer->size;
+		network_message_pool.stats.grows++;
+		return 1;
+	}
+
+	if (enet_packet_resize(msg->packet,new_size)) return 0;
+	msg->size = new_size;
+	return 1;
+}
+
+
+//==============================================================================
+// Writes bits to message (least significant bits first, up to 32 bits)
+//==============================================================================
+int network_message_write_bits(network_message* msg, unsigned int value, int count)
+{
+	if (count < 32) value &= (1 << count)-1;
+	msg->bit_buffer |= ((unsigned long long)value) << msg->bit_count;
+	msg->bit_count += count;
+
+	//Write complete bytes
+	while (msg->bit_count >= 8) {
+		unsigned char byte = (unsigned char)msg->bit_buffer;
+		msg->bit_buffer >>= 8;
+		msg->bit_count -= 8;
+		if (!network_message_write(msg,&byte,1)) return 0;
+	}
+	return 1;
+}
+
+//==============================================================================
+// Reads bits from message (up to 32 bits). Missing bits are read as zero
+//==============================================================================
+unsigned int network_message_read_bits(network_message* msg, int count)
+{
+	unsigned int value;
+
+	//Read enough bytes
+	while (msg->bit_count < count) {
+		unsigned char byte = 0;
+		if (!network_message_read(msg,&byte,1)) {
+			msg->bit_count = count;
+			break;
+		}
+		msg->bit_buffer |= ((unsigned long long)byte) << msg->bit_count;
+		msg->bit_count += 8;
+	}
+
+	value = (unsigned int)msg->bit_buffer;
+	if (count < 32) value &= (1 << count)-1;
+	msg->bit_buffer >>= count;
+	msg->bit_count -= count;
+	return value;
+}
+
+//==============================================================================
+// Writes last incomplete byte (must be called before writing bytes again)
+//==============================================================================
+void network_message_flush_bits(network_message* msg)
+{
+	if (msg->bit_count > 0) {
+		unsigned char byte = (unsigned char)msg->bit_buffer;
+		msg->bit_buffer = 0;
+		msg->bit_count = 0;
+		network_message_write(msg,&byte,1);
+	}
+}
+
+//==============================================================================
+// Skips rest of the current byte (must be called before reading bytes again)
+//==============================================================================
+void network_message_align_bits(network_message* msg)
+{
+	msg->bit_buffer = 0;
+	msg->bit_count = 0;
 }
\ No newline at end of file
@@ -1,9 +1,29 @@
 #ifndef NETWORK_H
 #define NETWORK_H
 
+#include "threading.h"
+
 //Default maximum network packet size
 #define NETWORK_MAX_PACKET_SIZE 65536
 
+//Message buffer pool: size classes are NETWORK_POOL_MIN_SIZE*4^N bytes
+#define NETWORK_POOL_CLASSES		7
+#define NETWORK_POOL_MIN_SIZE		256
+#define NETWORK_POOL_MAX_FREE		64		//Maximum free buffers kept per size class
+#define NETWORK_MESSAGE_INITIAL_SIZE 1024	//Initial size of new message (grows when written)
+
+//Time network thread waits for incoming data (milliseconds)
+#define NETWORK_THREAD_WAIT 1
+
+//Number of frames kept in frame history (6.4 seconds at 10 FPS)
+#define NETWORK_FRAME_HISTORY 64
+
+//Interest management: vessels closer than NEAR are sent every frame, vessels
+//further than FAR are sent at minimum rate (fraction of frames)
+#define NETWORK_INTEREST_NEAR			100e3
+#define NETWORK_INTEREST_FAR			2000e3
+#define NETWORK_INTEREST_MIN_PRIORITY	0.02
+
 //Key for networking
 typedef char network_key[32];
 
@@ -12,14 +32,199 @@ typedef struct {
 	ENetPacket* packet;
 	int size; //total size in bytes
 	int offset; //current offset into message, in bytes
+	unsigned long long bit_buffer; //bits waiting to be written or read
+	int bit_count; //number of bits in the bit buffer
 } network_message;
 
+//Queue shared between simulation and network thread (whole queue is taken at once)
+typedef struct network_queue_item_tag {
+	struct network_queue_item_tag* next;
+} network_queue_item;
+
+typedef struct {
+	network_queue_item* head;
+	network_queue_item* tail;
+	lockID lock;
+} network_queue;
+
+//Event received by network thread
+typedef struct {
+	network_queue_item item;
+	ENetEvent event;
+} network_event;
+
+//Packet waiting to be sent by network thread
+typedef struct {
+	network_queue_item item;
+	ENetPeer* peer;
+	ENetPacket* packet;
+} network_outgoing;
+
+//Networking host (ENet host, optionally serviced by its own thread)
+typedef struct network_host_tag {
+	ENetHost* host;
+	int threaded;			//Host is serviced by network thread
+	threadID thread;
+	volatile int running;	//Network thread must keep running
+	volatile int flush;		//Outgoing packets must be sent
+
+	network_queue incoming;	//Events waiting to be delivered to Lua
+	network_queue outgoing;	//Packets waiting to be sent
+
+	//Statistics
+	struct {
+		double events;			//Events delivered
+		double packets_sent;	//Packets sent
+		double flushes;			//Host flushes
+		double max_batch;		//Largest number of events delivered in one update
+	} stats;
+} network_host;
+
+//Pooled packet buffer (header is followed by data)
+typedef struct network_buffer_tag {
+	struct network_buffer_tag* next; //Next free buffer in pool
+	int size_class;			//Size class (-1 if buffer is too large for pool)
+	int size;				//Size of data in bytes
+} network_buffer;
+
+//Pool of message buffers and message headers
+typedef struct {
+	network_buffer* buffers[NETWORK_POOL_CLASSES]; //Free buffers for every size class
+	int buffer_count[NETWORK_POOL_CLASSES];
+	network_message* messages[NETWORK_POOL_MAX_FREE]; //Free message headers
+	int message_count;
+	lockID lock;			//Buffers are released by network thread
+
+	//Statistics
+	struct {
+		double allocations;		//Buffers allocated from system memory
+		double reuses;			//Buffers taken from the pool
+		double releases;		//Buffers returned to the pool (or freed)
+		double grows;			//Messages grown to a larger size class
+		double bytes_allocated;	//Bytes currently allocated (in use or pooled)
+		double bytes_pooled;	//Bytes currently in the pool
+
+		double window_start;	//Start of current one-second window
+		int window_allocations;	//Allocations in current window
+		int window_requests;	//Buffer requests in current window
+		double allocations_per_second;	//Allocations during last window
+		double requests_per_second;		//Buffer requests during last window
+	} stats;
+} network_pool;
+
+//Packed state of a single vessel inside a frame
+typedef struct network_frame_vessel_tag {
+	int net_id;				//Network ID (frame is sorted by it)
+	int networked;			//Was this record received from remote side
+	int index;				//Vessel index (-1 if record was received)
+	int client_id;			//Client which owns this vessel (-1 if none)
+
+	float x,y,z;			//Position relative to coordinate offset
+	float vx,vy,vz;			//Velocity
+	float ax,ay,az;			//Acceleration
+	float q[4];				//Attitude
+	int q_largest;			//Attitude encoded as smallest three components: index of the largest one
+	int q_packed[3];		//Attitude encoded as smallest three components: quantized components
+	float P,Q,R;			//Rates
+	double cx,cy,cz;		//Coordinate offset
+
+	float jxx,jyy,jzz;		//Radius of gyration squared
+	float chassis,hull;		//Static mass
+	float fuel[4];			//Dynamic mass (first four fuel tanks)
+} network_frame_vessel;
+
+//Snapshot of the world state
+typedef struct network_frame_tag {
+	unsigned int cycle;		//Frame cycle (0: invalid cycle, frame not used)
+	double time;			//Time at which frame is valid
+	int count;				//Number of vessel records
+	int alloc_count;		//Number of allocated vessel records
+	network_frame_vessel* vessels; //Vessel records, sorted by network ID
+} network_frame;
+
+//Ring buffer of frames (one per server or client)
+typedef struct network_frames_tag {
+	network_frame frames[NETWORK_FRAME_HISTORY];
+	network_frame local; //Frame for cycle 0 (local state on client, received state on server)
+
+	//Spatial index of the last encoded frame (hash grid, cell size NETWORK_INTEREST_FAR)
+	struct {
+		unsigned int cycle;		//Cycle for which index was built
+		int size;				//Number of hash table cells
+		int* cells;				//First record in every cell (-1 if none)
+		int* next;				//Next record in the same cell (-1 if none)
+		int alloc_count;		//Number of allocated records in next array
+	} index;
+
+	//Statistics
+	struct {
+		int captures;			//Frames captured
+		int encodes;			//Frames encoded
+		int decodes;			//Frames decoded
+		double capture_time;	//Total time spent capturing frames
+		double encode_time;		//Total time spent encoding frames
+		double decode_time;		//Total time spent decoding frames
+		double vessels_written;	//Vessel records written
+		double bytes_written;	//Bytes written by encoder
+	} stats;
+} network_frames;
+
+//Per-client state of frame encoder (interest management)
+typedef struct network_frame_client_tag {
+	int client_id;			//Client ID (vessels owned by client always have full priority)
+	float* priority;		//Priority accumulator for every vessel index
+	int priority_count;		//Number of allocated priority accumulators
+	float* distance;		//Distance from client vessels to every record (temporary)
+	int distance_count;		//Number of allocated distances
+
+	//Records which were written (or unchanged) in given frame, and can be used as delta base
+	struct {
+		unsigned int cycle;
+		int size;
+		unsigned char* bits;
+	} included[NETWORK_FRAME_HISTORY];
+
+	//Statistics
+	struct {
+		int encodes;			//Frames encoded
+		double encode_time;		//Total time spent encoding frames
+		double vessels_written;	//Vessel records written
+		double vessels_skipped;	//Vessel records skipped by interest management
+		double bytes_written;	//Bytes written by encoder
+	} stats;
+} network_frame_client;
+
 //Network routines
+extern double (*network_time)(); //Clock for networking timeouts (seconds)
 void network_initialize();
 void network_deinitialize();
 
+//Networking host functions
+network_host* network_host_create(ENetHost* enet_host, int threaded);
+void network_host_destroy(network_host* host);
+
 //Network message functions
+network_message* network_message_create(int reliable);
+void network_message_destroy(network_message* msg);
 int network_message_read(network_message* msg, void* ptr, int size);
 int network_message_write(network_message* msg, void* ptr, int size);
+int network_message_reserve(network_message* msg, int size);
+int network_message_write_bits(network_message* msg, unsigned int value, int count);
+unsigned int network_message_read_bits(network_message* msg, int count);
+void network_message_flush_bits(network_message* msg);
+void network_message_align_bits(network_message* msg);
+
+//Network frame functions
+network_frames* network_frames_create();
+void network_frames_destroy(network_frames* history);
+network_frame* network_frames_get(network_frames* history, unsigned int cycle);
+void network_frame_capture(network_frames* history, unsigned int cycle, double time, int is_client);
+int network_frame_write(network_frames* history, network_frame_client* client, unsigned int base_cycle, unsigned int cycle, network_message* msg);
+int network_frame_read(network_frames* history, unsigned int base_cycle, unsigned int cycle, double time, network_message* msg);
+void network_frame_merge(network_frames* history, unsigned int cycle, unsigned int base_cycle);
+void network_frame_apply(network_frames* history, unsigned int cycle, int client_id);
+network_frame_client* network_frame_client_create(int client_id);
+void network_frame_client_destroy(network_frame_client* client);
+void network_frame_initialize();
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,1266 @@
+//==============================================================================
+// Network frames (world snapshots) and delta compression between them
+//------------------------------------------------------------------------------
+// Frames are stored in a ring buffer indexed by cycle. Every frame is a packed
+// array of vessel records sorted by network ID, so delta between two frames is
+// computed by walking both arrays once.
+//
+// Wire format of a frame (bit-packed, least significant bits first):
+//   time from base frame in ms (6 bits of length N and N bits of value)
+//   for every changed vessel:
+//     1 bit (same compression bits as previous record), or 0 bit followed by
+//     8 bits compression bits
+//     1 bit delta flag
+//     1 bit (network ID follows previous network ID), or 0 bit followed by
+//     difference from previous network ID (6 bits of length N, N bits of value)
+//     changed groups of variables
+//   0 bit and 8 bits 0 (end of frame), padding to the byte boundary
+//
+// Groups of variables are quantized with a fixed step. Each group is written as
+// 6 bits of magnitude length N, followed by sign bit and N bits of magnitude
+// for every value (nothing if N is zero), so precision stays the same while
+// the size adapts to the range of values. Attitude is written as the index of
+// the largest component (2 bits) and three smallest components (12 bits each).
+// Vessel records are quantized when the frame is captured, so both sides
+// see exactly the same values.
+//
+// If delta flag is set, quantized values are written as differences from the
+// record in the base frame (position and velocity are first advanced by base
+// velocity and acceleration over the time between frames). Attitude is written
+// as 1 bit (largest component did not change) followed by the group of
+// differences of the smallest three components, or 0 bit and full attitude.
+// Delta records are only sent by the server, which tracks records each client
+// received exactly. Changes below the thresholds are held at capture time
+// (frame keeps values of the previous frame), so small changes are not sent.
+//
+// Server keeps per-client encoder state for interest management: vessels far
+// from the client vessels are sent at lower rate (priority accumulators), and
+// are sent in full when base frame of the client does not contain them.
+//==============================================================================
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <enet/enet.h>
+
+#include "x-space.h"
+#include "vessel.h"
+#include "network.h"
+#include "highlevel.h"
+#include "curtime.h"
+
+//Compression bits (groups of variables which changed)
+#define NETWORK_FRAME_COORDINATES		1
+#define NETWORK_FRAME_VELOCITY			2
+#define NETWORK_FRAME_ACCELERATION		4
+#define NETWORK_FRAME_ORIENTATION		8
+#define NETWORK_FRAME_ANGVELOCITY		16
+#define NETWORK_FRAME_CENTERPOINT		32
+#define NETWORK_FRAME_STATIC_MASS		64
+#define NETWORK_FRAME_DYNAMIC_MASS		128
+
+//Quantization steps
+#define NETWORK_FRAME_STEP_POSITION		(1.0/64.0)		//m
+#define NETWORK_FRAME_STEP_VELOCITY		(1.0/256.0)		//m/s
+#define NETWORK_FRAME_STEP_ACCELERATION	(1.0/64.0)		//m/s2
+#define NETWORK_FRAME_STEP_RATES		(1.0/4096.0)	//rad/sec
+#define NETWORK_FRAME_STEP_CENTERPOINT	(1.0/1024.0)	//m
+#define NETWORK_FRAME_STEP_FUEL			(1.0/16.0)		//kg
+#define NETWORK_FRAME_LENGTH_BITS		6
+#define NETWORK_FRAME_QUATERNION_BITS	12
+#define NETWORK_FRAME_MAX_QUANTIZED		4611686018427387903.0 //2^62-1
+
+//Maximum size of a single vessel record on the wire
+#define NETWORK_FRAME_MAX_RECORD		256
+
+//Maximum time between frame and base frame used for prediction (ms)
+#define NETWORK_FRAME_MAX_DT			60000
+
+
+//==============================================================================
+// Frame memory management
+//==============================================================================
+network_frames* network_frames_create()
+{
+	network_frames* history = (network_frames*)malloc(sizeof(network_frames));
+	memset(history,0,sizeof(network_frames));
+	return history;
+}
+
+void network_frames_destroy(network_frames* history)
+{
+	int i;
+	for (i = 0; i < NETWORK_FRAME_HISTORY; i++) {
+		if (history->frames[i].vessels) free(history->frames[i].vessels);
+	}
+	if (history->local.vessels) free(history->local.vessels);
+	if (history->index.cells) free(history->index.cells);
+	if (history->index.next) free(history->index.next);
+	free(history);
+}
+
+static void network_frame_reserve(network_frame* frame, int count)
+{
+	if (count > frame->alloc_count) {
+		int new_count = max(count,frame->alloc_count*2);
+		if (new_count < 64) new_count = 64;
+		frame->vessels = (network_frame_vessel*)realloc(frame->vessels,sizeof(network_frame_vessel)*new_count);
+		frame->alloc_count = new_count;
+	}
+}
+
+static void network_frame_copy(network_frame* frame, network_frame* base_frame)
+{
+	if (frame == base_frame) return;
+	if (!base_frame) {
+		frame->count = 0;
+		return;
+	}
+	network_frame_reserve(frame,base_frame->count);
+	memcpy(frame->vessels,base_frame->vessels,sizeof(network_frame_vessel)*base_frame->count);
+	frame->count = base_frame->count;
+}
+
+static int network_frame_compare(const void* a, const void* b)
+{
+	int id_a = ((network_frame_vessel*)a)->net_id;
+	int id_b = ((network_frame_vessel*)b)->net_id;
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+//Sort records by network ID, leave only last record for duplicate IDs
+static void network_frame_sort(network_frame* frame)
+{
+	int i,j;
+	qsort(frame->vessels,frame->count,sizeof(network_frame_vessel),network_frame_compare);
+	for (i = 1, j = 0; i < frame->count; i++) {
+		if (frame->vessels[i].net_id != frame->vessels[j].net_id) j++;
+		if (i != j) frame->vessels[j] = frame->vessels[i];
+	}
+	if (frame->count > 0) frame->count = j+1;
+}
+
+static network_frame_vessel* network_frame_find(network_frame* frame, int count, int net_id)
+{
+	network_frame_vessel key;
+	key.net_id = net_id;
+	return (network_frame_vessel*)bsearch(&key,frame->vessels,count,sizeof(network_frame_vessel),network_frame_compare);
+}
+
+
+//==============================================================================
+// Quantization of vessel state
+//==============================================================================
+static double network_frame_quantize(double value, double step)
+{
+	double q = floor(value/step+0.5);
+	if (q >  NETWORK_FRAME_MAX_QUANTIZED) q =  NETWORK_FRAME_MAX_QUANTIZED;
+	if (q < -NETWORK_FRAME_MAX_QUANTIZED) q = -NETWORK_FRAME_MAX_QUANTIZED;
+	return q;
+}
+
+//Position and velocity advanced from base record over dt (ms). Computed on the
+//quantization grid, so that encoder and decoder predict exactly the same value
+static double network_frame_predict_position(double x, double vx, double ax, int dt_ms)
+{
+	double q = network_frame_quantize(x,NETWORK_FRAME_STEP_POSITION);
+	double qv = network_frame_quantize(vx,NETWORK_FRAME_STEP_VELOCITY)*(NETWORK_FRAME_STEP_VELOCITY/NETWORK_FRAME_STEP_POSITION);
+	double qa = network_frame_quantize(ax,NETWORK_FRAME_STEP_ACCELERATION)*(NETWORK_FRAME_STEP_ACCELERATION/NETWORK_FRAME_STEP_POSITION);
+	return (q + floor((qv*dt_ms*1000.0 + 0.5*qa*dt_ms*dt_ms)/1000000.0+0.5))*NETWORK_FRAME_STEP_POSITION;
+}
+
+static double network_frame_predict_velocity(double vx, double ax, int dt_ms)
+{
+	double q = network_frame_quantize(vx,NETWORK_FRAME_STEP_VELOCITY);
+	double qa = network_frame_quantize(ax,NETWORK_FRAME_STEP_ACCELERATION)*(NETWORK_FRAME_STEP_ACCELERATION/NETWORK_FRAME_STEP_VELOCITY);
+	return (q + floor(qa*dt_ms/1000.0+0.5))*NETWORK_FRAME_STEP_VELOCITY;
+}
+
+static void network_frame_write_unsigned(network_message* msg, unsigned int value)
+{
+	int length = 0;
+	while ((length < 32) && (value >> length)) length++;
+	network_message_write_bits(msg,length,NETWORK_FRAME_LENGTH_BITS);
+	network_message_write_bits(msg,value,length);
+}
+
+static unsigned int network_frame_read_unsigned(network_message* msg)
+{
+	int length = network_message_read_bits(msg,NETWORK_FRAME_LENGTH_BITS);
+	return network_message_read_bits(msg,min(length,32));
+}
+
+//Write group of values (as differences from base values, if given)
+static void network_frame_write_group(network_message* msg, double* values, double* base, int count, double step)
+{
+	unsigned long long magnitude[4];
+	unsigned long long mask = 0;
+	int sign[4];
+	int i,length = 0;
+
+	for (i = 0; i < count; i++) {
+		double q = network_frame_quantize(values[i],step);
+		if (base) q -= network_frame_quantize(base[i],step);
+		sign[i] = q < 0.0;
+		magnitude[i] = (unsigned long long)fabs(q);
+		mask |= magnitude[i];
+	}
+	while ((length < 63) && (mask >> length)) length++;
+
+	network_message_write_bits(msg,length,NETWORK_FRAME_LENGTH_BITS);
+	if (!length) return;
+	for (i = 0; i < count; i++) {
+		network_message_write_bits(msg,sign[i],1);
+		network_message_write_bits(msg,(unsigned int)(magnitude[i] & 0xFFFFFFFF),min(length,32));
+		if (length > 32) network_message_write_bits(msg,(unsigned int)(magnitude[i] >> 32),length-32);
+	}
+}
+
+//Read group of values (as differences from base values, if given)
+static void network_frame_read_group(network_message* msg, double* values, double* base, int count, double step)
+{
+	int i,length = network_message_read_bits(msg,NETWORK_FRAME_LENGTH_BITS);
+	for (i = 0; i < count; i++) {
+		double q = base ? network_frame_quantize(base[i],step) : 0.0;
+
+		if (length) {
+			unsigned long long magnitude;
+			int sign = network_message_read_bits(msg,1);
+			magnitude = network_message_read_bits(msg,min(length,32));
+			if (length > 32) magnitude |= ((unsigned long long)network_message_read_bits(msg,length-32)) << 32;
+			q += sign ? -(double)magnitude : (double)magnitude;
+		}
+		values[i] = q*step;
+	}
+}
+
+//Encode quaternion as three smallest components
+static void network_frame_pack_quaternion(network_frame_vessel* rec)
+{
+	double max_value = (1 << NETWORK_FRAME_QUATERNION_BITS)-1;
+	double q[4],mag,sign;
+	int i,j;
+
+	q[0] = rec->q[0];
+	q[1] = rec->q[1];
+	q[2] = rec->q[2];
+	q[3] = rec->q[3];
+	mag = sqrt(q[0]*q[0]+q[1]*q[1]+q[2]*q[2]+q[3]*q[3]);
+	if (mag < 1e-9) {
+		q[0] = 1.0; q[1] = 0.0; q[2] = 0.0; q[3] = 0.0;
+		mag = 1.0;
+	}
+
+	rec->q_largest = 0;
+	for (i = 1; i < 4; i++) {
+		if (fabs(q[i]) > fabs(q[rec->q_largest])) rec->q_largest = i;
+	}
+	sign = (q[rec->q_largest] < 0.0) ? -1.0 : 1.0;
+
+	for (i = 0, j = 0; i < 4; i++) {
+		if (i != rec->q_largest) {
+			double c = sign*q[i]/mag; //Between -1/sqrt(2) and 1/sqrt(2)
+			c = floor((c*sqrt(0.5)+0.5)*max_value+0.5);
+			if (c < 0.0) c = 0.0;
+			if (c > max_value) c = max_value;
+			rec->q_packed[j++] = (int)c;
+		}
+	}
+}
+
+static void network_frame_unpack_quaternion(network_frame_vessel* rec)
+{
+	double max_value = (1 << NETWORK_FRAME_QUATERNION_BITS)-1;
+	double sum = 0.0;
+	int i,j;
+
+	for (i = 0, j = 0; i < 4; i++) {
+		if (i != rec->q_largest) {
+			double c = (rec->q_packed[j++]/max_value-0.5)/sqrt(0.5);
+			rec->q[i] = (float)c;
+			sum += c*c;
+		}
+	}
+	rec->q[rec->q_largest] = (float)sqrt(max(0.0,1.0-sum));
+}
+
+static void network_frame_quantize_record(network_frame_vessel* rec)
+{
+	int i;
+	rec->x = (float)(network_frame_quantize(rec->x,NETWORK_FRAME_STEP_POSITION)*NETWORK_FRAME_STEP_POSITION);
+	rec->y = (float)(network_frame_quantize(rec->y,NETWORK_FRAME_STEP_POSITION)*NETWORK_FRAME_STEP_POSITION);
+	rec->z = (float)(network_frame_quantize(rec->z,NETWORK_FRAME_STEP_POSITION)*NETWORK_FRAME_STEP_POSITION);
+	rec->vx = (float)(network_frame_quantize(rec->vx,NETWORK_FRAME_STEP_VELOCITY)*NETWORK_FRAME_STEP_VELOCITY);
+	rec->vy = (float)(network_frame_quantize(rec->vy,NETWORK_FRAME_STEP_VELOCITY)*NETWORK_FRAME_STEP_VELOCITY);
+	rec->vz = (float)(network_frame_quantize(rec->vz,NETWORK_FRAME_STEP_VELOCITY)*NETWORK_FRAME_STEP_VELOCITY);
+	rec->ax = (float)(network_frame_quantize(rec->ax,NETWORK_FRAME_STEP_ACCELERATION)*NETWORK_FRAME_STEP_ACCELERATION);
+	rec->ay = (float)(network_frame_quantize(rec->ay,NETWORK_FRAME_STEP_ACCELERATION)*NETWORK_FRAME_STEP_ACCELERATION);
+	rec->az = (float)(network_frame_quantize(rec->az,NETWORK_FRAME_STEP_ACCELERATION)*NETWORK_FRAME_STEP_ACCELERATION);
+	rec->P = (float)(network_frame_quantize(rec->P,NETWORK_FRAME_STEP_RATES)*NETWORK_FRAME_STEP_RATES);
+	rec->Q = (float)(network_frame_quantize(rec->Q,NETWORK_FRAME_STEP_RATES)*NETWORK_FRAME_STEP_RATES);
+	rec->R = (float)(network_frame_quantize(rec->R,NETWORK_FRAME_STEP_RATES)*NETWORK_FRAME_STEP_RATES);
+	rec->cx = network_frame_quantize(rec->cx,NETWORK_FRAME_STEP_CENTERPOINT)*NETWORK_FRAME_STEP_CENTERPOINT;
+	rec->cy = network_frame_quantize(rec->cy,NETWORK_FRAME_STEP_CENTERPOINT)*NETWORK_FRAME_STEP_CENTERPOINT;
+	rec->cz = network_frame_quantize(rec->cz,NETWORK_FRAME_STEP_CENTERPOINT)*NETWORK_FRAME_STEP_CENTERPOINT;
+	for (i = 0; i < 4; i++) {
+		rec->fuel[i] = (float)(network_frame_quantize(rec->fuel[i],NETWORK_FRAME_STEP_FUEL)*NETWORK_FRAME_STEP_FUEL);
+	}
+	network_frame_pack_quaternion(rec);
+	network_frame_unpack_quaternion(rec);
+}
+
+static void network_frame_write_float(network_message* msg, float value)
+{
+	unsigned int bits;
+	memcpy(&bits,&value,4);
+	network_message_write_bits(msg,bits,32);
+}
+
+static float network_frame_read_float(network_message* msg)
+{
+	unsigned int bits = network_message_read_bits(msg,32);
+	float value;
+	memcpy(&value,&bits,4);
+	return value;
+}
+
+
+//==============================================================================
+// Returns frame for the given cycle (cycle 0 is the local frame)
+//==============================================================================
+network_frame* network_frames_get(network_frames* history, unsigned int cycle)
+{
+	network_frame* frame;
+	if (cycle == 0) return &history->local;
+
+	frame = &history->frames[cycle % NETWORK_FRAME_HISTORY];
+	if (frame->cycle != cycle) return 0;
+	return frame;
+}
+
+
+//==============================================================================
+// Compute which groups of variables changed relative to base record
+//==============================================================================
+static int network_frame_delta(network_frame_vessel* v, network_frame_vessel* b)
+{
+	int bits = 0;
+	if (!b) return 0xFF;
+
+	if ((fabs(v->x - b->x) > 0.10) || //10 cm precision
+		(fabs(v->y - b->y) > 0.10) ||
+		(fabs(v->z - b->z) > 0.10)) bits |= NETWORK_FRAME_COORDINATES;
+	if ((fabs(v->vx - b->vx) > 0.1) ||
+		(fabs(v->vy - b->vy) > 0.1) ||
+		(fabs(v->vz - b->vz) > 0.1)) bits |= NETWORK_FRAME_VELOCITY;
+	if ((fabs(v->ax - b->ax) > 0.5) ||
+		(fabs(v->ay - b->ay) > 0.5) ||
+		(fabs(v->az - b->az) > 0.5)) bits |= NETWORK_FRAME_ACCELERATION;
+	if ((fabs(v->q[0] - b->q[0]) > 0.02) ||
+		(fabs(v->q[1] - b->q[1]) > 0.02) ||
+		(fabs(v->q[2] - b->q[2]) > 0.02) ||
+		(fabs(v->q[3] - b->q[3]) > 0.02)) bits |= NETWORK_FRAME_ORIENTATION;
+	if ((fabs(v->P - b->P) > 0.05) ||
+		(fabs(v->Q - b->Q) > 0.05) ||
+		(fabs(v->R - b->R) > 0.05)) bits |= NETWORK_FRAME_ANGVELOCITY;
+	if ((fabs(v->cx - b->cx) > 0.1) ||
+		(fabs(v->cy - b->cy) > 0.1) ||
+		(fabs(v->cz - b->cz) > 0.1)) bits |= NETWORK_FRAME_CENTERPOINT;
+	if ((fabs(v->jxx - b->jxx) > 0.1) ||
+		(fabs(v->jyy - b->jyy) > 0.1) ||
+		(fabs(v->jzz - b->jzz) > 0.1) ||
+		(fabs(v->chassis - b->chassis) > 0.1) ||
+		(fabs(v->hull - b->hull) > 0.1)) bits |= NETWORK_FRAME_STATIC_MASS;
+	if ((fabs(v->fuel[0] - b->fuel[0]) > 10.0) ||
+		(fabs(v->fuel[1] - b->fuel[1]) > 10.0) ||
+		(fabs(v->fuel[2] - b->fuel[2]) > 10.0) ||
+		(fabs(v->fuel[3] - b->fuel[3]) > 10.0)) bits |= NETWORK_FRAME_DYNAMIC_MASS;
+	return bits;
+}
+
+//Groups of variables which differ from base record at all (records are quantized,
+//so values written as differences are reconstructed exactly)
+static int network_frame_changed(network_frame_vessel* v, network_frame_vessel* b)
+{
+	int bits = 0;
+	if (!b) return 0xFF;
+
+	if ((v->x != b->x) || (v->y != b->y) || (v->z != b->z)) bits |= NETWORK_FRAME_COORDINATES;
+	if ((v->vx != b->vx) || (v->vy != b->vy) || (v->vz != b->vz)) bits |= NETWORK_FRAME_VELOCITY;
+	if ((v->ax != b->ax) || (v->ay != b->ay) || (v->az != b->az)) bits |= NETWORK_FRAME_ACCELERATION;
+	if ((v->q_largest != b->q_largest) ||
+		(v->q_packed[0] != b->q_packed[0]) ||
+		(v->q_packed[1] != b->q_packed[1]) ||
+		(v->q_packed[2] != b->q_packed[2])) bits |= NETWORK_FRAME_ORIENTATION;
+	if ((v->P != b->P) || (v->Q != b->Q) || (v->R != b->R)) bits |= NETWORK_FRAME_ANGVELOCITY;
+	if ((v->cx != b->cx) || (v->cy != b->cy) || (v->cz != b->cz)) bits |= NETWORK_FRAME_CENTERPOINT;
+	if ((v->jxx != b->jxx) || (v->jyy != b->jyy) || (v->jzz != b->jzz) ||
+		(v->chassis != b->chassis) || (v->hull != b->hull)) bits |= NETWORK_FRAME_STATIC_MASS;
+	if ((v->fuel[0] != b->fuel[0]) || (v->fuel[1] != b->fuel[1]) ||
+		(v->fuel[2] != b->fuel[2]) || (v->fuel[3] != b->fuel[3])) bits |= NETWORK_FRAME_DYNAMIC_MASS;
+	return bits;
+}
+
+//Keep values of the previous frame for groups which changed less than the threshold
+static void network_frame_hold(network_frame_vessel* v, network_frame_vessel* prev)
+{
+	int bits = network_frame_delta(v,prev);
+	if (!(bits & NETWORK_FRAME_COORDINATES)) {
+		v->x = prev->x; v->y = prev->y; v->z = prev->z;
+	}
+	if (!(bits & NETWORK_FRAME_VELOCITY)) {
+		v->vx = prev->vx; v->vy = prev->vy; v->vz = prev->vz;
+	}
+	if (!(bits & NETWORK_FRAME_ACCELERATION)) {
+		v->ax = prev->ax; v->ay = prev->ay; v->az = prev->az;
+	}
+	if (!(bits & NETWORK_FRAME_ORIENTATION)) {
+		memcpy(v->q,prev->q,sizeof(v->q));
+		memcpy(v->q_packed,prev->q_packed,sizeof(v->q_packed));
+		v->q_largest = prev->q_largest;
+	}
+	if (!(bits & NETWORK_FRAME_ANGVELOCITY)) {
+		v->P = prev->P; v->Q = prev->Q; v->R = prev->R;
+	}
+	if (!(bits & NETWORK_FRAME_CENTERPOINT)) {
+		v->cx = prev->cx; v->cy = prev->cy; v->cz = prev->cz;
+	}
+	if (!(bits & NETWORK_FRAME_STATIC_MASS)) {
+		v->jxx = prev->jxx; v->jyy = prev->jyy; v->jzz = prev->jzz;
+		v->chassis = prev->chassis; v->hull = prev->hull;
+	}
+	if (!(bits & NETWORK_FRAME_DYNAMIC_MASS)) {
+		memcpy(v->fuel,prev->fuel,sizeof(v->fuel));
+	}
+}
+
+
+//==============================================================================
+// Capture current state of the world into frame
+//==============================================================================
+void network_frame_capture(network_frames* history, unsigned int cycle, double time, int is_client)
+{
+	network_frame* frame;
+	network_frame* prev_frame = 0;
+	double start_time = curtime();
+	int j,k;
+
+	if (cycle > 1) prev_frame = network_frames_get(history,cycle-1);
+	if (cycle == 0) frame = &history->local;
+	else			frame = &history->frames[cycle % NETWORK_FRAME_HISTORY];
+	frame->cycle = cycle;
+	frame->time = time;
+	frame->count = 0;
+	network_frame_reserve(frame,vessel_count);
+
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		vessel* v = &vessels[vessels_slots.active[k]];
+		network_frame_vessel* rec;
+
+		//Fetch only vessels which exist and are not networked (client sends only own vessels)
+		if ((!v->exists) || (v->net_id <= 0) ||
+			(v->physics_type == VESSEL_PHYSICS_DISABLED) ||
+			(is_client && v->networked)) continue;
+
+		//Make sure coordinates are correct
+		vessels_get_ni(v);
+
+		//Read vessel data
+		rec = &frame->vessels[frame->count++];
+		rec->net_id = v->net_id;
+		rec->networked = 0;
+		rec->index = v->index;
+		rec->client_id = v->networked ? v->client_id : -1;
+		rec->x = (float)(v->noninertial.x - v->noninertial.cx);
+		rec->y = (float)(v->noninertial.y - v->noninertial.cy);
+		rec->z = (float)(v->noninertial.z - v->noninertial.cz);
+		rec->vx = (float)v->noninertial.vx;
+		rec->vy = (float)v->noninertial.vy;
+		rec->vz = (float)v->noninertial.vz;
+		rec->ax = (float)v->noninertial.ax;
+		rec->ay = (float)v->noninertial.ay;
+		rec->az = (float)v->noninertial.az;
+		rec->q[0] = (float)v->noninertial.q[0];
+		rec->q[1] = (float)v->noninertial.q[1];
+		rec->q[2] = (float)v->noninertial.q[2];
+		rec->q[3] = (float)v->noninertial.q[3];
+		rec->P = (float)v->noninertial.P;
+		rec->Q = (float)v->noninertial.Q;
+		rec->R = (float)v->noninertial.R;
+		rec->cx = v->noninertial.cx;
+		rec->cy = v->noninertial.cy;
+		rec->cz = v->noninertial.cz;
+
+		//Vessel physics parameters
+		rec->jxx = (float)v->jxx;
+		rec->jyy = (float)v->jyy;
+		rec->jzz = (float)v->jzz;
+		rec->chassis = (float)v->weight.chassis;
+		rec->hull = (float)v->weight.hull;
+		rec->fuel[0] = (float)v->weight.fuel[0];
+		rec->fuel[1] = (float)v->weight.fuel[1];
+		rec->fuel[2] = (float)v->weight.fuel[2];
+		rec->fuel[3] = (float)v->weight.fuel[3];
+		network_frame_quantize_record(rec);
+	}
+	network_frame_sort(frame);
+
+	//Hold values which changed less than the thresholds since previous frame
+	if (prev_frame) {
+		for (k = 0, j = 0; k < frame->count; k++) {
+			network_frame_vessel* rec = &frame->vessels[k];
+			while ((j < prev_frame->count) && (prev_frame->vessels[j].net_id < rec->net_id)) j++;
+			if ((j < prev_frame->count) && (prev_frame->vessels[j].net_id == rec->net_id)) {
+				network_frame_hold(rec,&prev_frame->vessels[j]);
+			}
+		}
+	}
+
+	history->stats.captures++;
+	history->stats.capture_time += curtime() - start_time;
+}
+
+
+//==============================================================================
+// Interest management
+//==============================================================================
+//Allocate priority accumulators for every vessel index (vessels array may grow)
+static void network_frame_client_reserve(network_frame_client* client)
+{
+	int i;
+	if (vessel_alloc_count <= client->priority_count) return;
+
+	//New vessels are sent right away
+	client->priority = (float*)realloc(client->priority,sizeof(float)*vessel_alloc_count);
+	for (i = client->priority_count; i < vessel_alloc_count; i++) client->priority[i] = 1.0f;
+	client->priority_count = vessel_alloc_count;
+}
+
+network_frame_client* network_frame_client_create(int client_id)
+{
+	network_frame_client* client = (network_frame_client*)malloc(sizeof(network_frame_client));
+	memset(client,0,sizeof(network_frame_client));
+	client->client_id = client_id;
+	network_frame_client_reserve(client);
+	return client;
+}
+
+void network_frame_client_destroy(network_frame_client* client)
+{
+	int i;
+	for (i = 0; i < NETWORK_FRAME_HISTORY; i++) {
+		if (client->included[i].bits) free(client->included[i].bits);
+	}
+	if (client->distance) free(client->distance);
+	free(client->priority);
+	free(client);
+}
+
+static void network_frame_cell(network_frame_vessel* v, int* x, int* y, int* z)
+{
+	*x = (int)floor((v->x + v->cx)/NETWORK_INTEREST_FAR);
+	*y = (int)floor((v->y + v->cy)/NETWORK_INTEREST_FAR);
+	*z = (int)floor((v->z + v->cz)/NETWORK_INTEREST_FAR);
+}
+
+static int network_frame_cell_hash(int x, int y, int z, int size)
+{
+	return (int)((((unsigned int)x*73856093u) ^ ((unsigned int)y*19349663u) ^ ((unsigned int)z*83492791u)) & (size-1));
+}
+
+//Build spatial index of the frame (once per frame)
+static void network_frame_build_index(network_frames* history, network_frame* frame)
+{
+	int i,size = 64;
+	if ((history->index.cycle == frame->cycle) && (history->index.cells)) return;
+	history->index.cycle = frame->cycle;
+
+	while (size < frame->count*2) size *= 2;
+	if (size != history->index.size) {
+		history->index.cells = (int*)realloc(history->index.cells,sizeof(int)*size);
+		history->index.size = size;
+	}
+	if (frame->count > history->index.alloc_count) {
+		history->index.next = (int*)realloc(history->index.next,sizeof(int)*frame->count);
+		history->index.alloc_count = frame->count;
+	}
+
+	for (i = 0; i < size; i++) history->index.cells[i] = -1;
+	for (i = 0; i < frame->count; i++) {
+		int x,y,z,h;
+		network_frame_cell(&frame->vessels[i],&x,&y,&z);
+		h = network_frame_cell_hash(x,y,z,size);
+		history->index.next[i] = history->index.cells[h];
+		history->index.cells[h] = i;
+	}
+}
+
+//Compute distance from client vessels to every vessel in the frame (-1 if too far).
+//Returns number of vessels owned by client
+static int network_frame_client_distances(network_frames* history, network_frame_client* client, network_frame* frame)
+{
+	int i,own_count = 0;
+	if (frame->count > client->distance_count) {
+		client->distance = (float*)realloc(client->distance,sizeof(float)*frame->count);
+		client->distance_count = frame->count;
+	}
+	for (i = 0; i < frame->count; i++) client->distance[i] = -1.0f;
+
+	for (i = 0; i < frame->count; i++) {
+		network_frame_vessel* v = &frame->vessels[i];
+		double vx = v->x + v->cx;
+		double vy = v->y + v->cy;
+		double vz = v->z + v->cz;
+		int x,y,z,dx,dy,dz;
+		if (v->client_id != client->client_id) continue;
+		own_count++;
+
+		//Check all cells around client vessel
+		network_frame_cell(v,&x,&y,&z);
+		for (dx = -1; dx <= 1; dx++) {
+			for (dy = -1; dy <= 1; dy++) {
+				for (dz = -1; dz <= 1; dz++) {
+					int k = history->index.cells[network_frame_cell_hash(x+dx,y+dy,z+dz,history->index.size)];
+					for (; k >= 0; k = history->index.next[k]) {
+						network_frame_vessel* t = &frame->vessels[k];
+						double d = sqrt((t->x + t->cx - vx)*(t->x + t->cx - vx)+
+						                (t->y + t->cy - vy)*(t->y + t->cy - vy)+
+						                (t->z + t->cz - vz)*(t->z + t->cz - vz));
+						if ((d < NETWORK_INTEREST_FAR) &&
+							((client->distance[k] < 0.0f) || (d < client->distance[k]))) {
+							client->distance[k] = (float)d;
+						}
+					}
+				}
+			}
+		}
+	}
+	return own_count;
+}
+
+//Rate at which vessel must be sent to the client (1.0: every frame)
+static float network_frame_priority(network_frame_client* client, network_frame_vessel* v, float distance, int own_count)
+{
+	if ((own_count == 0) || (v->client_id == client->client_id)) return 1.0f;
+	if (distance < 0.0f) return (float)NETWORK_INTEREST_MIN_PRIORITY;
+	if (distance < NETWORK_INTEREST_NEAR) return 1.0f;
+	return (float)max(NETWORK_INTEREST_MIN_PRIORITY,NETWORK_INTEREST_NEAR/distance);
+}
+
+
+//==============================================================================
+// Writes delta between frames into message. Returns 0 if base frame is unknown.
+// If client is given, only vessels relevant for the client are written
+//==============================================================================
+int network_frame_write(network_frames* history, network_frame_client* client,
+						unsigned int base_cycle, unsigned int cycle, network_message* msg)
+{
+	network_frame* frame = network_frames_get(history,cycle);
+	network_frame* base_frame = 0;
+	double start_time = curtime();
+	int start_offset = msg->offset;
+	int prev_net_id = 0;
+	int prev_bits = 0;
+	unsigned char* base_included = 0;
+	unsigned char* included = 0;
+	int own_count = 0;
+	int dt_ms = 0;
+	int i,j;
+
+	if (!frame) return 0;
+	if (base_cycle != 0) {
+		base_frame = network_frames_get(history,base_cycle);
+		if (!base_frame) return 0;
+		dt_ms = (int)floor((frame->time - base_frame->time)*1000.0+0.5);
+		dt_ms = max(0,min(NETWORK_FRAME_MAX_DT,dt_ms));
+	}
+	network_frame_write_unsigned(msg,dt_ms);
+
+	//Prepare interest management
+	if (client) {
+		int slot = cycle % NETWORK_FRAME_HISTORY;
+		int size = (frame->count+7)/8;
+		if (base_frame && (client->included[base_cycle % NETWORK_FRAME_HISTORY].cycle == base_cycle)) {
+			base_included = client->included[base_cycle % NETWORK_FRAME_HISTORY].bits;
+		}
+		if (size > client->included[slot].size) {
+			client->included[slot].bits = (unsigned char*)realloc(client->included[slot].bits,size);
+			client->included[slot].size = size;
+		}
+		if (size > 0) memset(client->included[slot].bits,0,size);
+		client->included[slot].cycle = cycle;
+		included = client->included[slot].bits;
+
+		network_frame_client_reserve(client);
+		network_frame_build_index(history,frame);
+		own_count = network_frame_client_distances(history,client,frame);
+	}
+
+	for (i = 0, j = 0; i < frame->count; i++) {
+		network_frame_vessel* v = &frame->vessels[i];
+		network_frame_vessel* b = 0;
+		network_frame_vessel* d = 0; //Base of values written as differences
+		int bits;
+
+		//Find matching vessel in base frame (both are sorted by network ID)
+		if (base_frame) {
+			while ((j < base_frame->count) && (base_frame->vessels[j].net_id < v->net_id)) j++;
+			if ((j < base_frame->count) && (base_frame->vessels[j].net_id == v->net_id)) {
+				b = &base_frame->vessels[j];
+			}
+		}
+
+		//Only vessels which were not received from remote side are sent
+		if (v->networked) continue;
+
+		//Skip vessels which are not relevant for client, send full state
+		//if client did not receive vessel in base frame
+		if (client) {
+			if ((v->index >= 0) && (v->index < client->priority_count)) {
+				float* priority = &client->priority[v->index];
+				*priority += network_frame_priority(client,v,client->distance[i],own_count);
+				if (*priority < 1.0f) {
+					client->stats.vessels_skipped++;
+					continue;
+				}
+				*priority = min(1.0f,*priority - 1.0f);
+			}
+			//Base record was replaced by client state after it was sent
+			if (b && b->networked) b = 0;
+			if (b && !(base_included && (base_included[j/8] & (1 << (j%8))))) b = 0;
+			d = b;
+		}
+
+		//Client received exactly the base record, so any change is written
+		bits = d ? network_frame_changed(v,d) : network_frame_delta(v,b);
+		if (!bits) {
+			if (included) included[i/8] |= 1 << (i%8);
+			continue;
+		}
+
+		//Grow message if required, stop if out of memory
+		if (!network_message_reserve(msg,NETWORK_FRAME_MAX_RECORD+1)) break;
+		if (included) included[i/8] |= 1 << (i%8);
+
+		network_message_write_bits(msg,bits == prev_bits,1);
+		if (bits != prev_bits) network_message_write_bits(msg,bits,8);
+		network_message_write_bits(msg,d != 0,1);
+		network_message_write_bits(msg,v->net_id == prev_net_id+1,1);
+		if (v->net_id != prev_net_id+1) {
+			network_frame_write_unsigned(msg,(unsigned int)v->net_id - (unsigned int)prev_net_id);
+		}
+		prev_net_id = v->net_id;
+		prev_bits = bits;
+		if (bits & NETWORK_FRAME_CENTERPOINT) {
+			double values[3] = { v->cx, v->cy, v->cz };
+			double base[3] = { 0.0, 0.0, 0.0 };
+			if (d) { base[0] = d->cx; base[1] = d->cy; base[2] = d->cz; }
+			network_frame_write_group(msg,values,d ? base : 0,3,NETWORK_FRAME_STEP_CENTERPOINT);
+		}
+		if (bits & NETWORK_FRAME_COORDINATES) {
+			double values[3] = { v->x, v->y, v->z };
+			double base[3] = { 0.0, 0.0, 0.0 };
+			if (d) {
+				base[0] = network_frame_predict_position(d->x+d->cx-v->cx,d->vx,d->ax,dt_ms);
+				base[1] = network_frame_predict_position(d->y+d->cy-v->cy,d->vy,d->ay,dt_ms);
+				base[2] = network_frame_predict_position(d->z+d->cz-v->cz,d->vz,d->az,dt_ms);
+			}
+			network_frame_write_group(msg,values,d ? base : 0,3,NETWORK_FRAME_STEP_POSITION);
+		}
+		if (bits & NETWORK_FRAME_VELOCITY) {
+			double values[3] = { v->vx, v->vy, v->vz };
+			double base[3] = { 0.0, 0.0, 0.0 };
+			if (d) {
+				base[0] = network_frame_predict_velocity(d->vx,d->ax,dt_ms);
+				base[1] = network_frame_predict_velocity(d->vy,d->ay,dt_ms);
+				base[2] = network_frame_predict_velocity(d->vz,d->az,dt_ms);
+			}
+			network_frame_write_group(msg,values,d ? base : 0,3,NETWORK_FRAME_STEP_VELOCITY);
+		}
+		if (bits & NETWORK_FRAME_ACCELERATION) {
+			double values[3] = { v->ax, v->ay, v->az };
+			double base[3] = { 0.0, 0.0, 0.0 };
+			if (d) { base[0] = d->ax; base[1] = d->ay; base[2] = d->az; }
+			network_frame_write_group(msg,values,d ? base : 0,3,NETWORK_FRAME_STEP_ACCELERATION);
+		}
+		if (bits & NETWORK_FRAME_ORIENTATION) {
+			if (d) network_message_write_bits(msg,d->q_largest == v->q_largest,1);
+			if (d && (d->q_largest == v->q_largest)) {
+				double values[3] = { v->q_packed[0], v->q_packed[1], v->q_packed[2] };
+				double base[3] = { d->q_packed[0], d->q_packed[1], d->q_packed[2] };
+				network_frame_write_group(msg,values,base,3,1.0);
+			} else {
+				network_message_write_bits(msg,v->q_largest,2);
+				network_message_write_bits(msg,v->q_packed[0],NETWORK_FRAME_QUATERNION_BITS);
+				network_message_write_bits(msg,v->q_packed[1],NETWORK_FRAME_QUATERNION_BITS);
+				network_message_write_bits(msg,v->q_packed[2],NETWORK_FRAME_QUATERNION_BITS);
+			}
+		}
+		if (bits & NETWORK_FRAME_ANGVELOCITY) {
+			double values[3] = { v->P, v->Q, v->R };
+			double base[3] = { 0.0, 0.0, 0.0 };
+			if (d) { base[0] = d->P; base[1] = d->Q; base[2] = d->R; }
+			network_frame_write_group(msg,values,d ? base : 0,3,NETWORK_FRAME_STEP_RATES);
+		}
+		if (bits & NETWORK_FRAME_STATIC_MASS) {
+			network_frame_write_float(msg,v->jxx);
+			network_frame_write_float(msg,v->jyy);
+			network_frame_write_float(msg,v->jzz);
+			network_frame_write_float(msg,v->chassis);
+			network_frame_write_float(msg,v->hull);
+		}
+		if (bits & NETWORK_FRAME_DYNAMIC_MASS) {
+			double values[4] = { v->fuel[0], v->fuel[1], v->fuel[2], v->fuel[3] };
+			double base[4] = { 0.0, 0.0, 0.0, 0.0 };
+			if (d) { base[0] = d->fuel[0]; base[1] = d->fuel[1]; base[2] = d->fuel[2]; base[3] = d->fuel[3]; }
+			network_frame_write_group(msg,values,d ? base : 0,4,NETWORK_FRAME_STEP_FUEL);
+		}
+		history->stats.vessels_written++;
+		if (client) client->stats.vessels_written++;
+	}
+
+	//Write no compression bits, marking end of the frame
+	network_message_write_bits(msg,0,1);
+	network_message_write_bits(msg,0,8);
+	network_message_flush_bits(msg);
+
+	history->stats.encodes++;
+	history->stats.encode_time += curtime() - start_time;
+	history->stats.bytes_written += msg->offset - start_offset;
+	if (client) {
+		client->stats.encodes++;
+		client->stats.encode_time += curtime() - start_time;
+		client->stats.bytes_written += msg->offset - start_offset;
+	}
+	return 1;
+}
+
+
+//==============================================================================
+// Reads frame from message into given cycle. Returns 0 if base frame is unknown
+//==============================================================================
+int network_frame_read(network_frames* history, unsigned int base_cycle, unsigned int cycle, double time, network_message* msg)
+{
+	network_frame* frame;
+	network_frame* base_frame = 0;
+	double start_time = curtime();
+	int prev_net_id = 0;
+	int prev_bits = 0;
+	int i,base_count,dt_ms;
+
+	if (base_cycle != 0) {
+		base_frame = network_frames_get(history,base_cycle);
+		if (!base_frame) return 0;
+	}
+
+	//Create new frame based on base frame
+	if (cycle == 0) frame = &history->local;
+	else			frame = &history->frames[cycle % NETWORK_FRAME_HISTORY];
+	network_frame_copy(frame,base_frame);
+	frame->cycle = cycle;
+	frame->time = time;
+	base_count = frame->count;
+
+	//Only records read from this message are marked as networked
+	for (i = 0; i < base_count; i++) frame->vessels[i].networked = 0;
+	dt_ms = (int)network_frame_read_unsigned(msg);
+	if ((dt_ms < 0) || (dt_ms > NETWORK_FRAME_MAX_DT)) dt_ms = NETWORK_FRAME_MAX_DT;
+
+	//Read vessels until zero compression bits encountered
+	while (1) {
+		network_frame_vessel* v;
+		double values[4],base[4],offset[3];
+		int bits,delta,net_id;
+
+		if (network_message_read_bits(msg,1)) bits = prev_bits;
+		else bits = network_message_read_bits(msg,8);
+		if ((bits == 0) || (msg->offset >= msg->size)) break;
+		delta = network_message_read_bits(msg,1);
+		if (network_message_read_bits(msg,1)) net_id = prev_net_id+1;
+		else net_id = prev_net_id + (int)network_frame_read_unsigned(msg);
+		prev_net_id = net_id;
+		prev_bits = bits;
+
+		//Find vessel or add a new one
+		v = network_frame_find(frame,base_count,net_id);
+		if (!v) {
+			network_frame_reserve(frame,frame->count+1);
+			v = &frame->vessels[frame->count++];
+			memset(v,0,sizeof(network_frame_vessel));
+			v->net_id = net_id;
+			v->index = -1;
+			v->client_id = -1;
+			v->jxx = 1.0f;
+			v->jyy = 1.0f;
+			v->jzz = 1.0f;
+			v->chassis = 1.0f;
+			v->hull = 1.0f;
+		}
+
+		//Values are written as differences from the record in base frame (position
+		//is predicted in the new coordinate offset)
+		offset[0] = v->cx; offset[1] = v->cy; offset[2] = v->cz;
+		if (bits & NETWORK_FRAME_CENTERPOINT) {
+			network_frame_read_group(msg,values,delta ? offset : 0,3,NETWORK_FRAME_STEP_CENTERPOINT);
+			v->cx = values[0];
+			v->cy = values[1];
+			v->cz = values[2];
+		}
+		if (bits & NETWORK_FRAME_COORDINATES) {
+			base[0] = network_frame_predict_position(v->x+offset[0]-v->cx,v->vx,v->ax,dt_ms);
+			base[1] = network_frame_predict_position(v->y+offset[1]-v->cy,v->vy,v->ay,dt_ms);
+			base[2] = network_frame_predict_position(v->z+offset[2]-v->cz,v->vz,v->az,dt_ms);
+			network_frame_read_group(msg,values,delta ? base : 0,3,NETWORK_FRAME_STEP_POSITION);
+			v->x = (float)values[0];
+			v->y = (float)values[1];
+			v->z = (float)values[2];
+		}
+		if (bits & NETWORK_FRAME_VELOCITY) {
+			base[0] = network_frame_predict_velocity(v->vx,v->ax,dt_ms);
+			base[1] = network_frame_predict_velocity(v->vy,v->ay,dt_ms);
+			base[2] = network_frame_predict_velocity(v->vz,v->az,dt_ms);
+			network_frame_read_group(msg,values,delta ? base : 0,3,NETWORK_FRAME_STEP_VELOCITY);
+			v->vx = (float)values[0];
+			v->vy = (float)values[1];
+			v->vz = (float)values[2];
+		}
+		if (bits & NETWORK_FRAME_ACCELERATION) {
+			base[0] = v->ax; base[1] = v->ay; base[2] = v->az;
+			network_frame_read_group(msg,values,delta ? base : 0,3,NETWORK_FRAME_STEP_ACCELERATION);
+			v->ax = (float)values[0];
+			v->ay = (float)values[1];
+			v->az = (float)values[2];
+		}
+		if (bits & NETWORK_FRAME_ORIENTATION) {
+			if (delta && network_message_read_bits(msg,1)) {
+				base[0] = v->q_packed[0]; base[1] = v->q_packed[1]; base[2] = v->q_packed[2];
+				network_frame_read_group(msg,values,base,3,1.0);
+				v->q_packed[0] = (int)values[0];
+				v->q_packed[1] = (int)values[1];
+				v->q_packed[2] = (int)values[2];
+			} else {
+				v->q_largest = network_message_read_bits(msg,2);
+				v->q_packed[0] = network_message_read_bits(msg,NETWORK_FRAME_QUATERNION_BITS);
+				v->q_packed[1] = network_message_read_bits(msg,NETWORK_FRAME_QUATERNION_BITS);
+				v->q_packed[2] = network_message_read_bits(msg,NETWORK_FRAME_QUATERNION_BITS);
+			}
+			network_frame_unpack_quaternion(v);
+		}
+		if (bits & NETWORK_FRAME_ANGVELOCITY) {
+			base[0] = v->P; base[1] = v->Q; base[2] = v->R;
+			network_frame_read_group(msg,values,delta ? base : 0,3,NETWORK_FRAME_STEP_RATES);
+			v->P = (float)values[0];
+			v->Q = (float)values[1];
+			v->R = (float)values[2];
+		}
+		if (bits & NETWORK_FRAME_STATIC_MASS) {
+			v->jxx = network_frame_read_float(msg);
+			v->jyy = network_frame_read_float(msg);
+			v->jzz = network_frame_read_float(msg);
+			v->chassis = network_frame_read_float(msg);
+			v->hull = network_frame_read_float(msg);
+		}
+		if (bits & NETWORK_FRAME_DYNAMIC_MASS) {
+			base[0] = v->fuel[0]; base[1] = v->fuel[1]; base[2] = v->fuel[2]; base[3] = v->fuel[3];
+			network_frame_read_group(msg,values,delta ? base : 0,4,NETWORK_FRAME_STEP_FUEL);
+			v->fuel[0] = (float)values[0];
+			v->fuel[1] = (float)values[1];
+			v->fuel[2] = (float)values[2];
+			v->fuel[3] = (float)values[3];
+		}
+
+		//Mark as networked
+		v->networked = 1;
+	}
+	network_message_align_bits(msg);
+	if (frame->count != base_count) network_frame_sort(frame);
+
+	history->stats.decodes++;
+	history->stats.decode_time += curtime() - start_time;
+	return 1;
+}
+
+
+//==============================================================================
+// Merge networked vessels from base frame into frame
+//==============================================================================
+void network_frame_merge(network_frames* history, unsigned int cycle, unsigned int base_cycle)
+{
+	network_frame* frame = network_frames_get(history,cycle);
+	network_frame* base_frame = network_frames_get(history,base_cycle);
+	int i,count;
+	if ((!frame) || (!base_frame) || (frame == base_frame)) return;
+
+	count = frame->count;
+	for (i = 0; i < base_frame->count; i++) {
+		network_frame_vessel* v;
+		if (!base_frame->vessels[i].networked) continue;
+
+		v = network_frame_find(frame,count,base_frame->vessels[i].net_id);
+		if (!v) {
+			network_frame_reserve(frame,frame->count+1);
+			v = &frame->vessels[frame->count++];
+		}
+		*v = base_frame->vessels[i];
+	}
+	if (frame->count != count) network_frame_sort(frame);
+}
+
+
+//==============================================================================
+// Updates current state based on the frame (only networked vessels)
+//==============================================================================
+void network_frame_apply(network_frames* history, unsigned int cycle, int client_id)
+{
+	network_frame* frame = network_frames_get(history,cycle);
+	int i,j;
+	if (!frame) return;
+
+	for (i = 0; i < frame->count; i++) {
+		network_frame_vessel* rec = &frame->vessels[i];
+		vessel* v = 0;
+		if (!rec->networked) continue;
+
+		//Find vessel or create a new one
+		j = vessels_find_by_net_id(rec->net_id);
+		if (j >= 0) {
+			v = &vessels[j];
+		} else {
+			int idx = vessels_add();
+			v = &vessels[idx];
+
+			lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_vessels_data);
+			lua_newtable(L);
+			lua_rawseti(L,-2,idx);
+			lua_pop(L,1);
+		}
+
+		vessels_set_exists(v,1);
+		vessels_set_net_id(v,rec->net_id);
+		v->networked = 1;
+		if (client_id >= 0) v->client_id = client_id;
+		v->noninertial.x = rec->x + rec->cx;
+		v->noninertial.y = rec->y + rec->cy;
+		v->noninertial.z = rec->z + rec->cz;
+		v->noninertial.vx = rec->vx;
+		v->noninertial.vy = rec->vy;
+		v->noninertial.vz = rec->vz;
+		v->noninertial.ax = rec->ax;
+		v->noninertial.ay = rec->ay;
+		v->noninertial.az = rec->az;
+		v->noninertial.q[0] = rec->q[0];
+		v->noninertial.q[1] = rec->q[1];
+		v->noninertial.q[2] = rec->q[2];
+		v->noninertial.q[3] = rec->q[3];
+		v->noninertial.P = rec->P;
+		v->noninertial.Q = rec->Q;
+		v->noninertial.R = rec->R;
+		v->noninertial.cx = rec->cx;
+		v->noninertial.cy = rec->cy;
+		v->noninertial.cz = rec->cz;
+
+		if ((v->jxx != rec->jxx) || (v->jyy != rec->jyy) || (v->jzz != rec->jzz) ||
+			(v->weight.chassis != rec->chassis) || (v->weight.hull != rec->hull) ||
+			(v->weight.fuel[0] != rec->fuel[0]) || (v->weight.fuel[1] != rec->fuel[1]) ||
+			(v->weight.fuel[2] != rec->fuel[2]) || (v->weight.fuel[3] != rec->fuel[3])) {
+			v->mass_dirty = 1;
+		}
+		v->jxx = rec->jxx;
+		v->jyy = rec->jyy;
+		v->jzz = rec->jzz;
+		v->weight.chassis = rec->chassis;
+		v->weight.hull = rec->hull;
+		v->weight.fuel[0] = rec->fuel[0];
+		v->weight.fuel[1] = rec->fuel[1];
+		v->weight.fuel[2] = rec->fuel[2];
+		v->weight.fuel[3] = rec->fuel[3];
+
+		//Reset physics type and update networking timer
+		v->physics_type = VESSEL_PHYSICS_NONINERTIAL;
+		v->last_update = network_time();
+	}
+}
+
+
+//==============================================================================
+// Highlevel API for frames
+//==============================================================================
+int network_highlevel_newframehistory(lua_State* L)
+{
+	highlevel_newptr("FrameHistory",network_frames_create());
+	return 1;
+}
+
+int network_highlevel_destroyframehistory(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	highlevel_checkzero(L,1);
+
+	network_frames_destroy(highlevel_getptr(L,1));
+	highlevel_setptr(L,1,0);
+	return 0;
+}
+
+int network_highlevel_hasframe(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	highlevel_checkzero(L,1);
+
+	lua_pushboolean(L,network_frames_get(highlevel_getptr(L,1),(unsigned int)luaL_checknumber(L,2)) != 0);
+	return 1;
+}
+
+int network_highlevel_getframetime(lua_State* L)
+{
+	network_frame* frame;
+	luaL_checkudata(L,1,"FrameHistory");
+	highlevel_checkzero(L,1);
+
+	frame = network_frames_get(highlevel_getptr(L,1),(unsigned int)luaL_checknumber(L,2));
+	if (frame) {
+		lua_pushnumber(L,frame->time);
+	} else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+int network_highlevel_captureframe(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	luaL_checktype(L,2,LUA_TNUMBER); //Cycle
+	luaL_checktype(L,3,LUA_TNUMBER); //Time
+	highlevel_checkzero(L,1);
+
+	network_frame_capture(highlevel_getptr(L,1),(unsigned int)lua_tonumber(L,2),
+		lua_tonumber(L,3),lua_toboolean(L,4));
+	return 0;
+}
+
+int network_highlevel_writeframe(lua_State* L)
+{
+	network_frame_client* client = 0;
+	luaL_checkudata(L,1,"FrameHistory");
+	luaL_checktype(L,2,LUA_TNUMBER); //Base cycle
+	luaL_checktype(L,3,LUA_TNUMBER); //Cycle
+	luaL_checkudata(L,4,"NetworkMessage");
+	highlevel_checkzero(L,1);
+	highlevel_checkzero(L,4);
+	if (!lua_isnoneornil(L,5)) {
+		luaL_checkudata(L,5,"FrameClient");
+		highlevel_checkzero(L,5);
+		client = highlevel_getptr(L,5);
+	}
+
+	lua_pushboolean(L,network_frame_write(highlevel_getptr(L,1),client,
+		(unsigned int)lua_tonumber(L,2),(unsigned int)lua_tonumber(L,3),highlevel_getptr(L,4)));
+	return 1;
+}
+
+int network_highlevel_readframe(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	luaL_checktype(L,2,LUA_TNUMBER); //Base cycle
+	luaL_checktype(L,3,LUA_TNUMBER); //Cycle
+	luaL_checktype(L,4,LUA_TNUMBER); //Time
+	luaL_checkudata(L,5,"NetworkMessage");
+	highlevel_checkzero(L,1);
+	highlevel_checkzero(L,5);
+
+	lua_pushboolean(L,network_frame_read(highlevel_getptr(L,1),
+		(unsigned int)lua_tonumber(L,2),(unsigned int)lua_tonumber(L,3),
+		lua_tonumber(L,4),highlevel_getptr(L,5)));
+	return 1;
+}
+
+int network_highlevel_mergeframe(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	luaL_checktype(L,2,LUA_TNUMBER); //Cycle
+	luaL_checktype(L,3,LUA_TNUMBER); //Merged cycle
+	highlevel_checkzero(L,1);
+
+	network_frame_merge(highlevel_getptr(L,1),(unsigned int)lua_tonumber(L,2),(unsigned int)lua_tonumber(L,3));
+	return 0;
+}
+
+int network_highlevel_applyframe(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameHistory");
+	luaL_checktype(L,2,LUA_TNUMBER); //Cycle
+	highlevel_checkzero(L,1);
+
+	network_frame_apply(highlevel_getptr(L,1),(unsigned int)lua_tonumber(L,2),luaL_optint(L,3,-1));
+	return 0;
+}
+int network_highlevel_newframeclient(lua_State* L)
+{
+	luaL_checktype(L,1,LUA_TNUMBER); //Client ID
+	highlevel_newptr("FrameClient",network_frame_client_create(lua_tointeger(L,1)));
+	return 1;
+}
+int network_highlevel_destroyframeclient(lua_State* L)
+{
+	luaL_checkudata(L,1,"FrameClient");
+	highlevel_checkzero(L,1);
+
+	network_frame_client_destroy(highlevel_getptr(L,1));
+	highlevel_setptr(L,1,0);
+	return 0;
+}
+int network_highlevel_getframeclientstats(lua_State* L)
+{
+	network_frame_client* client;
+	luaL_checkudata(L,1,"FrameClient");
+	highlevel_checkzero(L,1);
+
+	client = highlevel_getptr(L,1);
+	lua_createtable(L,0,5);
+	lua_pushnumber(L,client->stats.encodes);			lua_setfield(L,-2,"Encodes");
+	lua_pushnumber(L,client->stats.encode_time);		lua_setfield(L,-2,"EncodeTime");
+	lua_pushnumber(L,client->stats.vessels_written);	lua_setfield(L,-2,"VesselsWritten");
+	lua_pushnumber(L,client->stats.vessels_skipped);	lua_setfield(L,-2,"VesselsSkipped");
+	lua_pushnumber(L,client->stats.bytes_written);		lua_setfield(L,-2,"BytesWritten");
+	return 1;
+}
+
+int network_highlevel_getframestats(lua_State* L)
+{
+	network_frames* history;
+	luaL_checkudata(L,1,"FrameHistory");
+	highlevel_checkzero(L,1);
+
+	history = highlevel_getptr(L,1);
+	lua_createtable(L,0,9);
+	lua_pushnumber(L,history->stats.captures);			lua_setfield(L,-2,"Captures");
+	lua_pushnumber(L,history->stats.encodes);			lua_setfield(L,-2,"Encodes");
+	lua_pushnumber(L,history->stats.decodes);			lua_setfield(L,-2,"Decodes");
+	lua_pushnumber(L,history->stats.capture_time);		lua_setfield(L,-2,"CaptureTime");
+	lua_pushnumber(L,history->stats.encode_time);		lua_setfield(L,-2,"EncodeTime");
+	lua_pushnumber(L,history->stats.decode_time);		lua_setfield(L,-2,"DecodeTime");
+	lua_pushnumber(L,history->stats.vessels_written);	lua_setfield(L,-2,"VesselsWritten");
+	lua_pushnumber(L,history->stats.bytes_written);		lua_setfield(L,-2,"BytesWritten");
+	lua_pushnumber(L,history->stats.bytes_written/max(1.0,history->stats.vessels_written));
+	lua_setfield(L,-2,"BytesPerVessel");
+	return 1;
+}
+
+
+//==============================================================================
+// Register frame API
+//==============================================================================
+void network_frame_initialize()
+{
+	highlevel_addfunction("NetAPI","NewFrameHistory",network_highlevel_newframehistory);
+	highlevel_addfunction("NetAPI","DestroyFrameHistory",network_highlevel_destroyframehistory);
+	highlevel_addfunction("NetAPI","HasFrame",network_highlevel_hasframe);
+	highlevel_addfunction("NetAPI","GetFrameTime",network_highlevel_getframetime);
+	highlevel_addfunction("NetAPI","CaptureFrame",network_highlevel_captureframe);
+	highlevel_addfunction("NetAPI","WriteFrame",network_highlevel_writeframe);
+	highlevel_addfunction("NetAPI","ReadFrame",network_highlevel_readframe);
+	highlevel_addfunction("NetAPI","MergeFrame",network_highlevel_mergeframe);
+	highlevel_addfunction("NetAPI","ApplyFrame",network_highlevel_applyframe);
+	highlevel_addfunction("NetAPI","GetFrameStats",network_highlevel_getframestats);
+	highlevel_addfunction("NetAPI","NewFrameClient",network_highlevel_newframeclient);
+	highlevel_addfunction("NetAPI","DestroyFrameClient",network_highlevel_destroyframeclient);
+	highlevel_addfunction("NetAPI","GetFrameClientStats",network_highlevel_getframeclientstats);
+}
@@ -18,6 +18,7 @@
 //#include "physics.h"     //Physics simulation
 //#include "planet.h"      //Planet stuff
 #include "network.h"     //High-level networking
+#include "threading.h"   //Threading system
 
 //Resource management
 int xspace_initialized_all = 0;
@@ -30,6 +31,9 @@ void xspace_initialize_all()
 {
 	if (xspace_initialized_all) xspace_deinitialize_all();
 
+	//Initialize threading system (network thread)
+	thread_initialize();
+
 	//Initialize highlevel stuff
 	highlevel_initialize(); //allocates lua memory
 	highlevel_load(FROM_PLUGINS("lua/initialize.lua")); //allocates lua memory
@@ -70,6 +74,9 @@ void xspace_deinitialize_all()
 	//gui_deinitialize(); //free menu items
 	highlevel_deinitialize(); //free lua memory
 
+	//Deinitialize threading system
+	thread_deinitialize();
+
 	//Mark that X-Space is not loaded
 	xspace_initialized_all = 0;
 }
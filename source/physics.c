@@ -9,6 +9,7 @@
 #include "quaternion.h"
 #include "coordsys.h"
 #include "config.h"
+#include "thirdbody.h"
 
 //Current orbit
 orbit current_orbit;
@@ -33,7 +34,7 @@ void physics_initialize()
  ******************************************************************************/
 void physics_update(float dt)
 {
-	int i;
+	int i,k;
 	double w;
 
 	//Update number of orbits around Earth
@@ -52,7 +53,8 @@ void physics_update(float dt)
 	}
 
 	//Update orbital elements for all vessels
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists) {
 			kostStateVector state;
 			kostOrbitParam params;
@@ -192,7 +194,7 @@ void physics_force_bodygravity(vessel* v, vessel* b, double t, double rv[6], dou
 
 void physics_getforces(vessel* v, double t, double rv[6], double va[6])
 {
-	int i;
+	int i,k;
 	double ax,ay,az; //Acceleration vector
 	double rx,ry,rz; //Position vector
 	double nx,ny,nz; //Temporary vector
@@ -220,9 +222,14 @@ void physics_getforces(vessel* v, double t, double rv[6], double va[6])
 
 	//Apply long-term forces
 	physics_force_gravity(v,t,rv,va);
-	for (i = 0; i < vessel_count; i++) {
-		if ((vessels[i].exists) && (vessels[i].net_id >= 1000000)) {
-			physics_force_bodygravity(v,&vessels[i],t,rv,va);
+	if (thirdbody_count) {
+		thirdbody_acceleration(t,rv,&va[3]);
+	} else { //No ephemeris, use celestial bodies received over network
+		for (k = 0; k < vessels_slots.active_count; k++) {
+			i = vessels_slots.active[k];
+			if ((vessels[i].exists) && (vessels[i].net_id >= 1000000)) {
+				physics_force_bodygravity(v,&vessels[i],t,rv,va);
+			}
 		}
 	}
 
@@ -0,0 +1,215 @@
+//==============================================================================
+// Simulation profiler (time spent in every subsystem)
+//==============================================================================
+#ifndef WIN32
+#define _GNU_SOURCE
+#include <time.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "x-space.h"
+#include "highlevel.h"
+#include "curtime.h"
+#include "dataref.h"
+#include "profiler.h"
+#include "highlevel_alloc.h"
+
+//List of subsystems (names are also used for datarefs)
+profiler_section profiler_sections[PROFILER_SECTIONS] = {
+	{ "tick" },
+	{ "vessels" },
+	{ "atmosphere" },
+	{ "geomagnetic" },
+	{ "dragheat" },
+	{ "engines" },
+	{ "radiosys" },
+	{ "integrate" },
+	{ "lua" },
+	{ "callbacks" },
+	{ "heat" },
+	{ "shockwaves" },
+	{ "gc" },
+};
+
+//Number of ticks since statistics were last published
+int profiler_publish_ticks = 0;
+
+//Lua memory statistics
+profiler_memory profiler_lua_memory;
+
+
+//==============================================================================
+// Precise time for profiling
+//==============================================================================
+double profiler_time()
+{
+#if (defined(WIN32)) || (defined(APL))
+	return curtime();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+#endif
+}
+
+
+//==============================================================================
+// Start and stop timing of a section
+//==============================================================================
+void profiler_begin(int section)
+{
+	profiler_section* s = &profiler_sections[section];
+	if (s->depth++ == 0) s->start = profiler_time();
+}
+
+void profiler_end(int section)
+{
+	profiler_section* s = &profiler_sections[section];
+	if (--s->depth == 0) profiler_add(section,profiler_time() - s->start);
+}
+
+//Add time measured elsewhere (for example by a worker thread)
+void profiler_add(int section, double time)
+{
+	profiler_sections[section].total += time;
+	profiler_sections[section].tick += time;
+	profiler_sections[section].calls++;
+}
+
+
+//==============================================================================
+// Finish tick: store per-tick times and update rolling statistics
+//==============================================================================
+int profiler_compare(const void* a, const void* b)
+{
+	double x = *((double*)a);
+	double y = *((double*)b);
+	return (x > y) - (x < y);
+}
+
+void profiler_publish(profiler_section* s)
+{
+	double sorted[PROFILER_HISTORY];
+	double sum = 0.0;
+	int i;
+
+	if (!s->history_count) return;
+	memcpy(sorted,s->history,sizeof(double)*s->history_count);
+	qsort(sorted,s->history_count,sizeof(double),profiler_compare);
+	for (i = 0; i < s->history_count; i++) sum += sorted[i];
+
+	s->min  = (float)(1000.0*sorted[0]);
+	s->max  = (float)(1000.0*sorted[s->history_count-1]);
+	s->mean = (float)(1000.0*sum/s->history_count);
+	s->p99  = (float)(1000.0*sorted[(99*(s->history_count-1))/100]);
+}
+
+void profiler_tick()
+{
+	int i;
+	for (i = 0; i < PROFILER_SECTIONS; i++) {
+		profiler_section* s = &profiler_sections[i];
+		s->history[s->history_position] = s->tick;
+		s->history_position = (s->history_position+1) % PROFILER_HISTORY;
+		if (s->history_count < PROFILER_HISTORY) s->history_count++;
+		s->tick = 0.0;
+	}
+
+	if (++profiler_publish_ticks >= PROFILER_PUBLISH_TICKS) {
+		profiler_publish_ticks = 0;
+		for (i = 0; i < PROFILER_SECTIONS; i++) profiler_publish(&profiler_sections[i]);
+		profiler_lua_memory.used = (float)(highlevel_memory.used/1024.0);
+		profiler_lua_memory.peak = (float)(highlevel_memory.peak/1024.0);
+		profiler_lua_memory.pooled = (float)(highlevel_memory.pooled/1024.0);
+	}
+}
+
+
+//==============================================================================
+// Reset all counters
+//==============================================================================
+void profiler_reset()
+{
+	int i;
+	for (i = 0; i < PROFILER_SECTIONS; i++) {
+		profiler_sections[i].total = 0.0;
+		profiler_sections[i].calls = 0;
+		profiler_sections[i].tick = 0.0;
+		profiler_sections[i].history_count = 0;
+		profiler_sections[i].history_position = 0;
+	}
+	profiler_publish_ticks = 0;
+}
+
+
+//==============================================================================
+// Get profiler statistics (milliseconds per tick)
+//==============================================================================
+int profiler_highlevel_getstats(lua_State* L)
+{
+	int i;
+	lua_createtable(L,0,PROFILER_SECTIONS);
+	for (i = 0; i < PROFILER_SECTIONS; i++) {
+		profiler_section* s = &profiler_sections[i];
+		lua_createtable(L,0,6);
+		lua_pushnumber(L,s->min);		lua_setfield(L,-2,"Min");
+		lua_pushnumber(L,s->mean);		lua_setfield(L,-2,"Mean");
+		lua_pushnumber(L,s->p99);		lua_setfield(L,-2,"P99");
+		lua_pushnumber(L,s->max);		lua_setfield(L,-2,"Max");
+		lua_pushnumber(L,s->total);		lua_setfield(L,-2,"Total");
+		lua_pushnumber(L,s->calls);		lua_setfield(L,-2,"Calls");
+		lua_setfield(L,-2,s->name);
+	}
+	return 1;
+}
+
+int profiler_highlevel_getmemory(lua_State* L)
+{
+	lua_createtable(L,0,6);
+	lua_pushnumber(L,highlevel_memory.used/1024.0);		lua_setfield(L,-2,"Used");
+	lua_pushnumber(L,highlevel_memory.peak/1024.0);		lua_setfield(L,-2,"Peak");
+	lua_pushnumber(L,highlevel_memory.pooled/1024.0);	lua_setfield(L,-2,"Pooled");
+	lua_pushnumber(L,highlevel_memory.allocations);		lua_setfield(L,-2,"Allocations");
+	lua_pushnumber(L,highlevel_memory.pool_allocations);	lua_setfield(L,-2,"PoolAllocations");
+	lua_pushnumber(L,highlevel_memory.gc_cycles);		lua_setfield(L,-2,"GCCycles");
+	return 1;
+}
+
+int profiler_highlevel_reset(lua_State* L)
+{
+	profiler_reset();
+	return 0;
+}
+
+
+//==============================================================================
+// Initialize profiler datarefs and highlevel interface
+//==============================================================================
+void profiler_initialize()
+{
+#if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
+	char name[ARBITRARY_MAX] = { 0 };
+	int i;
+
+	for (i = 0; i < PROFILER_SECTIONS; i++) {
+		snprintf(name,ARBITRARY_MAX-1,"xsp/perf/%s/min",profiler_sections[i].name);
+		dataref_f(name,&profiler_sections[i].min);
+		snprintf(name,ARBITRARY_MAX-1,"xsp/perf/%s/mean",profiler_sections[i].name);
+		dataref_f(name,&profiler_sections[i].mean);
+		snprintf(name,ARBITRARY_MAX-1,"xsp/perf/%s/p99",profiler_sections[i].name);
+		dataref_f(name,&profiler_sections[i].p99);
+		snprintf(name,ARBITRARY_MAX-1,"xsp/perf/%s/max",profiler_sections[i].name);
+		dataref_f(name,&profiler_sections[i].max);
+	}
+	dataref_f("xsp/perf/lua/memory",&profiler_lua_memory.used);
+	dataref_f("xsp/perf/lua/peak",&profiler_lua_memory.peak);
+	dataref_f("xsp/perf/lua/pooled",&profiler_lua_memory.pooled);
+#endif
+
+	lua_createtable(L,0,3);
+	lua_setglobal(L,"ProfilerAPI");
+	highlevel_addfunction("ProfilerAPI","GetStats",profiler_highlevel_getstats);
+	highlevel_addfunction("ProfilerAPI","GetMemory",profiler_highlevel_getmemory);
+	highlevel_addfunction("ProfilerAPI","Reset",profiler_highlevel_reset);
+}
@@ -0,0 +1,65 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+//Simulation subsystems which are profiled
+enum {
+	PROFILER_TICK,			//Entire xspace_update
+	PROFILER_VESSELS,		//Reading, writing and synchronizing vessel state
+	PROFILER_ATMOSPHERE,
+	PROFILER_GEOMAGNETIC,
+	PROFILER_DRAGHEAT,
+	PROFILER_ENGINES,
+	PROFILER_RADIOSYS,
+	PROFILER_INTEGRATE,
+	PROFILER_LUA,			//OnFrame callback
+	PROFILER_CALLBACKS,		//All Lua calls made through highlevel_call
+	PROFILER_HEAT,			//One pass of heat threads over all vessels
+	PROFILER_SHOCKWAVES,	//One pass of shockwave threads over all vessels
+	PROFILER_GC,			//Incremental Lua garbage collection at end of tick
+	PROFILER_SECTIONS
+};
+
+//Number of ticks used for rolling statistics
+#define PROFILER_HISTORY		256
+//Rolling statistics are recomputed every this many ticks
+#define PROFILER_PUBLISH_TICKS	32
+
+//Timing of a single subsystem. Sections are only entered from the simulation
+//thread; worker threads report their own timings which are added in once per tick
+typedef struct profiler_section {
+	char* name;
+	double start;			//Time when section was entered
+	int depth;				//Nesting depth (section may be reentered)
+	double total;			//Total time spent in section
+	int calls;				//Number of times section was entered
+
+	//Rolling statistics
+	double tick;			//Time spent in section during current tick
+	double history[PROFILER_HISTORY];
+	int history_count;
+	int history_position;
+
+	//Published statistics (milliseconds per tick)
+	float min,mean,p99,max;
+} profiler_section;
+
+extern profiler_section profiler_sections[PROFILER_SECTIONS];
+
+//Published Lua memory statistics (kilobytes)
+typedef struct profiler_memory {
+	float used;
+	float peak;
+	float pooled;
+} profiler_memory;
+
+extern profiler_memory profiler_lua_memory;
+
+void profiler_initialize();
+void profiler_begin(int section);
+void profiler_end(int section);
+void profiler_add(int section, double time);
+void profiler_tick();
+void profiler_reset();
+double profiler_time();
+
+#endif
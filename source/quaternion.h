@@ -1,19 +1,334 @@
 #ifndef QUATERNION_H
 #define QUATERNION_H
 
+//==============================================================================
+// Quaternion and vector math
+//------------------------------------------------------------------------------
+// Header-only, all functions are inlined into the caller. Quaternions are
+// stored as { w, x, y, z }. Output may alias any of the inputs.
+//
+// When compiled with SSE2 (always on x64) quaternion products use packed
+// doubles, which gives the same results as the scalar code. Batched rotation
+// of vectors uses AVX when it is enabled.
+//==============================================================================
+#include <math.h>
+
 #ifndef _QUATERNION_TYPE
 #define _QUATERNION_TYPE
 typedef double quaternion[4];
 #endif
 
-void qmul(quaternion q, quaternion q1,quaternion q2);
-void qmul_vec(quaternion q, quaternion q1, double x, double y, double z);
-void qdiv(quaternion q, quaternion q1,quaternion q2);
-void qconj(quaternion q1, quaternion q2);
-void qeuler_from(quaternion q, double x, double y, double z);
-void qeuler_to(quaternion q, double* x, double* y, double* z);
-void qrot_vec(quaternion q, quaternion v);
-void qset_vec(quaternion q, double x, double y, double z);
-void qget_vec(quaternion q, double* x, double* y, double* z);
+#ifdef _MSC_VER
+#define QUATERNION_INLINE static __inline
+#else
+#define QUATERNION_INLINE static inline
+#endif
+
+#if defined(__AVX__)
+#define QUATERNION_AVX
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define QUATERNION_SSE2
+#include <emmintrin.h>
+#endif
+
+
+//==============================================================================
+// Sine and cosine of the same angle
+//==============================================================================
+#if defined(__GNUC__) && (!defined(__clang__))
+#define qsincos(a,s,c) __builtin_sincos(a,s,c)
+#else
+QUATERNION_INLINE void qsincos(double a, double* s, double* c)
+{
+	*s = sin(a);
+	*c = cos(a);
+}
+#endif
+
+
+//==============================================================================
+// Quaternion product (SSE2 kernel)
+//------------------------------------------------------------------------------
+// Result is kept as two halves { w, x } and { y, z }. Terms are added in the
+// same order as in the scalar product, so results are identical.
+//==============================================================================
+#ifdef QUATERNION_SSE2
+QUATERNION_INLINE void qmul_sse2(double* q, const double* a, const double* b, int conjugate_b)
+{
+	const __m128d sign_lo = _mm_set_pd(0.0,-0.0);	//Negate first element
+	const __m128d sign_hi = _mm_set_pd(-0.0,0.0);	//Negate second element
+	const __m128d sign_both = _mm_set_pd(-0.0,-0.0);
+	__m128d b01 = _mm_loadu_pd(b);
+	__m128d b23 = _mm_loadu_pd(b+2);
+	__m128d a0 = _mm_set1_pd(a[0]);
+	__m128d a1 = _mm_set1_pd(a[1]);
+	__m128d a2 = _mm_set1_pd(a[2]);
+	__m128d a3 = _mm_set1_pd(a[3]);
+	__m128d b10,b32,lo,hi;
+
+	if (conjugate_b) {
+		b01 = _mm_xor_pd(b01,sign_hi);
+		b23 = _mm_xor_pd(b23,sign_both);
+	}
+	b10 = _mm_shuffle_pd(b01,b01,1);
+	b32 = _mm_shuffle_pd(b23,b23,1);
+
+	lo = _mm_mul_pd(a0,b01);
+	lo = _mm_add_pd(lo,_mm_mul_pd(a1,_mm_xor_pd(b10,sign_lo)));
+	lo = _mm_add_pd(lo,_mm_mul_pd(a2,_mm_xor_pd(b23,sign_lo)));
+	lo = _mm_add_pd(lo,_mm_mul_pd(a3,_mm_xor_pd(b32,sign_both)));
+
+	hi = _mm_mul_pd(a0,b23);
+	hi = _mm_add_pd(hi,_mm_mul_pd(a1,_mm_xor_pd(b32,sign_lo)));
+	hi = _mm_add_pd(hi,_mm_mul_pd(a2,_mm_xor_pd(b01,sign_hi)));
+	hi = _mm_add_pd(hi,_mm_mul_pd(a3,b10));
+
+	_mm_storeu_pd(q,lo);
+	_mm_storeu_pd(q+2,hi);
+}
+#endif
+
+
+//==============================================================================
+// q = q1*q2
+//==============================================================================
+QUATERNION_INLINE void qmul(quaternion q, quaternion q1, quaternion q2)
+{
+#ifdef QUATERNION_SSE2
+	qmul_sse2(q,q1,q2,0);
+#else
+	double q11 = q1[0];
+	double q12 = q1[1];
+	double q13 = q1[2];
+	double q14 = q1[3];
+
+	double q21 = q2[0];
+	double q22 = q2[1];
+	double q23 = q2[2];
+	double q24 = q2[3];
+
+	q[0] = q11 * q21 - q12 * q22 - q13 * q23 - q14 * q24;
+	q[1] = q11 * q22 + q12 * q21 + q13 * q24 - q14 * q23;
+	q[2] = q11 * q23 - q12 * q24 + q13 * q21 + q14 * q22;
+	q[3] = q11 * q24 + q12 * q23 - q13 * q22 + q14 * q21;
+#endif
+}
+
+
+//==============================================================================
+// q = q1*(0,x,y,z)
+//==============================================================================
+QUATERNION_INLINE void qmul_vec(quaternion q, quaternion q1, double x, double y, double z)
+{
+	double q11 = q1[0];
+	double q12 = q1[1];
+	double q13 = q1[2];
+	double q14 = q1[3];
+
+	q[0] =           - q12 * x - q13 * y - q14 * z;
+	q[1] = q11 * x             + q13 * z - q14 * y;
+	q[2] = q11 * y - q12 * z             + q14 * x;
+	q[3] = q11 * z + q12 * y - q13 * x;
+}
+
+
+//==============================================================================
+// q = q1*conj(q2)
+//==============================================================================
+QUATERNION_INLINE void qdiv(quaternion q, quaternion q1, quaternion q2)
+{
+#ifdef QUATERNION_SSE2
+	qmul_sse2(q,q1,q2,1);
+#else
+	double q11 = q1[0];
+	double q12 = q1[1];
+	double q13 = q1[2];
+	double q14 = q1[3];
+
+	double q21 = q2[0];
+	double q22 = q2[1];
+	double q23 = q2[2];
+	double q24 = q2[3];
+
+	q[0] =   q11 * q21 + q12 * q22 + q13 * q23 + q14 * q24;
+	q[1] = - q11 * q22 + q12 * q21 - q13 * q24 + q14 * q23;
+	q[2] = - q11 * q23 + q12 * q24 + q13 * q21 - q14 * q22;
+	q[3] = - q11 * q24 - q12 * q23 + q13 * q22 + q14 * q21;
+#endif
+}
+
+
+//==============================================================================
+// q1 = conj(q2)
+//==============================================================================
+QUATERNION_INLINE void qconj(quaternion q1, quaternion q2)
+{
+	q1[0] =  q2[0];
+	q1[1] = -q2[1];
+	q1[2] = -q2[2];
+	q1[3] = -q2[3];
+}
+
+
+//==============================================================================
+// Quaternion from Euler angles (roll x, pitch y, yaw z)
+//==============================================================================
+QUATERNION_INLINE void qeuler_from(quaternion q, double x, double y, double z)
+{
+	double s1,s2,s3,c1,c2,c3;
+
+	qsincos(x*0.5,&s1,&c1);
+	qsincos(y*0.5,&s2,&c2);
+	qsincos(z*0.5,&s3,&c3);
+
+	q[0] = c1*c2*c3 + s1*s2*s3;
+	q[1] = s1*c2*c3 - c1*s2*s3;
+	q[2] = c1*s2*c3 + s1*c2*s3;
+	q[3] = c1*c2*s3 - s1*s2*c3;
+}
+
+
+//==============================================================================
+// Euler angles from quaternion
+//==============================================================================
+QUATERNION_INLINE void qeuler_to(quaternion q, double* x, double* y, double* z)
+{
+	double q1 = q[0];
+	double q2 = q[1];
+	double q3 = q[2];
+	double q4 = q[3];
+
+	double sine = 2*(q1*q3 - q4*q2);
+	if (sine > 1.0) sine = 1.0;
+	if (sine < -1.0) sine = -1.0;
+
+	*x = atan2(2*q1*q2+2*q3*q4 , 1 - 2*q2*q2 - 2*q3*q3);
+	*y = asin(sine);
+	*z = atan2(2*q1*q4+2*q2*q3 , 1 - 2*q3*q3 - 2*q4*q4);
+}
+
+
+//==============================================================================
+// Rotation angle and axis of the quaternion
+//==============================================================================
+QUATERNION_INLINE void qrot_vec(quaternion q, quaternion v)
+{
+	double l2 = q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3];
+	double m2 = q[1]*q[1] + q[2]*q[2] + q[3]*q[3];
+	double s = 2 * acos(q[0]/sqrt(l2));
+	if (s > 3.14159265358979323846) s = s - 2*3.14159265358979323846;
+	s = s / sqrt(m2);
+
+	if ((fabs(l2) < 1e-8) || (fabs(m2) < 1e-8)) s = 0;
+
+	v[0] = s;
+	v[1] = q[1];
+	v[2] = q[2];
+	v[3] = q[3];
+}
+
+QUATERNION_INLINE void qset_vec(quaternion q, double x, double y, double z)
+{
+	q[0] = 0;
+	q[1] = x;
+	q[2] = y;
+	q[3] = z;
+}
+
+QUATERNION_INLINE void qget_vec(quaternion q, double* x, double* y, double* z)
+{
+	*x = q[1];
+	*y = q[2];
+	*z = q[3];
+}
+
+
+//==============================================================================
+// Matrix of rotation q*v*conj(q) (quaternion does not have to be normalized,
+// same as the quaternion product)
+//==============================================================================
+QUATERNION_INLINE void qmatrix(double m[3][3], quaternion q)
+{
+	double w = q[0], x = q[1], y = q[2], z = q[3];
+
+	m[0][0] = w*w+x*x-y*y-z*z;	m[0][1] = 2.0*(x*y-w*z);	m[0][2] = 2.0*(x*z+w*y);
+	m[1][0] = 2.0*(x*y+w*z);	m[1][1] = w*w-x*x+y*y-z*z;	m[1][2] = 2.0*(y*z-w*x);
+	m[2][0] = 2.0*(x*z-w*y);	m[2][1] = 2.0*(y*z+w*x);	m[2][2] = w*w-x*x-y*y+z*z;
+}
+
+
+//==============================================================================
+// Rotate vector by quaternion: (0,ox,oy,oz) = q*(0,x,y,z)*conj(q)
+//==============================================================================
+QUATERNION_INLINE void qtransform(quaternion q, double x, double y, double z, double* ox, double* oy, double* oz)
+{
+	double m[3][3];
+
+	qmatrix(m,q);
+	*ox = m[0][0]*x + m[0][1]*y + m[0][2]*z;
+	*oy = m[1][0]*x + m[1][1]*y + m[1][2]*z;
+	*oz = m[2][0]*x + m[2][1]*y + m[2][2]*z;
+}
+
+
+//==============================================================================
+// Rotate count vectors (packed x,y,z) by the same quaternion. Source and
+// destination may be the same array
+//==============================================================================
+QUATERNION_INLINE void qtransform_array(quaternion q, double* src, double* dst, int count)
+{
+	double m[3][3];
+	int i = 0;
+
+	qmatrix(m,q);
+#if defined(QUATERNION_AVX)
+	{
+		//Columns of the matrix, one vector per iteration
+		__m256d c0 = _mm256_set_pd(0.0,m[2][0],m[1][0],m[0][0]);
+		__m256d c1 = _mm256_set_pd(0.0,m[2][1],m[1][1],m[0][1]);
+		__m256d c2 = _mm256_set_pd(0.0,m[2][2],m[1][2],m[0][2]);
+		__m256i mask = _mm256_set_epi64x(0,-1,-1,-1);
+		for (; i < count; i++) {
+			__m256d r = _mm256_mul_pd(c0,_mm256_broadcast_sd(&src[3*i+0]));
+			r = _mm256_add_pd(r,_mm256_mul_pd(c1,_mm256_broadcast_sd(&src[3*i+1])));
+			r = _mm256_add_pd(r,_mm256_mul_pd(c2,_mm256_broadcast_sd(&src[3*i+2])));
+			_mm256_maskstore_pd(&dst[3*i],mask,r);
+		}
+	}
+#elif defined(QUATERNION_SSE2)
+	{
+		//x and y of the result in one register, z separately
+		__m128d c0 = _mm_set_pd(m[1][0],m[0][0]);
+		__m128d c1 = _mm_set_pd(m[1][1],m[0][1]);
+		__m128d c2 = _mm_set_pd(m[1][2],m[0][2]);
+		for (; i < count; i++) {
+			double x = src[3*i+0], y = src[3*i+1], z = src[3*i+2];
+			__m128d r = _mm_mul_pd(c0,_mm_set1_pd(x));
+			r = _mm_add_pd(r,_mm_mul_pd(c1,_mm_set1_pd(y)));
+			r = _mm_add_pd(r,_mm_mul_pd(c2,_mm_set1_pd(z)));
+			_mm_storeu_pd(&dst[3*i],r);
+			dst[3*i+2] = m[2][0]*x + m[2][1]*y + m[2][2]*z;
+		}
+	}
+#endif
+	for (; i < count; i++) {
+		double x = src[3*i+0], y = src[3*i+1], z = src[3*i+2];
+		dst[3*i+0] = m[0][0]*x + m[0][1]*y + m[0][2]*z;
+		dst[3*i+1] = m[1][0]*x + m[1][1]*y + m[1][2]*z;
+		dst[3*i+2] = m[2][0]*x + m[2][1]*y + m[2][2]*z;
+	}
+}
+
+
+//==============================================================================
+// Multiply count pairs of quaternions: q[i] = q1[i]*q2[i]
+//==============================================================================
+QUATERNION_INLINE void qmul_array(quaternion* q, quaternion* q1, quaternion* q2, int count)
+{
+	int i;
+	for (i = 0; i < count; i++) qmul(q[i],q1[i],q2[i]);
+}
 
 #endif
@@ -306,18 +306,18 @@ void radiosys_update(float dt)
 		radiosys_channels[ch].prev_time = radiosys_time;
 
 		//Update all vessels
-		for (i = 0; i < vessel_count; i++) {
-			vessel* src = &vessels[i]; //Source
+		for (i = 0; i < vessels_slots.active_count; i++) {
+			vessel* src = &vessels[vessels_slots.active[i]]; //Source
 			if (!src->exists) continue;
 
 			//Transmit from every vessel to every other vessel
-			for (j = 0; j < vessel_count; j++) {
+			for (j = 0; j < vessels_slots.active_count; j++) {
 				double error_probability;
 				int threshold;
 				int bytes_left = bytes_transferred;
 				int initial_send_buffer_pos = src->radiosys.buffers.send_buffer_sys_position[ch];
 
-				vessel* tgt = &vessels[j]; //Target
+				vessel* tgt = &vessels[vessels_slots.active[j]]; //Target
 				if (j == i) continue;
 				if (!tgt->exists) continue;
 				if (!tgt->radiosys.buffers.channels_recv_used[ch]) continue;
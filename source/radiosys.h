@@ -12,6 +12,8 @@ double radiosys_transmission_model(double x1, double y1, double z1,
 void radiosys_simulate_transmission(double x, double y, double z, int channel, unsigned char data);
 void radiosys_transmit(vessel* v, int channel, unsigned char data);
 int radiosys_receive(vessel* v, int channel);
+void radiosys_transmit_buffer(radio_buffers* buffers, int channel, unsigned char data);
+void radiosys_buffer_advance_recv(radio_buffers* buffers, int channel, unsigned char data);
 
 int radiosys_highlevel_transmit(lua_State* L);
 int radiosys_highlevel_receive(lua_State* L);
@@ -0,0 +1,520 @@
+//==============================================================================
+// Headless benchmark of the dedicated server simulation
+//------------------------------------------------------------------------------
+// Usage: x-benchmark [vessels] [ticks] [seed] [dt]
+//
+// Creates a scenario of vessels in low orbit with a synthetic drag model and
+// random radio traffic, runs a fixed number of ticks at fixed time step, and
+// reports time spent in every subsystem and a checksum of the final state.
+// Also measures cost of reading vessel parameters from Lua for all vessels and
+// cost of ephemeris queries going backwards in time, compares coordinate
+// transforms through cached matrices with quaternion rotation, measures
+// network frame capture and encoding for 64 clients (time and bytes per
+// vessel), and measures network ID lookups for a frame of 5000 networked
+// vessels.
+// Build with "make benchmark LUAJIT=1" to compare the LuaJIT backend.
+// Simulation time does not depend on wall clock, so the same arguments must
+// always produce the same checksum.
+//==============================================================================
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <enet/enet.h>
+
+#include "x-space.h"
+#include "highlevel.h"
+#include "network.h"
+#include "curtime.h"
+#include "vessel.h"
+#include "planet.h"
+#include "dragheat.h"
+#include "radiosys.h"
+#include "profiler.h"
+#include "highlevel_alloc.h"
+#include "sol.h"
+#include "quaternion.h"
+#include "coordsys.h"
+
+//Name of the synthetic drag model
+#define BENCHMARK_MODEL_PATH "."
+#define BENCHMARK_MODEL_NAME "x-benchmark"
+
+//Number of radio channels used for random traffic
+#define BENCHMARK_RADIO_CHANNELS 4
+
+//Number of networked vessels for network ID lookups
+#define BENCHMARK_NETWORK_VESSELS 5000
+
+//Number of clients and frames for network frame encoding
+#define BENCHMARK_NETWORK_CLIENTS 64
+#define BENCHMARK_NETWORK_FRAMES 30
+
+
+//==============================================================================
+//Server timekeeping (simulated time only)
+double current_mjd;
+
+int highlevel_setmjd(lua_State* L)
+{
+	current_mjd = lua_tonumber(L,1);
+	return 0;
+}
+
+int highlevel_getmjd(lua_State* L)
+{
+	lua_pushnumber(L,current_mjd);
+	return 1;
+}
+
+//Networking timeouts run on simulated time, so the checksum does not depend
+//on how fast the benchmark runs
+double benchmark_network_time()
+{
+	return current_mjd*86400.0;
+}
+
+
+//==============================================================================
+// Write drag model of a 2x2x4 m box
+//==============================================================================
+int benchmark_write_model()
+{
+	//Box corners and faces (two triangles per quad, outward normals)
+	static const float corner[8][3] = {
+		{-1,-1,-2}, { 1,-1,-2}, { 1, 1,-2}, {-1, 1,-2},
+		{-1,-1, 2}, { 1,-1, 2}, { 1, 1, 2}, {-1, 1, 2},
+	};
+	static const int quad[6][4] = {
+		{0,3,2,1}, {4,5,6,7}, {0,1,5,4}, {2,3,7,6}, {1,2,6,5}, {3,0,4,7},
+	};
+	char filename[MAX_FILENAME] = { 0 };
+	FILE* f;
+	int i,j;
+
+	snprintf(filename,MAX_FILENAME-1,"%s/%s_drag.dat",BENCHMARK_MODEL_PATH,BENCHMARK_MODEL_NAME);
+	f = fopen(filename,"w+");
+	if (!f) return 0;
+
+	fprintf(f,"Cd 1.0\nK 1.0\nHULL Aluminium\nTRQ 1.0 1.0 1.0\nSHOCKWAVES 0\n");
+	for (i = 0; i < 6; i++) {
+		const float* a = corner[quad[i][0]];
+		const float* b = corner[quad[i][1]];
+		const float* c = corner[quad[i][2]];
+		double ux = b[0]-a[0], uy = b[1]-a[1], uz = b[2]-a[2];
+		double vx = c[0]-a[0], vy = c[1]-a[1], vz = c[2]-a[2];
+		double nx = uy*vz-uz*vy, ny = uz*vx-ux*vz, nz = ux*vy-uy*vx;
+		double area = sqrt(nx*nx+ny*ny+nz*nz);
+
+		for (j = 0; j < 2; j++) {
+			const float* p0 = corner[quad[i][0]];
+			const float* p1 = corner[quad[i][1+j]];
+			const float* p2 = corner[quad[i][2+j]];
+			fprintf(f,"TRI_MAT3 %f %f %f  %f %f %f  %f %f %f  %f %f %f  %f %f %d %s\n",
+				p0[0],p0[1],p0[2],p1[0],p1[1],p1[2],p2[0],p2[1],p2[2],
+				nx/area,ny/area,nz/area,0.5*area,0.005,1,"Aluminium"); //Area is per triangle
+		}
+	}
+	fclose(f);
+	return 1;
+}
+
+
+//==============================================================================
+// Random number in range (uses seeded C library generator)
+//==============================================================================
+double benchmark_random(double a, double b)
+{
+	return a + (b-a)*(rand()/(double)RAND_MAX);
+}
+
+
+//==============================================================================
+// Create vessels in circular orbits between 150 and 400 km
+//==============================================================================
+void benchmark_create_vessels(int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		vessel* v = &vessels[vessels_add()];
+		double r = current_planet.radius + benchmark_random(150e3,400e3);
+		double lon = benchmark_random(-PI,PI);
+		double inc = benchmark_random(0,PI/2);
+		double speed = sqrt(current_planet.mu*1e9/r);
+
+		vessels_set_exists(v,1);
+		vessels_set_net_id(v,1024+i);
+		v->physics_type = VESSEL_PHYSICS_INERTIAL;
+		v->weight.chassis = benchmark_random(500.0,5000.0);
+		v->weight.hull = 100.0;
+		v->jxx = 10;
+		v->jyy = 10;
+		v->jzz = 10;
+
+		v->noninertial.x = r*cos(lon);
+		v->noninertial.y = r*sin(lon);
+		v->noninertial.z = 0;
+		v->noninertial.vx = -speed*sin(lon)*cos(inc);
+		v->noninertial.vy = speed*cos(lon)*cos(inc);
+		v->noninertial.vz = speed*sin(inc);
+		v->noninertial.q[0] = 1;
+		v->noninertial.P = benchmark_random(-0.01,0.01);
+		v->noninertial.Q = benchmark_random(-0.01,0.01);
+		v->noninertial.R = benchmark_random(-0.01,0.01);
+		vessels_set_ni(v);
+
+		dragheat_initialize(v,BENCHMARK_MODEL_PATH,BENCHMARK_MODEL_NAME);
+	}
+}
+
+
+//==============================================================================
+// Send random bytes from random vessels
+//==============================================================================
+void benchmark_radio_traffic(int count)
+{
+	int i;
+	for (i = 0; i < count; i++) {
+		vessel* v = &vessels[rand() % vessel_count];
+		if (v->exists) radiosys_transmit(v,rand() % BENCHMARK_RADIO_CHANNELS,rand() & 0xFF);
+	}
+}
+
+
+//==============================================================================
+// Checksum of the simulation state (FNV-1a over vessel state)
+//==============================================================================
+unsigned int benchmark_checksum_data(unsigned int hash, void* data, int size)
+{
+	unsigned char* bytes = (unsigned char*)data;
+	int i;
+	for (i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+unsigned int benchmark_checksum()
+{
+	unsigned int hash = 2166136261u;
+	int i;
+	for (i = 0; i < vessel_count; i++) {
+		vessel* v = &vessels[i];
+		hash = benchmark_checksum_data(hash,&v->exists,sizeof(v->exists));
+		if (!v->exists) continue;
+		hash = benchmark_checksum_data(hash,&v->inertial.x,sizeof(double)*3);
+		hash = benchmark_checksum_data(hash,&v->inertial.vx,sizeof(double)*3);
+		hash = benchmark_checksum_data(hash,v->inertial.q,sizeof(v->inertial.q));
+		hash = benchmark_checksum_data(hash,&v->inertial.P,sizeof(double)*3);
+	}
+	return hash;
+}
+
+
+//==============================================================================
+// Compare ways of reading vessel parameters from Lua (all vessels, 17 values,
+// repeated 10 times so that LuaJIT traces get compiled)
+//==============================================================================
+const char* benchmark_parameters_code =
+	"local list = { 0,2,4,13,14,15,16,50,51,52,53,54,55,59,60,61,62 }\n"
+	"local count = VesselAPI.GetCount()\n"
+	"local values,state,readers = {},{},{}\n"
+	"for i=1,#list do\n"
+	"  for name,field in pairs(VesselView.Layout.Fields) do\n"
+	"    if field.Index == list[i] then readers[i] = VesselView.Field(name) end\n"
+	"  end\n"
+	"end\n"
+	"local t0 = curtime()\n"
+	"for n=1,10 do for idx=0,count-1 do\n"
+	"  for i=1,#list do values[i] = VesselAPI.GetParameter(idx,list[i]) end\n"
+	"end end\n"
+	"local t1 = curtime()\n"
+	"for n=1,10 do for idx=0,count-1 do VesselAPI.GetParameters(idx,list,values) end end\n"
+	"local t2 = curtime()\n"
+	"for n=1,10 do for idx=0,count-1 do VesselAPI.GetState(idx,state) end end\n"
+	"local t3 = curtime()\n"
+	"for n=1,10 do for idx=0,count-1 do\n"
+	"  for i=1,#readers do values[i] = readers[i](idx) end\n"
+	"end end\n"
+	"local t4 = curtime()\n"
+	"return VesselView.Backend,(t1-t0)/10,(t2-t1)/10,(t3-t2)/10,(t4-t3)/10\n";
+
+void benchmark_parameters()
+{
+	if (luaL_loadstring(L,benchmark_parameters_code) || lua_pcall(L,0,5,0)) {
+		log_write("X-Space: Parameter benchmark failed: %s\n",lua_tostring(L,-1));
+		lua_pop(L,1);
+		return;
+	}
+	printf("Parameters (%d vessels, %s): GetParameter %.3f ms, GetParameters %.3f ms, GetState %.3f ms, VesselView %.3f ms\n",
+		vessel_count,lua_tostring(L,-5),1000.0*lua_tonumber(L,-4),1000.0*lua_tonumber(L,-3),
+		1000.0*lua_tonumber(L,-2),1000.0*lua_tonumber(L,-1));
+	lua_pop(L,5);
+}
+
+
+//==============================================================================
+// Query ephemeris going backwards in time (like trajectory prediction does)
+//==============================================================================
+void benchmark_ephemeris()
+{
+	int targets[3] = { DE405_MOON, DE405_EARTH, DE405_SUN };
+	solsystem_state states[3];
+	solsystem_context ctx;
+	double start_time,query_time;
+	int i,ok = 0;
+
+	solsystem_context_initialize(&ctx);
+	start_time = curtime();
+	for (i = 0; i < 100000; i++) {
+		ok += DE405_Interpolate_States(&ctx,current_mjd + 2400000.5 - i*0.05,targets,3,states);
+	}
+	query_time = curtime() - start_time;
+	printf("Ephemeris: %.3f us per 3-body query (%d of %d answered)\n",1e6*query_time/100000.0,ok,100000);
+}
+
+
+//==============================================================================
+// Local to inertial transform through quaternion rotation (reference)
+//==============================================================================
+void benchmark_quat_l2i(vessel* v, double lx, double ly, double lz, double* ix, double* iy, double* iz)
+{
+	quaternion q;
+	double sx,sy,sz;
+
+	quat_i2sim(v->inertial.q,v->sim.q);
+	qset_vec(q,lx,ly,lz);
+	qdiv(q,q,v->sim.q);
+	qmul(q,v->sim.q,q);
+	qget_vec(q,&sz,&sx,&sy);
+	sx *= -1;
+
+	qset_vec(q,sz,sy,sx);
+	qdiv(q,q,sim2i_rotation);
+	qmul(q,sim2i_rotation,q);
+	qget_vec(q,ix,iz,iy);
+}
+
+
+//==============================================================================
+// Transform local velocities of all vessels to inertial coordinates through
+// cached matrices and through quaternion rotation
+//==============================================================================
+void benchmark_coordsys()
+{
+	double start_time,matrix_time,quat_time;
+	double sum = 0.0,error = 0.0;
+	int i,n,count = 0;
+
+	start_time = curtime();
+	for (n = 0; n < 100; n++) {
+		for (i = 0; i < vessel_count; i++) {
+			vessel* v = &vessels[i];
+			double x,y,z;
+			if (!v->exists) continue;
+			vec_l2i(v,v->local.vx,v->local.vy,v->local.vz,&x,&y,&z);
+			sum += x+y+z;
+			count++;
+		}
+	}
+	matrix_time = curtime() - start_time;
+
+	start_time = curtime();
+	for (n = 0; n < 100; n++) {
+		for (i = 0; i < vessel_count; i++) {
+			vessel* v = &vessels[i];
+			double x,y,z;
+			if (!v->exists) continue;
+			benchmark_quat_l2i(v,v->local.vx,v->local.vy,v->local.vz,&x,&y,&z);
+			sum -= x+y+z;
+		}
+	}
+	quat_time = curtime() - start_time;
+
+	for (i = 0; i < vessel_count; i++) {
+		vessel* v = &vessels[i];
+		double x,y,z,qx,qy,qz;
+		if (!v->exists) continue;
+		vec_l2i(v,v->local.vx,v->local.vy,v->local.vz,&x,&y,&z);
+		benchmark_quat_l2i(v,v->local.vx,v->local.vy,v->local.vz,&qx,&qy,&qz);
+		error = max(error,fabs(x-qx)+fabs(y-qy)+fabs(z-qz));
+	}
+	printf("Coordinates: %.4f us per transform with matrices, %.4f us with quaternions (max difference %.3g m/s)\n",
+		1e6*matrix_time/max(1,count),1e6*quat_time/max(1,count),error);
+}
+
+
+//==============================================================================
+// Capture network frames while simulation runs and encode every frame for all
+// clients (clients own no vessels, so every vessel is relevant, and every
+// client acknowledged the previous frame)
+//==============================================================================
+void benchmark_network_frames(double dt)
+{
+	network_frames* history = network_frames_create();
+	network_frame_client* clients[BENCHMARK_NETWORK_CLIENTS];
+	double start_time,capture_time = 0.0,encode_time = 0.0;
+	double full_bytes = 0.0,delta_bytes = 0.0;
+	int i,frame,records = 0;
+
+	for (i = 0; i < BENCHMARK_NETWORK_CLIENTS; i++) clients[i] = network_frame_client_create(i+1);
+	for (frame = 1; frame <= BENCHMARK_NETWORK_FRAMES; frame++) {
+		current_mjd += dt/86400.0;
+		xspace_update((float)dt);
+
+		start_time = curtime();
+		network_frame_capture(history,frame,frame*dt,0);
+		capture_time += curtime() - start_time;
+		records += network_frames_get(history,frame)->count;
+
+		for (i = 0; i < BENCHMARK_NETWORK_CLIENTS; i++) {
+			network_message* msg = network_message_create(0);
+			start_time = curtime();
+			network_frame_write(history,clients[i],frame-1,frame,msg);
+			encode_time += curtime() - start_time;
+
+			//First frame is sent in full, next ones as delta to the previous frame
+			if (frame == 1) full_bytes += msg->offset;
+			else delta_bytes += msg->offset;
+			network_message_destroy(msg);
+		}
+	}
+
+	printf("Network frames: %d vessels, %d clients, %.3f ms per capture, %.3f ms per client encode (%.2f ms per frame)\n",
+		records/BENCHMARK_NETWORK_FRAMES,BENCHMARK_NETWORK_CLIENTS,
+		1000.0*capture_time/BENCHMARK_NETWORK_FRAMES,
+		1000.0*encode_time/(BENCHMARK_NETWORK_FRAMES*BENCHMARK_NETWORK_CLIENTS),
+		1000.0*encode_time/BENCHMARK_NETWORK_FRAMES);
+	if (records > 0) {
+		int vessels_per_frame = max(1,records/BENCHMARK_NETWORK_FRAMES);
+		printf("Network frames: %.1f bytes per vessel (full), %.1f bytes per vessel per frame (delta)\n",
+			full_bytes/(BENCHMARK_NETWORK_CLIENTS*vessels_per_frame),
+			delta_bytes/((BENCHMARK_NETWORK_FRAMES-1)*BENCHMARK_NETWORK_CLIENTS*vessels_per_frame));
+	}
+
+	for (i = 0; i < BENCHMARK_NETWORK_CLIENTS; i++) network_frame_client_destroy(clients[i]);
+	network_frames_destroy(history);
+}
+
+
+//==============================================================================
+// Find vessels of a received frame by network ID (through the index and by
+// scanning all vessels as it was done before)
+//==============================================================================
+void benchmark_network_ids()
+{
+	double start_time,index_time,scan_time;
+	int i,j,frame,found = 0,scan_found = 0;
+
+	//Add networked vessels (not simulated)
+	while (vessel_count < BENCHMARK_NETWORK_VESSELS) {
+		vessel* v = &vessels[vessels_add()];
+		vessels_set_exists(v,1);
+		v->networked = 1;
+		vessels_set_net_id(v,1024+v->index);
+	}
+
+	start_time = curtime();
+	for (frame = 0; frame < 100; frame++) {
+		for (i = 0; i < vessel_count; i++) {
+			if (vessels_find_by_net_id(1024+i) == i) found++;
+		}
+	}
+	index_time = (curtime() - start_time)/100.0;
+
+	start_time = curtime();
+	for (i = 0; i < vessel_count; i++) {
+		for (j = 0; j < vessel_count; j++) {
+			if (vessels[j].net_id == 1024+i) break;
+		}
+		if (j == i) scan_found++;
+	}
+	scan_time = curtime() - start_time;
+
+	printf("Network IDs: %d vessels, %.3f ms per frame through index, %.3f ms by scanning (%d/%d found)\n",
+		vessel_count,1000.0*index_time,1000.0*scan_time,found/100,scan_found);
+}
+
+
+//==============================================================================
+// Benchmark main routine
+//==============================================================================
+int main(int argc, char** argv)
+{
+	int vessel_total = (argc > 1) ? atoi(argv[1]) : 100;
+	int ticks = (argc > 2) ? atoi(argv[2]) : 3000;
+	int seed = (argc > 3) ? atoi(argv[3]) : 1;
+	double dt = (argc > 4) ? atof(argv[4]) : 1.0/30.0;
+	double start_time,total_time;
+	int i,alive,mass_updates = 0;
+
+	//Initialize server (without starting networking)
+	log_write("X-Space: Benchmark (%d vessels, %d ticks, seed %d, dt %.4f)\n",vessel_total,ticks,seed,dt);
+	vessels_reserve(max(vessel_total,BENCHMARK_NETWORK_VESSELS)); //Before scripts get vessel layout
+	network_time = benchmark_network_time;
+	xspace_initialize_all();
+	vessels_set_exists(&vessels[0],0);
+
+	lua_createtable(L,0,32);
+	lua_setglobal(L,"DedicatedServerAPI");
+	highlevel_addfunction("DedicatedServerAPI","GetMJD",highlevel_getmjd);
+	highlevel_addfunction("DedicatedServerAPI","GetTrueMJD",highlevel_getmjd);
+	highlevel_addfunction("DedicatedServerAPI","SetMJD",highlevel_setmjd);
+
+	//Create scenario
+	if (!benchmark_write_model()) {
+		log_write("X-Space: Could not write benchmark drag model\n");
+		return 1;
+	}
+	srand(seed);
+	lua_getglobal(L,"math");
+	lua_getfield(L,-1,"randomseed");
+	lua_pushnumber(L,seed);
+	lua_call(L,1,0);
+	lua_pop(L,1);
+
+	current_mjd = 55197.0; //2010-01-01
+	benchmark_create_vessels(vessel_total);
+
+	//Run simulation
+	profiler_reset();
+	start_time = curtime();
+	for (i = 0; i < ticks; i++) {
+		benchmark_radio_traffic(vessel_total/10+1);
+		current_mjd += dt/86400.0;
+		xspace_update((float)dt);
+		mass_updates += vessels_mount_tree.mass_updates;
+	}
+	total_time = curtime() - start_time;
+
+	//Report results
+	alive = 0;
+	for (i = 0; i < vessel_count; i++) if (vessels[i].exists) alive++;
+
+	printf("Subsystem      Total [ms]  Per tick [ms]  Share\n");
+	for (i = 0; i < PROFILER_SECTIONS; i++) {
+		printf("%-12s %12.2f %14.4f %5.1f%%\n",profiler_sections[i].name,
+			profiler_sections[i].total*1000.0,
+			profiler_sections[i].total*1000.0/max(1,ticks),
+			100.0*profiler_sections[i].total/max(1e-9,total_time));
+	}
+	printf("%-12s %12.2f %14.4f\n","Total",total_time*1000.0,total_time*1000.0/max(1,ticks));
+	printf("Vessels alive: %d of %d (%d listed as active, %d free slots)\n",alive,vessel_total,
+		vessels_slots.active_count,vessels_slots.free_count);
+	printf("Mass properties recomputed: %.2f vessels per tick (mount tree rebuilt %d times)\n",
+		mass_updates/(double)max(1,ticks),vessels_mount_tree.rebuilds);
+	printf("State checksum: %08X\n",benchmark_checksum());
+	printf("Lua memory: %.0f KB (peak %.0f KB, pools %.0f KB), %.0f allocations (%.1f%% pooled), %.0f GC cycles\n",
+		highlevel_memory.used/1024.0,highlevel_memory.peak/1024.0,highlevel_memory.pooled/1024.0,
+		highlevel_memory.allocations,100.0*highlevel_memory.pool_allocations/max(1.0,highlevel_memory.allocations),
+		highlevel_memory.gc_cycles);
+	benchmark_parameters();
+	benchmark_ephemeris();
+	benchmark_coordsys();
+	benchmark_network_frames(dt);
+	benchmark_network_ids();
+
+	xspace_deinitialize_all();
+	return 0;
+}
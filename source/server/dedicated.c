@@ -30,6 +30,9 @@
 
 #include "curtime.h"     //Current time (precise)
 #include "threading.h"   //Multithreading support
+#include "profiler.h"    //Simulation profiler
+#include "snapshot.h"    //World state snapshots
+#include "geoindex.h"    //Proximity queries
 
 //Resource management
 int xspace_initialized_all = 0;
@@ -49,6 +52,7 @@ void xspace_initialize_all()
 	highlevel_initialize(); //allocates lua memory
 	highlevel_load(FROM_PLUGINS("lua/initialize.lua")); //allocates lua memory
 	config_initialize(); //allocates lua memory, loads configuration
+	profiler_initialize(); //lua memory
 
 	//Initializers with no mem alloc:
 	planet_initialize(); //datarefs
@@ -57,6 +61,7 @@ void xspace_initialize_all()
 	coordsys_initialize(); //datarefs
 	physics_initialize(); //datarefs
 	solsystem_initialize(); //loads file
+	geoindex_initialize(); //memory, lua memory
 
 	//Initializers with mem alloc:
 	geomagnetic_initialize(); //load model, datarefs
@@ -67,6 +72,7 @@ void xspace_initialize_all()
 	network_initialize(); //mem alloc, lua mem
 	dragheat_highlevel_initialize(); //lua mem
 	xivss_highlevel_initialize();
+	snapshot_initialize(); //thread, lua mem
 
 	//Extra dedicated server stuff:
 	vessels_reinitialize();
@@ -81,9 +87,12 @@ void xspace_deinitialize_all()
 	if (!xspace_initialized_all) return;
 
 	//Deinitializers with mem free:
+	snapshot_deinitialize(); //finish writing, free memory
 	material_deinitialize(); //free model
+	solsystem_deinitialize(); //unmap file
 	geomagnetic_deinitialize(); //free model
 	vessels_deinitialize(); //free memory, lua memory
+	geoindex_deinitialize(); //free memory
 	radiosys_deinitialize(); //free memory, datarefs
 
 	//Highlevel deinitialization
@@ -100,71 +109,87 @@ void xspace_deinitialize_all()
 
 void xspace_update(float dt)
 {
-	int i;
+	int i,k;
+	profiler_begin(PROFILER_TICK);
 
 	//Update current planet and coordinate system
 	planet_update(dt);
 	coordsys_update(dt);
 
-	//Read vessels
-	for (i = 0; i < vessel_count; i++) {
-		vessels[i].mount.checked = 0;
-	}
-
 	//Update/reset physics state
-	for (i = 0; i < vessel_count; i++) vessels_update_physics(&vessels[i]);
+	profiler_begin(PROFILER_VESSELS);
+	vessels_update_slots();
+	vessels_update_mounts();
+	profiler_end(PROFILER_VESSELS);
 
 	//Update various states
+	profiler_begin(PROFILER_GEOMAGNETIC);
 	geomagnetic_update();
+	profiler_end(PROFILER_GEOMAGNETIC);
 	physics_update(dt);
 	//particles_update(dt);
 
 	//Simulate physics for vessels
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_ATMOSPHERE);
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists && (vessels[i].physics_type == VESSEL_PHYSICS_INERTIAL)) {
 			vessels_reset_physics(&vessels[i]);
 			atmosphere_simulate(&vessels[i]);
 		}
 	}
+	profiler_end(PROFILER_ATMOSPHERE);
 
 	//Simulate physics which are called for all vessels
+	profiler_begin(PROFILER_RADIOSYS);
 	if (dt < 1.0/10.0) radiosys_update(dt);
+	profiler_end(PROFILER_RADIOSYS);
 	//engines_simulate(dt);
+	profiler_begin(PROFILER_DRAGHEAT);
 	dragheat_simulate(dt);
+	profiler_end(PROFILER_DRAGHEAT);
 	//launchpads_simulate(dt);
 	//camera_simulate();
 	//FIXME
 	{
 		extern double current_mjd;
-		solsystem_update(current_mjd);
+		solsystem_update(current_mjd,dt);
 	}
 
 	//Update Lua
+	profiler_begin(PROFILER_LUA);
 	if (highlevel_pushcallback("OnFrame")) {
 		lua_pushnumber(L,dt);
 		highlevel_call(1,0);
 	}
+	profiler_end(PROFILER_LUA);
 
 	//Finish physics simulation by integration
 	//if (XPLMGetDataf(dataref_vessel_agl) > 100) { //Hopefully there are no mountains higher than 395,000 ft
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_INTEGRATE);
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if ((vessels[i].exists) && (vessels[i].physics_type == VESSEL_PHYSICS_INERTIAL)) {
 			physics_integrate(dt,&vessels[i]);
 		}
 	}
+	profiler_end(PROFILER_INTEGRATE);
 
 	//Check timeout
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists && 
 			(vessels[i].physics_type == VESSEL_PHYSICS_NONINERTIAL) &&
-			(curtime() - vessels[i].last_update > 3.0)) {
+			(network_time() - vessels[i].last_update > 3.0)) {
 			vessels[i].physics_type = VESSEL_PHYSICS_INERTIAL;
 			vessels_set_ni(&vessels[i]);
 		}
 	}
 
 	//Synchronize all coordinates (sim, inertial)
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_VESSELS);
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists) {
 			double r;
 			vessels_get_ni(&vessels[i]);
@@ -183,12 +208,19 @@ void xspace_update(float dt)
 				//printf("%d %f %f %f\n",vessels[i].net_id,vessels[i].elevation,vessels[i].latitude,vessels[i].longitude);
 				if (vessels[i].elevation < 100e3) {
 					if (vessels[i].ivss_system) xivss_deinitialize(&vessels[i]);
-					vessels[i].exists = 0;
+					vessels_set_exists(&vessels[i],0);
 					printf("X-Space: Vessel %05d reentered atmosphere\n",vessels[i].net_id);
 				}
 			}
 		}
 	}
+	geoindex_update_vessels();
+	profiler_end(PROFILER_VESSELS);
+
+	//Collect Lua garbage within time budget
+	highlevel_collect_garbage();
+	profiler_end(PROFILER_TICK);
+	profiler_tick();
 
 	//Finish physics simulation by integration
 	//if (XPLMGetDataf(dataref_vessel_agl) > 100) { //Hopefully there are no mountains higher than 395,000 ft
@@ -1,6 +1,14 @@
+#ifdef WIN32
 #include <windows.h>
+#else
+#define _GNU_SOURCE
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 //#include "server.h"
 //#include "../xtime.h"
 //#include "frame.h"
@@ -9,10 +17,12 @@
 #include "x-space.h"
 #include "highlevel.h"
 #include "curtime.h"
+#include "config.h"
 
 #include "vessel.h"
 
 
+#ifdef WIN32
 //==============================================================================
 //Clear Windows console screen
 void cls(HANDLE hConsole)
@@ -32,6 +42,7 @@ void cls(HANDLE hConsole)
 	SetConsoleCursorPosition(hConsole, coordScreen);
 	return;
 }
+#endif
 
 
 //==============================================================================
@@ -60,17 +71,120 @@ int highlevel_gettruemjd(lua_State* L)
 }
 
 
+//==============================================================================
+//Server tick scheduling and statistics
+#define SERVER_HISTOGRAM_BINS 10
+
+//Upper limits of histogram bins (milliseconds), last bin has no limit
+double server_histogram_limits[SERVER_HISTOGRAM_BINS-1] = { 1, 2, 5, 10, 20, 33, 50, 100, 200 };
+
+typedef struct {
+	int bins[SERVER_HISTOGRAM_BINS];
+	int count;
+	double total;
+	double max;
+} server_histogram;
+
+server_histogram server_tick_time;		//Time spent in xspace_update
+server_histogram server_wake_jitter;	//Delay between tick deadline and wakeup
+int server_overruns;					//Ticks which took longer than tick period
+
+void server_histogram_add(server_histogram* histogram, double time)
+{
+	int i;
+	double ms = time*1000.0;
+	for (i = 0; i < SERVER_HISTOGRAM_BINS-1; i++) {
+		if (ms < server_histogram_limits[i]) break;
+	}
+	histogram->bins[i]++;
+	histogram->count++;
+	histogram->total += ms;
+	if (ms > histogram->max) histogram->max = ms;
+}
+
+void server_histogram_log(char* name, server_histogram* histogram)
+{
+	char buf[ARBITRARY_MAX] = { 0 };
+	int i,length = 0;
+	for (i = 0; i < SERVER_HISTOGRAM_BINS; i++) {
+		if (i < SERVER_HISTOGRAM_BINS-1) {
+			length += snprintf(buf+length,ARBITRARY_MAX-1-length," <%.0f:%d",server_histogram_limits[i],histogram->bins[i]);
+		} else {
+			length += snprintf(buf+length,ARBITRARY_MAX-1-length," >=%.0f:%d",server_histogram_limits[i-1],histogram->bins[i]);
+		}
+		if (length >= ARBITRARY_MAX-1) break;
+	}
+	log_write("X-Space: %s [ms]%s (avg %.2f, max %.2f)\n",name,buf,
+		histogram->total/(histogram->count ? histogram->count : 1),histogram->max);
+	memset(histogram,0,sizeof(server_histogram));
+}
+
+//Bind server thread to given CPU
+void server_set_affinity(int cpu)
+{
+	if (cpu < 0) return;
+#ifdef WIN32
+	if (!SetThreadAffinityMask(GetCurrentThread(),((DWORD_PTR)1) << cpu)) {
+		log_write("X-Space: Could not bind server to CPU %d\n",cpu);
+		return;
+	}
+#else
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu,&set);
+		if (sched_setaffinity(0,sizeof(set),&set)) {
+			log_write("X-Space: Could not bind server to CPU %d\n",cpu);
+			return;
+		}
+	}
+#endif
+	log_write("X-Space: Server bound to CPU %d\n",cpu);
+}
+
+//Sleep until given time (in curtime() seconds). Returns time at which server woke up
+double server_sleep_until(double deadline)
+{
+	double wait = deadline - curtime();
+	if (wait > 0.0) {
+#ifdef WIN32
+		Sleep((DWORD)(wait*1000.0));
+#else
+		//Convert deadline to absolute monotonic time once, so interrupted sleep
+		//resumes to the same deadline
+		struct timespec target;
+		clock_gettime(CLOCK_MONOTONIC,&target);
+		target.tv_sec += (time_t)wait;
+		target.tv_nsec += (long)((wait - (double)(time_t)wait)*1e9);
+		if (target.tv_nsec >= 1000000000L) {
+			target.tv_nsec -= 1000000000L;
+			target.tv_sec++;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&target,0) == EINTR) ;
+#endif
+	}
+	return curtime();
+}
+
+
 //==============================================================================
 // Dedicated server main routine
 //==============================================================================
-void main()
+int main()
 {
 	double notify_time = -1e9;
+	double stats_time;
 
 	//Initialize server
+#ifdef WIN32
 	log_write("X-Space: Dedicated server starting up (Win32)\n");
+	timeBeginPeriod(1);
+#else
+	log_write("X-Space: Dedicated server starting up (POSIX)\n");
+#endif
 	xspace_initialize_all();
-	vessels[0].exists = 0;
+	vessels_set_exists(&vessels[0],0);
+	server_set_affinity(config.server_cpu);
 
 	//Register server API
 	lua_createtable(L,0,32);
@@ -81,6 +195,7 @@ void main()
 
 	//Initialize timing
 	current_mjd = curtime_mjd();
+	stats_time = curtime();
 
 	//Start dedicated server
 	if (highlevel_pushcallback("OnDedicatedServer")) highlevel_call(0,0);
@@ -100,9 +215,22 @@ void main()
 		}
 
 		if (mjd > current_mjd + dmjd) {
+			double tick_start = curtime();
 			current_mjd += dmjd;
 			xspace_update((float)dt);
 
+			//Tick statistics
+			server_histogram_add(&server_tick_time,curtime() - tick_start);
+			if (curtime() - tick_start > dt) server_overruns++;
+			if ((config.server_stats_interval > 0.0) &&
+				(curtime() - stats_time > config.server_stats_interval)) {
+				stats_time = curtime();
+				server_histogram_log("Tick time",&server_tick_time);
+				server_histogram_log("Wakeup jitter",&server_wake_jitter);
+				log_write("X-Space: %d ticks overran the tick period\n",server_overruns);
+				server_overruns = 0;
+			}
+
 			if (date_offset > 60.0/86400.0) {
 				if (curtime() - notify_time > 60.0*60.0) {
 					int late_seconds = (int)(date_offset*86400.0);
@@ -114,7 +242,9 @@ void main()
 				}
 			}
 		} else {
-			Sleep(10);
+			//Sleep until the next tick is due
+			double deadline = curtime() + (current_mjd + dmjd - mjd)*86400.0;
+			server_histogram_add(&server_wake_jitter,server_sleep_until(deadline) - deadline);
 		}
 		//double newtime = curtime();
 		//double dt = newtime - prevtime;
@@ -124,4 +254,5 @@ void main()
 	}
 
 	xspace_deinitialize_all();
-}
\ No newline at end of file
+	return 0;
+}
@@ -0,0 +1,626 @@
+//==============================================================================
+// Binary snapshot of the world state (vessels, thermal state, radio buffers)
+//------------------------------------------------------------------------------
+// Snapshot is captured into memory on the simulation thread and written to disk
+// by a background thread. File is written under a temporary name, flushed to
+// disk and renamed over the old snapshot, so a crash never leaves a partially
+// written snapshot behind. Coordinates are stored in both frames as they are,
+// so the caller must restore simulation time returned by snapshot_load.
+// File layout (native byte order):
+//
+//   int magic, version; double mjd; int vessel_count
+//   for every vessel:
+//     int net_id, param_count
+//     param_count x { int index, count; double values[count] }
+//     int face_count; double temperature[face_count][2]
+//     int channel_count
+//     channel_count x { int channel, recv_used, send_count, recv_count; bytes }
+//   unsigned int checksum (FNV-1a over everything before it)
+//==============================================================================
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#include "x-space.h"
+#include "vessel.h"
+#include "highlevel.h"
+#include "radiosys.h"
+#include "threading.h"
+#include "profiler.h"
+#include "snapshot.h"
+
+//Growable memory buffer
+typedef struct snapshot_buffer {
+	char* data;
+	int size;
+	int allocated;
+} snapshot_buffer;
+
+//Thermal state waiting for drag model of the vessel to be loaded
+typedef struct snapshot_thermal {
+	int net_id;
+	int face_count;
+	double* temperature;
+	struct snapshot_thermal* next;
+} snapshot_thermal;
+
+//Snapshot waiting to be written
+snapshot_buffer* snapshot_pending = 0;
+char snapshot_pending_filename[MAX_FILENAME];
+//Writer thread must exit once pending snapshot is written
+int snapshot_stop = 0;
+lockID snapshot_lock = BAD_ID;
+threadID snapshot_thread = BAD_ID;
+
+//Thermal state from last loaded snapshot
+snapshot_thermal* snapshot_thermal_list = 0;
+
+//Statistics
+snapshot_stats snapshot_statistics;
+
+
+//==============================================================================
+// Buffer helpers
+//==============================================================================
+void snapshot_write(snapshot_buffer* buf, void* data, int size)
+{
+	if (buf->size + size > buf->allocated) {
+		buf->allocated = max(buf->allocated*2,buf->size + size + 65536);
+		buf->data = (char*)realloc(buf->data,buf->allocated);
+	}
+	memcpy(buf->data + buf->size,data,size);
+	buf->size += size;
+}
+
+void snapshot_write_int(snapshot_buffer* buf, int value)
+{
+	snapshot_write(buf,&value,sizeof(int));
+}
+
+void snapshot_write_double(snapshot_buffer* buf, double value)
+{
+	snapshot_write(buf,&value,sizeof(double));
+}
+
+void snapshot_free(snapshot_buffer* buf)
+{
+	if (!buf) return;
+	free(buf->data);
+	free(buf);
+}
+
+//Reads data from buffer, returns 0 if there is not enough data
+int snapshot_read(char** ptr, char* end, void* data, int size)
+{
+	if (end - *ptr < size) return 0;
+	memcpy(data,*ptr,size);
+	*ptr += size;
+	return 1;
+}
+
+unsigned int snapshot_checksum(char* data, int size)
+{
+	unsigned int hash = 2166136261u;
+	int i;
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+//==============================================================================
+// Parameters which are not stored: vessel indexes and network session state
+//==============================================================================
+int snapshot_is_transient(int index)
+{
+	return (index == 1) ||	//attached
+		   (index == 3) ||	//networked
+		   (index == 96);	//client_id
+}
+
+
+//==============================================================================
+// Capture state of a single vessel
+//==============================================================================
+void snapshot_capture_vessel(snapshot_buffer* buf, vessel* v)
+{
+	vessel_parameter* param;
+	radio_buffers* radio = &v->radiosys.buffers;
+	int param_count = 0,channel_count = 0;
+	int count_offset,i,j;
+
+	//Vessel parameters (only writeable ones, the rest is recomputed every frame)
+	snapshot_write_int(buf,v->net_id);
+	count_offset = buf->size;
+	snapshot_write_int(buf,0);
+	for (param = vessels_parameters; param->index >= 0; param++) {
+		int count = param->count ? param->count : 1;
+		if ((param->type == VESSEL_PARAMETER_TYPE_COMPUTED) || (!param->writeable)) continue;
+		if (snapshot_is_transient(param->index)) continue;
+
+		snapshot_write_int(buf,param->index);
+		snapshot_write_int(buf,count);
+		for (i = 0; i < count; i++) {
+			char* ptr = (char*)v + param->offset + i*param->stride;
+			if (param->type == VESSEL_PARAMETER_TYPE_INT) {
+				snapshot_write_double(buf,*((int*)ptr));
+			} else {
+				snapshot_write_double(buf,*((double*)ptr));
+			}
+		}
+		param_count++;
+	}
+	memcpy(buf->data + count_offset,&param_count,sizeof(int));
+
+	//Thermal state of the drag model
+	if (v->geometry.faces) {
+		int locked = (v->geometry.heat_thread != BAD_ID) && (v->geometry.heat_thread != 0);
+		if (locked) lock_enter(v->geometry.heat_data_lock);
+		snapshot_write_int(buf,v->geometry.num_faces);
+		for (i = 0; i < v->geometry.num_faces; i++) {
+			snapshot_write(buf,v->geometry.faces[i].temperature,2*sizeof(double));
+		}
+		if (locked) lock_leave(v->geometry.heat_data_lock);
+	} else {
+		snapshot_write_int(buf,0);
+	}
+
+	//Radio data not yet sent or read
+	count_offset = buf->size;
+	snapshot_write_int(buf,0);
+	for (i = 0; i < radio->num_channels; i++) {
+		int send_count = 0,recv_count = 0;
+		if (radio->send_buffer[i]) {
+			send_count = radio->send_buffer_user_position[i] - radio->send_buffer_sys_position[i];
+			if (send_count < 0) send_count += radio->buffer_size;
+		}
+		if (radio->recv_buffer[i]) {
+			recv_count = radio->recv_buffer_sys_position[i] - radio->recv_buffer_user_position[i];
+			if (recv_count < 0) recv_count += radio->buffer_size;
+		}
+		if ((!send_count) && (!recv_count) && (!radio->channels_recv_used[i])) continue;
+
+		snapshot_write_int(buf,i);
+		snapshot_write_int(buf,radio->channels_recv_used[i]);
+		snapshot_write_int(buf,send_count);
+		snapshot_write_int(buf,recv_count);
+		for (j = 0; j < send_count; j++) {
+			char data = (char)radio->send_buffer[i][(radio->send_buffer_sys_position[i]+j) % radio->buffer_size];
+			snapshot_write(buf,&data,1);
+		}
+		for (j = 0; j < recv_count; j++) {
+			char data = (char)radio->recv_buffer[i][(radio->recv_buffer_user_position[i]+j) % radio->buffer_size];
+			snapshot_write(buf,&data,1);
+		}
+		channel_count++;
+	}
+	memcpy(buf->data + count_offset,&channel_count,sizeof(int));
+}
+
+
+//==============================================================================
+// Capture snapshot and pass it to writer thread. Returns 0 on error
+//==============================================================================
+int snapshot_save(char* filename, double mjd, int max_net_id)
+{
+	snapshot_buffer* buf;
+	double start_time = profiler_time();
+	unsigned int checksum;
+	int i,count = 0,count_offset;
+
+	if (snapshot_lock == BAD_ID) return 0;
+	buf = (snapshot_buffer*)malloc(sizeof(snapshot_buffer));
+	memset(buf,0,sizeof(snapshot_buffer));
+
+	//Header
+	snapshot_write_int(buf,SNAPSHOT_MAGIC);
+	snapshot_write_int(buf,SNAPSHOT_VERSION);
+	snapshot_write_double(buf,mjd);
+	count_offset = buf->size;
+	snapshot_write_int(buf,0);
+
+	//Vessels
+	for (i = 0; i < vessel_count; i++) {
+		vessel* v = &vessels[i];
+		if ((!v->exists) || (v->physics_type != VESSEL_PHYSICS_INERTIAL)) continue;
+		if ((max_net_id > 0) && (v->net_id >= max_net_id)) continue;
+		snapshot_capture_vessel(buf,v);
+		count++;
+	}
+	memcpy(buf->data + count_offset,&count,sizeof(int));
+
+	//Checksum
+	checksum = snapshot_checksum(buf->data,buf->size);
+	snapshot_write(buf,&checksum,sizeof(unsigned int));
+
+	//Hand over to writer (replaces snapshot which was not written yet)
+	lock_enter(snapshot_lock);
+	if (snapshot_pending) {
+		snapshot_free(snapshot_pending);
+		snapshot_statistics.skipped++;
+	}
+	snapshot_pending = buf;
+	strncpy(snapshot_pending_filename,filename,MAX_FILENAME-1);
+	snapshot_statistics.saves++;
+	snapshot_statistics.bytes = buf->size;
+	snapshot_statistics.capture_time = profiler_time() - start_time;
+	lock_leave(snapshot_lock);
+	return 1;
+}
+
+
+//==============================================================================
+// Write snapshot to disk (crash-consistent)
+//==============================================================================
+int snapshot_write_file(char* filename, snapshot_buffer* buf)
+{
+	char temp_filename[MAX_FILENAME] = { 0 };
+	FILE* f;
+	int ok;
+
+	snprintf(temp_filename,MAX_FILENAME-1,"%s.tmp",filename);
+	f = fopen(temp_filename,"wb");
+	if (!f) return 0;
+
+	ok = (fwrite(buf->data,1,buf->size,f) == (size_t)buf->size);
+	ok = ok && (fflush(f) == 0);
+#ifdef WIN32
+	ok = ok && (_commit(_fileno(f)) == 0);
+#else
+	ok = ok && (fsync(fileno(f)) == 0);
+#endif
+	fclose(f);
+	if (!ok) {
+		remove(temp_filename);
+		return 0;
+	}
+
+#ifdef WIN32
+	return MoveFileExA(temp_filename,filename,MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename(temp_filename,filename) != 0) return 0;
+
+	//Rename is only durable once the directory is synced
+	{
+		char dirname[MAX_FILENAME] = { 0 };
+		char* slash;
+		int fd;
+
+		strncpy(dirname,filename,MAX_FILENAME-1);
+		slash = strrchr(dirname,'/');
+		if (slash == dirname) slash[1] = 0;
+		else if (slash) *slash = 0;
+		else strcpy(dirname,".");
+
+		fd = open(dirname,O_RDONLY);
+		if (fd < 0) return 0;
+		ok = (fsync(fd) == 0);
+		close(fd);
+		return ok;
+	}
+#endif
+}
+
+void snapshot_writer(void* unused)
+{
+	char filename[MAX_FILENAME];
+	while (1) {
+		snapshot_buffer* buf;
+		int stop;
+
+		//Fetch pending snapshot
+		lock_enter(snapshot_lock);
+		buf = snapshot_pending;
+		snapshot_pending = 0;
+		stop = snapshot_stop;
+		memcpy(filename,snapshot_pending_filename,MAX_FILENAME);
+		lock_leave(snapshot_lock);
+
+		if (buf) {
+			double start_time = profiler_time();
+			if (snapshot_write_file(filename,buf)) {
+				snapshot_statistics.writes++;
+			} else {
+				log_write("X-Space: Could not write snapshot %s\n",filename);
+			}
+			snapshot_statistics.write_time = profiler_time() - start_time;
+			snapshot_free(buf);
+		} else if (stop) {
+			return;
+		} else {
+			thread_sleep(0.05);
+		}
+	}
+}
+
+
+//==============================================================================
+// Restore vessel from snapshot data. Returns 0 if data is invalid
+//==============================================================================
+int snapshot_load_vessel(char** ptr, char* end)
+{
+	vessel* v = 0;
+	int net_id,param_count,face_count,channel_count;
+	int i,j;
+
+	if (!snapshot_read(ptr,end,&net_id,sizeof(int))) return 0;
+	if (!snapshot_read(ptr,end,&param_count,sizeof(int))) return 0;
+
+	//Find vessel or create a new one
+	i = vessels_find_by_net_id(net_id);
+	if ((i >= 0) && (!vessels[i].exists) && vessels_net_index.shared) { //Removed vessel may share ID with existing one
+		for (i = 0; i < vessel_count; i++) {
+			if (vessels[i].exists && (vessels[i].net_id == net_id)) break;
+		}
+		if (i == vessel_count) i = -1;
+	}
+	if ((i >= 0) && vessels[i].exists) v = &vessels[i];
+	if (!v) {
+		int idx = vessels_add();
+		v = &vessels[idx];
+
+		lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_vessels_data);
+		lua_newtable(L);
+		lua_rawseti(L,-2,idx);
+		lua_pop(L,1);
+	}
+
+	//Read parameters
+	for (i = 0; i < param_count; i++) {
+		vessel_parameter* param;
+		int index,count;
+
+		if (!snapshot_read(ptr,end,&index,sizeof(int))) return 0;
+		if (!snapshot_read(ptr,end,&count,sizeof(int))) return 0;
+		if ((count < 0) || (end - *ptr < count*(int)sizeof(double))) return 0;
+
+		param = vessels_get_parameter_info(index);
+		if ((!param) || (param->type == VESSEL_PARAMETER_TYPE_COMPUTED) ||
+			(count != (param->count ? param->count : 1))) {
+			*ptr += count*sizeof(double); //Parameter no longer exists or changed
+			continue;
+		}
+		for (j = 0; j < count; j++) {
+			char* data = (char*)v + param->offset + j*param->stride;
+			double value;
+			snapshot_read(ptr,end,&value,sizeof(double));
+			if (param->type == VESSEL_PARAMETER_TYPE_INT) {
+				*((int*)data) = (int)value;
+			} else {
+				*((double*)data) = value;
+			}
+		}
+	}
+	vessels_set_exists(v,1);
+	vessels_set_net_id(v,net_id);
+
+	//Existing vessel may have new weights and mounts written over it
+	v->mass_dirty = 1;
+	vessels_invalidate_mount_tree();
+
+	//Read thermal state (applied when drag model is loaded)
+	if (!snapshot_read(ptr,end,&face_count,sizeof(int))) return 0;
+	if ((face_count < 0) || (end - *ptr < face_count*2*(int)sizeof(double))) return 0;
+	if (face_count > 0) {
+		snapshot_thermal* thermal = (snapshot_thermal*)malloc(sizeof(snapshot_thermal));
+		thermal->net_id = net_id;
+		thermal->face_count = face_count;
+		thermal->temperature = (double*)malloc(face_count*2*sizeof(double));
+		snapshot_read(ptr,end,thermal->temperature,face_count*2*sizeof(double));
+		thermal->next = snapshot_thermal_list;
+		snapshot_thermal_list = thermal;
+		snapshot_restore_thermal(v);
+	}
+
+	//Read radio buffers
+	if (!snapshot_read(ptr,end,&channel_count,sizeof(int))) return 0;
+	for (i = 0; i < channel_count; i++) {
+		radio_buffers* radio = &v->radiosys.buffers;
+		int channel,recv_used,send_count,recv_count;
+
+		if (!snapshot_read(ptr,end,&channel,sizeof(int))) return 0;
+		if (!snapshot_read(ptr,end,&recv_used,sizeof(int))) return 0;
+		if (!snapshot_read(ptr,end,&send_count,sizeof(int))) return 0;
+		if (!snapshot_read(ptr,end,&recv_count,sizeof(int))) return 0;
+		if ((send_count < 0) || (recv_count < 0) || (end - *ptr < send_count + recv_count)) return 0;
+		if ((channel < 0) || (channel >= radio->num_channels)) {
+			*ptr += send_count + recv_count;
+			continue;
+		}
+
+		//Replace any data already pending in the channel
+		radio->channels_recv_used[channel] = recv_used;
+		radio->send_buffer_user_position[channel] = radio->send_buffer_sys_position[channel];
+		radio->recv_buffer_sys_position[channel] = radio->recv_buffer_user_position[channel];
+		for (j = 0; j < send_count; j++) radiosys_transmit_buffer(radio,channel,(unsigned char)(*ptr)[j]);
+		*ptr += send_count;
+		for (j = 0; j < recv_count; j++) radiosys_buffer_advance_recv(radio,channel,(unsigned char)(*ptr)[j]);
+		*ptr += recv_count;
+	}
+
+	return 1;
+}
+
+
+//==============================================================================
+// Load snapshot. Returns 0 if snapshot does not exist or is invalid
+//==============================================================================
+int snapshot_load(char* filename, double* mjd)
+{
+	double start_time = profiler_time();
+	char* data;
+	char* ptr;
+	char* end;
+	unsigned int checksum;
+	int size,magic,version,count,i;
+	FILE* f;
+
+	//Read entire file
+	f = fopen(filename,"rb");
+	if (!f) return 0;
+	fseek(f,0,SEEK_END);
+	size = ftell(f);
+	fseek(f,0,SEEK_SET);
+	if (size < (int)(3*sizeof(int)+sizeof(double)+sizeof(unsigned int))) {
+		fclose(f);
+		return 0;
+	}
+	data = (char*)malloc(size);
+	if (fread(data,1,size,f) != (size_t)size) {
+		fclose(f);
+		free(data);
+		return 0;
+	}
+	fclose(f);
+
+	//Verify header and checksum
+	ptr = data;
+	end = data + size - sizeof(unsigned int);
+	memcpy(&checksum,end,sizeof(unsigned int));
+	snapshot_read(&ptr,end,&magic,sizeof(int));
+	snapshot_read(&ptr,end,&version,sizeof(int));
+	if ((magic != SNAPSHOT_MAGIC) || (version != SNAPSHOT_VERSION) ||
+		(checksum != snapshot_checksum(data,size - sizeof(unsigned int)))) {
+		log_write("X-Space: Snapshot %s is invalid\n",filename);
+		free(data);
+		return 0;
+	}
+	snapshot_read(&ptr,end,mjd,sizeof(double));
+	snapshot_read(&ptr,end,&count,sizeof(int));
+
+	//Load vessels
+	for (i = 0; i < count; i++) {
+		if (!snapshot_load_vessel(&ptr,end)) {
+			log_write("X-Space: Snapshot %s is truncated\n",filename);
+			break;
+		}
+	}
+	free(data);
+
+	log_write("X-Space: Restored %d vessels from snapshot %s\n",i,filename);
+	snapshot_statistics.loads++;
+	snapshot_statistics.load_time = profiler_time() - start_time;
+	return 1;
+}
+
+
+//==============================================================================
+// Apply thermal state from snapshot once drag model is loaded
+//==============================================================================
+void snapshot_restore_thermal(vessel* v)
+{
+	snapshot_thermal* thermal = snapshot_thermal_list;
+	snapshot_thermal* prev = 0;
+	int i;
+
+	if (!v->geometry.faces) return;
+	while (thermal) {
+		if (thermal->net_id == v->net_id) {
+			if (thermal->face_count == v->geometry.num_faces) {
+				int locked = (v->geometry.heat_thread != BAD_ID) && (v->geometry.heat_thread != 0);
+				if (locked) lock_enter(v->geometry.heat_data_lock);
+				for (i = 0; i < thermal->face_count; i++) {
+					v->geometry.faces[i].temperature[0] = thermal->temperature[i*2+0];
+					v->geometry.faces[i].temperature[1] = thermal->temperature[i*2+1];
+				}
+				if (locked) lock_leave(v->geometry.heat_data_lock);
+			}
+
+			//Thermal state is only applied once
+			if (prev) prev->next = thermal->next;
+			else snapshot_thermal_list = thermal->next;
+			free(thermal->temperature);
+			free(thermal);
+			return;
+		}
+		prev = thermal;
+		thermal = thermal->next;
+	}
+}
+
+
+//==============================================================================
+// Highlevel interface
+//==============================================================================
+//SnapshotAPI.Save(filename,mjd[,max_net_id])
+int snapshot_highlevel_save(lua_State* L)
+{
+	lua_pushboolean(L,snapshot_save((char*)luaL_checkstring(L,1),luaL_checknumber(L,2),luaL_optint(L,3,0)));
+	return 1;
+}
+
+//SnapshotAPI.Load(filename): returns MJD or nil
+int snapshot_highlevel_load(lua_State* L)
+{
+	double mjd;
+	if (snapshot_load((char*)luaL_checkstring(L,1),&mjd)) {
+		lua_pushnumber(L,mjd);
+	} else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+int snapshot_highlevel_getstats(lua_State* L)
+{
+	lua_createtable(L,0,8);
+	lua_pushnumber(L,snapshot_statistics.saves);		lua_setfield(L,-2,"Saves");
+	lua_pushnumber(L,snapshot_statistics.writes);		lua_setfield(L,-2,"Writes");
+	lua_pushnumber(L,snapshot_statistics.skipped);		lua_setfield(L,-2,"Skipped");
+	lua_pushnumber(L,snapshot_statistics.loads);		lua_setfield(L,-2,"Loads");
+	lua_pushnumber(L,snapshot_statistics.bytes);		lua_setfield(L,-2,"Bytes");
+	lua_pushnumber(L,snapshot_statistics.capture_time);	lua_setfield(L,-2,"CaptureTime");
+	lua_pushnumber(L,snapshot_statistics.write_time);	lua_setfield(L,-2,"WriteTime");
+	lua_pushnumber(L,snapshot_statistics.load_time);	lua_setfield(L,-2,"LoadTime");
+	return 1;
+}
+
+
+//==============================================================================
+// Start writer thread and register highlevel interface
+//==============================================================================
+void snapshot_initialize()
+{
+	memset(&snapshot_statistics,0,sizeof(snapshot_statistics));
+	snapshot_lock = lock_create();
+	snapshot_thread = thread_create(snapshot_writer,0);
+
+	lua_createtable(L,0,3);
+	lua_setglobal(L,"SnapshotAPI");
+	highlevel_addfunction("SnapshotAPI","Save",snapshot_highlevel_save);
+	highlevel_addfunction("SnapshotAPI","Load",snapshot_highlevel_load);
+	highlevel_addfunction("SnapshotAPI","GetStats",snapshot_highlevel_getstats);
+}
+
+
+//==============================================================================
+// Finish writing last snapshot and stop writer thread
+//==============================================================================
+void snapshot_deinitialize()
+{
+	if (snapshot_lock == BAD_ID) return;
+	lock_enter(snapshot_lock);
+	snapshot_stop = 1;
+	lock_leave(snapshot_lock);
+
+	thread_waitfor(snapshot_thread);
+	lock_destroy(snapshot_lock);
+	snapshot_lock = BAD_ID;
+	snapshot_thread = BAD_ID;
+	snapshot_stop = 0;
+	while (snapshot_thermal_list) {
+		snapshot_thermal* next = snapshot_thermal_list->next;
+		free(snapshot_thermal_list->temperature);
+		free(snapshot_thermal_list);
+		snapshot_thermal_list = next;
+	}
+}
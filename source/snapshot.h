@@ -0,0 +1,30 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+struct vessel_tag;
+
+//Snapshot file signature and format version
+#define SNAPSHOT_MAGIC		0x53505358	//"XSPS"
+#define SNAPSHOT_VERSION	1
+
+//Snapshot statistics
+typedef struct snapshot_stats {
+	int saves;				//Snapshots captured
+	int writes;				//Snapshots written to disk
+	int skipped;			//Snapshots replaced before writer got to them
+	int loads;				//Snapshots loaded
+	int bytes;				//Size of last snapshot
+	double capture_time;	//Time to capture last snapshot (simulation thread)
+	double write_time;		//Time to write last snapshot (writer thread)
+	double load_time;		//Time to load last snapshot
+} snapshot_stats;
+
+extern snapshot_stats snapshot_statistics;
+
+void snapshot_initialize();
+void snapshot_deinitialize();
+int snapshot_save(char* filename, double mjd, int max_net_id);
+int snapshot_load(char* filename, double* mjd);
+void snapshot_restore_thermal(struct vessel_tag* v);
+
+#endif
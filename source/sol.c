@@ -2,42 +2,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "x-space.h"
 #include "vessel.h"
+#include "threading.h"
+#include "thirdbody.h"
 #include "sol.h"
 
 //==============================================================================
-// DE405
-#define EPH_ARRAY_SIZE 1018
-#define MERCURY		0
-#define VENUS		1
-#define EARTH		2	/* Earth-Moon Barycenter */
-#define MARS		3
-#define JUPITER		4
-#define SATURN		5
-#define URANUS		6
-#define NEPTUNE		7
-#define PLUTO		8
-#define MOON		9	/* Relative to geocenter */
-#define SUN			10
-#define SS_BARY		11
-#define EM_BARY		12
-#define NUTATIONS	13
-#define LIBRATIONS	14
-
-
+// DE405 (header is read field by field from byte offsets in the file, which
+// was written with 8-byte aligned doubles and 32-bit integers, so the layout
+// does not depend on struct alignment of the platform)
 //==============================================================================
+#define EPH_OFFSET_CONSTNAME	252
+#define EPH_OFFSET_TIMEDATA		2656
+#define EPH_OFFSET_NUMCONST		2680
+#define EPH_OFFSET_AU			2688
+#define EPH_OFFSET_EMRAT		2696
+#define EPH_OFFSET_COEFFPTR		2704
+#define EPH_OFFSET_DENUM		2848
+#define EPH_OFFSET_LIBRATPTR	2852
+
 struct eph_data1 {
 	char label[3][84];
 	char constName[400][6];
 	double timeData[3];
-	long int numConst;
+	int numConst;
 	double AU;
 	double EMRAT;
-	long int coeffPtr[12][3];
-	long int DENUM;
-	long int libratPtr[3];
+	int coeffPtr[12][3];
+	int DENUM;
+	int libratPtr[3];
 };
 
 struct eph_data2 {
@@ -47,219 +50,408 @@ struct eph_data2 {
 typedef struct eph_data1 eph_data1_t;
 typedef struct eph_data2 eph_data2_t;
 
-struct headerOne {
-	eph_data1_t data;
-	char pad[EPH_ARRAY_SIZE*sizeof(double) - sizeof(eph_data1_t)];
-} H1;
+double H1[EPH_ARRAY_SIZE]; //First header record (raw)
 struct headerTwo {
    eph_data2_t data;
    char pad[EPH_ARRAY_SIZE*sizeof(double) - sizeof(eph_data2_t)];
 } H2;
 eph_data1_t R1;
-double Coeff_Array[EPH_ARRAY_SIZE], T_beg, T_end, T_span;
-FILE* Ephemeris_File;
 
-typedef struct solsystem_state_t {
-	double Position[3];
-	double Velocity[3];
-} solsystem_state;
+//Ephemeris file
+FILE* Ephemeris_File = 0;
+//Data records (when ephemeris is memory-mapped)
+double* Ephemeris_Records = 0;
+//Number of data records, start time and span of every record (JD)
+int Ephemeris_Record_Count = 0;
+double Ephemeris_T_start,Ephemeris_T_span;
+
+//Memory mapping
+#ifdef WIN32
+HANDLE Ephemeris_Mapping = 0;
+#else
+size_t Ephemeris_Mapping_Size = 0;
+#endif
+void* Ephemeris_Mapping_View = 0;
+
+//Records read from file (when ephemeris is not memory-mapped)
+typedef struct eph_cache_entry {
+	int record;
+	int last_use;
+	double data[EPH_ARRAY_SIZE];
+} eph_cache_entry;
+eph_cache_entry* Ephemeris_Cache = 0;
+int Ephemeris_Cache_Time = 0;
+lockID Ephemeris_Cache_Lock = BAD_ID;
+
+//Context used by simulation thread
+solsystem_context solsystem_main_context;
+
+//Bodies which perturb motion of vessels (gravitational parameters in m3/sec2)
+typedef struct solsystem_perturbing_body {
+	int target;
+	double mu;
+} solsystem_perturbing_body;
+solsystem_perturbing_body solsystem_perturbing_bodies[] = {
+	{ DE405_SUN,		1.32712440018e20 },
+	{ DE405_MOON,		4.902800066e12 },
+	{ DE405_MERCURY,	2.2032e13 },
+	{ DE405_VENUS,		3.24858592e14 },
+	{ DE405_MARS,		4.282837e13 },
+	{ DE405_JUPITER,	1.26712764e17 },
+	{ DE405_SATURN,		3.7940585e16 },
+	{ DE405_URANUS,		5.794549e15 },
+	{ DE405_NEPTUNE,	6.836527e15 },
+};
+#define SOLSYSTEM_PERTURBING_BODIES (sizeof(solsystem_perturbing_bodies)/sizeof(solsystem_perturbing_bodies[0]))
 
+
+//==============================================================================
+// Read header fields from the first header record
 //==============================================================================
-void DE405_Read_Coefficients( double Time )
+void DE405_Read_Header(char* record, eph_data1_t* header)
 {
-  double  T_delta = 0.0;
-  int     Offset  =  0 ;
-
-  /*--------------------------------------------------------------------------*/
-  /*  Find ephemeris data that record contains input time. Note that one, and */
-  /*  only one, of the following conditional statements will be true (if both */
-  /*  were false, this function would not have been called).                  */
-  /*--------------------------------------------------------------------------*/
-
-  if ( Time < T_beg )                    /* Compute backwards location offset */
-     {
-       T_delta = T_beg - Time;
-       Offset  = (int) -ceil(T_delta/T_span); 
-     }
-
-  if ( Time > T_end )                    /* Compute forewards location offset */
-     {
-       T_delta = Time - T_end;
-       Offset  = (int) ceil(T_delta/T_span);
-     }
-
-  /*--------------------------------------------------------------------------*/
-  /*  Retrieve ephemeris data from new record.                                */
-  /*--------------------------------------------------------------------------*/
-
-  fseek(Ephemeris_File,(Offset-1)*EPH_ARRAY_SIZE*sizeof(double),SEEK_CUR);
-  fread(&Coeff_Array,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File);
-  
-  T_beg  = Coeff_Array[0];
-  T_end  = Coeff_Array[1];
-  T_span = T_end - T_beg;
+	memcpy(header->label,record,sizeof(header->label));
+	memcpy(header->constName,record+EPH_OFFSET_CONSTNAME,sizeof(header->constName));
+	memcpy(header->timeData,record+EPH_OFFSET_TIMEDATA,sizeof(header->timeData));
+	memcpy(&header->numConst,record+EPH_OFFSET_NUMCONST,sizeof(int));
+	memcpy(&header->AU,record+EPH_OFFSET_AU,sizeof(double));
+	memcpy(&header->EMRAT,record+EPH_OFFSET_EMRAT,sizeof(double));
+	memcpy(header->coeffPtr,record+EPH_OFFSET_COEFFPTR,sizeof(header->coeffPtr));
+	memcpy(&header->DENUM,record+EPH_OFFSET_DENUM,sizeof(int));
+	memcpy(header->libratPtr,record+EPH_OFFSET_LIBRATPTR,sizeof(header->libratPtr));
 }
 
-void DE405_Interpolate_State(double Time, int Target, solsystem_state *Planet)
+
+//==============================================================================
+// Map ephemeris file into memory. Returns pointer to file data or 0
+//==============================================================================
+void* DE405_Map_File(char* filename, size_t* size)
 {
-  double    A[50]   , B[50] , Cp[50] , P_Sum[3] , V_Sum[3] , Up[50] ,
-            T_break , T_seg , T_sub  , Tc;
-  int       i , j;
-  long int  C , G , N , offset = 0;
-  solsystem_state X;
-
-  /*--------------------------------------------------------------------------*/
-  /* This function doesn't "do" nutations or librations.                      */
-  /*--------------------------------------------------------------------------*/
-
-  if ( Target >= 11 )             /* Also protects against weird input errors */
-     {
-       //printf("\n This function does not compute nutations or librations.\n");
-       return;
-     }
-
-  /*--------------------------------------------------------------------------*/
-  /* Initialize local coefficient array.                                      */
-  /*--------------------------------------------------------------------------*/
-
-  for ( i=0 ; i<50 ; i++ )
-      {
-        A[i] = 0.0;
-        B[i] = 0.0;
-      }
-
-  /*--------------------------------------------------------------------------*/
-  /* Determine if a new record needs to be input.                             */
-  /*--------------------------------------------------------------------------*/
-  
-  if (Time < T_beg || Time > T_end)  {
-	  DE405_Read_Coefficients(Time);
-  }
-
-  /*--------------------------------------------------------------------------*/
-  /* Read the coefficients from the binary record.                            */
-  /*--------------------------------------------------------------------------*/
-  
-  C = R1.coeffPtr[Target][0] - 1;               /*    Coeff array entry point */
-  N = R1.coeffPtr[Target][1];                   /*          Number of coeff's */
-  G = R1.coeffPtr[Target][2];                   /* Granules in current record */
-
-  /*...................................................Debug print (optional) */
-
-  /*--------------------------------------------------------------------------*/
-  /*  Compute the normalized time, then load the Tchebeyshev coefficients     */
-  /*  into array A[]. If T_span is covered by a single granule this is easy.  */
-  /*  If not, the granule that contains the interpolation time is found, and  */
-  /*  an offset from the array entry point for the ephemeris body is used to  */
-  /*  load the coefficients.                                                  */
-  /*--------------------------------------------------------------------------*/
-
-  if ( G == 1 )
-     {
-       Tc = 2.0*(Time - T_beg) / T_span - 1.0;
-       for (i=C ; i<(C+3*N) ; i++)  A[i-C] = Coeff_Array[i];
-     }
-  else if ( G > 1 )
-     {
-       T_sub = T_span / ((double) G);          /* Compute subgranule interval */
-       
-       for ( j=G ; j>0 ; j-- ) 
-           {
-             T_break = T_beg + ((double) j-1) * T_sub;
-             if ( Time > T_break ) 
-                {
-                  T_seg  = T_break;
-                  offset = j-1;
-                  break;
-                }
-            }
-            
-       Tc = 2.0*(Time - T_seg) / T_sub - 1.0;
-       C  = C + 3 * offset * N;
-       
-       for (i=C ; i<(C+3*N) ; i++) A[i-C] = Coeff_Array[i];
-     }
-  else                                   /* Something has gone terribly wrong */
-     {
-       //printf("\n Number of granules must be >= 1: check header data.\n");
-     }
-
-  /*--------------------------------------------------------------------------*/
-  /* Compute the interpolated position & velocity                             */
-  /*--------------------------------------------------------------------------*/
-  
-  for ( i=0 ; i<3 ; i++ )                /* Compute interpolating polynomials */
-      {
-        Cp[0] = 1.0;           
-        Cp[1] = Tc;
-        Cp[2] = 2.0 * Tc*Tc - 1.0;
-        
-        Up[0] = 0.0;
-        Up[1] = 1.0;
-        Up[2] = 4.0 * Tc;
-
-        for ( j=3 ; j<N ; j++ )
-            {
-              Cp[j] = 2.0 * Tc * Cp[j-1] - Cp[j-2];
-              Up[j] = 2.0 * Tc * Up[j-1] + 2.0 * Cp[j-1] - Up[j-2];
-            }
-
-        P_Sum[i] = 0.0;           /* Compute interpolated position & velocity */
-        V_Sum[i] = 0.0;
-
-        for ( j=N-1 ; j>-1 ; j-- )  P_Sum[i] = P_Sum[i] + A[j+i*N] * Cp[j];
-        for ( j=N-1 ; j>0  ; j-- )  V_Sum[i] = V_Sum[i] + A[j+i*N] * Up[j];
-
-        X.Position[i] = P_Sum[i];
-        X.Velocity[i] = V_Sum[i] * 2.0 * ((double) G) / (T_span * 86400.0);
-      }
-
-  /*--------------------------------------------------------------------------*/
-  /*  Return computed values.                                                 */
-  /*--------------------------------------------------------------------------*/
-
-  *Planet = X;
-
-  return;
+#ifdef WIN32
+	HANDLE file = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0);
+	LARGE_INTEGER file_size;
+	if (file == INVALID_HANDLE_VALUE) return 0;
+	if (!GetFileSizeEx(file,&file_size)) {
+		CloseHandle(file);
+		return 0;
+	}
+	Ephemeris_Mapping = CreateFileMappingA(file,0,PAGE_READONLY,0,0,0);
+	CloseHandle(file);
+	if (!Ephemeris_Mapping) return 0;
+
+	Ephemeris_Mapping_View = MapViewOfFile(Ephemeris_Mapping,FILE_MAP_READ,0,0,0);
+	if (!Ephemeris_Mapping_View) {
+		CloseHandle(Ephemeris_Mapping);
+		Ephemeris_Mapping = 0;
+		return 0;
+	}
+	*size = (size_t)file_size.QuadPart;
+#else
+	struct stat st;
+	void* view;
+	int fd = open(filename,O_RDONLY);
+	if (fd < 0) return 0;
+	if (fstat(fd,&st) != 0) {
+		close(fd);
+		return 0;
+	}
+	view = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (view == MAP_FAILED) return 0;
+
+	Ephemeris_Mapping_View = view;
+	Ephemeris_Mapping_Size = st.st_size;
+	*size = st.st_size;
+#endif
+	return Ephemeris_Mapping_View;
 }
 
-void solsystem_initialize()
+void DE405_Unmap_File()
 {
-	Ephemeris_File = fopen(FROM_PLUGINS("de405.eph"),"rb");
-	if (!Ephemeris_File) {
-		log_write("X-Space: Unable to open ephemeris (de405.eph)\n");
+	if (!Ephemeris_Mapping_View) return;
+#ifdef WIN32
+	UnmapViewOfFile(Ephemeris_Mapping_View);
+	CloseHandle(Ephemeris_Mapping);
+	Ephemeris_Mapping = 0;
+#else
+	munmap(Ephemeris_Mapping_View,Ephemeris_Mapping_Size);
+	Ephemeris_Mapping_Size = 0;
+#endif
+	Ephemeris_Mapping_View = 0;
+}
+
+
+//==============================================================================
+// Read record from file through the cache (when ephemeris is not memory-mapped)
+//==============================================================================
+void DE405_Read_Record(int record, double* data)
+{
+	eph_cache_entry* entry = &Ephemeris_Cache[0];
+	int i;
+
+	lock_enter(Ephemeris_Cache_Lock);
+	Ephemeris_Cache_Time++;
+
+	//Find record in cache, or least recently used entry
+	for (i = 0; i < DE405_CACHE_RECORDS; i++) {
+		if (Ephemeris_Cache[i].record == record) {
+			entry = &Ephemeris_Cache[i];
+			break;
+		}
+		if (Ephemeris_Cache[i].last_use < entry->last_use) entry = &Ephemeris_Cache[i];
+	}
+
+	//Read record from file
+	if (entry->record != record) {
+		entry->record = -1;
+		fseek(Ephemeris_File,(long)(record+2)*EPH_ARRAY_SIZE*sizeof(double),SEEK_SET);
+		if (fread(entry->data,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File) == EPH_ARRAY_SIZE) {
+			entry->record = record;
+		}
+	}
+	entry->last_use = Ephemeris_Cache_Time;
+	memcpy(data,entry->data,EPH_ARRAY_SIZE*sizeof(double));
+	lock_leave(Ephemeris_Cache_Lock);
+}
+
+
+//==============================================================================
+// Select record that contains the given time. Returns 0 if time is not covered
+//==============================================================================
+int DE405_Read_Coefficients(solsystem_context* ctx, double Time)
+{
+	int record;
+
+	//Current record still valid
+	if ((ctx->record >= 0) && (Time >= ctx->T_beg) && (Time <= ctx->T_end)) return 1;
+	if (!Ephemeris_Record_Count) return 0;
+
+	//Records follow each other with constant span
+	record = (int)floor((Time - Ephemeris_T_start) / Ephemeris_T_span);
+	if (record == Ephemeris_Record_Count) record--; //End of last record
+	if ((record < 0) || (record >= Ephemeris_Record_Count)) return 0;
+
+	if (Ephemeris_Records) {
+		ctx->coeff = Ephemeris_Records + (size_t)record*EPH_ARRAY_SIZE;
+	} else {
+		DE405_Read_Record(record,ctx->buffer);
+		ctx->coeff = ctx->buffer;
+	}
+	ctx->record = record;
+	ctx->T_beg  = ctx->coeff[0];
+	ctx->T_end  = ctx->coeff[1];
+	ctx->T_span = ctx->T_end - ctx->T_beg;
+	return 1;
+}
+
+
+//==============================================================================
+// Interpolate state of the body from coefficients in current record
+//==============================================================================
+void DE405_Interpolate_Record(solsystem_context* ctx, double Time, int Target, solsystem_state* Planet)
+{
+	double Cp[50],Up[50];
+	double T_sub,Tc;
+	double* A;
+	int i,j;
+	int C,G,N,offset;
+
+	C = R1.coeffPtr[Target][0] - 1;	//Coeff array entry point
+	N = R1.coeffPtr[Target][1];		//Number of coeff's
+	G = R1.coeffPtr[Target][2];		//Granules in current record
+	if ((G < 1) || (N < 3) || (N > 50)) { //Invalid header data
+		memset(Planet,0,sizeof(solsystem_state));
 		return;
 	}
 
-	log_write("X-Space: Loading ephemeris (de405.eph)\n");
-	
-	fread(&H1,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File);
-	fread(&H2,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File);
-	fread(&Coeff_Array,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File);
+	//Compute the normalized time and find the granule which contains it
+	T_sub = ctx->T_span / ((double)G);
+	offset = (int)((Time - ctx->T_beg) / T_sub);
+	if (offset < 0) offset = 0;
+	if (offset > G-1) offset = G-1;
+	Tc = 2.0*(Time - (ctx->T_beg + offset*T_sub)) / T_sub - 1.0;
+	A = ctx->coeff + C + 3*offset*N;
+
+	//Compute interpolating polynomials
+	Cp[0] = 1.0;
+	Cp[1] = Tc;
+	Cp[2] = 2.0*Tc*Tc - 1.0;
+	Up[0] = 0.0;
+	Up[1] = 1.0;
+	Up[2] = 4.0*Tc;
+	for (j = 3; j < N; j++) {
+		Cp[j] = 2.0*Tc*Cp[j-1] - Cp[j-2];
+		Up[j] = 2.0*Tc*Up[j-1] + 2.0*Cp[j-1] - Up[j-2];
+	}
+
+	//Compute interpolated position & velocity
+	for (i = 0; i < 3; i++) {
+		double P_Sum = 0.0;
+		double V_Sum = 0.0;
+		for (j = N-1; j > -1; j--) P_Sum += A[j+i*N] * Cp[j];
+		for (j = N-1; j > 0;  j--) V_Sum += A[j+i*N] * Up[j];
 
-	R1 = H1.data;
-	T_beg  = Coeff_Array[0];
-	T_end  = Coeff_Array[1];
-	T_span = T_end - T_beg;
+		Planet->Position[i] = P_Sum;
+		Planet->Velocity[i] = V_Sum * 2.0 * ((double)G) / (ctx->T_span * 86400.0);
+	}
+}
+
+
+//==============================================================================
+// Get state of a body at given time (JD). Returns 0 if state is not available
+//==============================================================================
+int DE405_Interpolate_State(solsystem_context* ctx, double Time, int Target, solsystem_state* Planet)
+{
+	//This function doesn't "do" nutations or librations
+	if ((Target < 0) || (Target > DE405_SUN)) return 0;
+	if (!DE405_Read_Coefficients(ctx,Time)) return 0;
 
+	DE405_Interpolate_Record(ctx,Time,Target,Planet);
+	return 1;
+}
+
+
+//==============================================================================
+// Get states of several bodies at given time (JD)
+//==============================================================================
+int DE405_Interpolate_States(solsystem_context* ctx, double Time, int* Targets, int count, solsystem_state* Planets)
+{
+	int i;
+	if (!DE405_Read_Coefficients(ctx,Time)) return 0;
+
+	for (i = 0; i < count; i++) {
+		if ((Targets[i] < 0) || (Targets[i] > DE405_SUN)) return 0;
+		DE405_Interpolate_Record(ctx,Time,Targets[i],&Planets[i]);
+	}
+	return 1;
+}
+
+
+//==============================================================================
+// Reset ephemeris lookup context
+//==============================================================================
+void solsystem_context_initialize(solsystem_context* ctx)
+{
+	ctx->record = -1;
+	ctx->coeff = 0;
+	ctx->T_beg = 0.0;
+	ctx->T_end = 0.0;
+	ctx->T_span = 0.0;
+}
+
+
+//==============================================================================
+// Load ephemeris
+//==============================================================================
+void solsystem_initialize()
+{
+	double first[2];
+	double* data;
+	size_t size = 0;
+	int i;
+
+	solsystem_deinitialize();
+	solsystem_context_initialize(&solsystem_main_context);
+
+	//Map ephemeris into memory, or read it record by record
+	data = (double*)DE405_Map_File(FROM_PLUGINS("de405.eph"),&size);
+	if (data) {
+		log_write("X-Space: Loading ephemeris (de405.eph, memory-mapped)\n");
+		if (size < 3*EPH_ARRAY_SIZE*sizeof(double)) {
+			log_write("X-Space: Invalid ephemeris file (too short)\n");
+			DE405_Unmap_File();
+			return;
+		}
+		memcpy(H1,data,sizeof(H1));
+		memcpy(&H2,data+EPH_ARRAY_SIZE,sizeof(H2));
+	} else {
+		Ephemeris_File = fopen(FROM_PLUGINS("de405.eph"),"rb");
+		if (!Ephemeris_File) {
+			log_write("X-Space: Unable to open ephemeris (de405.eph)\n");
+			return;
+		}
+		log_write("X-Space: Loading ephemeris (de405.eph)\n");
+
+		fseek(Ephemeris_File,0,SEEK_END);
+		size = ftell(Ephemeris_File);
+		fseek(Ephemeris_File,0,SEEK_SET);
+		if ((size < 3*EPH_ARRAY_SIZE*sizeof(double)) ||
+			(fread(H1,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File) != EPH_ARRAY_SIZE) ||
+			(fread(&H2,sizeof(double),EPH_ARRAY_SIZE,Ephemeris_File) != EPH_ARRAY_SIZE)) {
+			log_write("X-Space: Invalid ephemeris file (too short)\n");
+			solsystem_deinitialize();
+			return;
+		}
+	}
+
+	DE405_Read_Header((char*)H1,&R1);
 	if (R1.DENUM != 405) {
-		log_write("X-Space: Invalid ephemeris file (not DE405)");
+		log_write("X-Space: Invalid ephemeris file (not DE405)\n");
+		solsystem_deinitialize();
 		return;
 	}
 
-	log_write("X-Space: Ephemeris from MJD%.0f to MJD%.0f\n",T_beg-2400000.5,T_end-2400000.5);
+	//Read time span of the first record (all records have same span)
+	Ephemeris_Record_Count = (int)(size / (EPH_ARRAY_SIZE*sizeof(double))) - 2;
+	if (data) {
+		Ephemeris_Records = data + 2*EPH_ARRAY_SIZE;
+	} else {
+		Ephemeris_Cache = (eph_cache_entry*)malloc(DE405_CACHE_RECORDS*sizeof(eph_cache_entry));
+		for (i = 0; i < DE405_CACHE_RECORDS; i++) {
+			Ephemeris_Cache[i].record = -1;
+			Ephemeris_Cache[i].last_use = 0;
+		}
+		Ephemeris_Cache_Lock = lock_create();
+	}
+	if (data) {
+		first[0] = Ephemeris_Records[0];
+		first[1] = Ephemeris_Records[1];
+	} else {
+		fseek(Ephemeris_File,2*EPH_ARRAY_SIZE*sizeof(double),SEEK_SET);
+		fread(first,sizeof(double),2,Ephemeris_File);
+	}
+	Ephemeris_T_start = first[0];
+	Ephemeris_T_span = first[1] - first[0];
+	if (Ephemeris_T_span <= 0.0) {
+		log_write("X-Space: Invalid ephemeris file (bad record span)\n");
+		solsystem_deinitialize();
+		return;
+	}
+
+	log_write("X-Space: Ephemeris from MJD%.0f to MJD%.0f\n",
+		Ephemeris_T_start-2400000.5,
+		Ephemeris_T_start+Ephemeris_T_span*Ephemeris_Record_Count-2400000.5);
+}
+
+
+//==============================================================================
+// Unload ephemeris
+//==============================================================================
+void solsystem_deinitialize()
+{
+	thirdbody_reset();
+	DE405_Unmap_File();
+	if (Ephemeris_File) fclose(Ephemeris_File);
+	if (Ephemeris_Cache) free(Ephemeris_Cache);
+	if (Ephemeris_Cache_Lock != BAD_ID) lock_destroy(Ephemeris_Cache_Lock);
+
+	Ephemeris_File = 0;
+	Ephemeris_Records = 0;
+	Ephemeris_Record_Count = 0;
+	Ephemeris_Cache = 0;
+	Ephemeris_Cache_Lock = BAD_ID;
 }
 
+
+//==============================================================================
 void solsystem_update_vessel(int net_id, solsystem_state* state, double mass) {
 	vessel* v = 0;
-	int i;
-	for (i = 0; i < vessel_count; i++) {
-		if (vessels[i].net_id == net_id) v = &vessels[i];
-	}
+	int idx = vessels_find_by_net_id(net_id);
+	if (idx >= 0) v = &vessels[idx];
 	if (!v) {
 		v = &vessels[vessels_add()];
-		v->net_id = net_id;
-		v->exists = 1;
+		vessels_set_net_id(v,net_id);
+		vessels_set_exists(v,1);
 	}
 
 	v->inertial.x = state->Position[0]*1e3;
@@ -268,6 +460,7 @@ void solsystem_update_vessel(int net_id, solsystem_state* state, double mass) {
 	v->inertial.vx = state->Velocity[0]*1e3;
 	v->inertial.vy = state->Velocity[1]*1e3;
 	v->inertial.vz = state->Velocity[2]*1e3;
+	if (v->weight.chassis != mass) v->mass_dirty = 1;
 	v->weight.chassis = mass;
 
 	v->physics_type = VESSEL_PHYSICS_INERTIAL;
@@ -275,34 +468,74 @@ void solsystem_update_vessel(int net_id, solsystem_state* state, double mass) {
 	v->physics_type = VESSEL_PHYSICS_DISABLED;
 }
 
-void solsystem_update(double mjd)
+//==============================================================================
+// Sample perturbing bodies over the time step for third-body gravity
+//==============================================================================
+void solsystem_update_perturbations(double jd, double dt)
+{
+	int targets[SOLSYSTEM_PERTURBING_BODIES+1];
+	solsystem_state states[SOLSYSTEM_PERTURBING_BODIES+1];
+	double positions[SOLSYSTEM_PERTURBING_BODIES][THIRDBODY_ORDER][3];
+	double nodes[THIRDBODY_ORDER];
+	double moon_fraction = 1.0/(1.0 + R1.EMRAT);
+	int i,j,k;
+
+	//Earth-Moon barycenter is needed to get geocentric positions
+	for (i = 0; i < SOLSYSTEM_PERTURBING_BODIES; i++) targets[i] = solsystem_perturbing_bodies[i].target;
+	targets[SOLSYSTEM_PERTURBING_BODIES] = DE405_EARTH;
+
+	thirdbody_begin(dt,nodes);
+	for (k = 0; k < THIRDBODY_ORDER; k++) {
+		solsystem_state* moon = 0;
+		solsystem_state* emb = &states[SOLSYSTEM_PERTURBING_BODIES];
+		double earth[3];
+
+		if (!DE405_Interpolate_States(&solsystem_main_context,jd + nodes[k]/86400.0,
+			targets,SOLSYSTEM_PERTURBING_BODIES+1,states)) {
+			thirdbody_reset();
+			return;
+		}
+		for (i = 0; i < SOLSYSTEM_PERTURBING_BODIES; i++) {
+			if (targets[i] == DE405_MOON) moon = &states[i];
+		}
+
+		//Earth = EMB - Moon/(1 + EMRAT), Moon is already geocentric
+		for (j = 0; j < 3; j++) {
+			earth[j] = emb->Position[j] - (moon ? moon->Position[j]*moon_fraction : 0.0);
+		}
+		for (i = 0; i < SOLSYSTEM_PERTURBING_BODIES; i++) {
+			for (j = 0; j < 3; j++) {
+				if (targets[i] == DE405_MOON) {
+					positions[i][k][j] = states[i].Position[j]*1e3;
+				} else {
+					positions[i][k][j] = (states[i].Position[j] - earth[j])*1e3;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < SOLSYSTEM_PERTURBING_BODIES; i++) {
+		thirdbody_add(solsystem_perturbing_bodies[i].mu,positions[i]);
+	}
+}
+
+
+//==============================================================================
+// Update solar system bodies
+//==============================================================================
+void solsystem_update(double mjd, double dt)
 {
-	double jd = mjd + 2400000.5;
+	int target = DE405_MOON;
 	solsystem_state moon;
-	solsystem_state earth;
-	solsystem_state sun;
-	solsystem_state jupiter;
-
-	DE405_Interpolate_State(jd, MOON, &moon);
-	DE405_Interpolate_State(jd, EARTH, &earth);
-	DE405_Interpolate_State(jd, SUN, &sun);
-	DE405_Interpolate_State(jd, JUPITER, &jupiter);
-
-	sun.Position[0] -= earth.Position[0];
-	sun.Position[1] -= earth.Position[1];
-	sun.Position[2] -= earth.Position[2];
-	sun.Velocity[0] = 0;
-	sun.Velocity[1] = 0;
-	sun.Velocity[2] = 0;
-	jupiter.Position[0] -= earth.Position[0];
-	jupiter.Position[1] -= earth.Position[1];
-	jupiter.Position[2] -= earth.Position[2];
-	jupiter.Velocity[0] = 0;
-	jupiter.Velocity[1] = 0;
-	jupiter.Velocity[2] = 0;
-
-	//Update vessel that corresponds to moon
+
+	if (!DE405_Interpolate_States(&solsystem_main_context,mjd + 2400000.5,&target,1,&moon)) {
+		thirdbody_reset();
+		return;
+	}
+
+	//Update vessel that corresponds to moon (for clients, does not attract vessels)
 	solsystem_update_vessel(1000000,&moon,7.3477e22);
-	//solsystem_update_vessel(1000001,&sun,1.98892e30);
-	//solsystem_update_vessel(1000002,&jupiter,1.8986e27);
-}
\ No newline at end of file
+
+	//Third-body gravity
+	solsystem_update_perturbations(mjd + 2400000.5,dt);
+}
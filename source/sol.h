@@ -1,7 +1,46 @@
 #ifndef SOL_H
 #define SOL_H
 
+//DE405 record size (in doubles)
+#define EPH_ARRAY_SIZE 1018
+
+//DE405 bodies
+#define DE405_MERCURY	0
+#define DE405_VENUS		1
+#define DE405_EARTH		2	//Earth-Moon Barycenter
+#define DE405_MARS		3
+#define DE405_JUPITER	4
+#define DE405_SATURN	5
+#define DE405_URANUS	6
+#define DE405_NEPTUNE	7
+#define DE405_PLUTO		8
+#define DE405_MOON		9	//Relative to geocenter
+#define DE405_SUN		10
+
+//Number of DE405 records kept in memory when ephemeris cannot be memory-mapped
+#define DE405_CACHE_RECORDS	16
+
+//State of a body (km, km/sec)
+typedef struct solsystem_state_t {
+	double Position[3];
+	double Velocity[3];
+} solsystem_state;
+
+//Ephemeris lookup context. Every thread which queries ephemeris must use its own
+//context, the context keeps last used record
+typedef struct solsystem_context_t {
+	int record;					//Index of current record (-1 if none)
+	double T_beg,T_end,T_span;	//Time span of current record (JD)
+	double* coeff;				//Coefficients of current record
+	double buffer[EPH_ARRAY_SIZE]; //Copy of record (when ephemeris is not memory-mapped)
+} solsystem_context;
+
 void solsystem_initialize();
-void solsystem_update(double mjd);
+void solsystem_deinitialize();
+void solsystem_update(double mjd, double dt);
+
+void solsystem_context_initialize(solsystem_context* ctx);
+int DE405_Interpolate_State(solsystem_context* ctx, double Time, int Target, solsystem_state* Planet);
+int DE405_Interpolate_States(solsystem_context* ctx, double Time, int* Targets, int count, solsystem_state* Planets);
 
 #endif
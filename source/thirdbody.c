@@ -0,0 +1,108 @@
+//==============================================================================
+// Third-body gravitational perturbations (Sun, Moon, planets)
+//------------------------------------------------------------------------------
+// Once per tick positions of all perturbing bodies are sampled at Chebyshev
+// nodes over the time step and turned into Chebyshev series. Integrator then
+// evaluates the series at its sub-step times, so cost of third-body gravity
+// does not depend on how bodies are simulated or on number of vessels.
+//==============================================================================
+#include <math.h>
+#include <string.h>
+#include "x-space.h"
+#include "thirdbody.h"
+
+//Perturbing bodies over current time step
+thirdbody_segment thirdbody_segments[THIRDBODY_MAX_BODIES];
+int thirdbody_count = 0;
+//Length of current time step (sec)
+double thirdbody_span = 1.0;
+
+
+//==============================================================================
+// Start new segment. Returns times (sec from start) at which positions of the
+// bodies must be sampled
+//==============================================================================
+void thirdbody_begin(double span, double nodes[THIRDBODY_ORDER])
+{
+	int k;
+
+	thirdbody_count = 0;
+	thirdbody_span = (span > 1e-3) ? span : 1e-3;
+	for (k = 0; k < THIRDBODY_ORDER; k++) {
+		double x = cos(PI*(k+0.5)/THIRDBODY_ORDER);
+		nodes[k] = 0.5*thirdbody_span*(x+1.0);
+	}
+}
+
+
+//==============================================================================
+// Add perturbing body by its positions at the nodes (relative to planet, m)
+//==============================================================================
+void thirdbody_add(double mu, double position[THIRDBODY_ORDER][3])
+{
+	thirdbody_segment* body;
+	int i,j,k;
+
+	if (thirdbody_count >= THIRDBODY_MAX_BODIES) return;
+	body = &thirdbody_segments[thirdbody_count++];
+	body->mu = mu;
+
+	//Chebyshev interpolation through the nodes
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < THIRDBODY_ORDER; j++) {
+			double sum = 0.0;
+			for (k = 0; k < THIRDBODY_ORDER; k++) {
+				sum += position[k][i]*cos(PI*j*(k+0.5)/THIRDBODY_ORDER);
+			}
+			body->c[i][j] = (2.0/THIRDBODY_ORDER)*sum;
+		}
+		body->c[i][0] *= 0.5;
+	}
+}
+
+
+//==============================================================================
+// Remove all perturbing bodies
+//==============================================================================
+void thirdbody_reset()
+{
+	thirdbody_count = 0;
+}
+
+
+//==============================================================================
+// Add third-body acceleration at time t (sec from start of segment) and
+// position r (planet-centered inertial, m) to a
+//==============================================================================
+void thirdbody_acceleration(double t, double r[3], double a[3])
+{
+	double tau = 2.0*t/thirdbody_span - 1.0;
+	int i,j,k;
+
+	for (k = 0; k < thirdbody_count; k++) {
+		thirdbody_segment* body = &thirdbody_segments[k];
+		double rb[3],d[3];
+		double d3,rb3;
+
+		//Position of the body (Clenshaw recurrence)
+		for (i = 0; i < 3; i++) {
+			double b1 = 0.0,b2 = 0.0;
+			for (j = THIRDBODY_ORDER-1; j > 0; j--) {
+				double b0 = 2.0*tau*b1 - b2 + body->c[i][j];
+				b2 = b1;
+				b1 = b0;
+			}
+			rb[i] = tau*b1 - b2 + body->c[i][0];
+			d[i] = rb[i] - r[i];
+		}
+
+		//Direct attraction minus attraction of the planet (frame is planet-centered)
+		d3 = d[0]*d[0]+d[1]*d[1]+d[2]*d[2];
+		d3 = d3*sqrt(d3);
+		rb3 = rb[0]*rb[0]+rb[1]*rb[1]+rb[2]*rb[2];
+		rb3 = rb3*sqrt(rb3);
+		for (i = 0; i < 3; i++) {
+			a[i] += body->mu*(d[i]/d3 - rb[i]/rb3);
+		}
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef THIRDBODY_H
+#define THIRDBODY_H
+
+//Maximum number of perturbing bodies
+#define THIRDBODY_MAX_BODIES	16
+//Number of Chebyshev coefficients per axis (positions are sampled at this many nodes)
+#define THIRDBODY_ORDER			4
+
+//Perturbing body over the current segment
+typedef struct thirdbody_segment {
+	double mu;							//Gravitational parameter (m3/sec2)
+	double c[3][THIRDBODY_ORDER];		//Chebyshev coefficients of position relative to planet (m)
+} thirdbody_segment;
+
+extern thirdbody_segment thirdbody_segments[THIRDBODY_MAX_BODIES];
+extern int thirdbody_count;
+
+void thirdbody_begin(double span, double nodes[THIRDBODY_ORDER]);
+void thirdbody_add(double mu, double position[THIRDBODY_ORDER][3]);
+void thirdbody_reset();
+void thirdbody_acceleration(double t, double r[3], double a[3]);
+
+#endif
@@ -327,6 +327,13 @@ void thread_sleep(double time)
 }
 
 
+//Full memory barrier (orders loads and stores of shared data between threads)
+void thread_memory_barrier()
+{
+	MemoryBarrier();
+}
+
+
 //Thread get number of processors
 int thread_numprocessors()
 {
@@ -703,6 +710,12 @@ void thread_sleep(double time)
 }
 
 
+void thread_memory_barrier()
+{
+	__sync_synchronize();
+}
+
+
 int thread_numprocessors()
 {
 #if APL
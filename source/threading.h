@@ -3,7 +3,8 @@
 
 #ifndef __THREAD_ID
 	#define BAD_ID 0xFFFFFFFF
-	typedef unsigned int genericID;
+	#include <stddef.h>
+	typedef size_t genericID; //Must be able to hold a pointer
 	typedef genericID threadID;
 	typedef genericID lockID;
 	#define __THREAD_ID
@@ -23,6 +24,7 @@ threadID     thread_getcurrentID();
 int          thread_waitfor(threadID ID);
 void         thread_kill(threadID ID);
 void         thread_sleep(double time);
+void         thread_memory_barrier();
 
 //Processor information
 int          thread_numprocessors();
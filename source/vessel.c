@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <stddef.h>
 
 #include "x-space.h"
 #include "config.h"
@@ -103,6 +104,9 @@ XPLMDataRef dataref_plane_yaw[20];
 int vessel_count;
 int vessel_alloc_count;
 vessel* vessels;
+vessel_mount_tree vessels_mount_tree;
+vessel_slots vessels_slots;
+vessel_net_index vessels_net_index;
 
 
 
@@ -110,304 +114,262 @@ vessel* vessels;
 //==============================================================================
 // ID-based interface to vessel internal variables
 //==============================================================================
+#define VESSEL_PARAMETER(index,name,type,field,writeable) \
+	{ index, name, VESSEL_PARAMETER_TYPE_##type, (int)offsetof(vessel,field), 0, 0, writeable }
+#define VESSEL_PARAMETER_ARRAY(index,name,field,element,count) \
+	{ index, name, VESSEL_PARAMETER_TYPE_DOUBLE, (int)offsetof(vessel,field), (int)sizeof(((vessel*)0)->element), count, 1 }
+#define VESSEL_PARAMETER_COMPUTED(index,name) \
+	{ index, name, VESSEL_PARAMETER_TYPE_COMPUTED, 0, 0, 0, 1 }
+
+//List of all parameters (offsets are resolved by compiler)
+vessel_parameter vessels_parameters[] = {
+	//Misc variables (0-29)
+	VESSEL_PARAMETER(  0,"exists",INT,exists,1),
+	VESSEL_PARAMETER(  1,"attached",INT,attached,1),
+	VESSEL_PARAMETER(  2,"net_id",INT,net_id,1),
+	VESSEL_PARAMETER(  3,"networked",INT,networked,1),
+	VESSEL_PARAMETER(  4,"physics_type",INT,physics_type,1),
+	VESSEL_PARAMETER(  5,"is_plane",INT,is_plane,0),
+	VESSEL_PARAMETER(  6,"plane_index",INT,plane_index,0),
+	VESSEL_PARAMETER(  7,"ixx",DOUBLE,ixx,0),
+	VESSEL_PARAMETER(  8,"iyy",DOUBLE,iyy,0),
+	VESSEL_PARAMETER(  9,"izz",DOUBLE,izz,0),
+	VESSEL_PARAMETER( 10,"jxx",DOUBLE,jxx,1),
+	VESSEL_PARAMETER( 11,"jyy",DOUBLE,jyy,1),
+	VESSEL_PARAMETER( 12,"jzz",DOUBLE,jzz,1),
+	VESSEL_PARAMETER( 13,"mass",DOUBLE,mass,1),
+	VESSEL_PARAMETER( 14,"latitude",DOUBLE,latitude,1),
+	VESSEL_PARAMETER( 15,"longitude",DOUBLE,longitude,1),
+	VESSEL_PARAMETER( 16,"elevation",DOUBLE,elevation,1),
+	VESSEL_PARAMETER( 17,"weight_chassis",DOUBLE,weight.chassis,1),
+	VESSEL_PARAMETER( 18,"weight_hull",DOUBLE,weight.hull,1),
+	VESSEL_PARAMETER( 19,"weight_fuel0",DOUBLE,weight.fuel[0],1),
+	VESSEL_PARAMETER( 20,"weight_fuel1",DOUBLE,weight.fuel[1],1),
+	VESSEL_PARAMETER( 21,"weight_fuel2",DOUBLE,weight.fuel[2],1),
+	VESSEL_PARAMETER( 22,"weight_fuel3",DOUBLE,weight.fuel[3],1),
+	VESSEL_PARAMETER( 23,"geometry_dx",DOUBLE,geometry.dx,1),
+	VESSEL_PARAMETER( 24,"geometry_dy",DOUBLE,geometry.dy,1),
+	VESSEL_PARAMETER( 25,"geometry_dz",DOUBLE,geometry.dz,1),
+	VESSEL_PARAMETER_ARRAY( 26,"weight_fuel",weight.fuel[0],weight.fuel[0],VESSEL_MAX_FUELTANKS),
+	VESSEL_PARAMETER_ARRAY( 27,"weight_fuel_x",weight.fuel_location[0].x,weight.fuel_location[0],VESSEL_MAX_FUELTANKS),
+	VESSEL_PARAMETER_ARRAY( 28,"weight_fuel_y",weight.fuel_location[0].y,weight.fuel_location[0],VESSEL_MAX_FUELTANKS),
+	VESSEL_PARAMETER_ARRAY( 29,"weight_fuel_z",weight.fuel_location[0].z,weight.fuel_location[0],VESSEL_MAX_FUELTANKS),
+	//Inertial coordinates (30-49)
+	VESSEL_PARAMETER( 30,"inertial_x",DOUBLE,inertial.x,1),
+	VESSEL_PARAMETER( 31,"inertial_y",DOUBLE,inertial.y,1),
+	VESSEL_PARAMETER( 32,"inertial_z",DOUBLE,inertial.z,1),
+	VESSEL_PARAMETER( 33,"inertial_vx",DOUBLE,inertial.vx,1),
+	VESSEL_PARAMETER( 34,"inertial_vy",DOUBLE,inertial.vy,1),
+	VESSEL_PARAMETER( 35,"inertial_vz",DOUBLE,inertial.vz,1),
+	VESSEL_PARAMETER( 36,"inertial_ax",DOUBLE,inertial.ax,1),
+	VESSEL_PARAMETER( 37,"inertial_ay",DOUBLE,inertial.ay,1),
+	VESSEL_PARAMETER( 38,"inertial_az",DOUBLE,inertial.az,1),
+	VESSEL_PARAMETER( 39,"inertial_q0",DOUBLE,inertial.q[0],1),
+	VESSEL_PARAMETER( 40,"inertial_q1",DOUBLE,inertial.q[1],1),
+	VESSEL_PARAMETER( 41,"inertial_q2",DOUBLE,inertial.q[2],1),
+	VESSEL_PARAMETER( 42,"inertial_q3",DOUBLE,inertial.q[3],1),
+	VESSEL_PARAMETER( 43,"inertial_P",DOUBLE,inertial.P,1),
+	VESSEL_PARAMETER( 44,"inertial_Q",DOUBLE,inertial.Q,1),
+	VESSEL_PARAMETER( 45,"inertial_R",DOUBLE,inertial.R,1),
+	//Non-inertial coordinates (50-69)
+	VESSEL_PARAMETER( 50,"noninertial_x",DOUBLE,noninertial.x,1),
+	VESSEL_PARAMETER( 51,"noninertial_y",DOUBLE,noninertial.y,1),
+	VESSEL_PARAMETER( 52,"noninertial_z",DOUBLE,noninertial.z,1),
+	VESSEL_PARAMETER( 53,"noninertial_vx",DOUBLE,noninertial.vx,1),
+	VESSEL_PARAMETER( 54,"noninertial_vy",DOUBLE,noninertial.vy,1),
+	VESSEL_PARAMETER( 55,"noninertial_vz",DOUBLE,noninertial.vz,1),
+	VESSEL_PARAMETER( 56,"noninertial_ax",DOUBLE,noninertial.ax,1),
+	VESSEL_PARAMETER( 57,"noninertial_ay",DOUBLE,noninertial.ay,1),
+	VESSEL_PARAMETER( 58,"noninertial_az",DOUBLE,noninertial.az,1),
+	VESSEL_PARAMETER( 59,"noninertial_q0",DOUBLE,noninertial.q[0],1),
+	VESSEL_PARAMETER( 60,"noninertial_q1",DOUBLE,noninertial.q[1],1),
+	VESSEL_PARAMETER( 61,"noninertial_q2",DOUBLE,noninertial.q[2],1),
+	VESSEL_PARAMETER( 62,"noninertial_q3",DOUBLE,noninertial.q[3],1),
+	VESSEL_PARAMETER( 63,"noninertial_P",DOUBLE,noninertial.P,1),
+	VESSEL_PARAMETER( 64,"noninertial_Q",DOUBLE,noninertial.Q,1),
+	VESSEL_PARAMETER( 65,"noninertial_R",DOUBLE,noninertial.R,1),
+	VESSEL_PARAMETER( 66,"noninertial_cx",DOUBLE,noninertial.cx,1),
+	VESSEL_PARAMETER( 67,"noninertial_cy",DOUBLE,noninertial.cy,1),
+	VESSEL_PARAMETER( 68,"noninertial_cz",DOUBLE,noninertial.cz,1),
+	//Geomagnetic variables (70-89)
+	VESSEL_PARAMETER( 70,"geomagnetic_inclination",DOUBLE,geomagnetic.inclination,1),
+	VESSEL_PARAMETER( 71,"geomagnetic_declination",DOUBLE,geomagnetic.declination,1),
+	VESSEL_PARAMETER( 72,"geomagnetic_F",DOUBLE,geomagnetic.F,1),
+	VESSEL_PARAMETER( 73,"geomagnetic_H",DOUBLE,geomagnetic.H,1),
+	VESSEL_PARAMETER( 74,"geomagnetic_noninertial_x",DOUBLE,geomagnetic.noninertial.x,1),
+	VESSEL_PARAMETER( 75,"geomagnetic_noninertial_y",DOUBLE,geomagnetic.noninertial.y,1),
+	VESSEL_PARAMETER( 76,"geomagnetic_noninertial_z",DOUBLE,geomagnetic.noninertial.z,1),
+	VESSEL_PARAMETER( 77,"geomagnetic_local_x",DOUBLE,geomagnetic.local.x,1),
+	VESSEL_PARAMETER( 78,"geomagnetic_local_y",DOUBLE,geomagnetic.local.y,1),
+	VESSEL_PARAMETER( 79,"geomagnetic_local_z",DOUBLE,geomagnetic.local.z,1),
+	VESSEL_PARAMETER( 80,"geomagnetic_GV",DOUBLE,geomagnetic.GV,1),
+	VESSEL_PARAMETER( 81,"geomagnetic_g",DOUBLE,geomagnetic.g,1),
+	VESSEL_PARAMETER( 82,"geomagnetic_V",DOUBLE,geomagnetic.V,1),
+	//Misc variables (90-99)
+	VESSEL_PARAMETER_COMPUTED( 90,"detach"),
+	VESSEL_PARAMETER( 91,"mount_x",DOUBLE,mount.x,1),
+	VESSEL_PARAMETER( 92,"mount_y",DOUBLE,mount.y,1),
+	VESSEL_PARAMETER( 93,"mount_z",DOUBLE,mount.z,1),
+	VESSEL_PARAMETER( 94,"weight_tps",DOUBLE,weight.tps,1),
+	VESSEL_PARAMETER( 95,"heat_fps",DOUBLE,geometry.heat_fps,0),
+	VESSEL_PARAMETER( 96,"client_id",INT,client_id,1),
+	VESSEL_PARAMETER( 97,"last_update",DOUBLE,last_update,1),
+	//Atmospheric variables (100-119)
+	VESSEL_PARAMETER(100,"air_density",DOUBLE,air.density,0),
+	VESSEL_PARAMETER(101,"air_concentration",DOUBLE,air.concentration,0),
+	VESSEL_PARAMETER(102,"air_temperature",DOUBLE,air.temperature,0),
+	VESSEL_PARAMETER(103,"air_pressure",DOUBLE,air.pressure,0),
+	VESSEL_PARAMETER(104,"air_Q",DOUBLE,air.Q,0),
+	VESSEL_PARAMETER(105,"air_exospheric_temperature",DOUBLE,air.exospheric_temperature,0),
+	VESSEL_PARAMETER(106,"air_concentration_He",DOUBLE,air.concentration_He,0),
+	VESSEL_PARAMETER(107,"air_concentration_O",DOUBLE,air.concentration_O,0),
+	VESSEL_PARAMETER(108,"air_concentration_N2",DOUBLE,air.concentration_N2,0),
+	VESSEL_PARAMETER(109,"air_concentration_O2",DOUBLE,air.concentration_O2,0),
+	VESSEL_PARAMETER(110,"air_concentration_Ar",DOUBLE,air.concentration_Ar,0),
+	VESSEL_PARAMETER(111,"air_concentration_H",DOUBLE,air.concentration_H,0),
+	VESSEL_PARAMETER(112,"air_concentration_N",DOUBLE,air.concentration_N,0),
+	VESSEL_PARAMETER(113,"air_density_He",DOUBLE,air.density_He,0),
+	VESSEL_PARAMETER(114,"air_density_O",DOUBLE,air.density_O,0),
+	VESSEL_PARAMETER(115,"air_density_N2",DOUBLE,air.density_N2,0),
+	VESSEL_PARAMETER(116,"air_density_O2",DOUBLE,air.density_O2,0),
+	VESSEL_PARAMETER(117,"air_density_Ar",DOUBLE,air.density_Ar,0),
+	VESSEL_PARAMETER(118,"air_density_H",DOUBLE,air.density_H,0),
+	VESSEL_PARAMETER(119,"air_density_N",DOUBLE,air.density_N,0),
+	//Orbital elements and information (120-129)
+	VESSEL_PARAMETER(120,"orbit_smA",DOUBLE,orbit.smA,0),
+	VESSEL_PARAMETER(121,"orbit_e",DOUBLE,orbit.e,0),
+	VESSEL_PARAMETER(122,"orbit_i",DOUBLE,orbit.i,0),
+	VESSEL_PARAMETER(123,"orbit_MnA",DOUBLE,orbit.MnA,0),
+	VESSEL_PARAMETER(124,"orbit_AgP",DOUBLE,orbit.AgP,0),
+	VESSEL_PARAMETER(125,"orbit_AsN",DOUBLE,orbit.AsN,0),
+	VESSEL_PARAMETER(126,"orbit_BSTAR",DOUBLE,orbit.BSTAR,0),
+	VESSEL_PARAMETER(127,"orbit_period",DOUBLE,orbit.period,0),
+	//Statistics (130-139)
+	VESSEL_PARAMETER(130,"statistics_time_in_space",DOUBLE,statistics.time_in_space,1),
+	VESSEL_PARAMETER(131,"statistics_total_orbits",DOUBLE,statistics.total_orbits,1),
+	VESSEL_PARAMETER(132,"statistics_total_true_orbits",DOUBLE,statistics.total_true_orbits,1),
+	VESSEL_PARAMETER(133,"statistics_total_distance",DOUBLE,statistics.total_distance,1),
+	//Local & relative coordinates (140-169)
+	VESSEL_PARAMETER(140,"local_x",DOUBLE,local.x,1),
+	VESSEL_PARAMETER(141,"local_y",DOUBLE,local.y,1),
+	VESSEL_PARAMETER(142,"local_z",DOUBLE,local.z,1),
+	VESSEL_PARAMETER(143,"local_vx",DOUBLE,local.vx,1),
+	VESSEL_PARAMETER(144,"local_vy",DOUBLE,local.vy,1),
+	VESSEL_PARAMETER(145,"local_vz",DOUBLE,local.vz,1),
+	VESSEL_PARAMETER(146,"local_ax",DOUBLE,local.ax,1),
+	VESSEL_PARAMETER(147,"local_ay",DOUBLE,local.ay,1),
+	VESSEL_PARAMETER(148,"local_az",DOUBLE,local.az,1),
+	VESSEL_PARAMETER(149,"relative_q0",DOUBLE,relative.q[0],1),
+	VESSEL_PARAMETER(150,"relative_q1",DOUBLE,relative.q[1],1),
+	VESSEL_PARAMETER(151,"relative_q2",DOUBLE,relative.q[2],1),
+	VESSEL_PARAMETER(152,"relative_q3",DOUBLE,relative.q[3],1),
+	VESSEL_PARAMETER(153,"relative_P",DOUBLE,relative.P,1),
+	VESSEL_PARAMETER(154,"relative_Q",DOUBLE,relative.Q,1),
+	VESSEL_PARAMETER(155,"relative_R",DOUBLE,relative.R,1),
+	VESSEL_PARAMETER(156,"relative_roll",DOUBLE,relative.roll,1),
+	VESSEL_PARAMETER(157,"relative_pitch",DOUBLE,relative.pitch,1),
+	VESSEL_PARAMETER(158,"relative_yaw",DOUBLE,relative.yaw,1),
+	VESSEL_PARAMETER(159,"relative_heading",DOUBLE,relative.heading,1),
+	VESSEL_PARAMETER(160,"relative_airspeed",DOUBLE,relative.airspeed,1),
+	VESSEL_PARAMETER(161,"relative_hpath",DOUBLE,relative.hpath,1),
+	VESSEL_PARAMETER(162,"relative_vpath",DOUBLE,relative.vpath,1),
+	VESSEL_PARAMETER(163,"relative_vv",DOUBLE,relative.vv,1),
+	VESSEL_PARAMETER(164,"relative_gx",DOUBLE,relative.gx,1),
+	VESSEL_PARAMETER(165,"relative_gy",DOUBLE,relative.gy,1),
+	VESSEL_PARAMETER(166,"relative_gz",DOUBLE,relative.gz,1),
+	{ -1 }
+};
+
+//Parameters by index
+vessel_parameter* vessels_parameters_lookup[VESSEL_MAX_PARAMETERS];
+
+//Build lookup table for parameters
+void vessels_initialize_parameters()
+{
+	vessel_parameter* param;
+	memset(vessels_parameters_lookup,0,sizeof(vessels_parameters_lookup));
+	for (param = vessels_parameters; param->index >= 0; param++) {
+		vessels_parameters_lookup[param->index] = param;
+	}
+}
+
+//Get parameter description, or 0 if there is no such parameter
+vessel_parameter* vessels_get_parameter_info(int paramidx)
+{
+	if ((paramidx < 0) || (paramidx >= VESSEL_MAX_PARAMETERS)) return 0;
+	return vessels_parameters_lookup[paramidx];
+}
+
+//Get pointer to parameter variable, or 0 if it is not stored in vessel structure
+static char* vessels_get_parameter_ptr(vessel_parameter* param, int idx, int arridx)
+{
+	if ((!param) || (param->type == VESSEL_PARAMETER_TYPE_COMPUTED)) return 0;
+	if (param->count) {
+		if ((arridx < 0) || (arridx >= param->count)) return 0;
+		return (char*)&vessels[idx] + param->offset + arridx*param->stride;
+	}
+	return (char*)&vessels[idx] + param->offset;
+}
+
 double vessels_read_param_d(int idx, int paramidx, int arridx)
 {
+	vessel_parameter* param = vessels_get_parameter_info(paramidx);
+	char* ptr = vessels_get_parameter_ptr(param,idx,arridx);
+
+	if (ptr) {
+		if (param->type == VESSEL_PARAMETER_TYPE_INT) return (double)(*((int*)ptr));
+		return *((double*)ptr);
+	}
+
+	//Parameters which are computed
 	switch (paramidx) {
-			//Misc variables (0-29)
-		case  0: return (double)vessels[idx].exists;
-		case  1: return (double)vessels[idx].attached;
-		case  2: return (double)vessels[idx].net_id;
-		case  3: return (double)vessels[idx].networked;
-		case  4: return (double)vessels[idx].physics_type;
-		case  5: return (double)vessels[idx].is_plane;
-		case  6: return (double)vessels[idx].plane_index;
-		case  7: return (double)vessels[idx].ixx;
-		case  8: return (double)vessels[idx].iyy;
-		case  9: return (double)vessels[idx].izz;
-		case 10: return (double)vessels[idx].jxx;
-		case 11: return (double)vessels[idx].jyy;
-		case 12: return (double)vessels[idx].jzz;
-		case 13: return (double)vessels[idx].mass;
-		case 14: return (double)vessels[idx].latitude;
-		case 15: return (double)vessels[idx].longitude;
-		case 16: return (double)vessels[idx].elevation;
-		case 17: return (double)vessels[idx].weight.chassis;
-		case 18: return (double)vessels[idx].weight.hull;
-		case 19: return (double)vessels[idx].weight.fuel[0];
-		case 20: return (double)vessels[idx].weight.fuel[1];
-		case 21: return (double)vessels[idx].weight.fuel[2];
-		case 22: return (double)vessels[idx].weight.fuel[3];
-		case 23: return (double)vessels[idx].geometry.dx;
-		case 24: return (double)vessels[idx].geometry.dy;
-		case 25: return (double)vessels[idx].geometry.dz;
-		case 26: return (double)vessels[idx].weight.fuel[arridx];
-		case 27: return (double)vessels[idx].weight.fuel_location[arridx].x;
-		case 28: return (double)vessels[idx].weight.fuel_location[arridx].y;
-		case 29: return (double)vessels[idx].weight.fuel_location[arridx].z;
-			//Inertial coordinates (30-49)
-		case 30: return vessels[idx].inertial.x;
-		case 31: return vessels[idx].inertial.y;
-		case 32: return vessels[idx].inertial.z;
-		case 33: return vessels[idx].inertial.vx;
-		case 34: return vessels[idx].inertial.vy;
-		case 35: return vessels[idx].inertial.vz;
-		case 36: return vessels[idx].inertial.ax;
-		case 37: return vessels[idx].inertial.ay;
-		case 38: return vessels[idx].inertial.az;
-		case 39: return vessels[idx].inertial.q[0];
-		case 40: return vessels[idx].inertial.q[1];
-		case 41: return vessels[idx].inertial.q[2];
-		case 42: return vessels[idx].inertial.q[3];
-		case 43: return vessels[idx].inertial.P;
-		case 44: return vessels[idx].inertial.Q;
-		case 45: return vessels[idx].inertial.R;
-			//Non-inertial coordinates (50-69)
-		case 50: return vessels[idx].noninertial.x;
-		case 51: return vessels[idx].noninertial.y;
-		case 52: return vessels[idx].noninertial.z;
-		case 53: return vessels[idx].noninertial.vx;
-		case 54: return vessels[idx].noninertial.vy;
-		case 55: return vessels[idx].noninertial.vz;
-		case 56: return vessels[idx].noninertial.ax;
-		case 57: return vessels[idx].noninertial.ay;
-		case 58: return vessels[idx].noninertial.az;
-		case 59: return vessels[idx].noninertial.q[0];
-		case 60: return vessels[idx].noninertial.q[1];
-		case 61: return vessels[idx].noninertial.q[2];
-		case 62: return vessels[idx].noninertial.q[3];
-		case 63: return vessels[idx].noninertial.P;
-		case 64: return vessels[idx].noninertial.Q;
-		case 65: return vessels[idx].noninertial.R;
-		case 66: return vessels[idx].noninertial.cx;
-		case 67: return vessels[idx].noninertial.cy;
-		case 68: return vessels[idx].noninertial.cz;
-			//Geomagnetic variables (70-89)
-		case 70: return vessels[idx].geomagnetic.inclination;
-		case 71: return vessels[idx].geomagnetic.declination;
-		case 72: return vessels[idx].geomagnetic.F;
-		case 73: return vessels[idx].geomagnetic.H;
-		case 74: return vessels[idx].geomagnetic.noninertial.x;
-		case 75: return vessels[idx].geomagnetic.noninertial.y;
-		case 76: return vessels[idx].geomagnetic.noninertial.z;
-		case 77: return vessels[idx].geomagnetic.local.x;
-		case 78: return vessels[idx].geomagnetic.local.y;
-		case 79: return vessels[idx].geomagnetic.local.z;
-		case 80: return vessels[idx].geomagnetic.GV;
-		case 81: return vessels[idx].geomagnetic.g;
-		case 82: return vessels[idx].geomagnetic.V;
-			//Misc variables (90-99)
 		case 90: return 1.0 - (double)vessels[idx].attached;
-		case 91: return vessels[idx].mount.x;
-		case 92: return vessels[idx].mount.y;
-		case 93: return vessels[idx].mount.z;
-		case 94: return vessels[idx].weight.tps;
-		case 95: return vessels[idx].geometry.heat_fps;
-		case 96: return (double)vessels[idx].client_id;
-		case 97: return vessels[idx].last_update;
-			//Atmospheric variables (100-119)
-		case 100: return vessels[idx].air.density;
-		case 101: return vessels[idx].air.concentration;
-		case 102: return vessels[idx].air.temperature;
-		case 103: return vessels[idx].air.pressure;
-		case 104: return vessels[idx].air.Q;
-		case 105: return vessels[idx].air.exospheric_temperature;
-		case 106: return vessels[idx].air.concentration_He;
-		case 107: return vessels[idx].air.concentration_O;
-		case 108: return vessels[idx].air.concentration_N2;
-		case 109: return vessels[idx].air.concentration_O2;
-		case 110: return vessels[idx].air.concentration_Ar;
-		case 111: return vessels[idx].air.concentration_H;
-		case 112: return vessels[idx].air.concentration_N;
-		case 113: return vessels[idx].air.density_He;
-		case 114: return vessels[idx].air.density_O;
-		case 115: return vessels[idx].air.density_N2;
-		case 116: return vessels[idx].air.density_O2;
-		case 117: return vessels[idx].air.density_Ar;
-		case 118: return vessels[idx].air.density_H;
-		case 119: return vessels[idx].air.density_N;
-			//Orbital elements and information (120-129)
-		case 120: return vessels[idx].orbit.smA;
-		case 121: return vessels[idx].orbit.e;
-		case 122: return vessels[idx].orbit.i;
-		case 123: return vessels[idx].orbit.MnA;
-		case 124: return vessels[idx].orbit.AgP;
-		case 125: return vessels[idx].orbit.AsN;
-		case 126: return vessels[idx].orbit.BSTAR;
-		case 127: return vessels[idx].orbit.period;
-			//Statistics (130-139)
-		case 130: return vessels[idx].statistics.time_in_space;
-		case 131: return vessels[idx].statistics.total_orbits;
-		case 132: return vessels[idx].statistics.total_true_orbits;
-		case 133: return vessels[idx].statistics.total_distance;
-			//Local & relative coordinates (140-169)
-		case 140: return vessels[idx].local.x; 
-		case 141: return vessels[idx].local.y; 
-		case 142: return vessels[idx].local.z; 
-		case 143: return vessels[idx].local.vx;
-		case 144: return vessels[idx].local.vy;
-		case 145: return vessels[idx].local.vz;
-		case 146: return vessels[idx].local.ax;
-		case 147: return vessels[idx].local.ay;
-		case 148: return vessels[idx].local.az;
-		case 149: return vessels[idx].relative.q[0];
-		case 150: return vessels[idx].relative.q[1];
-		case 151: return vessels[idx].relative.q[2];
-		case 152: return vessels[idx].relative.q[3];
-		case 153: return vessels[idx].relative.P;
-		case 154: return vessels[idx].relative.Q;
-		case 155: return vessels[idx].relative.R;
-		case 156: return vessels[idx].relative.roll;
-		case 157: return vessels[idx].relative.pitch;
-		case 158: return vessels[idx].relative.yaw;
-		case 159: return vessels[idx].relative.heading;
-		case 160: return vessels[idx].relative.airspeed;
-		case 161: return vessels[idx].relative.hpath;
-		case 162: return vessels[idx].relative.vpath;
-		case 163: return vessels[idx].relative.vv;
-		case 164: return vessels[idx].relative.gx;
-		case 165: return vessels[idx].relative.gy;
-		case 166: return vessels[idx].relative.gz;
 		default: return 0.0;
 	}
 }
 
+//Parameters from which mass properties are computed (or mass properties themselves)
+static int vessels_parameter_changes_mass(vessel_parameter* param)
+{
+	int offset = param->offset;
+	if ((offset >= (int)offsetof(vessel,jxx)) && (offset < (int)offsetof(vessel,index))) return 1;
+	if ((offset >= (int)offsetof(vessel,weight)) &&
+		(offset < (int)(offsetof(vessel,weight)+sizeof(((vessel*)0)->weight)))) return 1;
+	if ((offset >= (int)offsetof(vessel,mount)) &&
+		(offset < (int)(offsetof(vessel,mount)+sizeof(((vessel*)0)->mount)))) return 1;
+	return 0;
+}
+
 void vessels_write_param_d(int idx, int paramidx, int arridx, double val)
 {
+	vessel_parameter* param = vessels_get_parameter_info(paramidx);
+	char* ptr = vessels_get_parameter_ptr(param,idx,arridx);
+
+	if (ptr) {
+		if (!param->writeable) return;
+		if (param->type == VESSEL_PARAMETER_TYPE_INT) {
+			*((int*)ptr) = (int)val;
+		} else {
+			*((double*)ptr) = val;
+		}
+		if (vessels_parameter_changes_mass(param)) vessels[idx].mass_dirty = 1;
+		if (ptr == (char*)&vessels[idx].exists) vessels_set_exists(&vessels[idx],vessels[idx].exists);
+		if (ptr == (char*)&vessels[idx].net_id) vessels_set_net_id(&vessels[idx],vessels[idx].net_id);
+		return;
+	}
+
+	//Parameters which have side effects
 	switch (paramidx) {
-			//Misc variables (0-10)
-		case  0: vessels[idx].exists = (int)val; break;
-		case  1: vessels[idx].attached = (int)val; break;
-		case  2: vessels[idx].net_id = (int)val; break;
-		case  3: vessels[idx].networked = (int)val; break;
-		case  4: vessels[idx].physics_type = (int)val; break;
-			//case  5: vessels[idx].is_plane = (int)val; break;
-			//case  6: vessels[idx].plane_index = (int)val; break;
-			//case  7: vessels[idx].ixx = val; break;
-			//case  8: vessels[idx].iyy = val; break;
-			//case  9: vessels[idx].izz = val; break;
-		case 10: vessels[idx].jxx = val; break;
-		case 11: vessels[idx].jyy = val; break;
-		case 12: vessels[idx].jzz = val; break;
-		case 13: vessels[idx].mass = val; break;
-		case 14: vessels[idx].latitude = val; break;
-		case 15: vessels[idx].longitude = val; break;
-		case 16: vessels[idx].elevation = val; break;
-		case 17: vessels[idx].weight.chassis = val; break;
-		case 18: vessels[idx].weight.hull = val; break;
-		case 19: vessels[idx].weight.fuel[0] = val; break;
-		case 20: vessels[idx].weight.fuel[1] = val; break;
-		case 21: vessels[idx].weight.fuel[2] = val; break;
-		case 22: vessels[idx].weight.fuel[3] = val; break;
-		case 23: vessels[idx].geometry.dx = val; break;
-		case 24: vessels[idx].geometry.dy = val; break;
-		case 25: vessels[idx].geometry.dz = val; break;
-		case 26: vessels[idx].weight.fuel[arridx] = val; break;
-		case 27: vessels[idx].weight.fuel_location[arridx].x = val; break;
-		case 28: vessels[idx].weight.fuel_location[arridx].y = val; break;
-		case 29: vessels[idx].weight.fuel_location[arridx].z = val; break;
-			//Inertial coordinates (30-49)
-		case 30: vessels[idx].inertial.x = val; break;
-		case 31: vessels[idx].inertial.y = val; break;
-		case 32: vessels[idx].inertial.z = val; break;
-		case 33: vessels[idx].inertial.vx = val; break;
-		case 34: vessels[idx].inertial.vy = val; break;
-		case 35: vessels[idx].inertial.vz = val; break;
-		case 36: vessels[idx].inertial.ax = val; break;
-		case 37: vessels[idx].inertial.ay = val; break;
-		case 38: vessels[idx].inertial.az = val; break;
-		case 39: vessels[idx].inertial.q[0] = val; break;
-		case 40: vessels[idx].inertial.q[1] = val; break;
-		case 41: vessels[idx].inertial.q[2] = val; break;
-		case 42: vessels[idx].inertial.q[3] = val; break;
-		case 43: vessels[idx].inertial.P = val; break;
-		case 44: vessels[idx].inertial.Q = val; break;
-		case 45: vessels[idx].inertial.R = val; break;
-			//Non-inertial coordinates (50-69)
-		case 50: vessels[idx].noninertial.x = val; break;
-		case 51: vessels[idx].noninertial.y = val; break;
-		case 52: vessels[idx].noninertial.z = val; break;
-		case 53: vessels[idx].noninertial.vx = val; break;
-		case 54: vessels[idx].noninertial.vy = val; break;
-		case 55: vessels[idx].noninertial.vz = val; break;
-		case 56: vessels[idx].noninertial.ax = val; break;
-		case 57: vessels[idx].noninertial.ay = val; break;
-		case 58: vessels[idx].noninertial.az = val; break;
-		case 59: vessels[idx].noninertial.q[0] = val; break;
-		case 60: vessels[idx].noninertial.q[1] = val; break;
-		case 61: vessels[idx].noninertial.q[2] = val; break;
-		case 62: vessels[idx].noninertial.q[3] = val; break;
-		case 63: vessels[idx].noninertial.P = val; break;
-		case 64: vessels[idx].noninertial.Q = val; break;
-		case 65: vessels[idx].noninertial.R = val; break;
-		case 66: vessels[idx].noninertial.cx = val; break;
-		case 67: vessels[idx].noninertial.cy = val; break;
-		case 68: vessels[idx].noninertial.cz = val; break;
-			//Geomagnetic variables (70-89)
-		case 70: vessels[idx].geomagnetic.inclination = val; break;
-		case 71: vessels[idx].geomagnetic.declination = val; break;
-		case 72: vessels[idx].geomagnetic.F = val; break;
-		case 73: vessels[idx].geomagnetic.H = val; break;
-		case 74: vessels[idx].geomagnetic.noninertial.x = val; break;
-		case 75: vessels[idx].geomagnetic.noninertial.y = val; break;
-		case 76: vessels[idx].geomagnetic.noninertial.z = val; break;
-		case 77: vessels[idx].geomagnetic.local.x = val; break;
-		case 78: vessels[idx].geomagnetic.local.y = val; break;
-		case 79: vessels[idx].geomagnetic.local.z = val; break;
-		case 80: vessels[idx].geomagnetic.GV = val; break;
-		case 81: vessels[idx].geomagnetic.g = val; break;
-		case 82: vessels[idx].geomagnetic.V = val; break;
-				//Misc variables (90-99)
 		case 90: 
 			if (val > 0.5) { 
 				vessels[idx].attached = 0;
+				vessels_invalidate_mount_tree();
 				if (vessels[0].physics_type == VESSEL_PHYSICS_SIM) {
 					vessels[0].detach_time = curtime();
 					if (config.staging_wait_time > 0.0) vessels[0].physics_type = VESSEL_PHYSICS_INERTIAL;
 				}
 			}
 			break;
-		case 91: vessels[idx].mount.x = val; break;
-		case 92: vessels[idx].mount.y = val; break;
-		case 93: vessels[idx].mount.z = val; break;
-		case 94: vessels[idx].weight.tps = val; break;
-		//case 95: vessels[idx].geometry.heat_fps = val; break;
-		case 96: vessels[idx].client_id = (int)val; break;
-		case 97: vessels[idx].last_update = val; break;
-			//Atmospheric variables (100-119)
-			//Orbital elements and information (120-129)
-			//Statistics (130-139)
-		case 130: vessels[idx].statistics.time_in_space = val;
-		case 131: vessels[idx].statistics.total_orbits = val;
-		case 132: vessels[idx].statistics.total_true_orbits = val;
-		case 133: vessels[idx].statistics.total_distance = val;
-			//Local & relative coordinates (140-169)
-		case 140: vessels[idx].local.x = val; break;
-		case 141: vessels[idx].local.y = val; break;
-		case 142: vessels[idx].local.z = val; break;
-		case 143: vessels[idx].local.vx = val; break;
-		case 144: vessels[idx].local.vy = val; break;
-		case 145: vessels[idx].local.vz = val; break;
-		case 146: vessels[idx].local.ax = val; break;
-		case 147: vessels[idx].local.ay = val; break;
-		case 148: vessels[idx].local.az = val; break;
-		case 149: vessels[idx].relative.q[0] = val; break;
-		case 150: vessels[idx].relative.q[1] = val; break;
-		case 151: vessels[idx].relative.q[2] = val; break;
-		case 152: vessels[idx].relative.q[3] = val; break;
-		case 153: vessels[idx].relative.P = val; break;
-		case 154: vessels[idx].relative.Q = val; break;
-		case 155: vessels[idx].relative.R = val; break;
-		case 156: vessels[idx].relative.roll = val; break;
-		case 157: vessels[idx].relative.pitch = val; break;
-		case 158: vessels[idx].relative.yaw = val; break;
-		case 159: vessels[idx].relative.heading = val; break;
-		case 160: vessels[idx].relative.airspeed = val; break;
-		case 161: vessels[idx].relative.hpath = val; break;
-		case 162: vessels[idx].relative.vpath = val; break;
-		case 163: vessels[idx].relative.vv = val; break;
-		case 164: vessels[idx].relative.gx = val; break;
-		case 165: vessels[idx].relative.gy = val; break;
-		case 166: vessels[idx].relative.gz = val; break;
 		default: break;
 	}
 }
@@ -430,27 +392,77 @@ double vessels_get_parameter(vessel* v, int index, int array_index)
 typedef struct __vessels_param_tag {
 	int idx;
 	int arraysize;
+
+	//Values for all vessels, refreshed once per frame
+	float* values;
+	int size;				//Number of values allocated
+	int filled;				//Number of values written during last refresh
+	struct __vessels_param_tag* next;
 } __vessels_param;
 
-static long vessels_get_param_fv(void* dataptr, float* values, int inOffset, int inMax)
+//List of all published parameters
+__vessels_param* vessels_published_params = 0;
+
+//Value of parameter for vessels which do not exist
+static float vessels_param_default(__vessels_param* param)
+{
+	return (param->idx == 90) ? 1.0f : 0.0f;
+}
+
+//Allocate values for all possible vessels
+static void vessels_param_allocate(__vessels_param* param)
+{
+	int i,size = vessel_alloc_count*param->arraysize;
+	if (param->size == size) return;
+
+	param->values = (float*)realloc(param->values,sizeof(float)*size);
+	for (i = param->size; i < size; i++) param->values[i] = vessels_param_default(param);
+	param->size = size;
+	if (param->filled > size) param->filled = size;
+}
+
+//Copy parameter of all vessels into its table
+static void vessels_param_refresh(__vessels_param* param)
 {
+	vessel_parameter* info = vessels_get_parameter_info(param->idx);
+	int count = vessel_count*param->arraysize;
 	int i;
+
+	vessels_param_allocate(param);
+	if (info && (info->type != VESSEL_PARAMETER_TYPE_COMPUTED) && (param->arraysize == 1)) {
+		char* ptr = (char*)vessels + info->offset;
+		if (info->type == VESSEL_PARAMETER_TYPE_INT) {
+			for (i = 0; i < count; i++, ptr += sizeof(vessel)) param->values[i] = (float)(*((int*)ptr));
+		} else {
+			for (i = 0; i < count; i++, ptr += sizeof(vessel)) param->values[i] = (float)(*((double*)ptr));
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			param->values[i] = (float)vessels_read_param_d(i / param->arraysize,param->idx,i % param->arraysize);
+		}
+	}
+
+	//Clear values of vessels removed since last refresh
+	for (i = count; i < param->filled; i++) param->values[i] = vessels_param_default(param);
+	param->filled = count;
+}
+
+//Refresh all vessel datarefs (called once per frame after simulation)
+void vessels_update_datarefs()
+{
+	__vessels_param* param;
+	for (param = vessels_published_params; param; param = param->next) {
+		vessels_param_refresh(param);
+	}
+}
+
+static long vessels_get_param_fv(void* dataptr, float* values, int inOffset, int inMax)
+{
 	__vessels_param* param = (__vessels_param*)dataptr;
 	if (!values) return vessel_count;
 
-	for (i = inOffset; i < inOffset+inMax; i++) {
-		int vidx = i / param->arraysize;
-		if ((vidx >= 0) && (vidx < vessel_alloc_count)) {
-			if (vidx < vessel_count) {
-				values[i-inOffset] = (float)(vessels_read_param_d(vidx,param->idx,i%param->arraysize));
-			} else {
-				if (param->idx == 90) {
-					values[i-inOffset] = 1.0f;
-				} else {
-					values[i-inOffset] = 0.0f;
-				}
-			}
-		}
+	if ((inOffset >= 0) && (inOffset < param->size)) {
+		memcpy(values,param->values+inOffset,sizeof(float)*min(inMax,param->size-inOffset));
 	}
 	return vessel_count;
 }
@@ -465,15 +477,24 @@ static void vessels_set_param_fv(void* dataptr, float* values, int inOffset, int
 		int vidx = i / param->arraysize;
 		if ((vidx >= 0) && (vidx < vessel_count)) {
 			vessels_write_param_d(vidx,param->idx,i%param->arraysize,(double)values[i-inOffset]);
+			if (i < param->size) param->values[i] = (float)vessels_read_param_d(vidx,param->idx,i%param->arraysize);
 		}
 	}
 }
 
-void vessels_register_dataref(char* name, int paramidx)
+void vessels_register_dataref_v(char* name, int paramidx, int arraysize)
 {
 	__vessels_param* param = (__vessels_param*)malloc(sizeof(__vessels_param));
 	param->idx = paramidx;
-	param->arraysize = 1;
+	param->arraysize = arraysize;
+	param->values = 0;
+	param->size = 0;
+	param->filled = 0;
+	vessels_param_allocate(param);
+
+	//Add to list of published parameters
+	param->next = vessels_published_params;
+	vessels_published_params = param;
 
 	XPLMRegisterDataAccessor(
 	    name,xplmType_FloatArray,1,0,0,0,0,0,0,0,0,
@@ -481,16 +502,9 @@ void vessels_register_dataref(char* name, int paramidx)
 	    (void*)param,(void*)param);
 }
 
-void vessels_register_dataref_v(char* name, int paramidx, int arraysize)
+void vessels_register_dataref(char* name, int paramidx)
 {
-	__vessels_param* param = (__vessels_param*)malloc(sizeof(__vessels_param));
-	param->idx = paramidx;
-	param->arraysize = arraysize;
-
-	XPLMRegisterDataAccessor(
-	    name,xplmType_FloatArray,1,0,0,0,0,0,0,0,0,
-	    vessels_get_param_fv,vessels_set_param_fv,0,0,
-	    (void*)param,(void*)param);
+	vessels_register_dataref_v(name,paramidx,1);
 }
 #endif
 
@@ -589,6 +603,7 @@ void vessels_read(vessel* v, int update_inertial)
 		for (i = 0; i < 9; i++) v->weight.fuel[i] = nan_filter(fuel[i]);
 		v->weight.chassis = 0.8*mass;
 		v->weight.hull = 0.2*mass;
+		v->mass_dirty = 1;
 
 		//FIXME: Pd, Qd, Rd
 	} else if (v->is_plane) { //This cause is horribly broken due to X-Plane legacy
@@ -1022,10 +1037,36 @@ void vessels_initialize()
 	dataref_d("xsp/local/gz",			&instrument_gz);
 #endif
 
-	//No vessels
-	vessel_alloc_count = 1024;
+	//Resolve vessel parameters
+	vessels_initialize_parameters();
+
+	//No vessels (keep capacity reserved before initialization, see vessels_reserve)
+	vessel_alloc_count = max(vessel_alloc_count,max(config.max_vessels,1024));
 	vessels = malloc(vessel_alloc_count*sizeof(vessel));
 
+	//Mount tree
+	vessels_mount_tree.order = malloc(vessel_alloc_count*sizeof(int));
+	vessels_mount_tree.parent = malloc(vessel_alloc_count*sizeof(int));
+	vessels_mount_tree.keys = malloc(3*vessel_alloc_count*sizeof(int));
+	vessels_mount_tree.state = malloc(vessel_alloc_count*sizeof(int));
+	vessels_mount_tree.count = 0;
+	vessels_mount_tree.key_count = -1;
+	vessels_mount_tree.rebuilds = 0;
+
+	//Vessel slots
+	vessels_slots.active = malloc(vessel_alloc_count*sizeof(int));
+	vessels_slots.free = malloc(vessel_alloc_count*sizeof(int));
+	vessels_slots.flags = calloc(vessel_alloc_count,sizeof(int));
+	vessels_slots.generation = calloc(vessel_alloc_count,sizeof(int));
+
+	//Network ID index
+	vessels_net_index.size = 2048;
+	vessels_net_index.keys = calloc(vessels_net_index.size,sizeof(int));
+	vessels_net_index.values = malloc(vessels_net_index.size*sizeof(int));
+	vessels_net_index.indexed = calloc(vessel_alloc_count,sizeof(int));
+	vessels_net_index.count = 0;
+	vessels_net_index.shared = 0;
+
 	//Datarefs to all internal vessel information
 #if (!defined(DEDICATED_SERVER)) && (!defined(ORBITER_MODULE))
 	vessels_register_dataref("xsp/vessel/exists",0);
@@ -1181,11 +1222,19 @@ void vessels_reinitialize()
 {
 	//Initialize main vessel (on dedicated server this represents the server itself)
 	vessel_count = 0;
+	memset(vessels_slots.flags,0,vessel_alloc_count*sizeof(int));
+	vessels_slots.active_count = 0;
+	vessels_slots.free_count = 0;
+	vessels_slots.changes++;
+	memset(vessels_net_index.keys,0,vessels_net_index.size*sizeof(int));
+	memset(vessels_net_index.indexed,0,vessel_alloc_count*sizeof(int));
+	vessels_net_index.count = 0;
+	vessels_net_index.shared = 0;
 	vessels_add();
 	//memset(&vessels[0],0,sizeof(vessel));
 	//vessels[0].index = 0;
 	vessels[0].geometry.hull = material_get("Aluminium");
-	vessels[0].exists = 1;
+	vessels_set_exists(&vessels[0],1);
 }
 
 
@@ -1196,9 +1245,223 @@ void vessels_deinitialize()
 {
 	free(vessels);
 	vessels = 0;
+
+	free(vessels_mount_tree.order);
+	free(vessels_mount_tree.parent);
+	free(vessels_mount_tree.keys);
+	free(vessels_mount_tree.state);
+	memset(&vessels_mount_tree,0,sizeof(vessels_mount_tree));
+
+	free(vessels_slots.active);
+	free(vessels_slots.free);
+	free(vessels_slots.flags);
+	free(vessels_slots.generation);
+	memset(&vessels_slots,0,sizeof(vessels_slots));
+
+	free(vessels_net_index.keys);
+	free(vessels_net_index.values);
+	free(vessels_net_index.indexed);
+	memset(&vessels_net_index,0,sizeof(vessels_net_index));
+}
+
+
+//==============================================================================
+// Allocate memory for at least count vessels (before vessels_initialize only:
+// threads, scripts and cached pointers keep pointers into the vessels array)
+//==============================================================================
+void vessels_reserve(int count)
+{
+	if (count <= vessel_alloc_count) return;
+	if (vessels) {
+		log_write("X-Space: Cannot reserve %d vessels after initialization (%d allocated)\n",
+			count,vessel_alloc_count);
+		return;
+	}
+	vessel_alloc_count = count; //vessels_initialize allocates requested capacity
+}
+
+
+
+
+//==============================================================================
+// Index of vessels by network ID. Network IDs are assigned by the server (and
+// temporarily by clients for vessels not yet known to the server), several
+// vessels may share an ID (removed vessels keep it until their slot is reused)
+//==============================================================================
+static int vessels_net_index_home(int net_id)
+{
+	unsigned int hash = (unsigned int)net_id*2654435761u;
+	return (hash ^ (hash >> 16)) & (vessels_net_index.size-1);
+}
+
+static int vessels_net_index_slot(int net_id)
+{
+	int mask = vessels_net_index.size-1;
+	int slot = vessels_net_index_home(net_id);
+	while (vessels_net_index.keys[slot] && (vessels_net_index.keys[slot] != net_id)) slot = (slot+1) & mask;
+	return slot;
+}
+
+static void vessels_net_index_grow()
+{
+	int* keys = vessels_net_index.keys;
+	int* values = vessels_net_index.values;
+	int i,size = vessels_net_index.size;
+
+	vessels_net_index.size = size*2;
+	vessels_net_index.keys = calloc(vessels_net_index.size,sizeof(int));
+	vessels_net_index.values = malloc(vessels_net_index.size*sizeof(int));
+	for (i = 0; i < size; i++) {
+		if (keys[i]) {
+			int slot = vessels_net_index_slot(keys[i]);
+			vessels_net_index.keys[slot] = keys[i];
+			vessels_net_index.values[slot] = values[i];
+		}
+	}
+	free(keys);
+	free(values);
+}
+
+//Remove hash slot, shifting back entries which probed past it
+static void vessels_net_index_delete(int slot)
+{
+	int mask = vessels_net_index.size-1;
+	int next = slot;
+	while (1) {
+		int home;
+		next = (next+1) & mask;
+		if (!vessels_net_index.keys[next]) break;
+
+		//Entry can not move back if its probe sequence starts after the free slot
+		home = vessels_net_index_home(vessels_net_index.keys[next]);
+		if ((slot < next) ? ((home > slot) && (home <= next)) : ((home > slot) || (home <= next))) continue;
+		vessels_net_index.keys[slot] = vessels_net_index.keys[next];
+		vessels_net_index.values[slot] = vessels_net_index.values[next];
+		slot = next;
+	}
+	vessels_net_index.keys[slot] = 0;
+	vessels_net_index.count--;
 }
 
+static void vessels_net_index_link(int idx, int net_id)
+{
+	int slot = vessels_net_index_slot(net_id);
+	if (vessels_net_index.keys[slot]) {
+		vessels_net_index.shared++;
+		if (idx < vessels_net_index.values[slot]) vessels_net_index.values[slot] = idx;
+		return;
+	}
 
+	if (2*(vessels_net_index.count+1) > vessels_net_index.size) {
+		vessels_net_index_grow();
+		slot = vessels_net_index_slot(net_id);
+	}
+	vessels_net_index.keys[slot] = net_id;
+	vessels_net_index.values[slot] = idx;
+	vessels_net_index.count++;
+}
+
+static void vessels_net_index_unlink(int idx, int net_id)
+{
+	int slot = vessels_net_index_slot(net_id);
+	int i;
+	if (!vessels_net_index.keys[slot]) return;
+	if (vessels_net_index.values[slot] != idx) {
+		vessels_net_index.shared--;
+		return;
+	}
+
+	//Pass the ID to the next vessel sharing it
+	if (vessels_net_index.shared > 0) {
+		for (i = 0; i < vessel_count; i++) {
+			if ((i != idx) && (vessels_net_index.indexed[i] == net_id)) {
+				vessels_net_index.values[slot] = i;
+				vessels_net_index.shared--;
+				return;
+			}
+		}
+	}
+	vessels_net_index_delete(slot);
+}
+
+void vessels_set_net_id(vessel* v, int net_id)
+{
+	int old_net_id = vessels_net_index.indexed[v->index];
+	v->net_id = net_id;
+	if (old_net_id == net_id) return;
+
+	if (old_net_id) vessels_net_index_unlink(v->index,old_net_id);
+	if (net_id) vessels_net_index_link(v->index,net_id);
+	vessels_net_index.indexed[v->index] = net_id;
+}
+
+int vessels_find_by_net_id(int net_id)
+{
+	int i,slot;
+	if (!net_id) { //Not indexed
+		for (i = 0; i < vessel_count; i++) {
+			if (!vessels[i].net_id) return i;
+		}
+		return -1;
+	}
+
+	slot = vessels_net_index_slot(net_id);
+	if (!vessels_net_index.keys[slot]) return -1;
+	return vessels_net_index.values[slot];
+}
+
+
+//==============================================================================
+// Vessel slots. Vessels removed while subsystems iterate the active list stay
+// listed (and are skipped by exists checks) until the next vessels_update_slots
+//==============================================================================
+void vessels_set_exists(vessel* v, int exists)
+{
+	int* flags = &vessels_slots.flags[v->index];
+	v->exists = exists;
+
+	if (exists) {
+		if (!(*flags & VESSEL_SLOT_EXISTS)) vessels_slots.changes++;
+		if (!(*flags & VESSEL_SLOT_ACTIVE)) {
+			if (vessels_slots.active_count && (vessels_slots.active[vessels_slots.active_count-1] > v->index)) {
+				vessels_slots.unsorted = 1;
+			}
+			vessels_slots.active[vessels_slots.active_count++] = v->index;
+		}
+		*flags |= VESSEL_SLOT_EXISTS | VESSEL_SLOT_ACTIVE;
+	} else {
+		if (*flags & VESSEL_SLOT_EXISTS) vessels_slots.changes++;
+		if (*flags & VESSEL_SLOT_ACTIVE) vessels_slots.compact = 1;
+		if (!(*flags & VESSEL_SLOT_FREE)) vessels_slots.free[vessels_slots.free_count++] = v->index;
+		*flags = (*flags & ~VESSEL_SLOT_EXISTS) | VESSEL_SLOT_FREE;
+	}
+}
+
+static int vessels_compare_index(const void* a, const void* b)
+{
+	return *((int*)a) - *((int*)b);
+}
+
+void vessels_update_slots()
+{
+	int i,count = 0;
+	if (vessels_slots.compact) {
+		for (i = 0; i < vessels_slots.active_count; i++) {
+			int idx = vessels_slots.active[i];
+			if (vessels[idx].exists) {
+				vessels_slots.active[count++] = idx;
+			} else {
+				vessels_slots.flags[idx] &= ~VESSEL_SLOT_ACTIVE;
+			}
+		}
+		vessels_slots.active_count = count;
+		vessels_slots.compact = 0;
+	}
+	if (vessels_slots.unsorted) {
+		qsort(vessels_slots.active,vessels_slots.active_count,sizeof(int),vessels_compare_index);
+		vessels_slots.unsorted = 0;
+	}
+}
 
 
 //==============================================================================
@@ -1207,14 +1470,12 @@ void vessels_deinitialize()
 int vessels_add()
 {
 	int new_index = -1;
-	int i;
 
-	//Try to find non-existant vessel
-	for (i = 0; i < vessel_count; i++) {
-		if (!vessels[i].exists) {
-			new_index = i;
-			break;
-		}
+	//Reuse slot of a removed vessel (slot may have been brought back directly)
+	while ((new_index == -1) && (vessels_slots.free_count > 0)) {
+		int idx = vessels_slots.free[--vessels_slots.free_count];
+		vessels_slots.flags[idx] &= ~VESSEL_SLOT_FREE;
+		if (!vessels[idx].exists) new_index = idx;
 	}
 
 	//Initialize more memory (FIXME: no out of mem check)
@@ -1222,12 +1483,14 @@ int vessels_add()
 		new_index = vessel_count;
 		vessel_count++;
 	}
+	vessels_slots.generation[new_index]++;
 
 	//Reset vessel
 	memset(&vessels[new_index],0,sizeof(vessel));
 	vessels[new_index].geometry.hull = material_get("Aluminium");
 	vessels[new_index].index = new_index;
-	vessels[new_index].net_id = 0;
+	vessels_set_net_id(&vessels[new_index],0);
+	vessels[new_index].mass_dirty = 1;
 
 	//Network signature
 	memset(vessels[new_index].net_signature,0,sizeof(vessels[new_index].net_signature));
@@ -1277,7 +1540,7 @@ int vessels_load(char* filename)
 	strncat(path,filename,MAX_FILENAME-1);
 
 	//Initialize vessel
-	vessels[new_index].exists = 1;
+	vessels_set_exists(&vessels[new_index],1);
 	vessels[new_index].is_plane = 1;
 	strncpy(vessels[new_index].plane_filename,path,1023);
 
@@ -1532,24 +1795,13 @@ void vessels_update_mount_physics(vessel* v)
 
 
 //==============================================================================
-// Update physics (weights, moments of inertia)
+// Update physics (weights, moments of inertia) of the vessel itself
 //==============================================================================
 void vessels_update_physics(vessel* v)
 {
 	int i;
-	//if (v->mass == 0) v->mass = 1000;
-	//v->ixx = v->jxx*v->mass;
-	//v->iyy = v->jyy*v->mass;
-	//v->izz = v->jzz*v->mass;
-	//if (v->ixx == 0) v->ixx = 10000;
-	//if (v->iyy == 0) v->iyy = 10000;
-	//if (v->izz == 0) v->izz = 10000;
-
-	//Exit if this was already checked
-	if (v->mount.checked) return;
-	v->mount.checked = 1;
-
-	//Do not update non-existant vessel (FIXME: check if root vessel stopped existing)
+
+	//Do not update non-existant vessel
 	if (!v->exists) return;
 
 	//Calculate MI/mass for this vessel
@@ -1558,64 +1810,239 @@ void vessels_update_physics(vessel* v)
 	for (i = 0; i < VESSEL_MAX_FUELTANKS; i++) v->mass += v->weight.fuel[i];
 	v->mass += v->weight.chassis;
 	v->mass += v->weight.hull;
+	v->own_mass = v->mass;
 
 	v->ixx = v->mass*v->jxx;
 	v->iyy = v->mass*v->jyy;
 	v->izz = v->mass*v->jzz;
+}
 
-	//Add this mass to the root body
-	if ((v->attached != 0) && (v->attached != VESSEL_MOUNT_LAUNCHPAD)) {
-		vessel* root = &vessels[v->mount.body];
-		if ((root->attached == 0) || (root->attached == VESSEL_MOUNT_LAUNCHPAD)) { //If root body not mounted to anything
-			//Update physics of root body
-			vessels_update_physics(root);
-
-			//Set root body for this one
-			v->mount.root_body = root->index;
-			v->mount.rx = v->mount.x; //Offset of this one from the root body
-			v->mount.ry = v->mount.y;
-			v->mount.rz = v->mount.z;
-			memcpy(&v->mount.rattitude,&v->mount.attitude,sizeof(quaternion));
-
-			//Add own mass to mass of root body
-			root->mass += v->mass;
-			root->attached_mass += v->mass;
-
-			//Add own moments of inertia to MI of the root mass
-			root->ixx += v->ixx + v->mass*(v->mount.ry*v->mount.ry+v->mount.rz*v->mount.rz);
-			root->iyy += v->iyy + v->mass*(v->mount.rx*v->mount.rx+v->mount.rz*v->mount.rz);
-			root->izz += v->izz + v->mass*(v->mount.rx*v->mount.rx+v->mount.ry*v->mount.ry);
-		} else { //Root body is recursively mounted to some other body
-			//Correctly rotated centerpoint of this body (rotated by attitude of the mount body)
-			quaternion q;
-			double x,y,z;
-
-			//Update physics of root body
-			vessels_update_physics(root);
-
-			//Rotate mount coordinates by attitude of mount body
-			qset_vec(q,v->mount.x,v->mount.y,v->mount.z);
-			qdiv(q,q,root->mount.attitude); //NOT rattitude! must rotate around the mount body, not root body
-			qmul(q,root->mount.attitude,q);
-			qget_vec(q,&x,&y,&z);
-
-			//Set root body
-			v->mount.root_body = root->mount.root_body;
-			v->mount.rx = x + root->mount.rx; //Offset of this one from the root body
-			v->mount.ry = y + root->mount.ry;
-			v->mount.rz = z + root->mount.rz;
-			qmul(v->mount.rattitude,root->mount.rattitude,v->mount.attitude);
-
-			//Add own mass to the root body (the most root there is)
-			vessels[root->mount.root_body].mass += v->mass;
-			vessels[root->mount.root_body].attached_mass += v->mass;
-
-			//Add own moments of inertia to MI of the root mass
-			vessels[root->mount.root_body].ixx += v->ixx + v->mass*(v->mount.ry*v->mount.ry+v->mount.rz*v->mount.rz);
-			vessels[root->mount.root_body].iyy += v->iyy + v->mass*(v->mount.rx*v->mount.rx+v->mount.rz*v->mount.rz);
-			vessels[root->mount.root_body].izz += v->izz + v->mass*(v->mount.rx*v->mount.rx+v->mount.ry*v->mount.ry);
+
+//==============================================================================
+// Mount tree
+//------------------------------------------------------------------------------
+// Existing vessels are kept in such order that every vessel comes after the
+// body it is mounted to, so mass and poses propagate in a single pass. Tree
+// only depends on existance, attachment and mount body of every vessel, and
+// is rebuilt when any of these change (checked once per frame, because they
+// can be written from Lua and networking directly)
+//==============================================================================
+void vessels_invalidate_mount_tree()
+{
+	vessels_mount_tree.key_count = -1;
+}
+
+int vessels_mount_tree_valid()
+{
+	int* keys = vessels_mount_tree.keys;
+	int i,k;
+
+	//Vessels added or removed
+	if ((vessels_mount_tree.key_count != vessel_count) ||
+		(vessels_mount_tree.key_changes != vessels_slots.changes)) return 0;
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
+		if ((keys[3*i+0] != vessels[i].exists) ||
+			(keys[3*i+1] != vessels[i].attached) ||
+			(keys[3*i+2] != vessels[i].mount.body)) return 0;
+	}
+	return 1;
+}
+
+void vessels_rebuild_mount_tree()
+{
+	int* order = vessels_mount_tree.order;
+	int* parent = vessels_mount_tree.parent;
+	int* keys = vessels_mount_tree.keys;
+	int* state = vessels_mount_tree.state; //0: not visited, 1: being visited, 2: in order
+	int i,j;
+
+	//Body every vessel is mounted to
+	for (i = 0; i < vessel_count; i++) {
+		vessel* v = &vessels[i];
+		keys[3*i+0] = v->exists;
+		keys[3*i+1] = v->attached;
+		keys[3*i+2] = v->mount.body;
+
+		state[i] = 0;
+		parent[i] = -1;
+		if ((v->attached != 0) && (v->attached != VESSEL_MOUNT_LAUNCHPAD) &&
+			(v->mount.body >= 0) && (v->mount.body < vessel_count) && (v->mount.body != i) &&
+			(vessels[v->mount.body].exists)) {
+			parent[i] = v->mount.body;
 		}
 	}
+
+	//Sort vessels so that mount bodies come first (same order in which they were
+	//visited by recursive updates). Walk is collected in the order array itself
+	vessels_mount_tree.count = 0;
+	for (i = 0; i < vessel_count; i++) {
+		int first = vessels_mount_tree.count;
+		int last;
+
+		if ((!vessels[i].exists) || state[i]) continue;
+
+		//Walk towards the root until reaching a body which is already sorted
+		j = i;
+		last = first;
+		while ((j >= 0) && (state[j] == 0)) {
+			state[j] = 1;
+			order[last++] = j;
+			j = parent[j];
+		}
+
+		//Mount loop: treat the last visited body as a root body
+		if ((j >= 0) && (state[j] == 1)) parent[order[last-1]] = -1;
+
+		//Reverse the walk, so it starts from the body closest to the root
+		for (j = 0; j < (last-first)/2; j++) {
+			int k = order[first+j];
+			order[first+j] = order[last-1-j];
+			order[last-1-j] = k;
+		}
+		for (j = first; j < last; j++) state[order[j]] = 2;
+		vessels_mount_tree.count = last;
+	}
+
+	vessels_mount_tree.key_count = vessel_count;
+	vessels_mount_tree.key_changes = vessels_slots.changes;
+	vessels_mount_tree.rebuilds++;
+}
+
+void vessels_update_mount_tree()
+{
+	if (!vessels_mount_tree_valid()) vessels_rebuild_mount_tree();
+}
+
+
+//==============================================================================
+// Update offset and attitude of the vessel relative to its root body (mount
+// body must already be updated)
+//==============================================================================
+void vessels_update_mount_offset(vessel* v)
+{
+	int body = vessels_mount_tree.parent[v->index];
+
+	if (body < 0) {
+		//Root body, or mounted to a body which does not exist
+		v->mount.root_body = v->index;
+		v->mount.rx = 0.0;
+		v->mount.ry = 0.0;
+		v->mount.rz = 0.0;
+		qeuler_from(v->mount.rattitude,0,0,0);
+	} else if (vessels_mount_tree.parent[body] < 0) { //If root body not mounted to anything
+		vessel* root = &vessels[body];
+
+		//Set root body for this one
+		v->mount.root_body = root->index;
+		v->mount.rx = v->mount.x; //Offset of this one from the root body
+		v->mount.ry = v->mount.y;
+		v->mount.rz = v->mount.z;
+		memcpy(&v->mount.rattitude,&v->mount.attitude,sizeof(quaternion));
+	} else { //Root body is recursively mounted to some other body
+		vessel* root = &vessels[body];
+		double x,y,z;
+
+		//Rotate mount coordinates by attitude of mount body
+		//NOT rattitude! must rotate around the mount body, not root body
+		qtransform(root->mount.attitude,v->mount.x,v->mount.y,v->mount.z,&x,&y,&z);
+
+		//Set root body
+		v->mount.root_body = root->mount.root_body;
+		v->mount.rx = x + root->mount.rx; //Offset of this one from the root body
+		v->mount.ry = y + root->mount.ry;
+		v->mount.rz = z + root->mount.rz;
+		qmul(v->mount.rattitude,root->mount.rattitude,v->mount.attitude);
+	}
+}
+
+
+//==============================================================================
+// Update physics (weights, moments of inertia, mount offsets) of all vessels.
+// Only vessels marked with mass_dirty (and bodies mounted to them) are
+// recomputed, and only root bodies of these vessels sum up mass again
+//==============================================================================
+void vessels_update_mounts()
+{
+	int* order = vessels_mount_tree.order;
+	int* parent = vessels_mount_tree.parent;
+	int* changed_root = vessels_mount_tree.state;
+	int k,changed_roots = 0;
+
+	//Offsets and masses of all vessels change together with the tree
+	if (!vessels_mount_tree_valid()) {
+		vessels_rebuild_mount_tree();
+		for (k = 0; k < vessels_mount_tree.count; k++) vessels[order[k]].mass_dirty = 1;
+	}
+
+	//Update vessels themselves (mount bodies come first, so their changes propagate to mounted vessels)
+	vessels_mount_tree.mass_updates = 0;
+	for (k = 0; k < vessels_mount_tree.count; k++) changed_root[order[k]] = 0;
+	for (k = 0; k < vessels_mount_tree.count; k++) {
+		vessel* v = &vessels[order[k]];
+		if ((parent[v->index] >= 0) && (vessels[parent[v->index]].mass_dirty)) v->mass_dirty = 1;
+		if (!v->mass_dirty) continue;
+
+		vessels_update_physics(v);
+		vessels_update_mount_offset(v);
+		vessels_mount_tree.mass_updates++;
+		if (!changed_root[v->mount.root_body]) {
+			changed_root[v->mount.root_body] = 1;
+			changed_roots++;
+		}
+	}
+	if (!changed_roots) return;
+
+	//Sum up mass properties of root bodies
+	for (k = 0; k < vessels_mount_tree.count; k++) {
+		vessel* v = &vessels[order[k]];
+		vessel* root = &vessels[v->mount.root_body];
+
+		v->mass_dirty = 0;
+		if (!changed_root[root->index]) continue;
+		if (parent[v->index] < 0) {
+			v->mass = v->own_mass;
+			v->attached_mass = 0.0;
+			v->ixx = v->mass*v->jxx;
+			v->iyy = v->mass*v->jyy;
+			v->izz = v->mass*v->jzz;
+			continue;
+		}
+
+		//Add own mass to the root body (the most root there is)
+		root->mass += v->mass;
+		root->attached_mass += v->mass;
+
+		//Add own moments of inertia to MI of the root mass
+		root->ixx += v->ixx + v->mass*(v->mount.ry*v->mount.ry+v->mount.rz*v->mount.rz);
+		root->iyy += v->iyy + v->mass*(v->mount.rx*v->mount.rx+v->mount.rz*v->mount.rz);
+		root->izz += v->izz + v->mass*(v->mount.rx*v->mount.rx+v->mount.ry*v->mount.ry);
+	}
+}
+
+
+//==============================================================================
+// Move mounted vessels together with their root bodies and synchronize
+// coordinates of all vessels (root bodies are updated before mounted ones)
+//==============================================================================
+void vessels_update_mount_poses()
+{
+	int k;
+
+	//Attachments changed since the frame started (from Lua)
+	if (!vessels_mount_tree_valid()) {
+		vessels_rebuild_mount_tree();
+		for (k = 0; k < vessels_mount_tree.count; k++) {
+			vessels_update_mount_offset(&vessels[vessels_mount_tree.order[k]]);
+			vessels[vessels_mount_tree.order[k]].mass_dirty = 1;
+		}
+	}
+
+	for (k = 0; k < vessels_mount_tree.count; k++) {
+		vessel* v = &vessels[vessels_mount_tree.order[k]];
+		if (vessels_mount_tree.parent[v->index] >= 0) vessels_update_mount_physics(v);
+		vessels_update_coordinates(v);
+	}
 }
 
 //==============================================================================
@@ -1702,7 +2129,7 @@ int vessels_highlevel_getparameter(lua_State* L)
 	int paramidx = luaL_checkint(L,2);
 	int arridx = lua_tointeger(L,3);
 	DEFINE_VESSEL();
-	if (v && (paramidx >= 0) && (paramidx < 1000)) {
+	if (v && (paramidx >= 0) && (paramidx < VESSEL_MAX_PARAMETERS)) {
 		lua_pushnumber(L,vessels_read_param_d(v->index,paramidx,arridx));
 	} else {
 		lua_pushnil(L);
@@ -1715,7 +2142,7 @@ int vessels_highlevel_setparameter(lua_State* L)
 	int paramidx = luaL_checkint(L,2);
 	int arridx = 0;
 	DEFINE_VESSEL();
-	if (v && (paramidx >= 0) && (paramidx < 1000)) {
+	if (v && (paramidx >= 0) && (paramidx < VESSEL_MAX_PARAMETERS)) {
 		if (lua_isnumber(L,4)) {
 			arridx = lua_tointeger(L,3);
 			luaL_checknumber(L,4);
@@ -1728,6 +2155,95 @@ int vessels_highlevel_setparameter(lua_State* L)
 	return 0;
 }
 
+//Read list of parameters: GetParameters(idx,{param1,param2,...}[,result])
+int vessels_highlevel_getparameters(lua_State* L)
+{
+	int i,count;
+	DEFINE_VESSEL();
+	luaL_checktype(L,2,LUA_TTABLE);
+	if (!v) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	//Reuse result table if passed
+	count = lua_objlen(L,2);
+	if (lua_istable(L,3)) {
+		lua_pushvalue(L,3);
+	} else {
+		lua_createtable(L,count,0);
+	}
+
+	for (i = 1; i <= count; i++) {
+		lua_rawgeti(L,2,i);
+		lua_pushnumber(L,vessels_read_param_d(v->index,lua_tointeger(L,-1),0));
+		lua_rawseti(L,-3,i);
+		lua_pop(L,1);
+	}
+	return 1;
+}
+
+//Read all parameters by name: GetState(idx[,result])
+int vessels_highlevel_getstate(lua_State* L)
+{
+	vessel_parameter* param;
+	DEFINE_VESSEL();
+	if (!v) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	//Reuse result table if passed
+	if (lua_istable(L,2)) {
+		lua_pushvalue(L,2);
+	} else {
+		lua_createtable(L,0,160);
+	}
+
+	for (param = vessels_parameters; param->index >= 0; param++) {
+		if (param->count) continue; //Arrays must be read with GetParameter
+		lua_pushnumber(L,vessels_read_param_d(v->index,param->index,0));
+		lua_setfield(L,-2,param->name);
+	}
+	return 1;
+}
+
+//Layout of vessel structure for direct access (LuaJIT FFI): GetLayout()
+int vessels_highlevel_getlayout(lua_State* L)
+{
+	vessel_parameter* param;
+
+	lua_createtable(L,0,6);
+	lua_pushlightuserdata(L,vessels);		lua_setfield(L,-2,"Base"); //Fixed after initialization
+	lua_pushlightuserdata(L,&vessels);		lua_setfield(L,-2,"BaseAddress");
+	lua_pushlightuserdata(L,&vessel_count);	lua_setfield(L,-2,"CountAddress");
+	lua_pushnumber(L,sizeof(vessel));		lua_setfield(L,-2,"Stride");
+	lua_pushnumber(L,vessel_alloc_count);	lua_setfield(L,-2,"Capacity");
+
+	lua_createtable(L,0,160);
+	for (param = vessels_parameters; param->index >= 0; param++) {
+		if (param->type == VESSEL_PARAMETER_TYPE_COMPUTED) continue;
+
+		//Slot lists and network ID index are only updated through SetParameter
+		if ((param->offset == (int)offsetof(vessel,exists)) ||
+			(param->offset == (int)offsetof(vessel,net_id))) continue;
+		lua_createtable(L,0,6);
+		lua_pushnumber(L,param->index);		lua_setfield(L,-2,"Index");
+		lua_pushnumber(L,param->offset);	lua_setfield(L,-2,"Offset");
+		lua_pushnumber(L,param->stride);	lua_setfield(L,-2,"Stride");
+		lua_pushnumber(L,param->count);		lua_setfield(L,-2,"Count");
+		lua_pushstring(L,(param->type == VESSEL_PARAMETER_TYPE_INT) ? "int" : "double");
+		lua_setfield(L,-2,"Type");
+
+		//Raw writes would not mark mass properties for recomputation
+		lua_pushboolean(L,(!param->writeable) || vessels_parameter_changes_mass(param));
+		lua_setfield(L,-2,"ReadOnly");
+		lua_setfield(L,-2,param->name);
+	}
+	lua_setfield(L,-2,"Fields");
+	return 1;
+}
+
 int vessels_highlevel_getnoninertial(lua_State* L)
 {
 	DEFINE_VESSEL();
@@ -1758,15 +2274,12 @@ int vessels_highlevel_setlocal(lua_State* L)
 
 int vessels_highlevel_getbynetid(lua_State* L)
 {
-	int i;
-	int net_id = lua_tointeger(L,1);
-	for (i = 0; i < vessel_count; i++) {
-		if (vessels[i].net_id == net_id) {
-			lua_pushinteger(L,i);
-			return 1;
-		}
+	int idx = vessels_find_by_net_id(lua_tointeger(L,1));
+	if (idx >= 0) {
+		lua_pushinteger(L,idx);
+	} else {
+		lua_pushnil(L);
 	}
-	lua_pushnil(L);
 	return 1;
 }
 
@@ -1814,6 +2327,7 @@ int vessels_highlevel_mount(lua_State* L)
 		v->attached = 1;
 		v->mount.body = root->index;
 		qeuler_from(v->mount.attitude,0,0,0);
+		vessels_invalidate_mount_tree();
 	}
 	return 0;
 }
@@ -1828,6 +2342,7 @@ int vessels_highlevel_setmountoffset(lua_State* L)
 		v->mount.x = lua_tonumber(L,2);
 		v->mount.y = lua_tonumber(L,3);
 		v->mount.z = lua_tonumber(L,4);
+		v->mass_dirty = 1;
 	}
 	return 0;
 }
@@ -1843,6 +2358,7 @@ int vessels_highlevel_setmountattitude(lua_State* L)
 		            RAD(lua_tonumber(L,2)),
 		            RAD(lua_tonumber(L,3)),
 		            RAD(lua_tonumber(L,4)));
+		v->mass_dirty = 1;
 	}
 	return 0;
 }
@@ -1850,7 +2366,10 @@ int vessels_highlevel_setmountattitude(lua_State* L)
 int vessels_highlevel_computemoments(lua_State* L)
 {
 	DEFINE_VESSEL();
-	if (v) vessels_compute_moments(v);
+	if (v) {
+		vessels_compute_moments(v);
+		v->mass_dirty = 1;
+	}
 	return 0;
 }
 
@@ -1861,6 +2380,7 @@ int vessels_highlevel_setfueltank(lua_State* L)
 	if (v && (tank >= 0) && (tank < VESSEL_MAX_FUELTANKS)) {
 		luaL_checknumber(L,3);
 		v->weight.fuel[tank] = lua_tonumber(L,3);
+		v->mass_dirty = 1;
 	}
 	return 0;
 }
@@ -1877,6 +2397,27 @@ int vessels_highlevel_getfueltank(lua_State* L)
 	return 1;
 }
 
+int vessels_highlevel_getstats(lua_State* L)
+{
+	lua_createtable(L,0,4);
+	lua_pushnumber(L,vessels_mount_tree.mass_updates);	lua_setfield(L,-2,"MassUpdates");
+	lua_pushnumber(L,vessels_mount_tree.rebuilds);		lua_setfield(L,-2,"MountTreeRebuilds");
+	lua_pushnumber(L,vessels_slots.active_count);		lua_setfield(L,-2,"ActiveVessels");
+	lua_pushnumber(L,vessels_slots.free_count);			lua_setfield(L,-2,"FreeSlots");
+	return 1;
+}
+
+//Number of times the vessel slot was reused (to detect stale vessel indexes)
+int vessels_highlevel_getgeneration(lua_State* L)
+{
+	DEFINE_VESSEL();
+	if (v) {
+		lua_pushinteger(L,vessels_slots.generation[idx]);
+		return 1;
+	}
+	return 0;
+}
+
 int vessels_highlevel_getfilename(lua_State* L)
 {
 	DEFINE_VESSEL();
@@ -1907,12 +2448,16 @@ void vessels_highlevel_initialize()
 	highlevel_addfunction("VesselAPI","GetCount",vessels_highlevel_getcount);
 	highlevel_addfunction("VesselAPI","GetParameter",vessels_highlevel_getparameter);
 	highlevel_addfunction("VesselAPI","SetParameter",vessels_highlevel_setparameter);
+	highlevel_addfunction("VesselAPI","GetParameters",vessels_highlevel_getparameters);
+	highlevel_addfunction("VesselAPI","GetState",vessels_highlevel_getstate);
+	highlevel_addfunction("VesselAPI","GetLayout",vessels_highlevel_getlayout);
 	highlevel_addfunction("VesselAPI","GetNoninertialCoordinates",vessels_highlevel_getnoninertial);
 	highlevel_addfunction("VesselAPI","SetNoninertialCoordinates",vessels_highlevel_setnoninertial);
 	highlevel_addfunction("VesselAPI","SetInertialCoordinates",vessels_highlevel_setinertial);
 	highlevel_addfunction("VesselAPI","SetLocalCoordinates",vessels_highlevel_setlocal);
 
 	highlevel_addfunction("VesselAPI","GetByNetID",vessels_highlevel_getbynetid);
+	highlevel_addfunction("VesselAPI","GetGeneration",vessels_highlevel_getgeneration);
 	highlevel_addfunction("VesselAPI","Create",vessels_highlevel_create);
 	highlevel_addfunction("VesselAPI","Add",vessels_highlevel_add);
 	highlevel_addfunction("VesselAPI","Mount",vessels_highlevel_mount);
@@ -1923,14 +2468,16 @@ void vessels_highlevel_initialize()
 	highlevel_addfunction("VesselAPI","SetFuelTank",vessels_highlevel_setfueltank);
 	highlevel_addfunction("VesselAPI","GetFuelTank",vessels_highlevel_getfueltank);
 	highlevel_addfunction("VesselAPI","GetFilename",vessels_highlevel_getfilename);
+	highlevel_addfunction("VesselAPI","GetStats",vessels_highlevel_getstats);
 }
 
 void vessels_highlevel_logic()
 {
-	int i;
+	int i,k;
 
 	lua_rawgeti(L,LUA_REGISTRYINDEX,highlevel_table_vessels);
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists) {
 			lua_rawgeti(L,-1,i);
 			if (lua_istable(L,-1)) {
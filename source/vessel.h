@@ -8,7 +8,8 @@ typedef double quaternion[4];
 
 #ifndef __THREAD_ID
 	#define BAD_ID 0xFFFFFFFF
-	typedef unsigned int genericID;
+	#include <stddef.h>
+	typedef size_t genericID; //Must be able to hold a pointer
 	typedef genericID threadID;
 	typedef genericID lockID;
 	#define __THREAD_ID
@@ -25,6 +26,12 @@ typedef double quaternion[4];
 #define VESSEL_MAX_SOLAR_PANELS			100
 #define VESSEL_MAX_ENGINES				512
 
+#define VESSEL_MAX_PARAMETERS			1000
+
+#define VESSEL_PARAMETER_TYPE_DOUBLE	0
+#define VESSEL_PARAMETER_TYPE_INT		1
+#define VESSEL_PARAMETER_TYPE_COMPUTED	2	//Not stored in vessel structure
+
 #define FACE_LAYER_TPS					0
 #define FACE_LAYER_HULL					1
 
@@ -84,6 +91,30 @@ typedef struct face_tag {
 } face;
 
 
+//------------------------------------------------------------------------------
+// Airflow over the vessel, published by the main thread once per tick for the
+// heating and shockwave threads
+//------------------------------------------------------------------------------
+#define AIRFLOW_HEAT_FLUX	0	//Heat flux, W/m2
+#define AIRFLOW_DOT			1	//Dot product of airflow direction and face normal
+#define AIRFLOW_DOT0		2	//Dot products of faces with shared edges
+#define AIRFLOW_DOT1		3
+#define AIRFLOW_DOT2		4
+#define AIRFLOW_FACE_VALUES	5	//Number of values per face
+
+typedef struct airflow_state_tag {
+	volatile unsigned int sequence; //Odd while state is being written, 0 if never published
+	double M;					//Mach number
+	double vx,vy,vz;			//Airflow direction in local coordinates
+	double temperature;			//Air temperature, K
+	double concentration;		//Air concentration, 1/m3
+	double hull_weight;			//Hull mass, kg
+	int shockwave_heating;		//Should shockwave heating be accounted for
+	int num_faces;
+	double* faces;				//Values for every face (AIRFLOW_FACE_VALUES per face)
+} airflow_state;
+
+
 //------------------------------------------------------------------------------
 // Surface sensor (measures something off vessels surface)
 //------------------------------------------------------------------------------
@@ -124,6 +155,20 @@ typedef struct solar_panel_tag {
 } solar_panel;
 
 
+//------------------------------------------------------------------------------
+// Vessel parameter (variable accessible by its numeric index)
+//------------------------------------------------------------------------------
+typedef struct vessel_parameter_tag {
+	int index;				//Numeric index, -1 marks end of list
+	char* name;				//Name used by highlevel interface
+	int type;				//Type of the variable
+	int offset;				//Offset of the variable in vessel structure
+	int stride;				//Offset between array elements
+	int count;				//Number of array elements (0 if not an array)
+	int writeable;			//Can parameter be written to
+} vessel_parameter;
+
+
 //------------------------------------------------------------------------------
 // Vessel (any sort of object that is located in the world)
 //------------------------------------------------------------------------------
@@ -134,6 +179,8 @@ typedef struct vessel_tag {
 	double ixx,iyy,izz;		//[Calculated] Moment of inertia. Used in actual computations, accounts for attached bodies
 	double mass;			//[Calculated] Total mass. Used in computations, includes mass of attached bodies
 	double attached_mass;	//[Calculated] Mass attached to this vessel. Used for X-Plane physics interface
+	double own_mass;		//[Calculated] Mass of the vessel itself, without attached bodies
+	int mass_dirty;			//Mass properties must be recomputed (weights, moments or mount offsets changed)
 	int index;				//0: main vessel
 
 	//Vessel weights
@@ -154,7 +201,7 @@ typedef struct vessel_tag {
 	//int network_override;	//Vessel overriden by networking
 
 	//Existance parameters
-	int exists;				//Does the vessel exist now
+	int exists;				//Does the vessel exist now (changed through vessels_set_exists)
 	int attached;			//Is vessel attached to other vessel (see mount)
 
 	//Plane parameters (if loaded as an AI plane)
@@ -223,6 +270,15 @@ typedef struct vessel_tag {
 		double gx,gy,gz; //accelerometer values
 	} relative;
 
+	//Cached attitude transforms (see coordsys.c, valid for given attitude and coordinate system update)
+	struct {
+		int epoch;				//Coordinate system update the cache was computed for
+		quaternion q;			//Inertial attitude the cache was computed for
+		quaternion sim_q;		//Simulator attitude
+		double l2i[3][3];		//Local to inertial rotation
+		double l2ni[3][3];		//Local to non-inertial rotation
+	} transform;
+
 	//Orbital elements
 	struct {
 		//State vector
@@ -254,7 +310,6 @@ typedef struct vessel_tag {
 		double x,y,z;			//Attachment offset (local coords offset from root body)
 		quaternion attitude;	//Mount attitude
 
-		int checked;			//Mounting stuff checked (reset before doing vessel_update_physics)
 		int root_body;			//Body the physics must be applied to
 		double rx,ry,rz;		//Attachment offset relative to root body
 		quaternion rattitude;	//Attitude relative to root body
@@ -285,10 +340,17 @@ typedef struct vessel_tag {
 		threadID shockwave_thread; //Shockwave simulation thread ID
 		lockID heat_data_lock;	//Heat data lock (heat-flux is updated)
 		double heat_fps;		//Heat simulation FPS
+		double heat_time;		//Time taken by last heat simulation pass (written by heat thread)
+		double shockwave_time;	//Time taken by last shockwave simulation pass (written by shockwave thread)
 		double effective_M;		//Mach number used in computations
 
 		//Even more misc data
 		double vx,vy,vz,vmag;	//Velocity direction, magnitude in local coordinates
+
+		//Airflow shared with simulation threads (threads read only their own copies)
+		airflow_state airflow;
+		airflow_state heat_airflow;
+		airflow_state shockwave_airflow;
 	} geometry;
 
 	//Atmosphere information at altitude
@@ -338,6 +400,12 @@ typedef struct vessel_tag {
 		int surface_count;
 	} sensors;
 
+	//Engines (parameters cached from Lua)
+	struct {
+		struct engine_tag* list;
+		int count;
+	} engines;
+
 	//Radio transmission simulation
 	struct {
 		radio_buffers buffers;
@@ -368,6 +436,50 @@ typedef struct vessel_tag {
 	struct IVSS_UNITS_LIST_TAG* ivss_radios;
 } vessel;
 
+//Mount tree. Rebuilt only when vessels are attached, detached, created or removed
+typedef struct vessel_mount_tree_tag {
+	int* order;				//Existing vessels, every vessel after the body it is mounted to
+	int* parent;			//Body each vessel is mounted to (-1 for root bodies)
+	int* keys;				//Existance, attachment and mount body of every vessel when tree was built
+	int* state;				//Temporary storage for rebuilding the tree
+	int count;				//Number of vessels in order
+	int key_count;			//Number of vessels in keys (-1 if tree must be rebuilt)
+	int key_changes;		//Number of vessel slot changes when tree was built
+	int rebuilds;			//Number of times the tree was rebuilt
+	int mass_updates;		//Number of vessels which mass properties were recomputed during last update
+} vessel_mount_tree;
+
+//Vessel slot state
+#define VESSEL_SLOT_EXISTS		1	//Vessel exists
+#define VESSEL_SLOT_ACTIVE		2	//Vessel is listed in active vessels
+#define VESSEL_SLOT_FREE		4	//Slot is listed in free slots
+
+//Vessel slots. Slots of removed vessels are reused through a free list, and
+//existing vessels are listed in a dense array so that per-tick loops do not
+//visit removed vessels
+typedef struct vessel_slots_tag {
+	int* active;			//Existing vessels (in index order after vessels_update_slots)
+	int* free;				//Slots of removed vessels (last removed is reused first)
+	int* flags;				//State of every slot (VESSEL_SLOT_*)
+	int* generation;		//Number of times every slot was reused
+	int active_count;		//Number of vessels in active (may include vessels removed during this tick)
+	int free_count;			//Number of slots in free
+	int compact;			//Vessels were removed since last update
+	int unsorted;			//Vessels were added out of order since last update
+	int changes;			//Number of times vessels were added or removed
+} vessel_slots;
+
+//Index of vessels by network ID (open addressing with linear probing). Vessels
+//without network ID (0) are not indexed
+typedef struct vessel_net_index_tag {
+	int* keys;				//Network ID in every hash slot (0 if slot is empty)
+	int* values;			//Vessel in every hash slot (lowest index if network ID is shared)
+	int* indexed;			//Network ID every vessel is indexed by
+	int size;				//Number of hash slots (power of two)
+	int count;				//Number of network IDs in the index
+	int shared;				//Number of vessels sharing network ID with a vessel of lower index
+} vessel_net_index;
+
 //Iteraction with X-Plane
 void vessels_read(vessel* v, int update_inertial); //Read from simulator
 void vessels_write(vessel* v); //Write to simulator
@@ -383,20 +495,30 @@ int vessels_add(); //Adds new vessel, returns its index
 int vessels_load(char* filename); //Loads vessel and return index
 void vessels_set_parameter(vessel* v, int index, int array_index, double value); //Write parameter
 double vessels_get_parameter(vessel* v, int index, int array_index); //Read parameter
+vessel_parameter* vessels_get_parameter_info(int index); //Get parameter description
+void vessels_set_exists(vessel* v, int exists); //Add vessel to or remove it from the world
+void vessels_update_slots(); //Drop removed vessels from the active list (called once per tick)
+void vessels_set_net_id(vessel* v, int net_id); //Change network ID of the vessel
+int vessels_find_by_net_id(int net_id); //Index of vessel with the network ID, or -1
 
 //Add force on a vessel (in local coordinates)
 void vessels_addforce(vessel* v, double dt, double lx, double ly, double lz, double fx, double fy, double fz);
 void vessels_update_mount_physics(vessel* v); //Updates forces and behaviour of mount joints
-void vessels_update_physics(vessel* v); //Recalculate total mass, moments of inertia
+void vessels_update_physics(vessel* v); //Recalculate mass, moments of inertia of the vessel itself
+void vessels_update_mounts(); //Recalculate total mass, moments of inertia and mount offsets of all vessels
+void vessels_update_mount_poses(); //Move mounted vessels with their root bodies, synchronize coordinates
+void vessels_invalidate_mount_tree(); //Force rebuilding mount tree
 void vessels_reset_physics(vessel* v); //Reset physics calculations
 void vessels_compute_moments(vessel* v); //Computes Jxx, Jyy, Jzz based on geometry, weight, etc
 
 //General functions
 void vessels_initialize(); //Initialize vessels system
 void vessels_reinitialize();
+void vessels_reserve(int count); //Allocate memory for vessels (only before vessels_initialize)
 void vessels_deinitialize(); //Free up resources
 void vessels_draw(); //Draw all vessels
 void vessels_update_aircraft(); //Update X-Plane aircraft
+void vessels_update_datarefs(); //Refresh values published through vessel datarefs
 
 //Highlevel functions
 void vessels_highlevel_initialize();
@@ -406,5 +528,9 @@ void vessels_highlevel_logic();
 extern int vessel_count;
 extern int vessel_alloc_count;
 extern vessel* vessels;
+extern vessel_parameter vessels_parameters[];
+extern vessel_mount_tree vessels_mount_tree;
+extern vessel_slots vessels_slots;
+extern vessel_net_index vessels_net_index;
 
 #endif
\ No newline at end of file
@@ -32,6 +32,8 @@
 
 #include "curtime.h"     //Current time (precise)
 #include "threading.h"   //Multithreading support
+#include "profiler.h"    //Simulation profiler
+#include "geoindex.h"    //Proximity queries
 
 //X-Plane SDK
 #include <XPLMPlanes.h>
@@ -59,11 +61,13 @@ void xspace_initialize_all()
 	highlevel_initialize(); //allocates lua memory
 	highlevel_load(FROM_PLUGINS("lua/initialize.lua")); //allocates lua memory
 	config_initialize(); //allocates lua memory, loads configuration
+	profiler_initialize(); //datarefs, lua memory
 
 	//Initializers with no mem alloc:
 	planet_initialize(); //datarefs
 	atmosphere_initialize(); //datarefs
 	vessels_initialize(); //datarefs, lua memory
+	geoindex_initialize(); //memory, lua memory
 	coordsys_initialize(); //datarefs
 	physics_initialize(); //datarefs
 	engines_initialize(); //datarefs
@@ -107,6 +111,7 @@ void xspace_deinitialize_all()
 	geomagnetic_deinitialize(); //free model
 	rendering_deinitialize(); //free textures
 	vessels_deinitialize(); //free memory, lua memory
+	geoindex_deinitialize(); //free memory
 	radiosys_deinitialize(); //free memory, datarefs
 
 	//Highlevel deinitialization
@@ -187,6 +192,8 @@ void xspace_load_aircraft(int index, char* acfpath, char* acfname)
 	highlevel_load_aircraft(&vessels[index],acfpath,acfname); //inits lua
 	//Load sensors
 	dragheat_initialize_highlevel(&vessels[index]);
+	//Load engines
+	engines_initialize_highlevel(&vessels[index]);
 	//Load solar panels
 	solpanels_initialize_highlevel(&vessels[index]);
 	//Initialize radio system
@@ -204,34 +211,40 @@ void xspace_unload_aircraft(int index)
 {
 	//Deinitialize stuff
 	dragheat_deinitialize(&vessels[index]); //free geometry, sensors
+	engines_deinitialize_highlevel(&vessels[index]); //free engines
 	radiosys_deinitialize_vessel(&vessels[index]); //free memory
 	xivss_deinitialize(&vessels[index]);
 }
 
 void xspace_update(float dt)
 {
-	int i;
+	int i,k;
 #ifdef PROFILING
 	__itt_resume();
 #endif
+	profiler_begin(PROFILER_TICK);
 
 	//Update current planet and coordinate system
 	planet_update(dt);
 	coordsys_update(dt);
 
 	//Read vessels
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_VESSELS);
+	vessels_update_slots();
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if ((!vessels[i].networked) && (vessels[i].physics_type != VESSEL_PHYSICS_DISABLED)) {
 			vessels_read(&vessels[i],vessels[i].physics_type != VESSEL_PHYSICS_INERTIAL);
-			vessels[i].mount.checked = 0;
 		}
 	}
 
 	//Update/reset physics state
-	for (i = 0; i < vessel_count; i++) vessels_update_physics(&vessels[i]);
+	vessels_update_mounts();
+	profiler_end(PROFILER_VESSELS);
 
 	//Check if inertial physics must be enabled
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		//Only check existing vessels, and do not check if it's vessel 0 standing on launch pad
 		if ((vessels[i].exists) && 
 			(vessels[i].physics_type != VESSEL_PHYSICS_NONINERTIAL) &&
@@ -264,54 +277,64 @@ void xspace_update(float dt)
 	}
 
 	//Update various states
+	profiler_begin(PROFILER_GEOMAGNETIC);
 	geomagnetic_update();
+	profiler_end(PROFILER_GEOMAGNETIC);
 	physics_update(dt);
 	particles_update(dt);
 
 	//Simulate physics for vessels
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_ATMOSPHERE);
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if (vessels[i].exists && (vessels[i].physics_type != VESSEL_PHYSICS_DISABLED)) {
 			vessels_reset_physics(&vessels[i]);
 			atmosphere_simulate(&vessels[i]);
 		}
 	}
+	profiler_end(PROFILER_ATMOSPHERE);
 
 	//Simulate physics which are called for all vessels
 	//radiosys_update(dt);
+	profiler_begin(PROFILER_ENGINES);
 	engines_simulate(dt);
+	profiler_end(PROFILER_ENGINES);
+	profiler_begin(PROFILER_DRAGHEAT);
 	dragheat_simulate(dt);
+	profiler_end(PROFILER_DRAGHEAT);
 	launchpads_simulate(dt);
 	camera_simulate();
 
 	//Update Lua
+	profiler_begin(PROFILER_LUA);
 	if (highlevel_pushcallback("OnFrame")) {
 		lua_pushnumber(L,dt);
 		highlevel_call(1,0);
 	}
 	vessels_highlevel_logic();
+	profiler_end(PROFILER_LUA);
 
 	//Finish physics simulation by integration
 	//if (XPLMGetDataf(dataref_vessel_agl) > 100) { //Hopefully there are no mountains higher than 395,000 ft
-	for (i = 0; i < vessel_count; i++) {
+	profiler_begin(PROFILER_INTEGRATE);
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if ((vessels[i].exists) && 
 			(vessels[i].physics_type != VESSEL_PHYSICS_DISABLED) &&
 			(vessels[i].attached == 0)) {
 			physics_integrate(dt,&vessels[i]);
 		}
 	}
+	profiler_end(PROFILER_INTEGRATE);
 	//}
 
-	//Update mounting physics (FIXME: should not require two coordinate updates! bug!)
-	for (i = 0; i < vessel_count; i++) if (vessels[i].exists) vessels_update_coordinates(&vessels[i]);
-	for (i = 0; i < vessel_count; i++) {
-		if (vessels[i].exists) vessels_update_mount_physics(&vessels[i]);
-	}
-
-	//Synchronize all coordinates (sim, inertial)
-	for (i = 0; i < vessel_count; i++) if (vessels[i].exists) vessels_update_coordinates(&vessels[i]);
+	//Update mounting physics and synchronize all coordinates (sim, inertial)
+	profiler_begin(PROFILER_VESSELS);
+	vessels_update_mount_poses();
 
 	//Write back information
-	for (i = 0; i < vessel_count; i++) {
+	for (k = 0; k < vessels_slots.active_count; k++) {
+		i = vessels_slots.active[k];
 		if ((vessels[i].exists) && (!vessels[i].networked) && (vessels[i].physics_type != VESSEL_PHYSICS_DISABLED)) {
 			//Do not write focused vessel if simulator is paused
 			if ((i == 0) && (dt == 0.0)) {
@@ -349,6 +372,16 @@ void xspace_update(float dt)
 		}
 	}
 
+	//Publish state of all vessels for this frame
+	vessels_update_datarefs();
+	geoindex_update_vessels();
+	profiler_end(PROFILER_VESSELS);
+
+	//Collect Lua garbage within time budget
+	highlevel_collect_garbage();
+
+	profiler_end(PROFILER_TICK);
+	profiler_tick();
 #ifdef PROFILING
 	__itt_pause();
 #endif